@@ -171,7 +171,8 @@ HKLAPI void hkl_parameter_randomize(HklParameter *self) HKL_ARG_NONNULL(1);
 typedef struct _HklDetector HklDetector;
 typedef enum _HklDetectorType
 {
-	HKL_DETECTOR_TYPE_0D
+	HKL_DETECTOR_TYPE_0D,
+	HKL_DETECTOR_TYPE_2D
 } HklDetectorType;
 
 HKLAPI HklDetector *hkl_detector_factory_new(HklDetectorType type);
@@ -182,6 +183,24 @@ HKLAPI void hkl_detector_free(HklDetector *self) HKL_ARG_NONNULL(1);
 
 HKLAPI void hkl_detector_fprintf(FILE *f, const HklDetector *self) HKL_ARG_NONNULL(1, 2);
 
+HKLAPI HklDetectorType hkl_detector_type_get(const HklDetector *self) HKL_ARG_NONNULL(1);
+
+HKLAPI int hkl_detector_2d_pixels_set(HklDetector *self,
+				      size_t width, size_t height,
+				      double pixel_width, double pixel_height,
+				      GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_detector_2d_pixels_get(const HklDetector *self,
+				       size_t *width, size_t *height) HKL_ARG_NONNULL(1, 2, 3);
+
+HKLAPI int hkl_detector_2d_poni_set(HklDetector *self, double distance,
+				    double center_column, double center_row,
+				    GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_detector_2d_orientation_set(HklDetector *self,
+					   double euler_x, double euler_y, double euler_z,
+					   GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
 /************/
 /* Geometry */
 /************/
@@ -226,6 +245,16 @@ HKLAPI int hkl_geometry_wavelength_set(HklGeometry *self, double wavelength,
 
 HKLAPI void hkl_geometry_randomize(HklGeometry *self) HKL_ARG_NONNULL(1);
 
+HKLAPI int hkl_geometry_axis_motion_set(HklGeometry *self, const char *name,
+					double velocity, double acceleration,
+					HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_geometry_simultaneous_motions_set(HklGeometry *self,
+						  unsigned int simultaneous) HKL_ARG_NONNULL(1);
+
+HKLAPI double hkl_geometry_motion_time(const HklGeometry *self,
+				       const HklGeometry *ref) HKL_ARG_NONNULL(1, 2);
+
 /* TODO after bissecting it seems that this method is slow (to replace) */
 HKLAPI int hkl_geometry_set_values_v(HklGeometry *self, HklUnitEnum unit_type,
 				     GError **error, ...) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
@@ -311,6 +340,22 @@ HKLAPI void hkl_lattice_get(const HklLattice *self,
 			    double *alpha, double *beta, double *gamma,
 			    HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2, 3, 4, 5, 6, 7);
 
+typedef enum _HklLatticeSystem
+{
+	HKL_LATTICE_SYSTEM_TRICLINIC = 0,
+	HKL_LATTICE_SYSTEM_MONOCLINIC, /* alpha = gamma = 90, unique axis b */
+	HKL_LATTICE_SYSTEM_ORTHORHOMBIC, /* alpha = beta = gamma = 90 */
+	HKL_LATTICE_SYSTEM_TETRAGONAL, /* a = b, alpha = beta = gamma = 90 */
+	HKL_LATTICE_SYSTEM_RHOMBOHEDRAL, /* a = b = c, alpha = beta = gamma */
+	HKL_LATTICE_SYSTEM_HEXAGONAL, /* a = b, alpha = beta = 90, gamma = 120 */
+	HKL_LATTICE_SYSTEM_CUBIC, /* a = b = c, alpha = beta = gamma = 90 */
+} HklLatticeSystem;
+
+HKLAPI HklLatticeSystem hkl_lattice_system_get(const HklLattice *self) HKL_ARG_NONNULL(1);
+
+HKLAPI int hkl_lattice_system_set(HklLattice *self, HklLatticeSystem system,
+				  GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI int hkl_lattice_get_B(const HklLattice *self, HklMatrix *B) HKL_ARG_NONNULL(1, 2);
 
 HKLAPI int hkl_lattice_get_1_B(const HklLattice *self, HklMatrix *B) HKL_ARG_NONNULL(1, 2);
@@ -379,6 +424,18 @@ HKLAPI int hkl_sample_compute_UB_busing_levy(HklSample *self,
 					     const HklSampleReflection *r2,
 					     GError **error) HKL_ARG_NONNULL(1, 2, 3) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI int hkl_sample_compute_U_least_squares(HklSample *self,
+					      GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_sample_compute_UB_ransac(HklSample *self,
+					unsigned int n_iterations,
+					double angle_tolerance, double norm_tolerance,
+					GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_sample_autoindex(HklSample *self, unsigned int hkl_max,
+				double angle_tolerance, double norm_tolerance,
+				GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI double hkl_sample_get_reflection_mesured_angle(const HklSample *self,
 						      const HklSampleReflection *r1,
 						      const HklSampleReflection *r2) HKL_ARG_NONNULL(1, 2, 3);
@@ -389,6 +446,9 @@ HKLAPI double hkl_sample_get_reflection_theoretical_angle(const HklSample *self,
 
 HKLAPI int hkl_sample_affine(HklSample *self, GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI int hkl_sample_affine_multistart(HklSample *self, unsigned int n_starts,
+					GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
 /* HklSampleReflection */
 
 HKLAPI HklSampleReflection *hkl_sample_reflection_new(const HklGeometry *geometry,
@@ -412,6 +472,147 @@ HKLAPI const HklGeometry *hkl_sample_reflection_geometry_get(HklSampleReflection
 HKLAPI void hkl_sample_reflection_geometry_set(HklSampleReflection *self,
 					       const HklGeometry *geometry) HKL_ARG_NONNULL(1, 2);
 
+/* HklDetector frames */
+
+HKLAPI int hkl_detector_2d_q_get(const HklDetector *self, HklGeometry *geometry,
+				 double qx[], double qy[], double qz[],
+				 GError **error) HKL_ARG_NONNULL(1, 2, 3, 4, 5) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_detector_2d_hkl_get(const HklDetector *self, HklGeometry *geometry,
+				   const HklSample *sample,
+				   double h[], double k[], double l[],
+				   GError **error) HKL_ARG_NONNULL(1, 2, 3, 4, 5, 6) HKL_WARN_UNUSED_RESULT;
+
+/* HklFrames */
+
+typedef struct _HklFrames HklFrames;
+typedef enum _HklFramesType
+{
+	HKL_FRAMES_TYPE_UINT16,
+	HKL_FRAMES_TYPE_INT32,
+	HKL_FRAMES_TYPE_UINT32,
+	HKL_FRAMES_TYPE_FLOAT32,
+	HKL_FRAMES_TYPE_FLOAT64,
+} HklFramesType;
+
+HKLAPI HklFrames *hkl_frames_new_raw(const char *filename, HklFramesType type,
+				     size_t width, size_t height,
+				     size_t offset, size_t gap,
+				     GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklFrames *hkl_frames_new_edf(const char *filename,
+				     GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_frames_free(HklFrames *self) HKL_ARG_NONNULL(1);
+
+HKLAPI size_t hkl_frames_len(const HklFrames *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_frames_size_get(const HklFrames *self,
+				size_t *width, size_t *height) HKL_ARG_NONNULL(1, 2, 3);
+
+HKLAPI HklFramesType hkl_frames_type_get(const HklFrames *self) HKL_ARG_NONNULL(1);
+
+HKLAPI const void *hkl_frames_row_get(const HklFrames *self, size_t frame, size_t row,
+				      int *swap) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_frames_frame_get(const HklFrames *self, size_t frame,
+				 double values[]) HKL_ARG_NONNULL(1, 3);
+
+/* HklBinning */
+
+typedef struct _HklBinning HklBinning;
+typedef enum _HklBinningSpace
+{
+	HKL_BINNING_SPACE_HKL, /* h, k, l */
+	HKL_BINNING_SPACE_Q, /* qx, qy, qz in the sample holder frame */
+	HKL_BINNING_SPACE_QPAR_QPER, /* qpar, qper, azimuth of qpar, the surface normal is z */
+} HklBinningSpace;
+
+HKLAPI HklBinning *hkl_binning_new(HklBinningSpace space,
+				   const double min[3], const double max[3], const size_t n[3],
+				   GError **error) HKL_ARG_NONNULL(2, 3, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_binning_free(HklBinning *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_binning_reset(HklBinning *self) HKL_ARG_NONNULL(1);
+
+HKLAPI int hkl_binning_frames_add(HklBinning *self,
+				  const HklDetector *detector,
+				  HklGeometry *const geometries[],
+				  const HklSample *sample,
+				  const double *const frames[],
+				  size_t n_frames,
+				  GError **error) HKL_ARG_NONNULL(1, 2, 3, 4, 5) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_binning_frames_source_add(HklBinning *self,
+					 const HklDetector *detector,
+					 HklGeometry *const geometries[],
+					 const HklSample *sample,
+					 const HklFrames *source,
+					 GError **error) HKL_ARG_NONNULL(1, 2, 3, 4, 5) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI size_t hkl_binning_len(const HklBinning *self) HKL_ARG_NONNULL(1);
+
+HKLAPI size_t hkl_binning_voxels_len(const HklBinning *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_binning_voxels_get(const HklBinning *self, size_t idx[],
+				   double intensities[], double counts[]) HKL_ARG_NONNULL(1, 2, 3, 4);
+
+HKLAPI void hkl_binning_get(const HklBinning *self,
+			    double intensities[], double counts[]) HKL_ARG_NONNULL(1, 2, 3);
+
+/* HklPrediction */
+
+typedef struct _HklPrediction HklPrediction;
+
+HKLAPI HklPrediction *hkl_prediction_new(const HklSample *sample, double qmax,
+					 GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_prediction_free(HklPrediction *self) HKL_ARG_NONNULL(1);
+
+HKLAPI size_t hkl_prediction_len(const HklPrediction *self) HKL_ARG_NONNULL(1);
+
+HKLAPI int hkl_prediction_geometry(HklPrediction *self,
+				   const HklGeometry *geometry,
+				   const HklSample *sample,
+				   double tolerance,
+				   GError **error) HKL_ARG_NONNULL(1, 2, 3) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_prediction_sweep(HklPrediction *self,
+				const HklGeometry *geometry,
+				const HklSample *sample,
+				const char *axis_name,
+				double from, double to,
+				HklUnitEnum unit_type,
+				GError **error) HKL_ARG_NONNULL(1, 2, 3, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI size_t hkl_prediction_reflections_len(const HklPrediction *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_prediction_reflection_get(const HklPrediction *self, size_t idx,
+					  double *h, double *k, double *l,
+					  double *value) HKL_ARG_NONNULL(1, 3, 4, 5, 6);
+
+/* HklBranches */
+
+typedef struct _HklBranches HklBranches;
+
+HKLAPI HklBranches *hkl_branches_new(double max_distance) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_branches_free(HklBranches *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_branches_add(HklBranches *self, const HklGeometryList *solutions,
+			     size_t *births, size_t *deaths) HKL_ARG_NONNULL(1);
+
+HKLAPI size_t hkl_branches_len(const HklBranches *self) HKL_ARG_NONNULL(1);
+
+HKLAPI size_t hkl_branches_n_points_get(const HklBranches *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_branches_branch_get(const HklBranches *self, size_t id,
+				    size_t *birth, size_t *death) HKL_ARG_NONNULL(1, 3, 4);
+
+HKLAPI const HklGeometry *hkl_branches_geometry_get(const HklBranches *self,
+						    size_t id, size_t point) HKL_ARG_NONNULL(1);
+
 /**************/
 /* PseudoAxis */
 /**************/
@@ -437,6 +638,64 @@ HKLAPI HklGeometryList *hkl_engine_pseudo_axes_values_set(HklEngine *self,
 							  double values[], size_t n_values,
 							  HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI HklGeometryList *hkl_engine_pseudo_axes_values_plan(HklEngine *self,
+							   double values[], size_t n_values,
+							   const double weights[], size_t n_weights,
+							   HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklGeometryList *hkl_engine_pseudo_axes_values_order(HklEngine *self,
+							    double values[], size_t n_values,
+							    size_t order[],
+							    HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklGeometryList *hkl_engine_pseudo_axes_values_equivalents(HklEngine *self,
+								  double values[], size_t n_values,
+								  const double operators[], size_t n_operators,
+								  double equivalents[], size_t *n_equivalents,
+								  HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 4, 6, 7) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_pseudo_axes_values_batch_get(HklEngine *self,
+						   const double positions[], size_t n_positions,
+						   double values[], size_t n_values,
+						   HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklGeometryList *hkl_engine_wavelength_scan(HklEngine *self,
+						   double values[], size_t n_values,
+						   const double wavelengths[], size_t n_wavelengths,
+						   HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklGeometryList *hkl_engine_psi_scan(HklEngine *self,
+					    const double hkl0[], const double hkl1[],
+					    double from, double to, double step,
+					    HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 3) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_pvt_profile(HklEngine *self,
+				  const double times[], size_t n_times,
+				  const double values[], size_t n_values,
+				  double rate,
+				  double profile[], size_t n_profile, size_t *n_rows,
+				  HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 4, 7, 9) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_jacobian_get(HklEngine *self,
+				   double jacobian[], size_t n_jacobian,
+				   HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_jacobian_solve(HklEngine *self,
+				     const double dh[], size_t n_dh,
+				     double dtheta[], size_t n_dtheta,
+				     HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_grid_compute(HklEngine *self,
+				   const double min[], const double max[],
+				   const size_t n[], size_t n_dim,
+				   HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2, 3, 4) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_grid_save(const HklEngine *self, const char *filename,
+				GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_grid_load(HklEngine *self, const char *filename,
+				GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI const HklParameter *hkl_engine_pseudo_axis_get(const HklEngine *self,
 						      const char *name,
 						      GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
@@ -504,6 +763,14 @@ HKLAPI int hkl_engine_list_geometry_set(HklEngineList *self, const HklGeometry *
 HKLAPI int hkl_engine_list_select_solution(HklEngineList *self,
 					   const HklGeometryListItem *item) HKL_ARG_NONNULL(1);
 
+HKLAPI int hkl_engine_list_range_constrained_get(const HklEngineList *self) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_list_range_constrained_set(HklEngineList *self,
+						  int range_constrained) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_list_solutions_cache_set(HklEngineList *self,
+						size_t capacity, double quantum) HKL_ARG_NONNULL(1);
+
 HKLAPI HklEngine *hkl_engine_list_engine_get_by_name(HklEngineList *self,
 						     const char *name,
 						     GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
@@ -518,6 +785,18 @@ HKLAPI int hkl_engine_list_get(HklEngineList *self) HKL_ARG_NONNULL(1);
 HKLAPI void hkl_engine_list_fprintf(FILE *f,
 				    const HklEngineList *self) HKL_ARG_NONNULL(1, 2);
 
+/* Eulerians */
+
+HKLAPI void hkl_eulerians_from_kappa(const double komega[], const double kappa[], const double kphi[],
+				     double omega[], double chi[], double phi[], size_t n,
+				     double alpha, int solution,
+				     HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2, 3, 4, 5, 6);
+
+HKLAPI int hkl_eulerians_to_kappa(const double omega[], const double chi[], const double phi[],
+				  double komega[], double kappa[], double kphi[], size_t n,
+				  double alpha, int solution, HklUnitEnum unit_type,
+				  GError **error) HKL_ARG_NONNULL(1, 2, 3, 4, 5, 6) HKL_WARN_UNUSED_RESULT;
+
 /***********/
 /* Factory */
 /***********/
@@ -0,0 +1,68 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_BINNING_PRIVATE_H__
+#define __HKL_BINNING_PRIVATE_H__
+
+#include <stddef.h>                     // for size_t
+#include "hkl.h"                        // for HklBinning, etc
+
+G_BEGIN_DECLS
+
+/* the grid is stored by blocks of 8x8x8 voxels allocated on the first
+ * hit, so only the visited part of large volumes uses memory */
+#define HKL_BINNING_BLOCK_SHIFT 3
+#define HKL_BINNING_BLOCK_MASK ((1 << HKL_BINNING_BLOCK_SHIFT) - 1)
+#define HKL_BINNING_BLOCK_LEN (1 << (3 * HKL_BINNING_BLOCK_SHIFT))
+#define HKL_BINNING_KEY_BITS 21 /* per direction */
+
+struct hkl_binning_block_t
+{
+	gint64 key; /* the block coordinates, also the hash table key */
+	double intensities[HKL_BINNING_BLOCK_LEN];
+	double counts[HKL_BINNING_BLOCK_LEN];
+};
+
+struct _HklBinning
+{
+	HklBinningSpace space;
+	double min[3];
+	double max[3];
+	size_t n[3];
+	double scale[3]; /* n / (max - min) */
+	GHashTable *blocks;
+};
+
+#define HKL_BINNING_ERROR hkl_binning_error_quark ()
+
+static GQuark hkl_binning_error_quark (void)
+{
+	return g_quark_from_static_string ("hkl-binning-error-quark");
+}
+
+typedef enum {
+	HKL_BINNING_ERROR_NEW, /* can not create the grid */
+	HKL_BINNING_ERROR_FRAMES_ADD, /* can not add the frames */
+} HklBinningError;
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,602 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <math.h>                       // for isfinite, atan2, sqrt
+#include <stdlib.h>                     // for free, calloc
+#include <string.h>                     // for memset
+#include "hkl-binning-private.h"        // for _HklBinning, etc
+#include "hkl-detector-private.h"       // for hkl_detector_2d_frame_t, etc
+#include "hkl-frames-private.h"         // for hkl_frames_prefetch_t, etc
+#include "hkl-geometry-private.h"       // for _HklGeometry, _HklHolder
+#include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_error, etc
+#include "hkl-matrix-private.h"         // for hkl_matrix_transpose
+#include "hkl-quaternion-private.h"     // for hkl_quaternion_to_matrix
+
+static struct hkl_binning_block_t *binning_block_new(gint64 key)
+{
+	struct hkl_binning_block_t *block = calloc(1, sizeof(*block));
+
+	block->key = key;
+
+	return block;
+}
+
+static GHashTable *binning_blocks_new(void)
+{
+	return g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+}
+
+static inline gint64 binning_key(const size_t idx[3])
+{
+	return ((gint64)(idx[0] >> HKL_BINNING_BLOCK_SHIFT) << (2 * HKL_BINNING_KEY_BITS))
+		| ((gint64)(idx[1] >> HKL_BINNING_BLOCK_SHIFT) << HKL_BINNING_KEY_BITS)
+		| (gint64)(idx[2] >> HKL_BINNING_BLOCK_SHIFT);
+}
+
+static inline void binning_key_origin(gint64 key, size_t idx[3])
+{
+	const gint64 mask = ((gint64)1 << HKL_BINNING_KEY_BITS) - 1;
+
+	idx[0] = (size_t)(key >> (2 * HKL_BINNING_KEY_BITS)) << HKL_BINNING_BLOCK_SHIFT;
+	idx[1] = (size_t)((key >> HKL_BINNING_KEY_BITS) & mask) << HKL_BINNING_BLOCK_SHIFT;
+	idx[2] = (size_t)(key & mask) << HKL_BINNING_BLOCK_SHIFT;
+}
+
+static inline size_t binning_offset(const size_t idx[3])
+{
+	return ((idx[0] & HKL_BINNING_BLOCK_MASK) << (2 * HKL_BINNING_BLOCK_SHIFT))
+		| ((idx[1] & HKL_BINNING_BLOCK_MASK) << HKL_BINNING_BLOCK_SHIFT)
+		| (idx[2] & HKL_BINNING_BLOCK_MASK);
+}
+
+/**
+ * hkl_binning_new:
+ * @space: the coordinates of the grid
+ * @min: (array fixed-size=3): the lower bounds of the grid
+ * @max: (array fixed-size=3): the upper bounds of the grid
+ * @n: (array fixed-size=3): the number of voxels along each direction
+ * @error: return location for a GError, or NULL
+ *
+ * create an empty regular 3D grid accumulating the intensities and
+ * the number of contributing pixels of detector frames. The grid is
+ * sparse, the memory grows with the visited volume only.
+ *
+ * Returns: the new grid or NULL if the parameters are wrong.
+ **/
+HklBinning *hkl_binning_new(HklBinningSpace space,
+			    const double min[3], const double max[3], const size_t n[3],
+			    GError **error)
+{
+	HklBinning *self;
+	size_t i;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	for(i=0; i<3; ++i)
+		if(!(max[i] > min[i]) || n[i] == 0
+		   || (n[i] - 1) >> HKL_BINNING_BLOCK_SHIFT >> HKL_BINNING_KEY_BITS){
+			g_set_error(error,
+				    HKL_BINNING_ERROR,
+				    HKL_BINNING_ERROR_NEW,
+				    "wrong bounds or number of voxels along the direction %zu", i);
+			return NULL;
+		}
+
+	self = HKL_MALLOC(HklBinning);
+
+	self->space = space;
+	for(i=0; i<3; ++i){
+		self->min[i] = min[i];
+		self->max[i] = max[i];
+		self->n[i] = n[i];
+		self->scale[i] = n[i] / (max[i] - min[i]);
+	}
+	self->blocks = binning_blocks_new();
+
+	return self;
+}
+
+/**
+ * hkl_binning_free:
+ * @self: the this ptr
+ *
+ * release the memory of the grid
+ **/
+void hkl_binning_free(HklBinning *self)
+{
+	g_hash_table_destroy(self->blocks);
+	free(self);
+}
+
+/**
+ * hkl_binning_reset:
+ * @self: the this ptr
+ *
+ * empty the grid
+ **/
+void hkl_binning_reset(HklBinning *self)
+{
+	g_hash_table_remove_all(self->blocks);
+}
+
+/* the workers share the frames, each one takes the next frame not
+ * yet processed and accumulates it in its own partial grid. The
+ * partial grids are summed into the grid once all the frames are
+ * processed */
+struct binning_frames_t
+{
+	const HklBinning *binning;
+	const HklDetector *detector;
+	HklGeometry *const *geometries;
+	const HklSample *sample;
+	const double *const *intensities; /* or NULL */
+	const HklFrames *source; /* or NULL */
+	struct hkl_frames_prefetch_t *prefetch; /* or NULL */
+	size_t n_frames;
+	volatile gint next;
+	volatile gint failed;
+};
+
+struct binning_worker_t
+{
+	struct binning_frames_t *frames;
+	GHashTable *blocks;
+	GError *error;
+};
+
+static int binning_frame_coordinates(const HklBinning *self,
+				     const HklDetector *detector,
+				     HklGeometry *geometry,
+				     const HklSample *sample,
+				     struct hkl_detector_2d_frame_t *frame,
+				     GError **error)
+{
+	size_t n_pixels;
+	size_t i;
+
+	if(!hkl_detector_2d_frame_init(detector, geometry, frame, error))
+		return FALSE;
+
+	switch(self->space){
+	case HKL_BINNING_SPACE_HKL:
+		if(!hkl_detector_2d_frame_sample_set(frame, geometry, sample, error))
+			return FALSE;
+		break;
+	case HKL_BINNING_SPACE_Q:
+	case HKL_BINNING_SPACE_QPAR_QPER:
+		/* in the sample holder frame */
+		hkl_quaternion_to_matrix(&darray_item(geometry->holders, 0)->q, &frame->T);
+		hkl_matrix_transpose(&frame->T);
+		break;
+	}
+
+	hkl_detector_2d_frame_rows(frame, 0, frame->height);
+
+	if(self->space == HKL_BINNING_SPACE_QPAR_QPER){
+		n_pixels = frame->width * frame->height;
+		for(i=0; i<n_pixels; ++i){
+			double x = frame->out[0][i];
+			double y = frame->out[1][i];
+
+			frame->out[0][i] = sqrt(x * x + y * y);
+			frame->out[1][i] = frame->out[2][i];
+			frame->out[2][i] = atan2(y, x);
+		}
+	}
+
+	return TRUE;
+}
+
+static void binning_worker_run(gpointer data, gpointer user_data)
+{
+	struct binning_worker_t *worker = data;
+	struct binning_frames_t *frames = worker->frames;
+	const HklBinning *self = frames->binning;
+	struct hkl_detector_2d_frame_t frame;
+	struct hkl_binning_block_t *block = NULL;
+	size_t width, height, n_pixels;
+	double *coordinates;
+	double *row_buffer = NULL; /* one row of the source frames */
+	size_t row, column, i;
+
+	hkl_detector_2d_pixels_get(frames->detector, &width, &height);
+	n_pixels = width * height;
+	coordinates = malloc(3 * n_pixels * sizeof(*coordinates));
+	if(frames->source)
+		row_buffer = malloc(width * sizeof(*row_buffer));
+
+	while(!g_atomic_int_get(&frames->failed)){
+		size_t f = g_atomic_int_add(&frames->next, 1);
+
+		if(f >= frames->n_frames)
+			break;
+
+		if(frames->prefetch)
+			hkl_frames_prefetch_next(frames->prefetch, f);
+
+		for(i=0; i<3; ++i)
+			frame.out[i] = &coordinates[i * n_pixels];
+		if(!binning_frame_coordinates(self, frames->detector,
+					      frames->geometries[f], frames->sample,
+					      &frame, &worker->error)){
+			g_atomic_int_set(&frames->failed, TRUE);
+			break;
+		}
+
+		for(row=0; row<height; ++row){
+			const double *intensities;
+
+			/* the rows of the source are converted one at a
+			 * time from the mapped file */
+			if(frames->source){
+				hkl_frames_row_values_get(frames->source, f, row, row_buffer);
+				intensities = row_buffer;
+			}else
+				intensities = &frames->intensities[f][row * width];
+
+			for(column=0; column<width; ++column){
+				const size_t p = row * width + column;
+				size_t idx[3];
+				gint64 key;
+				size_t offset;
+				int inside = isfinite(intensities[column]); /* NaN for masked pixels */
+
+				for(i=0; i<3 && inside; ++i){
+					double x = (frame.out[i][p] - self->min[i]) * self->scale[i];
+
+					inside = x >= 0 && x < self->n[i];
+					idx[i] = inside ? (size_t)x : 0;
+				}
+				if(!inside)
+					continue;
+
+				/* consecutive pixels mostly hit the same block */
+				key = binning_key(idx);
+				if(!block || block->key != key){
+					block = g_hash_table_lookup(worker->blocks, &key);
+					if(!block){
+						block = binning_block_new(key);
+						g_hash_table_insert(worker->blocks, &block->key, block);
+					}
+				}
+				offset = binning_offset(idx);
+				block->intensities[offset] += intensities[column];
+				block->counts[offset] += 1;
+			}
+		}
+	}
+
+	free(row_buffer);
+	free(coordinates);
+}
+
+static void binning_blocks_merge(HklBinning *self, GHashTable *blocks)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, blocks);
+	while(g_hash_table_iter_next(&iter, &key, &value)){
+		struct hkl_binning_block_t *block = value;
+		struct hkl_binning_block_t *dst = g_hash_table_lookup(self->blocks, key);
+
+		if(!dst){
+			g_hash_table_iter_steal(&iter);
+			g_hash_table_insert(self->blocks, &block->key, block);
+		}else{
+			size_t i;
+
+			for(i=0; i<HKL_BINNING_BLOCK_LEN; ++i){
+				dst->intensities[i] += block->intensities[i];
+				dst->counts[i] += block->counts[i];
+			}
+		}
+	}
+}
+
+static int binning_frames_run(HklBinning *self, struct binning_frames_t *frames,
+			      size_t n_workers, GError **error)
+{
+	struct binning_worker_t *workers;
+	GThreadPool *pool;
+	GError *failure = NULL;
+	size_t k;
+
+	workers = calloc(n_workers, sizeof(*workers));
+	pool = g_thread_pool_new(binning_worker_run, NULL, n_workers, TRUE, NULL);
+	for(k=0; k<n_workers; ++k){
+		workers[k].frames = frames;
+		workers[k].blocks = binning_blocks_new();
+		if(!pool || !g_thread_pool_push(pool, &workers[k], NULL))
+			binning_worker_run(&workers[k], NULL);
+	}
+	if(pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	for(k=0; k<n_workers; ++k)
+		if(workers[k].error && !failure)
+			failure = g_error_copy(workers[k].error);
+
+	for(k=0; k<n_workers; ++k){
+		if(!failure)
+			binning_blocks_merge(self, workers[k].blocks);
+		g_hash_table_destroy(workers[k].blocks);
+		if(workers[k].error)
+			g_error_free(workers[k].error);
+	}
+	free(workers);
+
+	if(failure){
+		g_propagate_error(error, failure);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int binning_detector_check(const HklDetector *detector, GError **error)
+{
+	if(hkl_detector_type_get(detector) != HKL_DETECTOR_TYPE_2D){
+		g_set_error(error,
+			    HKL_BINNING_ERROR,
+			    HKL_BINNING_ERROR_FRAMES_ADD,
+			    "the frames must come from a 2D detector");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * hkl_binning_frames_add:
+ * @self: the this ptr
+ * @detector: the 2D detector of the frames
+ * @geometries: (array length=n_frames): the geometry of each frame
+ * @sample: the sample
+ * @frames: (array length=n_frames): the intensities of each frame,
+ *          width x height values stored row after row, NaN for the
+ *          masked pixels
+ * @n_frames: the number of frames
+ * @error: return location for a GError, or NULL
+ *
+ * accumulate the pixels of the frames in the grid, the coordinates
+ * of the pixels are computed with the geometry of each frame and the
+ * sample. The frames are processed in parallel, the grid can be
+ * filled with successive calls. The geometries are updated but not
+ * modified, they must be distinct objects.
+ *
+ * Returns: TRUE on success, FALSE otherwise, the grid is then unchanged.
+ **/
+int hkl_binning_frames_add(HklBinning *self,
+			   const HklDetector *detector,
+			   HklGeometry *const geometries[],
+			   const HklSample *sample,
+			   const double *const frames[],
+			   size_t n_frames,
+			   GError **error)
+{
+	struct binning_frames_t shared = {
+		self, detector, geometries, sample, frames, NULL, NULL, n_frames, 0, FALSE,
+	};
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!binning_detector_check(detector, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if(n_frames == 0)
+		return TRUE;
+
+	return binning_frames_run(self, &shared,
+				  MIN(n_frames, g_get_num_processors()), error);
+}
+
+/**
+ * hkl_binning_frames_source_add:
+ * @self: the this ptr
+ * @detector: the 2D detector of the frames
+ * @geometries: (array length=n_frames): the geometry of each frame,
+ *              as many as the frames of the source
+ * @sample: the sample
+ * @source: the frames, with the size of the detector
+ * @error: return location for a GError, or NULL
+ *
+ * same as hkl_binning_frames_add() but the frames are read from the
+ * mapped file, each row is converted into doubles just before its
+ * pixels are binned, so no frame is copied. A thread loads the
+ * frames a few frames ahead of the workers so the computation
+ * overlaps the disk reads.
+ *
+ * Returns: TRUE on success, FALSE otherwise, the grid is then unchanged.
+ **/
+int hkl_binning_frames_source_add(HklBinning *self,
+				  const HklDetector *detector,
+				  HklGeometry *const geometries[],
+				  const HklSample *sample,
+				  const HklFrames *source,
+				  GError **error)
+{
+	struct hkl_frames_prefetch_t prefetch;
+	struct binning_frames_t shared = {
+		self, detector, geometries, sample, NULL, source, &prefetch,
+		hkl_frames_len(source), 0, FALSE,
+	};
+	size_t width, height;
+	size_t d_width, d_height;
+	size_t n_workers;
+	int res;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!binning_detector_check(detector, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	hkl_frames_size_get(source, &width, &height);
+	hkl_detector_2d_pixels_get(detector, &d_width, &d_height);
+	if(width != d_width || height != d_height){
+		g_set_error(error,
+			    HKL_BINNING_ERROR,
+			    HKL_BINNING_ERROR_FRAMES_ADD,
+			    "the frames (%zu x %zu) do not match the detector (%zu x %zu)",
+			    width, height, d_width, d_height);
+		return FALSE;
+	}
+
+	if(shared.n_frames == 0)
+		return TRUE;
+
+	n_workers = MIN(shared.n_frames, g_get_num_processors());
+	hkl_frames_prefetch_start(&prefetch, source, 2 * n_workers);
+	res = binning_frames_run(self, &shared, n_workers, error);
+	hkl_frames_prefetch_stop(&prefetch);
+
+	return res;
+}
+
+/**
+ * hkl_binning_len:
+ * @self: the this ptr
+ *
+ * Returns: the number of voxels of the grid
+ **/
+size_t hkl_binning_len(const HklBinning *self)
+{
+	return self->n[0] * self->n[1] * self->n[2];
+}
+
+/**
+ * hkl_binning_voxels_len:
+ * @self: the this ptr
+ *
+ * Returns: the number of voxels with at least one contribution
+ **/
+size_t hkl_binning_voxels_len(const HklBinning *self)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	size_t n = 0;
+
+	g_hash_table_iter_init(&iter, self->blocks);
+	while(g_hash_table_iter_next(&iter, &key, &value)){
+		const struct hkl_binning_block_t *block = value;
+		size_t i;
+
+		for(i=0; i<HKL_BINNING_BLOCK_LEN; ++i)
+			n += block->counts[i] > 0;
+	}
+
+	return n;
+}
+
+/* call func for each voxel with at least one contribution */
+static void binning_voxels_foreach(const HklBinning *self,
+				   void (*func)(size_t idx, double intensity, double count, void *data),
+				   void *data)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, self->blocks);
+	while(g_hash_table_iter_next(&iter, &key, &value)){
+		const struct hkl_binning_block_t *block = value;
+		size_t origin[3];
+		size_t i;
+
+		binning_key_origin(block->key, origin);
+		for(i=0; i<HKL_BINNING_BLOCK_LEN; ++i)
+			if(block->counts[i] > 0){
+				size_t x = origin[0] + (i >> (2 * HKL_BINNING_BLOCK_SHIFT));
+				size_t y = origin[1] + ((i >> HKL_BINNING_BLOCK_SHIFT) & HKL_BINNING_BLOCK_MASK);
+				size_t z = origin[2] + (i & HKL_BINNING_BLOCK_MASK);
+
+				func((x * self->n[1] + y) * self->n[2] + z,
+				     block->intensities[i], block->counts[i], data);
+			}
+	}
+}
+
+struct binning_voxels_t
+{
+	size_t *idx;
+	double *intensities;
+	double *counts;
+	size_t n;
+};
+
+static void binning_voxels_sparse(size_t idx, double intensity, double count, void *data)
+{
+	struct binning_voxels_t *voxels = data;
+
+	voxels->idx[voxels->n] = idx;
+	voxels->intensities[voxels->n] = intensity;
+	voxels->counts[voxels->n] = count;
+	voxels->n++;
+}
+
+static void binning_voxels_dense(size_t idx, double intensity, double count, void *data)
+{
+	struct binning_voxels_t *voxels = data;
+
+	voxels->intensities[idx] = intensity;
+	voxels->counts[idx] = count;
+}
+
+/**
+ * hkl_binning_voxels_get:
+ * @self: the this ptr
+ * @idx: (out caller-allocates): the linear index (i * n[1] + j) * n[2] + k
+ *       of the voxels, hkl_binning_voxels_len() values
+ * @intensities: (out caller-allocates): the summed intensities of the voxels
+ * @counts: (out caller-allocates): the number of pixels of the voxels
+ *
+ * get the voxels with at least one contribution, in no particular
+ * order. Use it for the volumes too large for hkl_binning_get().
+ **/
+void hkl_binning_voxels_get(const HklBinning *self, size_t idx[],
+			    double intensities[], double counts[])
+{
+	struct binning_voxels_t voxels = {idx, intensities, counts, 0};
+
+	binning_voxels_foreach(self, binning_voxels_sparse, &voxels);
+}
+
+/**
+ * hkl_binning_get:
+ * @self: the this ptr
+ * @intensities: (out caller-allocates): the summed intensities of all
+ *               the voxels, hkl_binning_len() values
+ * @counts: (out caller-allocates): the number of pixels of all the voxels
+ *
+ * get the whole grid, the voxel (i, j, k) is at (i * n[1] + j) * n[2] + k.
+ * Divide the intensities by the counts to normalize.
+ **/
+void hkl_binning_get(const HklBinning *self, double intensities[], double counts[])
+{
+	struct binning_voxels_t voxels = {NULL, intensities, counts, 0};
+
+	memset(intensities, 0, hkl_binning_len(self) * sizeof(*intensities));
+	memset(counts, 0, hkl_binning_len(self) * sizeof(*counts));
+	binning_voxels_foreach(self, binning_voxels_dense, &voxels);
+}
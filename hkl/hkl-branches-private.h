@@ -0,0 +1,52 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_BRANCHES_PRIVATE_H__
+#define __HKL_BRANCHES_PRIVATE_H__
+
+#include <stddef.h>                     // for size_t
+#include "hkl.h"                        // for HklBranches, HklGeometry
+#include "hkl/ccan/darray/darray.h"     // for darray
+
+G_BEGIN_DECLS
+
+/* a branch contains one geometry per point since its birth, it
+ * exists until its last geometry */
+struct hkl_branch_t
+{
+	size_t birth;
+	darray(HklGeometry *) geometries;
+};
+
+typedef darray(struct hkl_branch_t *) darray_branch;
+typedef darray(size_t) darray_branch_id;
+
+struct _HklBranches
+{
+	double max_distance; /* 0 for no limit */
+	size_t n_points;
+	darray_branch branches; /* indexed by the branch id */
+	darray_branch_id alive; /* the ids of the alive branches */
+};
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,342 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <math.h>                       // for M_PI
+#include <stdlib.h>                     // for free, calloc
+#include "hkl-branches-private.h"       // for _HklBranches, etc
+#include "hkl-geometry-private.h"       // for hkl_geometry_distance_orthodromic, etc
+#include "hkl-macros-private.h"         // for HKL_MALLOC
+#include "hkl/ccan/darray/darray.h"     // for darray_item, darray_size, etc
+
+/* solve the square assignment problem of size n with the hungarian
+ * algorithm, assignment[row] is the column of the minimum total cost */
+static void branches_assign(const double *cost, size_t n, size_t *assignment)
+{
+	double *u = calloc(n + 1, sizeof(*u));
+	double *v = calloc(n + 1, sizeof(*v));
+	double *minv = malloc((n + 1) * sizeof(*minv));
+	size_t *p = calloc(n + 1, sizeof(*p));
+	size_t *way = calloc(n + 1, sizeof(*way));
+	int *used = malloc((n + 1) * sizeof(*used));
+	size_t i, j;
+
+	/* rows and columns are numbered from 1, 0 is the free column */
+	for(i=1; i<=n; ++i){
+		size_t j0 = 0;
+
+		p[0] = i;
+		for(j=0; j<=n; ++j){
+			minv[j] = HUGE_VAL;
+			used[j] = FALSE;
+		}
+
+		do{
+			const size_t i0 = p[j0];
+			double delta = HUGE_VAL;
+			size_t j1 = 0;
+
+			used[j0] = TRUE;
+			for(j=1; j<=n; ++j)
+				if(!used[j]){
+					double cur = cost[(i0 - 1) * n + j - 1] - u[i0] - v[j];
+
+					if(cur < minv[j]){
+						minv[j] = cur;
+						way[j] = j0;
+					}
+					if(minv[j] < delta){
+						delta = minv[j];
+						j1 = j;
+					}
+				}
+			for(j=0; j<=n; ++j)
+				if(used[j]){
+					u[p[j]] += delta;
+					v[j] -= delta;
+				}else
+					minv[j] -= delta;
+			j0 = j1;
+		}while(p[j0] != 0);
+
+		do{
+			size_t j1 = way[j0];
+
+			p[j0] = p[j1];
+			j0 = j1;
+		}while(j0);
+	}
+
+	for(j=1; j<=n; ++j)
+		assignment[p[j] - 1] = j - 1;
+
+	free(used);
+	free(way);
+	free(p);
+	free(minv);
+	free(v);
+	free(u);
+}
+
+static struct hkl_branch_t *hkl_branch_new(size_t birth)
+{
+	struct hkl_branch_t *self = HKL_MALLOC(struct hkl_branch_t);
+
+	self->birth = birth;
+	darray_init(self->geometries);
+
+	return self;
+}
+
+static void hkl_branch_free(struct hkl_branch_t *self)
+{
+	HklGeometry **geometry;
+
+	darray_foreach(geometry, self->geometries){
+		hkl_geometry_free(*geometry);
+	}
+	darray_free(self->geometries);
+	free(self);
+}
+
+/**
+ * hkl_branches_new:
+ * @max_distance: the maximum orthodromic distance (default unit)
+ *                between two consecutive geometries of a branch, 0
+ *                for no limit
+ *
+ * create a tracker which follows the branches of solutions along the
+ * points of a trajectory, each solution of a point being attached to
+ * a branch of the previous point.
+ *
+ * Returns: a new tracker, use hkl_branches_free to release the memory.
+ **/
+HklBranches *hkl_branches_new(double max_distance)
+{
+	HklBranches *self = HKL_MALLOC(HklBranches);
+
+	self->max_distance = max_distance > 0 ? max_distance : 0;
+	self->n_points = 0;
+	darray_init(self->branches);
+	darray_init(self->alive);
+
+	return self;
+}
+
+/**
+ * hkl_branches_free:
+ * @self: the this ptr
+ *
+ * release the memory of the tracker and of its geometries
+ **/
+void hkl_branches_free(HklBranches *self)
+{
+	struct hkl_branch_t **branch;
+
+	darray_foreach(branch, self->branches){
+		hkl_branch_free(*branch);
+	}
+	darray_free(self->branches);
+	darray_free(self->alive);
+	free(self);
+}
+
+/**
+ * hkl_branches_add:
+ * @self: the this ptr
+ * @solutions: (allow-none): the solutions of the next point or NULL
+ *             if the point has no solution
+ * @births: (out caller-allocates) (allow-none): the number of branches
+ *          born at this point
+ * @deaths: (out caller-allocates) (allow-none): the number of branches
+ *          dead at this point
+ *
+ * attach the solutions of the next point to the alive branches. The
+ * solutions are assigned to the last geometries of the branches in
+ * order to minimize the total orthodromic distance. A branch without
+ * solution dies, a solution farther than the max distance of all the
+ * branches or left without branch starts a new one. The order of the
+ * solutions in the list does not matter.
+ **/
+void hkl_branches_add(HklBranches *self, const HklGeometryList *solutions,
+		      size_t *births, size_t *deaths)
+{
+	const size_t n_branches = darray_size(self->alive);
+	const size_t n_solutions = solutions ? hkl_geometry_list_n_items_get(solutions) : 0;
+	const size_t n = n_branches + n_solutions;
+	const HklGeometry **geometries;
+	const HklGeometryListItem *item;
+	darray_branch_id alive = darray_new();
+	double *cost;
+	double gate;
+	double forbidden;
+	size_t *assignment;
+	size_t i, j;
+
+	if(births)
+		*births = 0;
+	if(deaths)
+		*deaths = 0;
+
+	geometries = calloc(n_solutions + 1, sizeof(*geometries));
+	i = 0;
+	if(solutions)
+		HKL_GEOMETRY_LIST_FOREACH(item, solutions){
+			geometries[i++] = hkl_geometry_list_item_geometry_get(item);
+		}
+
+	/* without limit all the matches must be cheaper than a death
+	 * and a birth, the distances are smaller than n_axes * pi */
+	gate = self->max_distance;
+	if(gate == 0 && n_solutions)
+		gate = darray_size(geometries[0]->axes) * M_PI + 1;
+	forbidden = 2 * (n + 1) * gate;
+
+	/* rows: the branches then the births, columns: the solutions
+	 * then the deaths */
+	cost = calloc(n * n, sizeof(*cost));
+	for(i=0; i<n_branches; ++i){
+		const struct hkl_branch_t *branch = darray_item(self->branches,
+								darray_item(self->alive, i));
+		const HklGeometry *last = darray_item(branch->geometries,
+						      darray_size(branch->geometries) - 1);
+
+		for(j=0; j<n_solutions; ++j){
+			double d = hkl_geometry_distance_orthodromic(geometries[j], last);
+
+			cost[i * n + j] = d <= gate ? d : forbidden;
+		}
+		for(j=n_solutions; j<n; ++j)
+			cost[i * n + j] = gate;
+	}
+	for(i=n_branches; i<n; ++i)
+		for(j=0; j<n_solutions; ++j)
+			cost[i * n + j] = gate;
+
+	assignment = calloc(n + 1, sizeof(*assignment));
+	if(n)
+		branches_assign(cost, n, assignment);
+
+	/* the matched branches continue, the others die */
+	for(i=0; i<n_branches; ++i){
+		const size_t id = darray_item(self->alive, i);
+		struct hkl_branch_t *branch = darray_item(self->branches, id);
+
+		j = assignment[i];
+		if(j < n_solutions && cost[i * n + j] < forbidden){
+			darray_append(branch->geometries, hkl_geometry_new_copy(geometries[j]));
+			darray_append(alive, id);
+		}else if(deaths)
+			*deaths += 1;
+	}
+
+	/* the solutions without branch start a new one */
+	for(j=0; j<n_solutions; ++j){
+		int matched = FALSE;
+
+		for(i=0; i<n_branches && !matched; ++i)
+			matched = assignment[i] == j && cost[i * n + j] < forbidden;
+		if(!matched){
+			struct hkl_branch_t *branch = hkl_branch_new(self->n_points);
+
+			darray_append(branch->geometries, hkl_geometry_new_copy(geometries[j]));
+			darray_append(alive, darray_size(self->branches));
+			darray_append(self->branches, branch);
+			if(births)
+				*births += 1;
+		}
+	}
+
+	darray_free(self->alive);
+	self->alive = alive;
+	self->n_points += 1;
+
+	free(assignment);
+	free(cost);
+	free(geometries);
+}
+
+/**
+ * hkl_branches_len:
+ * @self: the this ptr
+ *
+ * Returns: the number of branches born since the creation of the
+ *          tracker, the branch ids are in [0, len)
+ **/
+size_t hkl_branches_len(const HklBranches *self)
+{
+	return darray_size(self->branches);
+}
+
+/**
+ * hkl_branches_n_points_get:
+ * @self: the this ptr
+ *
+ * Returns: the number of points added to the tracker
+ **/
+size_t hkl_branches_n_points_get(const HklBranches *self)
+{
+	return self->n_points;
+}
+
+/**
+ * hkl_branches_branch_get:
+ * @self: the this ptr
+ * @id: the id of the branch
+ * @birth: (out caller-allocates): the index of the first point of the branch
+ * @death: (out caller-allocates): the index of the point after the
+ *         last one of the branch, the number of points if the branch
+ *         is still alive
+ *
+ * get the lifetime of a branch
+ **/
+void hkl_branches_branch_get(const HklBranches *self, size_t id,
+			     size_t *birth, size_t *death)
+{
+	const struct hkl_branch_t *branch = darray_item(self->branches, id);
+
+	*birth = branch->birth;
+	*death = branch->birth + darray_size(branch->geometries);
+}
+
+/**
+ * hkl_branches_geometry_get:
+ * @self: the this ptr
+ * @id: the id of the branch
+ * @point: the index of the point
+ *
+ * Returns: (allow-none): the geometry of the branch at this point or
+ *          NULL if the branch does not exist at this point.
+ **/
+const HklGeometry *hkl_branches_geometry_get(const HklBranches *self,
+					     size_t id, size_t point)
+{
+	const struct hkl_branch_t *branch;
+
+	if(id >= darray_size(self->branches))
+		return NULL;
+
+	branch = darray_item(self->branches, id);
+	if(point < branch->birth
+	   || point - branch->birth >= darray_size(branch->geometries))
+		return NULL;
+
+	return darray_item(branch->geometries, point - branch->birth);
+}
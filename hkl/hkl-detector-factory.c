@@ -39,6 +39,9 @@ HklDetector *hkl_detector_factory_new(HklDetectorType type)
 	case HKL_DETECTOR_TYPE_0D:
 		detector = hkl_detector_new();
 		break;
+	case HKL_DETECTOR_TYPE_2D:
+		detector = hkl_detector_new_2d();
+		break;
 	}
 
 	return detector;
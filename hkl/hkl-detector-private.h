@@ -24,25 +24,82 @@
 
 #include <stddef.h>                     // for size_t
 #include "hkl-geometry-private.h"       // for HklHolder
+#include "hkl-matrix-private.h"         // for _HklMatrix
 #include "hkl-vector-private.h"         // for HklVector
 #include "hkl.h"                        // for HklDetector, etc
 
 G_BEGIN_DECLS
 
+/* the 2D detector is a plane at distance from the center of rotation,
+ * perpendicular to the x axis of the detector holder (the kf of the
+ * 0D detector) before its orientation. Columns go along y and rows
+ * along z, the pixels are stored row after row. */
+struct hkl_detector_2d_t
+{
+	size_t width; /* number of columns */
+	size_t height; /* number of rows */
+	double pixel_width;
+	double pixel_height;
+	double distance;
+	double center[2]; /* column, row of the normal incidence point */
+	HklMatrix orientation; /* of the plane in the detector holder frame */
+};
+
 struct _HklDetector
 {
+	HklDetectorType type;
 	size_t idx;
 	HklHolder const *holder;
+	struct hkl_detector_2d_t d2;
 };
 
+/* conversion of the pixels of a 2D detector for one geometry */
+struct hkl_detector_2d_frame_t
+{
+	double origin[3]; /* direction of the pixel (0, 0) */
+	double step_c[3]; /* from one column to the next */
+	double step_r[3]; /* from one row to the next */
+	double ki[3];
+	double k;
+	HklMatrix T; /* applied to Q */
+	size_t width;
+	size_t height;
+	double *out[3]; /* width x height values each */
+};
+
+#define HKL_DETECTOR_ERROR hkl_detector_error_quark ()
+
+static GQuark hkl_detector_error_quark (void)
+{
+	return g_quark_from_static_string ("hkl-detector-error-quark");
+}
+
+typedef enum {
+	HKL_DETECTOR_ERROR_2D_SET, /* can not set the 2D detector parameters */
+	HKL_DETECTOR_ERROR_2D_COMPUTE, /* can not compute the pixels */
+} HklDetectorError;
+
 extern HklDetector *hkl_detector_new(void);
 
+extern HklDetector *hkl_detector_new_2d(void);
+
 extern void hkl_detector_attach_to_holder(HklDetector *self,
 					  HklHolder const *holder) HKL_ARG_NONNULL(1, 2);
 
 extern int hkl_detector_compute_kf(HklDetector const *self, HklGeometry *g,
 				   HklVector *kf) HKL_ARG_NONNULL(1, 2, 3);
 
+extern int hkl_detector_2d_frame_init(const HklDetector *self, HklGeometry *geometry,
+				      struct hkl_detector_2d_frame_t *frame,
+				      GError **error) HKL_ARG_NONNULL(1, 2, 3);
+
+extern int hkl_detector_2d_frame_sample_set(struct hkl_detector_2d_frame_t *frame,
+					    HklGeometry *geometry, const HklSample *sample,
+					    GError **error) HKL_ARG_NONNULL(1, 2, 3);
+
+extern void hkl_detector_2d_frame_rows(const struct hkl_detector_2d_frame_t *frame,
+				       size_t begin, size_t end) HKL_ARG_NONNULL(1);
+
 G_END_DECLS
 
 #endif /* __HKL_DETECTOR_PRIVATE_H__ */
@@ -19,11 +19,15 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <math.h>                       // for sqrt
 #include <stdio.h>                      // for fprintf, NULL, FILE
 #include <stdlib.h>                     // for free
 #include "hkl-detector-private.h"       // for _HklDetector
 #include "hkl-geometry-private.h"       // for HklHolder, _HklGeometry, etc
 #include "hkl-macros-private.h"         // for HKL_MALLOC
+#include "hkl-matrix-private.h"         // for hkl_matrix_init_from_euler, etc
+#include "hkl-quaternion-private.h"     // for hkl_quaternion_to_matrix
+#include "hkl-sample-private.h"         // for _HklSample
 #include "hkl-source-private.h"         // for HklSource
 #include "hkl-vector-private.h"         // for hkl_vector_init, etc
 #include "hkl.h"                        // for HklDetector, HklGeometry, etc
@@ -42,12 +46,39 @@ HklDetector *hkl_detector_new(void)
 
 	self = HKL_MALLOC(HklDetector);
 
+	self->type = HKL_DETECTOR_TYPE_0D;
 	self->idx = 1;
 	self->holder = NULL;
 
 	return self;
 }
 
+/**
+ * hkl_detector_new_2d: (skip)
+ *
+ * Create a new #HklDetector of type HKL_DETECTOR_TYPE_2D, one pixel
+ * of unit size at unit distance with its normal incidence point on
+ * this pixel.
+ *
+ * Returns:
+ **/
+HklDetector *hkl_detector_new_2d(void)
+{
+	HklDetector *self = hkl_detector_new();
+
+	self->type = HKL_DETECTOR_TYPE_2D;
+	self->d2.width = 1;
+	self->d2.height = 1;
+	self->d2.pixel_width = 1;
+	self->d2.pixel_height = 1;
+	self->d2.distance = 1;
+	self->d2.center[0] = 0;
+	self->d2.center[1] = 0;
+	hkl_matrix_init_from_euler(&self->d2.orientation, 0, 0, 0);
+
+	return self;
+}
+
 /**
  * hkl_detector_new_copy: (skip)
  * @src: the detector to copy
@@ -110,6 +141,9 @@ int hkl_detector_compute_kf(HklDetector const *self, HklGeometry *g,
 	holder = darray_item(g->holders, self->idx);
 	if (holder) {
 		hkl_vector_init(kf, HKL_TAU / g->source.wave_length, 0, 0);
+		/* the 2D detector kf goes through its normal incidence point */
+		if (self->type == HKL_DETECTOR_TYPE_2D)
+			hkl_matrix_times_vector(&self->d2.orientation, kf);
 		hkl_vector_rotated_quaternion(kf, &holder->q);
 		return TRUE;
 	} else
@@ -127,4 +161,457 @@ void hkl_detector_fprintf(FILE *f, const HklDetector *self)
 {
 	fprintf(f, "detector->idx: %d\n", self->idx);
 	fprintf(f, "detector->holder: %p\n", self->holder);
+	if (self->type == HKL_DETECTOR_TYPE_2D){
+		fprintf(f, "detector->pixels: %zu x %zu (%f x %f)\n",
+			self->d2.width, self->d2.height,
+			self->d2.pixel_width, self->d2.pixel_height);
+		fprintf(f, "detector->poni: %f (%f, %f)\n",
+			self->d2.distance, self->d2.center[0], self->d2.center[1]);
+		fprintf(f, "detector->orientation:\n");
+		hkl_matrix_fprintf(f, &self->d2.orientation);
+	}
+}
+
+/**
+ * hkl_detector_type_get:
+ * @self: the this ptr
+ *
+ * Returns: the type of the detector
+ **/
+HklDetectorType hkl_detector_type_get(const HklDetector *self)
+{
+	return self->type;
+}
+
+static int detector_2d_check(const HklDetector *self, GError **error)
+{
+	if (self->type != HKL_DETECTOR_TYPE_2D){
+		g_set_error(error,
+			    HKL_DETECTOR_ERROR,
+			    HKL_DETECTOR_ERROR_2D_SET,
+			    "not a 2D detector");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_pixels_set:
+ * @self: the this ptr
+ * @width: the number of columns
+ * @height: the number of rows
+ * @pixel_width: the size of a pixel along the columns
+ * @pixel_height: the size of a pixel along the rows
+ * @error: return location for a GError, or NULL
+ *
+ * set the pixels of a 2D detector, the sizes are in the same unit
+ * than the distance.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_pixels_set(HklDetector *self,
+			       size_t width, size_t height,
+			       double pixel_width, double pixel_height,
+			       GError **error)
+{
+	hkl_error(error == NULL || *error == NULL);
+
+	if (!detector_2d_check(self, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if (width == 0 || height == 0 || !(pixel_width > 0) || !(pixel_height > 0)){
+		g_set_error(error,
+			    HKL_DETECTOR_ERROR,
+			    HKL_DETECTOR_ERROR_2D_SET,
+			    "the pixels must have a strictly positive number and size");
+		return FALSE;
+	}
+
+	self->d2.width = width;
+	self->d2.height = height;
+	self->d2.pixel_width = pixel_width;
+	self->d2.pixel_height = pixel_height;
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_pixels_get:
+ * @self: the this ptr
+ * @width: (out caller-allocates): the number of columns
+ * @height: (out caller-allocates): the number of rows
+ *
+ * get the number of pixels of a 2D detector, the arrays of
+ * hkl_detector_2d_q_get() and hkl_detector_2d_hkl_get() have width x
+ * height values.
+ **/
+void hkl_detector_2d_pixels_get(const HklDetector *self,
+				size_t *width, size_t *height)
+{
+	*width = self->type == HKL_DETECTOR_TYPE_2D ? self->d2.width : 1;
+	*height = self->type == HKL_DETECTOR_TYPE_2D ? self->d2.height : 1;
+}
+
+/**
+ * hkl_detector_2d_poni_set:
+ * @self: the this ptr
+ * @distance: the distance from the center of rotation to the detector plane
+ * @center_column: the column of the normal incidence point (can be fractional)
+ * @center_row: the row of the normal incidence point (can be fractional)
+ * @error: return location for a GError, or NULL
+ *
+ * set the point of normal incidence of a 2D detector
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_poni_set(HklDetector *self, double distance,
+			     double center_column, double center_row,
+			     GError **error)
+{
+	hkl_error(error == NULL || *error == NULL);
+
+	if (!detector_2d_check(self, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if (!(distance > 0)){
+		g_set_error(error,
+			    HKL_DETECTOR_ERROR,
+			    HKL_DETECTOR_ERROR_2D_SET,
+			    "the distance must be strictly positive");
+		return FALSE;
+	}
+
+	self->d2.distance = distance;
+	self->d2.center[0] = center_column;
+	self->d2.center[1] = center_row;
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_orientation_set:
+ * @self: the this ptr
+ * @euler_x: the eulerian value along X (radian)
+ * @euler_y: the eulerian value along Y (radian)
+ * @euler_z: the eulerian value along Z (radian)
+ * @error: return location for a GError, or NULL
+ *
+ * set the orientation of the 2D detector plane relatively to the
+ * detector holder, see hkl_matrix_new_euler().
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_orientation_set(HklDetector *self,
+				    double euler_x, double euler_y, double euler_z,
+				    GError **error)
+{
+	hkl_error(error == NULL || *error == NULL);
+
+	if (!detector_2d_check(self, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	hkl_matrix_init_from_euler(&self->d2.orientation, euler_x, euler_y, euler_z);
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_frame_init: (skip)
+ * @self: the this ptr, a 2D detector
+ * @geometry: the geometry holding the detector
+ * @frame: (out caller-allocates): the frame to initialize
+ * @error: return location for a GError, or NULL
+ *
+ * prepare the conversion of the pixels for this geometry, the pixels
+ * give Q in the laboratory frame until frame->T is changed. The out
+ * arrays must be set before hkl_detector_2d_frame_rows().
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_frame_init(const HklDetector *self, HklGeometry *geometry,
+			       struct hkl_detector_2d_frame_t *frame,
+			       GError **error)
+{
+	HklMatrix M;
+	HklVector ki;
+	size_t i;
+
+	if (self->type != HKL_DETECTOR_TYPE_2D
+	    || self->idx >= darray_size(geometry->holders)){
+		g_set_error(error,
+			    HKL_DETECTOR_ERROR,
+			    HKL_DETECTOR_ERROR_2D_COMPUTE,
+			    "not a 2D detector of this geometry");
+		return FALSE;
+	}
+
+	/* from the detector plane to the laboratory frame */
+	hkl_geometry_update(geometry);
+	hkl_quaternion_to_matrix(&darray_item(geometry->holders, self->idx)->q, &M);
+	hkl_matrix_times_matrix(&M, &self->d2.orientation);
+
+	for(i=0; i<3; ++i){
+		frame->step_c[i] = M.data[i][1] * self->d2.pixel_width;
+		frame->step_r[i] = M.data[i][2] * self->d2.pixel_height;
+		frame->origin[i] = M.data[i][0] * self->d2.distance
+			- self->d2.center[0] * frame->step_c[i]
+			- self->d2.center[1] * frame->step_r[i];
+	}
+	hkl_source_compute_ki(&geometry->source, &ki);
+	for(i=0; i<3; ++i)
+		frame->ki[i] = ki.data[i];
+	frame->k = hkl_vector_norm2(&ki);
+	hkl_matrix_init_from_euler(&frame->T, 0, 0, 0);
+	frame->width = self->d2.width;
+	frame->height = self->d2.height;
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_frame_sample_set: (skip)
+ * @frame: the frame initialized for the geometry
+ * @geometry: the geometry holding the sample
+ * @sample: the sample
+ * @error: return location for a GError, or NULL
+ *
+ * the pixels of the frame give hkl instead of Q, hkl = (R.UB)^-1.Q
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_frame_sample_set(struct hkl_detector_2d_frame_t *frame,
+				     HklGeometry *geometry, const HklSample *sample,
+				     GError **error)
+{
+	HklMatrix RUB;
+	size_t i, j;
+
+	hkl_geometry_update(geometry);
+	hkl_quaternion_to_matrix(&darray_item(geometry->holders, 0)->q, &RUB);
+	hkl_matrix_times_matrix(&RUB, &sample->UB);
+	for(j=0; j<3; ++j){
+		HklVector e = {{0, 0, 0}};
+		HklVector column;
+
+		e.data[j] = 1;
+		if(hkl_matrix_solve(&RUB, &column, &e) != 0){
+			g_set_error(error,
+				    HKL_DETECTOR_ERROR,
+				    HKL_DETECTOR_ERROR_2D_COMPUTE,
+				    "the UB matrix of the sample is singular");
+			return FALSE;
+		}
+		for(i=0; i<3; ++i)
+			frame->T.data[i][j] = column.data[i];
+	}
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_frame_rows: (skip)
+ * @frame: the frame
+ * @begin: the first row
+ * @end: the row after the last one
+ *
+ * convert the pixels of the rows [begin, end) into frame->out. The
+ * pixel (row, column) direction is origin + column * step_c + row *
+ * step_r, so the inner loop has no branch and no call. It is
+ * vectorized, sqrt included, when the compiler accepts the
+ * -fopenmp-simd and -fno-math-errno flags (SIMD_CFLAGS).
+ **/
+void hkl_detector_2d_frame_rows(const struct hkl_detector_2d_frame_t *frame,
+				size_t begin, size_t end)
+{
+	const double (*T)[3] = frame->T.data;
+	const double T00 = T[0][0], T01 = T[0][1], T02 = T[0][2];
+	const double T10 = T[1][0], T11 = T[1][1], T12 = T[1][2];
+	const double T20 = T[2][0], T21 = T[2][1], T22 = T[2][2];
+	const double cx = frame->step_c[0], cy = frame->step_c[1], cz = frame->step_c[2];
+	const double kix = frame->ki[0], kiy = frame->ki[1], kiz = frame->ki[2];
+	const double k = frame->k;
+	const size_t width = frame->width;
+	size_t row;
+
+	for(row=begin; row<end; ++row){
+		const double ox = frame->origin[0] + row * frame->step_r[0];
+		const double oy = frame->origin[1] + row * frame->step_r[1];
+		const double oz = frame->origin[2] + row * frame->step_r[2];
+		double *restrict x = &frame->out[0][row * width];
+		double *restrict y = &frame->out[1][row * width];
+		double *restrict z = &frame->out[2][row * width];
+		size_t column;
+
+#pragma omp simd
+		for(column=0; column<width; ++column){
+			/* int to double has a vector conversion, not size_t */
+			const double c = (int)column;
+			const double rx = ox + c * cx;
+			const double ry = oy + c * cy;
+			const double rz = oz + c * cz;
+			const double s = k / sqrt(rx * rx + ry * ry + rz * rz);
+			const double qx = rx * s - kix;
+			const double qy = ry * s - kiy;
+			const double qz = rz * s - kiz;
+
+			x[column] = T00 * qx + T01 * qy + T02 * qz;
+			y[column] = T10 * qx + T11 * qy + T12 * qz;
+			z[column] = T20 * qx + T21 * qy + T22 * qz;
+		}
+	}
+}
+
+/* the rows are split in chunks run in parallel by one pool shared by
+ * all the detectors, created at the first 2D computation and kept
+ * for the life of the process. */
+struct detector_2d_job_t
+{
+	GMutex mutex;
+	GCond cond;
+	size_t pending; /* number of chunks not yet computed */
+};
+
+struct detector_2d_chunk_t
+{
+	const struct hkl_detector_2d_frame_t *frame;
+	struct detector_2d_job_t *job;
+	size_t begin;
+	size_t end;
+};
+
+static void detector_2d_chunk_run(gpointer data, gpointer user_data)
+{
+	const struct detector_2d_chunk_t *chunk = data;
+
+	hkl_detector_2d_frame_rows(chunk->frame, chunk->begin, chunk->end);
+
+	g_mutex_lock(&chunk->job->mutex);
+	if(--chunk->job->pending == 0)
+		g_cond_signal(&chunk->job->cond);
+	g_mutex_unlock(&chunk->job->mutex);
+}
+
+static gpointer detector_2d_pool_new(gpointer data)
+{
+	return g_thread_pool_new(detector_2d_chunk_run, NULL,
+				 g_get_num_processors(), FALSE, NULL);
+}
+
+static GThreadPool *detector_2d_pool_get(void)
+{
+	static GOnce once = G_ONCE_INIT;
+
+	return g_once(&once, detector_2d_pool_new, NULL);
+}
+
+static void detector_2d_frame_compute(const struct hkl_detector_2d_frame_t *frame)
+{
+	GThreadPool *pool = detector_2d_pool_get();
+	struct detector_2d_chunk_t *chunks;
+	struct detector_2d_job_t job;
+	size_t n_chunks;
+	size_t i;
+
+	n_chunks = MIN(frame->height, g_get_num_processors());
+	chunks = calloc(n_chunks, sizeof(*chunks));
+	g_mutex_init(&job.mutex);
+	g_cond_init(&job.cond);
+	job.pending = n_chunks;
+	for(i=0; i<n_chunks; ++i){
+		chunks[i].frame = frame;
+		chunks[i].job = &job;
+		chunks[i].begin = frame->height * i / n_chunks;
+		chunks[i].end = frame->height * (i + 1) / n_chunks;
+		if(!pool || !g_thread_pool_push(pool, &chunks[i], NULL))
+			detector_2d_chunk_run(&chunks[i], NULL);
+	}
+
+	g_mutex_lock(&job.mutex);
+	while(job.pending > 0)
+		g_cond_wait(&job.cond, &job.mutex);
+	g_mutex_unlock(&job.mutex);
+
+	g_cond_clear(&job.cond);
+	g_mutex_clear(&job.mutex);
+	free(chunks);
+}
+
+/**
+ * hkl_detector_2d_q_get:
+ * @self: the this ptr, a 2D detector
+ * @geometry: the geometry holding the detector
+ * @qx: (out caller-allocates): the x coordinates of Q, width x height values
+ * @qy: (out caller-allocates): the y coordinates of Q, width x height values
+ * @qz: (out caller-allocates): the z coordinates of Q, width x height values
+ * @error: return location for a GError, or NULL
+ *
+ * compute the scattering vector Q = kf - ki of every pixel in the
+ * laboratory frame, the pixels are stored row after row.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_q_get(const HklDetector *self, HklGeometry *geometry,
+			  double qx[], double qy[], double qz[],
+			  GError **error)
+{
+	struct hkl_detector_2d_frame_t frame;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!hkl_detector_2d_frame_init(self, geometry, &frame, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+	frame.out[0] = qx;
+	frame.out[1] = qy;
+	frame.out[2] = qz;
+
+	detector_2d_frame_compute(&frame);
+
+	return TRUE;
+}
+
+/**
+ * hkl_detector_2d_hkl_get:
+ * @self: the this ptr, a 2D detector
+ * @geometry: the geometry holding the detector
+ * @sample: the sample
+ * @h: (out caller-allocates): the h of every pixel, width x height values
+ * @k: (out caller-allocates): the k of every pixel, width x height values
+ * @l: (out caller-allocates): the l of every pixel, width x height values
+ * @error: return location for a GError, or NULL
+ *
+ * compute the hkl coordinates of every pixel, the pixels are stored
+ * row after row.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_detector_2d_hkl_get(const HklDetector *self, HklGeometry *geometry,
+			    const HklSample *sample,
+			    double h[], double k[], double l[],
+			    GError **error)
+{
+	struct hkl_detector_2d_frame_t frame;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!hkl_detector_2d_frame_init(self, geometry, &frame, error)
+	   || !hkl_detector_2d_frame_sample_set(&frame, geometry, sample, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+	frame.out[0] = h;
+	frame.out[1] = k;
+	frame.out[2] = l;
+
+	detector_2d_frame_compute(&frame);
+
+	return TRUE;
 }
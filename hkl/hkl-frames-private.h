@@ -0,0 +1,82 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_FRAMES_PRIVATE_H__
+#define __HKL_FRAMES_PRIVATE_H__
+
+#include <stddef.h>                     // for size_t
+#include "hkl.h"                        // for HklFrames, etc
+#include "hkl/ccan/darray/darray.h"     // for darray
+
+G_BEGIN_DECLS
+
+/* a stack of frames mapped in memory, the data of the frame i starts
+ * at offsets[i] in the file */
+struct _HklFrames
+{
+	GMappedFile *file;
+	HklFramesType type;
+	size_t width;
+	size_t height;
+	int swap; /* the byte order is not the host one */
+	darray(size_t) offsets;
+};
+
+/* a thread touching the pages of the frames a few frames ahead of the
+ * consumers, so the page faults are not taken by the computation */
+struct hkl_frames_prefetch_t
+{
+	const HklFrames *frames;
+	size_t depth;
+	size_t next; /* the next frame needed by the consumers */
+	int stop;
+	GMutex mutex;
+	GCond cond;
+	GThread *thread;
+};
+
+extern size_t hkl_frames_type_size(HklFramesType type);
+
+extern void hkl_frames_row_values_get(const HklFrames *self, size_t frame, size_t row,
+				      double values[]) HKL_ARG_NONNULL(1, 4);
+
+extern void hkl_frames_prefetch_start(struct hkl_frames_prefetch_t *self,
+				      const HklFrames *frames, size_t depth) HKL_ARG_NONNULL(1, 2);
+
+extern void hkl_frames_prefetch_next(struct hkl_frames_prefetch_t *self, size_t frame) HKL_ARG_NONNULL(1);
+
+extern void hkl_frames_prefetch_stop(struct hkl_frames_prefetch_t *self) HKL_ARG_NONNULL(1);
+
+#define HKL_FRAMES_ERROR hkl_frames_error_quark ()
+
+static GQuark hkl_frames_error_quark (void)
+{
+	return g_quark_from_static_string ("hkl-frames-error-quark");
+}
+
+typedef enum {
+	HKL_FRAMES_ERROR_RAW, /* can not map the raw stack */
+	HKL_FRAMES_ERROR_EDF, /* can not parse the EDF file */
+} HklFramesError;
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,555 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <stdlib.h>                     // for free, strtoull
+#include <string.h>                     // for memcpy, memchr, strlen
+#include "hkl-frames-private.h"         // for _HklFrames, etc
+#include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_error, etc
+#include "hkl/ccan/array_size/array_size.h"  // for ARRAY_SIZE
+#include "hkl/ccan/darray/darray.h"     // for darray_item, darray_size, etc
+
+#define HKL_FRAMES_PAGE_SIZE 4096
+
+/**
+ * hkl_frames_type_size: (skip)
+ * @type: the type of the pixels
+ *
+ * Returns: the size of one pixel in bytes
+ **/
+size_t hkl_frames_type_size(HklFramesType type)
+{
+	switch(type){
+	case HKL_FRAMES_TYPE_UINT16:
+		return 2;
+	case HKL_FRAMES_TYPE_INT32:
+	case HKL_FRAMES_TYPE_UINT32:
+	case HKL_FRAMES_TYPE_FLOAT32:
+		return 4;
+	case HKL_FRAMES_TYPE_FLOAT64:
+		return 8;
+	}
+
+	return 0;
+}
+
+static size_t frames_size(const HklFrames *self)
+{
+	return self->width * self->height * hkl_frames_type_size(self->type);
+}
+
+/* a known pixel type and a frame size which fits in a size_t */
+static int frames_size_check(HklFramesType type, size_t width, size_t height)
+{
+	const size_t type_size = hkl_frames_type_size(type);
+
+	return width > 0 && height > 0 && type_size > 0
+		&& height <= G_MAXSIZE / width / type_size;
+}
+
+static HklFrames *frames_new(GMappedFile *file, HklFramesType type,
+			     size_t width, size_t height, int swap)
+{
+	HklFrames *self = HKL_MALLOC(HklFrames);
+
+	self->file = file;
+	self->type = type;
+	self->width = width;
+	self->height = height;
+	self->swap = swap;
+	darray_init(self->offsets);
+
+	return self;
+}
+
+/**
+ * hkl_frames_new_raw:
+ * @filename: the file of the stack
+ * @type: the type of the pixels, in the host byte order
+ * @width: the number of columns of a frame
+ * @height: the number of rows of a frame
+ * @offset: the size of the file header
+ * @gap: the size of the header of each frame
+ * @error: return location for a GError, or NULL
+ *
+ * map a stack of raw frames, the frames are stored row after row
+ * and follow each other after the file header. The file is not read,
+ * the pages are loaded on demand.
+ *
+ * Returns: the frames or NULL if the file does not contain a stack
+ **/
+HklFrames *hkl_frames_new_raw(const char *filename, HklFramesType type,
+			      size_t width, size_t height,
+			      size_t offset, size_t gap,
+			      GError **error)
+{
+	HklFrames *self;
+	GMappedFile *file;
+	size_t length;
+	size_t size;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!frames_size_check(type, width, height)){
+		g_set_error(error,
+			    HKL_FRAMES_ERROR,
+			    HKL_FRAMES_ERROR_RAW,
+			    "the frames must have at least one pixel of a known type"
+			    " and fit in memory");
+		return NULL;
+	}
+
+	file = g_mapped_file_new(filename, FALSE, error);
+	if(!file){
+		g_assert(error == NULL || *error != NULL);
+		return NULL;
+	}
+
+	self = frames_new(file, type, width, height, FALSE);
+	size = frames_size(self);
+	length = g_mapped_file_get_length(file);
+	while(offset <= length && gap <= length - offset
+	      && size <= length - offset - gap){
+		offset += gap;
+		darray_append(self->offsets, offset);
+		offset += size;
+	}
+
+	if(offset != length){
+		g_set_error(error,
+			    HKL_FRAMES_ERROR,
+			    HKL_FRAMES_ERROR_RAW,
+			    "the size of \"%s\" is not a whole number of frames", filename);
+		hkl_frames_free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+/* the trimmed value of "key = value ;" in an EDF header */
+static int edf_value(const char *header, size_t len, const char *key,
+		     char *value, size_t size)
+{
+	const char *p = header;
+	const char *end = header + len;
+	size_t key_len = strlen(key);
+
+	while(p < end){
+		const char *eol = memchr(p, ';', end - p);
+		const char *eq;
+
+		if(!eol)
+			eol = end;
+		while(p < eol && g_ascii_isspace(*p))
+			++p;
+		eq = memchr(p, '=', eol - p);
+		if(eq){
+			const char *k_end = eq;
+			const char *v = eq + 1;
+			const char *v_end = eol;
+
+			while(k_end > p && g_ascii_isspace(k_end[-1]))
+				--k_end;
+			if((size_t)(k_end - p) == key_len && !g_ascii_strncasecmp(p, key, key_len)){
+				while(v < v_end && g_ascii_isspace(*v))
+					++v;
+				while(v_end > v && g_ascii_isspace(v_end[-1]))
+					--v_end;
+				if((size_t)(v_end - v) >= size)
+					return FALSE;
+				memcpy(value, v, v_end - v);
+				value[v_end - v] = '\0';
+				return TRUE;
+			}
+		}
+		p = eol + 1;
+	}
+
+	return FALSE;
+}
+
+static int edf_size(const char *header, size_t len, const char *key, size_t *size)
+{
+	char value[32];
+	char *end;
+
+	if(!edf_value(header, len, key, value, sizeof(value)))
+		return FALSE;
+	*size = g_ascii_strtoull(value, &end, 10);
+
+	return end != value && *end == '\0';
+}
+
+static int edf_type(const char *header, size_t len, HklFramesType *type)
+{
+	static const struct {
+		const char *name;
+		HklFramesType type;
+	} types[] = {
+		{"UnsignedShort", HKL_FRAMES_TYPE_UINT16},
+		{"SignedInteger", HKL_FRAMES_TYPE_INT32},
+		{"SignedLong", HKL_FRAMES_TYPE_INT32},
+		{"UnsignedInteger", HKL_FRAMES_TYPE_UINT32},
+		{"UnsignedLong", HKL_FRAMES_TYPE_UINT32},
+		{"FloatValue", HKL_FRAMES_TYPE_FLOAT32},
+		{"Float", HKL_FRAMES_TYPE_FLOAT32},
+		{"DoubleValue", HKL_FRAMES_TYPE_FLOAT64},
+		{"Double", HKL_FRAMES_TYPE_FLOAT64},
+	};
+	char value[32];
+	size_t i;
+
+	if(!edf_value(header, len, "DataType", value, sizeof(value)))
+		return FALSE;
+	for(i=0; i<ARRAY_SIZE(types); ++i)
+		if(!g_ascii_strcasecmp(value, types[i].name)){
+			*type = types[i].type;
+			return TRUE;
+		}
+
+	return FALSE;
+}
+
+/**
+ * hkl_frames_new_edf:
+ * @filename: the EDF file
+ * @error: return location for a GError, or NULL
+ *
+ * map the frames of an EDF file, a sequence of "{ key = value ; ... }"
+ * headers each followed by its frame. All the frames must have the
+ * same size and type (Dim_1, Dim_2, DataType, ByteOrder).
+ *
+ * Returns: the frames or NULL if the file can not be parsed
+ **/
+HklFrames *hkl_frames_new_edf(const char *filename, GError **error)
+{
+	HklFrames *self = NULL;
+	GMappedFile *file;
+	const char *contents;
+	size_t length;
+	size_t pos = 0;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	file = g_mapped_file_new(filename, FALSE, error);
+	if(!file){
+		g_assert(error == NULL || *error != NULL);
+		return NULL;
+	}
+	contents = g_mapped_file_get_contents(file);
+	length = g_mapped_file_get_length(file);
+
+	for(;;){
+		const char *header;
+		const char *close;
+		HklFramesType type;
+		size_t width, height, size;
+		char order[32];
+		int swap;
+
+		while(pos < length && g_ascii_isspace(contents[pos]))
+			++pos;
+		if(pos == length)
+			break;
+
+		if(contents[pos] != '{'
+		   || !(close = memchr(&contents[pos], '}', length - pos)))
+			goto failed;
+		header = &contents[pos + 1];
+
+		if(!edf_size(header, close - header, "Dim_1", &width)
+		   || !edf_size(header, close - header, "Dim_2", &height)
+		   || !edf_type(header, close - header, &type))
+			goto failed;
+
+		swap = FALSE;
+		if(edf_value(header, close - header, "ByteOrder", order, sizeof(order)))
+			swap = !g_ascii_strcasecmp(order, "HighByteFirst")
+				? G_BYTE_ORDER == G_LITTLE_ENDIAN
+				: G_BYTE_ORDER == G_BIG_ENDIAN;
+
+		if(!self){
+			if(!frames_size_check(type, width, height))
+				goto failed;
+			self = frames_new(file, type, width, height, swap);
+		}else if(width != self->width || height != self->height
+			 || type != self->type || swap != self->swap)
+			goto failed;
+
+		if(edf_size(header, close - header, "Size", &size)
+		   && size != frames_size(self))
+			goto failed;
+
+		/* the data starts after the "}\n" closing the header */
+		pos = close - contents + 1;
+		if(pos < length && contents[pos] == '\n')
+			++pos;
+		if(frames_size(self) > length - pos)
+			goto failed;
+		darray_append(self->offsets, pos);
+		pos += frames_size(self);
+	}
+
+	if(!self)
+		goto failed;
+
+	return self;
+
+failed:
+	g_set_error(error,
+		    HKL_FRAMES_ERROR,
+		    HKL_FRAMES_ERROR_EDF,
+		    "can not read the frame at the offset %zu of \"%s\"", pos, filename);
+	if(self)
+		hkl_frames_free(self);
+	else
+		g_mapped_file_unref(file);
+	return NULL;
+}
+
+/**
+ * hkl_frames_free:
+ * @self: the this ptr
+ *
+ * unmap the frames
+ **/
+void hkl_frames_free(HklFrames *self)
+{
+	g_mapped_file_unref(self->file);
+	darray_free(self->offsets);
+	free(self);
+}
+
+/**
+ * hkl_frames_len:
+ * @self: the this ptr
+ *
+ * Returns: the number of frames
+ **/
+size_t hkl_frames_len(const HklFrames *self)
+{
+	return darray_size(self->offsets);
+}
+
+/**
+ * hkl_frames_size_get:
+ * @self: the this ptr
+ * @width: (out caller-allocates): the number of columns of a frame
+ * @height: (out caller-allocates): the number of rows of a frame
+ **/
+void hkl_frames_size_get(const HklFrames *self, size_t *width, size_t *height)
+{
+	*width = self->width;
+	*height = self->height;
+}
+
+/**
+ * hkl_frames_type_get:
+ * @self: the this ptr
+ *
+ * Returns: the type of the pixels
+ **/
+HklFramesType hkl_frames_type_get(const HklFrames *self)
+{
+	return self->type;
+}
+
+/**
+ * hkl_frames_row_get: (skip)
+ * @self: the this ptr
+ * @frame: the index of the frame
+ * @row: the index of the row
+ * @swap: (out caller-allocates) (allow-none): TRUE if the pixels are
+ *        not in the host byte order
+ *
+ * Returns: the pixels of the row, directly in the mapped file
+ **/
+const void *hkl_frames_row_get(const HklFrames *self, size_t frame, size_t row,
+			       int *swap)
+{
+	if(swap)
+		*swap = self->swap;
+
+	return g_mapped_file_get_contents(self->file)
+		+ darray_item(self->offsets, frame)
+		+ row * self->width * hkl_frames_type_size(self->type);
+}
+
+static inline void frames_pixel_get(void *dst, const char *src, size_t size, int swap)
+{
+	size_t i;
+
+	if(!swap)
+		memcpy(dst, src, size);
+	else
+		for(i=0; i<size; ++i)
+			((char *)dst)[i] = src[size - 1 - i];
+}
+
+#define FRAMES_CONVERT(_type) do {					\
+		for(i=0; i<n; ++i){					\
+			_type v;					\
+			frames_pixel_get(&v, &src[i * sizeof(v)], sizeof(v), self->swap); \
+			values[i] = v;					\
+		}							\
+	} while(0)
+
+/* convert n pixels of the mapped file starting at src into doubles */
+static void frames_convert(const HklFrames *self, const char *src, size_t n,
+			   double values[])
+{
+	size_t i;
+
+	switch(self->type){
+	case HKL_FRAMES_TYPE_UINT16:
+		FRAMES_CONVERT(guint16);
+		break;
+	case HKL_FRAMES_TYPE_INT32:
+		FRAMES_CONVERT(gint32);
+		break;
+	case HKL_FRAMES_TYPE_UINT32:
+		FRAMES_CONVERT(guint32);
+		break;
+	case HKL_FRAMES_TYPE_FLOAT32:
+		FRAMES_CONVERT(float);
+		break;
+	case HKL_FRAMES_TYPE_FLOAT64:
+		FRAMES_CONVERT(double);
+		break;
+	}
+}
+
+/**
+ * hkl_frames_row_values_get: (skip)
+ * @self: the this ptr
+ * @frame: the index of the frame
+ * @row: the index of the row
+ * @values: (out caller-allocates): the width pixels of the row
+ *
+ * convert the pixels of one row of a frame into doubles, read in
+ * place from the mapped file.
+ **/
+void hkl_frames_row_values_get(const HklFrames *self, size_t frame, size_t row,
+			       double values[])
+{
+	frames_convert(self, hkl_frames_row_get(self, frame, row, NULL),
+		       self->width, values);
+}
+
+/**
+ * hkl_frames_frame_get:
+ * @self: the this ptr
+ * @frame: the index of the frame
+ * @values: (out caller-allocates): the width x height pixels
+ *
+ * convert the pixels of a frame into doubles
+ **/
+void hkl_frames_frame_get(const HklFrames *self, size_t frame, double values[])
+{
+	frames_convert(self, hkl_frames_row_get(self, frame, 0, NULL),
+		       self->width * self->height, values);
+}
+
+/* prefetch */
+
+static gpointer frames_prefetch_run(gpointer data)
+{
+	struct hkl_frames_prefetch_t *self = data;
+	const char *contents = g_mapped_file_get_contents(self->frames->file);
+	size_t size = frames_size(self->frames);
+	volatile char sink = 0;
+	size_t frame;
+
+	for(frame=0; frame<hkl_frames_len(self->frames); ++frame){
+		const char *p = contents + darray_item(self->frames->offsets, frame);
+		size_t i;
+		int stop;
+
+		g_mutex_lock(&self->mutex);
+		while(!self->stop && frame >= self->next + self->depth)
+			g_cond_wait(&self->cond, &self->mutex);
+		stop = self->stop;
+		g_mutex_unlock(&self->mutex);
+		if(stop)
+			break;
+
+		/* one read per page is enough to fault it in */
+		for(i=0; i<size; i+=HKL_FRAMES_PAGE_SIZE)
+			sink += p[i];
+		sink += p[size - 1];
+	}
+
+	return NULL;
+}
+
+/**
+ * hkl_frames_prefetch_start: (skip)
+ * @self: the prefetcher to start
+ * @frames: the frames
+ * @depth: the number of frames loaded ahead of the consumers
+ *
+ * start a thread loading the frames in order, at most depth frames
+ * after the one given by hkl_frames_prefetch_next().
+ **/
+void hkl_frames_prefetch_start(struct hkl_frames_prefetch_t *self,
+			       const HklFrames *frames, size_t depth)
+{
+	self->frames = frames;
+	self->depth = MAX(depth, 1);
+	self->next = 0;
+	self->stop = FALSE;
+	g_mutex_init(&self->mutex);
+	g_cond_init(&self->cond);
+	self->thread = g_thread_new("hkl-frames-prefetch", frames_prefetch_run, self);
+}
+
+/**
+ * hkl_frames_prefetch_next: (skip)
+ * @self: the prefetcher
+ * @frame: the frame the consumers are about to use
+ **/
+void hkl_frames_prefetch_next(struct hkl_frames_prefetch_t *self, size_t frame)
+{
+	g_mutex_lock(&self->mutex);
+	if(frame > self->next){
+		self->next = frame;
+		g_cond_signal(&self->cond);
+	}
+	g_mutex_unlock(&self->mutex);
+}
+
+/**
+ * hkl_frames_prefetch_stop: (skip)
+ * @self: the prefetcher
+ *
+ * stop and join the prefetching thread
+ **/
+void hkl_frames_prefetch_stop(struct hkl_frames_prefetch_t *self)
+{
+	g_mutex_lock(&self->mutex);
+	self->stop = TRUE;
+	g_cond_signal(&self->cond);
+	g_mutex_unlock(&self->mutex);
+
+	g_thread_join(self->thread);
+	g_mutex_clear(&self->mutex);
+	g_cond_clear(&self->cond);
+}
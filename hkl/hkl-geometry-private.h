@@ -52,12 +52,24 @@ struct _HklHolder {
 	HklQuaternion q;
 };
 
+typedef struct _HklAxisMotion HklAxisMotion;
+
+/* the motion model of one axis */
+struct _HklAxisMotion {
+	double velocity; /* default unit / s */
+	double acceleration; /* default unit / s^2, 0 for an infinite one */
+};
+
+typedef darray(HklAxisMotion) darray_motion;
+
 struct _HklGeometry
 {
 	const HklFactory *factory;
 	HklSource source;
 	darray_parameter axes;
 	darray_holder holders;
+	darray_motion motions; /* empty or one per axis */
+	unsigned int simultaneous; /* max number of axes moving at once, 0 for all */
 };
 
 #define HKL_GEOMETRY_ERROR hkl_geometry_error_quark ()
@@ -70,6 +82,7 @@ static GQuark hkl_geometry_error_quark (void)
 typedef enum {
 	HKL_GEOMETRY_ERROR_AXIS_GET, /* can not get the axis */
 	HKL_GEOMETRY_ERROR_AXIS_SET, /* can not set the axis */
+	HKL_GEOMETRY_ERROR_AXIS_MOTION_SET, /* can not set the axis motion */
 } HklGeometryError;
 
 struct _HklGeometryList
@@ -105,6 +118,8 @@ extern HklHolder *hkl_geometry_add_holder(HklGeometry *self);
 
 extern void hkl_geometry_update(HklGeometry *self);
 
+extern void hkl_geometry_motion_set_from(HklGeometry *self, const HklGeometry *src);
+
 extern int hkl_geometry_get_axis_idx_by_name(const HklGeometry *self,
 					     const char *name);
 
@@ -118,6 +133,10 @@ extern double hkl_geometry_distance(const HklGeometry *self,
 extern double hkl_geometry_distance_orthodromic(const HklGeometry *self,
 						const HklGeometry *ref);
 
+extern double hkl_geometry_distance_weighted(const HklGeometry *self,
+					     const HklGeometry *ref,
+					     const double weights[]);
+
 extern int hkl_geometry_closest_from_geometry_with_range(HklGeometry *self,
 							 const HklGeometry *ref);
 
@@ -145,6 +164,16 @@ extern void hkl_geometry_list_multiply_from_range(HklGeometryList *self);
 
 extern void hkl_geometry_list_remove_invalid(HklGeometryList *self);
 
+extern HklGeometryList *hkl_geometry_list_plan(const HklGeometry *start,
+					       HklGeometryList *const lists[],
+					       size_t n_lists,
+					       const double weights[]);
+
+extern HklGeometryList *hkl_geometry_list_order(const HklGeometry *start,
+						HklGeometryList *const lists[],
+						size_t n_lists,
+						size_t order[]);
+
 /***********************/
 /* HklGeometryListItem */
 /***********************/
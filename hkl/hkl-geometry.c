@@ -210,6 +210,8 @@ HklGeometry *hkl_geometry_new(const HklFactory *factory)
 	hkl_source_init(&g->source, 1.54, 1, 0, 0);
 	darray_init(g->axes);
 	darray_init(g->holders);
+	darray_init(g->motions);
+	g->simultaneous = 0;
 
 	return g;
 }
@@ -249,6 +251,12 @@ HklGeometry *hkl_geometry_new_copy(const HklGeometry *src)
 			      hkl_holder_new_copy(*holder, self));
 	}
 
+	/* copy the motion model */
+	darray_init(self->motions);
+	darray_append_items(self->motions,
+			    src->motions.item, darray_size(src->motions));
+	self->simultaneous = src->simultaneous;
+
 	return self;
 }
 
@@ -273,6 +281,8 @@ void hkl_geometry_free(HklGeometry *self)
 	}
 	darray_free(self->holders);
 
+	darray_free(self->motions);
+
 	free(self);
 }
 
@@ -304,6 +314,27 @@ int hkl_geometry_set(HklGeometry *self, const HklGeometry *src)
 	return TRUE;
 }
 
+/**
+ * hkl_geometry_motion_set_from: (skip)
+ * @self: the this ptr
+ * @src: the other #HklGeometry to copy the motion model from
+ *
+ * Copy the motion model of the axes and the number of simultaneous
+ * motions. This is kept out of hkl_geometry_set which only copies
+ * the axes configuration and must not allocate.
+ **/
+void hkl_geometry_motion_set_from(HklGeometry *self, const HklGeometry *src)
+{
+	if(self == src)
+		return;
+
+	darray_resize(self->motions, darray_size(src->motions));
+	if(darray_size(src->motions))
+		memcpy(self->motions.item, src->motions.item,
+		       darray_size(src->motions) * sizeof(*src->motions.item));
+	self->simultaneous = src->simultaneous;
+}
+
 /**
  * hkl_geometry_axes_names_get:
  * @self: the this ptr
@@ -388,6 +419,169 @@ int hkl_geometry_axis_set(HklGeometry *self, const char *name,
 	return TRUE;
 }
 
+/**
+ * hkl_geometry_axis_motion_set:
+ * @self: the this ptr
+ * @name: the name of the axis
+ * @velocity: the maximum velocity of the axis (unit / s)
+ * @acceleration: the acceleration of the axis (unit / s^2) or 0 for
+ *                an infinite one.
+ * @unit_type: the unit type (default or user) of the values
+ * @error: return location for a GError, or NULL
+ *
+ * set the motion model of an axis, used to estimate the time needed
+ * to move from one geometry to another (hkl_geometry_motion_time).
+ * Without model an axis moves at 1 default unit / s.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_geometry_axis_motion_set(HklGeometry *self, const char *name,
+				 double velocity, double acceleration,
+				 HklUnitEnum unit_type, GError **error)
+{
+	int idx;
+	size_t i;
+	double factor = 1.;
+	const HklParameter *axis;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	axis = hkl_geometry_axis_get(self, name, error);
+	if(!axis){
+		g_assert (error == NULL || *error != NULL);
+		return FALSE;
+	}
+	g_assert (error == NULL || *error == NULL);
+
+	if(velocity <= 0. || acceleration < 0.){
+		g_set_error(error,
+			    HKL_GEOMETRY_ERROR,
+			    HKL_GEOMETRY_ERROR_AXIS_MOTION_SET,
+			    "the velocity (%f) must be positive and the acceleration (%f) not negative",
+			    velocity, acceleration);
+		return FALSE;
+	}
+
+	if(unit_type == HKL_UNIT_USER)
+		factor = hkl_unit_factor(axis->unit, axis->punit);
+
+	/* the default model of all the axes */
+	if(darray_size(self->motions) != darray_size(self->axes)){
+		darray_resize(self->motions, darray_size(self->axes));
+		for(i=0; i<darray_size(self->motions); ++i){
+			darray_item(self->motions, i).velocity = 1.;
+			darray_item(self->motions, i).acceleration = 0.;
+		}
+	}
+
+	idx = hkl_geometry_get_axis_idx_by_name(self, name);
+	darray_item(self->motions, idx).velocity = velocity / factor;
+	darray_item(self->motions, idx).acceleration = acceleration / factor;
+
+	return TRUE;
+}
+
+/**
+ * hkl_geometry_simultaneous_motions_set:
+ * @self: the this ptr
+ * @simultaneous: the maximum number of axes moving at the same time,
+ *                0 if all the axes can move together.
+ *
+ * set how many axes the motion controller can move at once, the
+ * others have to wait. 1 means that the axes are moved one after
+ * the other.
+ **/
+void hkl_geometry_simultaneous_motions_set(HklGeometry *self,
+					   unsigned int simultaneous)
+{
+	self->simultaneous = simultaneous;
+}
+
+/* the time needed by an axis to travel a distance, trapezoidal profile */
+static double axis_motion_time(const HklAxisMotion *motion, double distance)
+{
+	double v = motion ? motion->velocity : 1.;
+	double a = motion ? motion->acceleration : 0.;
+
+	distance = fabs(distance);
+	if(a <= 0.)
+		return distance / v;
+	if(distance >= v * v / a)
+		return distance / v + v / a;
+	return 2. * sqrt(distance / a);
+}
+
+static int motion_time_cmp(const void *p1, const void *p2)
+{
+	double t1 = *(const double *)p1;
+	double t2 = *(const double *)p2;
+
+	return (t1 < t2) - (t1 > t2);
+}
+
+/*
+ * the time to move from the geometry g1 to g2 with the motion model
+ * of model. The longest moves are dispatched first on the free
+ * controller channels.
+ */
+static double geometry_motion_time(const HklGeometry *model,
+				   const HklGeometry *g1, const HklGeometry *g2)
+{
+	size_t i, j;
+	size_t n = darray_size(model->axes);
+	size_t n_channels = model->simultaneous && model->simultaneous < n
+		? model->simultaneous : n;
+	double *times = alloca(n * sizeof(*times));
+	double *channels = alloca(n_channels * sizeof(*channels));
+	double res = 0.;
+
+	for(i=0; i<n; ++i)
+		times[i] = axis_motion_time(darray_size(model->motions) == n
+					    ? &darray_item(model->motions, i) : NULL,
+					    darray_item(g2->axes, i)->_value
+					    - darray_item(g1->axes, i)->_value);
+
+	if(n_channels == n){
+		for(i=0; i<n; ++i)
+			if(times[i] > res)
+				res = times[i];
+		return res;
+	}
+
+	qsort(times, n, sizeof(*times), motion_time_cmp);
+	for(j=0; j<n_channels; ++j)
+		channels[j] = 0.;
+	for(i=0; i<n; ++i){
+		size_t k = 0;
+
+		for(j=1; j<n_channels; ++j)
+			if(channels[j] < channels[k])
+				k = j;
+		channels[k] += times[i];
+	}
+	for(j=0; j<n_channels; ++j)
+		if(channels[j] > res)
+			res = channels[j];
+
+	return res;
+}
+
+/**
+ * hkl_geometry_motion_time:
+ * @self: the this ptr
+ * @ref: the #HklGeometry to move to
+ *
+ * estimate the time needed to move from @self to @ref with the
+ * motion model of @self.
+ *
+ * Returns: the motion time (s)
+ **/
+double hkl_geometry_motion_time(const HklGeometry *self,
+				const HklGeometry *ref)
+{
+	return geometry_motion_time(self, self, ref);
+}
+
 /**
  * hkl_geometry_wavelength_get: (skip)
  * @self: the this ptr
@@ -685,6 +879,40 @@ double hkl_geometry_distance(const HklGeometry *self,
 	return distance;
 }
 
+/**
+ * hkl_geometry_distance_weighted: (skip)
+ * @self: the this ptr
+ * @ref: the #HklGeometry to compare with
+ * @weights: (allow-none): the cost weight of each axis or NULL
+ *
+ * compute the distance between two #HklGeometries, the contribution
+ * of each axis is multiplied by its weight.
+ *
+ * Returns: the weighted distance between the two geometries
+ **/
+double hkl_geometry_distance_weighted(const HklGeometry *self,
+				      const HklGeometry *ref,
+				      const double weights[])
+{
+	size_t i;
+	double value1, value2;
+	double distance = 0.;
+
+	if (!weights)
+		return hkl_geometry_distance(self, ref);
+
+	if (!self || !ref)
+		return 0.;
+
+	for(i=0; i<darray_size(self->axes); ++i){
+		value1 = darray_item(self->axes, i)->_value;
+		value2 = darray_item(ref->axes, i)->_value;
+		distance += weights[i] * fabs(value2 - value1);
+	}
+
+	return distance;
+}
+
 /**
  * hkl_geometry_distance_orthodromic: (skip)
  * @self: the this ptr
@@ -991,6 +1219,443 @@ void hkl_geometry_list_sort(HklGeometryList *self, HklGeometry *ref)
 		list_add_tail(&self->items, &items[idx[i]]->list);
 }
 
+/*
+ * the cost of the move between two geometries used by the planners.
+ */
+typedef double (* geometry_cost_t) (const HklGeometry *g1,
+				    const HklGeometry *g2,
+				    const void *data);
+
+static double geometry_cost_distance(const HklGeometry *g1,
+				     const HklGeometry *g2,
+				     const void *data)
+{
+	return hkl_geometry_distance_weighted(g1, g2, data);
+}
+
+static double geometry_cost_time(const HklGeometry *g1,
+				 const HklGeometry *g2,
+				 const void *data)
+{
+	return geometry_motion_time(data, g1, g2);
+}
+
+/*
+ * Viterbi pass, see hkl_geometry_list_plan.
+ */
+static HklGeometryList *geometry_list_plan(const HklGeometry *start,
+					   HklGeometryList *const lists[],
+					   size_t n_lists,
+					   geometry_cost_t cost_func,
+					   const void *data)
+{
+	HklGeometryList *self;
+	HklGeometryListItem *item;
+	size_t *offsets;
+	size_t *from;
+	size_t *path;
+	double *costs;
+	const HklGeometry **geometries;
+	size_t i, j, k;
+
+	/* flatten the solutions, the solutions of the point i are in
+	 * [offsets[i], offsets[i+1]) */
+	offsets = malloc((n_lists + 1) * sizeof(*offsets));
+	offsets[0] = 0;
+	for(i=0; i<n_lists; ++i){
+		if (lists[i]->n_items == 0){
+			free(offsets);
+			return NULL;
+		}
+		offsets[i + 1] = offsets[i] + lists[i]->n_items;
+	}
+
+	geometries = malloc(offsets[n_lists] * sizeof(*geometries));
+	costs = malloc(offsets[n_lists] * sizeof(*costs));
+	from = malloc(offsets[n_lists] * sizeof(*from));
+	path = malloc(n_lists * sizeof(*path));
+
+	for(i=0; i<n_lists; ++i){
+		k = offsets[i];
+		list_for_each(&lists[i]->items, item, list)
+			geometries[k++] = item->geometry;
+	}
+
+	/* forward pass, the best cumulative cost to reach each solution */
+	for(k=offsets[0]; k<offsets[1]; ++k)
+		costs[k] = start ? cost_func(start, geometries[k], data) : 0.;
+
+	for(i=1; i<n_lists; ++i)
+		for(k=offsets[i]; k<offsets[i + 1]; ++k){
+			costs[k] = INFINITY;
+			for(j=offsets[i - 1]; j<offsets[i]; ++j){
+				double cost = costs[j]
+					+ cost_func(geometries[j], geometries[k], data);
+
+				if (cost < costs[k]){
+					costs[k] = cost;
+					from[k] = j;
+				}
+			}
+		}
+
+	/* backtrack from the best last solution */
+	if (n_lists > 0){
+		path[n_lists - 1] = offsets[n_lists - 1];
+		for(k=offsets[n_lists - 1]; k<offsets[n_lists]; ++k)
+			if (costs[k] < costs[path[n_lists - 1]])
+				path[n_lists - 1] = k;
+		for(i=n_lists - 1; i>0; --i)
+			path[i - 1] = from[path[i]];
+	}
+
+	/* hkl_geometry_list_add would merge identical consecutive points */
+	self = hkl_geometry_list_new();
+	for(i=0; i<n_lists; ++i){
+		list_add_tail(&self->items,
+			      &hkl_geometry_list_item_new(geometries[path[i]])->list);
+		self->n_items++;
+	}
+
+	free(path);
+	free(from);
+	free(costs);
+	free(geometries);
+	free(offsets);
+
+	return self;
+}
+
+/**
+ * hkl_geometry_list_plan: (skip)
+ * @start: (allow-none): the geometry before the first point or NULL
+ * @lists: the solutions of each point of a scan
+ * @n_lists: the number of points
+ * @weights: (allow-none): the cost weight of each axis or NULL
+ *
+ * choose one solution per point in order to minimize the cumulative
+ * weighted distance between consecutive points (and between @start
+ * and the first point). This is a Viterbi dynamic programming pass,
+ * so the cost is the sum of the products of the number of solutions
+ * of consecutive points.
+ *
+ * Returns: a new #HklGeometryList with the chosen geometry of each
+ * point (in the points order) or NULL if one of the lists is empty.
+ **/
+HklGeometryList *hkl_geometry_list_plan(const HklGeometry *start,
+					HklGeometryList *const lists[],
+					size_t n_lists,
+					const double weights[])
+{
+	return geometry_list_plan(start, lists, n_lists,
+				  geometry_cost_distance, weights);
+}
+
+/*
+ * ordering of the points, open travelling salesman path starting
+ * from a geometry. The cost between two points is the shortest
+ * motion time between their solutions.
+ */
+#define ORDER_NONE ((size_t)-1)
+
+struct order_t
+{
+	const HklGeometry *model;
+	const HklGeometry **geometries;
+	const size_t *offsets; /* the solutions of the point i are in [offsets[i], offsets[i+1]) */
+	size_t n;
+	double *costs; /* n x n */
+	double *start_costs; /* n */
+};
+
+struct order_tour_t
+{
+	const struct order_t *order;
+	size_t first;
+	size_t *tour;
+	double cost;
+};
+
+static double order_edge(const struct order_t *self, size_t a, size_t b)
+{
+	if(b == ORDER_NONE)
+		return 0.;
+	if(a == ORDER_NONE)
+		return self->start_costs[b];
+	return self->costs[a * self->n + b];
+}
+
+/* the row i of the cost matrix, i is shifted by one (NULL is not a valid pool data) */
+static void order_costs_run(gpointer data, gpointer user_data)
+{
+	size_t i = GPOINTER_TO_SIZE(data) - 1;
+	struct order_t *self = user_data;
+	size_t j, a, b;
+
+	for(j=0; j<self->n; ++j){
+		double cost = INFINITY;
+
+		for(a=self->offsets[i]; a<self->offsets[i + 1]; ++a)
+			for(b=self->offsets[j]; b<self->offsets[j + 1]; ++b){
+				double t = geometry_motion_time(self->model,
+								self->geometries[a],
+								self->geometries[b]);
+				if(t < cost)
+					cost = t;
+			}
+		self->costs[i * self->n + j] = i == j ? 0. : cost;
+	}
+}
+
+static double order_tour_cost(const struct order_t *self, const size_t *tour)
+{
+	size_t k;
+	double cost = order_edge(self, ORDER_NONE, tour[0]);
+
+	for(k=1; k<self->n; ++k)
+		cost += order_edge(self, tour[k - 1], tour[k]);
+
+	return cost;
+}
+
+/* move the segment [i, i + len) of the tour after the position p (-1 for the head) */
+static void order_tour_move(size_t *tour, size_t *tmp, size_t n,
+			    size_t i, size_t len, long p)
+{
+	size_t k;
+	size_t m = 0;
+
+	if(p < 0)
+		for(k=0; k<len; ++k)
+			tmp[m++] = tour[i + k];
+	for(k=0; k<n; ++k){
+		size_t l;
+
+		if(k >= i && k < i + len)
+			continue;
+		tmp[m++] = tour[k];
+		if((long)k == p)
+			for(l=0; l<len; ++l)
+				tmp[m++] = tour[i + l];
+	}
+	memcpy(tour, tmp, n * sizeof(*tour));
+}
+
+/* nearest neighbour construction then 2-opt and Or-opt improvements */
+static void order_tour_run(gpointer data, gpointer user_data)
+{
+	struct order_tour_t *tour = data;
+	const struct order_t *self = tour->order;
+	size_t n = self->n;
+	size_t *t = tour->tour;
+	size_t *tmp = malloc(n * sizeof(*tmp));
+	int *visited = calloc(n, sizeof(*visited));
+	int improved = TRUE;
+	size_t i, j, k;
+
+	t[0] = tour->first;
+	visited[tour->first] = TRUE;
+	for(k=1; k<n; ++k){
+		size_t best = ORDER_NONE;
+
+		for(j=0; j<n; ++j)
+			if(!visited[j] && (best == ORDER_NONE
+					   || order_edge(self, t[k - 1], j) < order_edge(self, t[k - 1], best)))
+				best = j;
+		t[k] = best;
+		visited[best] = TRUE;
+	}
+
+	while(improved){
+		size_t len;
+
+		improved = FALSE;
+
+		/* 2-opt, reverse the segment [i, j] */
+		for(i=0; i<n; ++i)
+			for(j=i+1; j<n; ++j){
+				size_t prev = i > 0 ? t[i - 1] : ORDER_NONE;
+				size_t next = j + 1 < n ? t[j + 1] : ORDER_NONE;
+				double delta = order_edge(self, prev, t[j]) + order_edge(self, t[i], next)
+					- order_edge(self, prev, t[i]) - order_edge(self, t[j], next);
+
+				if(delta < -HKL_EPSILON){
+					size_t a, b;
+
+					for(a=i, b=j; a<b; ++a, --b){
+						size_t swap = t[a];
+
+						t[a] = t[b];
+						t[b] = swap;
+					}
+					improved = TRUE;
+				}
+			}
+
+		/* Or-opt, move a segment of 1 to 3 points elsewhere */
+		for(len=1; len<=3 && len<n; ++len)
+			for(i=0; i+len<=n; ++i){
+				size_t prev = i > 0 ? t[i - 1] : ORDER_NONE;
+				size_t next = i + len < n ? t[i + len] : ORDER_NONE;
+				double gain = order_edge(self, prev, t[i])
+					+ order_edge(self, t[i + len - 1], next)
+					- order_edge(self, prev, next);
+				long p;
+
+				for(p=-1; p<(long)n; ++p){
+					size_t a, b;
+					double add;
+
+					if(p >= (long)i - 1 && p <= (long)(i + len - 1))
+						continue;
+
+					a = p >= 0 ? t[p] : ORDER_NONE;
+					b = p + 1 < (long)n ? t[p + 1] : ORDER_NONE;
+					add = order_edge(self, a, t[i])
+						+ order_edge(self, t[i + len - 1], b)
+						- order_edge(self, a, b);
+					if(add - gain < -HKL_EPSILON){
+						order_tour_move(t, tmp, n, i, len, p);
+						improved = TRUE;
+						break;
+					}
+				}
+			}
+	}
+
+	tour->cost = order_tour_cost(self, t);
+
+	free(visited);
+	free(tmp);
+}
+
+/**
+ * hkl_geometry_list_order: (skip)
+ * @start: the geometry before the first point, its motion model is used
+ * @lists: the solutions of each point
+ * @n_lists: the number of points
+ * @order: (out caller-allocates) (array length=n_lists): the visiting order
+ *
+ * choose the visiting order of the points and the solution of each
+ * point in order to minimize the estimated motion time (see
+ * hkl_geometry_motion_time). The order is computed with a multi
+ * start nearest neighbour + 2-opt/Or-opt heuristic on the shortest
+ * motion time between the points, the starts are improved in
+ * parallel. The solutions are then chosen with a Viterbi pass along
+ * the best order.
+ *
+ * Returns: a new #HklGeometryList with the chosen geometry of each
+ * point in the visiting order, or NULL if one of the lists is empty.
+ **/
+HklGeometryList *hkl_geometry_list_order(const HklGeometry *start,
+					 HklGeometryList *const lists[],
+					 size_t n_lists,
+					 size_t order[])
+{
+	struct order_t self;
+	struct order_tour_t *tours;
+	struct order_tour_t *best = NULL;
+	HklGeometryList **ordered;
+	HklGeometryList *res;
+	HklGeometryListItem *item;
+	GThreadPool *pool;
+	size_t *offsets;
+	size_t n_tours;
+	size_t i, j, k;
+
+	if(n_lists == 0)
+		return NULL;
+
+	offsets = malloc((n_lists + 1) * sizeof(*offsets));
+	offsets[0] = 0;
+	for(i=0; i<n_lists; ++i){
+		if(lists[i]->n_items == 0){
+			free(offsets);
+			return NULL;
+		}
+		offsets[i + 1] = offsets[i] + lists[i]->n_items;
+	}
+
+	self.model = start;
+	self.n = n_lists;
+	self.offsets = offsets;
+	self.geometries = malloc(offsets[n_lists] * sizeof(*self.geometries));
+	self.costs = malloc(n_lists * n_lists * sizeof(*self.costs));
+	self.start_costs = malloc(n_lists * sizeof(*self.start_costs));
+	for(i=0; i<n_lists; ++i){
+		k = offsets[i];
+		self.start_costs[i] = INFINITY;
+		list_for_each(&lists[i]->items, item, list){
+			double t = geometry_motion_time(start, start, item->geometry);
+
+			if(t < self.start_costs[i])
+				self.start_costs[i] = t;
+			self.geometries[k++] = item->geometry;
+		}
+	}
+
+	/* the cost matrix */
+	pool = g_thread_pool_new(order_costs_run, &self,
+				 g_get_num_processors(), TRUE, NULL);
+	for(i=0; i<n_lists; ++i)
+		if(!pool || !g_thread_pool_push(pool, GSIZE_TO_POINTER(i + 1), NULL))
+			order_costs_run(GSIZE_TO_POINTER(i + 1), &self);
+	if(pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	/* start the tours from the points the closest to start */
+	n_tours = MIN(n_lists, 2 * g_get_num_processors());
+	tours = calloc(n_tours, sizeof(*tours));
+	for(k=0; k<n_tours; ++k){
+		size_t first = ORDER_NONE;
+
+		for(i=0; i<n_lists; ++i){
+			int used = FALSE;
+
+			for(j=0; j<k; ++j)
+				used |= tours[j].first == i;
+			if(!used && (first == ORDER_NONE
+				     || self.start_costs[i] < self.start_costs[first]))
+				first = i;
+		}
+		tours[k].order = &self;
+		tours[k].first = first;
+		tours[k].tour = malloc(n_lists * sizeof(*tours[k].tour));
+	}
+
+	pool = g_thread_pool_new(order_tour_run, NULL,
+				 g_get_num_processors(), TRUE, NULL);
+	for(k=0; k<n_tours; ++k)
+		if(!pool || !g_thread_pool_push(pool, &tours[k], NULL))
+			order_tour_run(&tours[k], NULL);
+	if(pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	for(k=0; k<n_tours; ++k)
+		if(!best || tours[k].cost < best->cost)
+			best = &tours[k];
+
+	/* the solutions along the best order */
+	ordered = malloc(n_lists * sizeof(*ordered));
+	for(i=0; i<n_lists; ++i){
+		order[i] = best->tour[i];
+		ordered[i] = lists[best->tour[i]];
+	}
+	res = geometry_list_plan(start, ordered, n_lists,
+				 geometry_cost_time, start);
+
+	free(ordered);
+	for(k=0; k<n_tours; ++k)
+		free(tours[k].tour);
+	free(tours);
+	free(self.start_costs);
+	free(self.costs);
+	free(self.geometries);
+	free(offsets);
+
+	return res;
+}
+
 /**
  * hkl_geometry_list_fprintf: (skip)
  * @f:
@@ -0,0 +1,49 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_KDTREE_PRIVATE_H__
+#define __HKL_KDTREE_PRIVATE_H__
+
+#include <stddef.h>                     // for size_t
+#include "hkl.h"                        // for G_BEGIN_DECLS, etc
+
+G_BEGIN_DECLS
+
+/* k-d tree of points with an attached payload, the oldest points are
+ * dropped once the capacity is reached */
+typedef struct _HklKdTree HklKdTree;
+
+extern HklKdTree *hkl_kdtree_new(size_t dim, size_t data_size, size_t capacity);
+
+extern void hkl_kdtree_free(HklKdTree *self);
+
+extern void hkl_kdtree_reset(HklKdTree *self);
+
+extern size_t hkl_kdtree_size(const HklKdTree *self);
+
+extern void hkl_kdtree_add(HklKdTree *self, const double point[], const double data[]);
+
+extern const double *hkl_kdtree_nearest(const HklKdTree *self, const double point[],
+					double *distance);
+
+G_END_DECLS
+
+#endif
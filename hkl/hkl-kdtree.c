@@ -0,0 +1,226 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <math.h>                       // for sqrt, INFINITY
+#include <stdlib.h>                     // for free
+#include <string.h>                     // for memcpy, memmove
+#include "hkl-kdtree-private.h"         // for HklKdTree
+#include "hkl-macros-private.h"         // for HKL_MALLOC
+#include "hkl/ccan/darray/darray.h"     // for darray_item, darray_size, etc
+
+#define HKL_KDTREE_NONE ((size_t)-1)
+
+struct hkl_kdtree_node_t
+{
+	size_t left;
+	size_t right;
+};
+
+/* the node i is the point i, the points are kept in insertion order
+ * so the oldest ones are at the beginning */
+struct _HklKdTree
+{
+	size_t dim;
+	size_t data_size;
+	size_t capacity;
+	darray(double) points; /* dim coordinates then data_size payload values per point */
+	darray(struct hkl_kdtree_node_t) nodes;
+};
+
+static inline const double *kdtree_point(const HklKdTree *self, size_t i)
+{
+	return &darray_item(self->points, i * (self->dim + self->data_size));
+}
+
+/* link the last point in the tree */
+static void kdtree_link(HklKdTree *self, size_t n)
+{
+	const double *point = kdtree_point(self, n);
+	struct hkl_kdtree_node_t node = {HKL_KDTREE_NONE, HKL_KDTREE_NONE};
+	size_t i = 0;
+	size_t depth = 0;
+
+	darray_append(self->nodes, node);
+	if(n == 0)
+		return;
+
+	for(;;){
+		size_t axis = depth % self->dim;
+		struct hkl_kdtree_node_t *parent = &darray_item(self->nodes, i);
+		size_t *next = point[axis] < kdtree_point(self, i)[axis] ? &parent->left : &parent->right;
+
+		if(*next == HKL_KDTREE_NONE){
+			*next = n;
+			return;
+		}
+		i = *next;
+		depth++;
+	}
+}
+
+/**
+ * hkl_kdtree_new: (skip)
+ * @dim: the dimension of the points
+ * @data_size: the number of values attached to each point
+ * @capacity: the maximum number of points
+ *
+ * constructor
+ *
+ * Returns: a new #HklKdTree
+ **/
+HklKdTree *hkl_kdtree_new(size_t dim, size_t data_size, size_t capacity)
+{
+	HklKdTree *self = HKL_MALLOC(HklKdTree);
+
+	self->dim = dim;
+	self->data_size = data_size;
+	self->capacity = capacity > 1 ? capacity : 2;
+	darray_init(self->points);
+	darray_init(self->nodes);
+
+	return self;
+}
+
+/**
+ * hkl_kdtree_free: (skip)
+ * @self: the this ptr
+ *
+ * destructor
+ **/
+void hkl_kdtree_free(HklKdTree *self)
+{
+	darray_free(self->nodes);
+	darray_free(self->points);
+	free(self);
+}
+
+/**
+ * hkl_kdtree_reset: (skip)
+ * @self: the this ptr
+ *
+ * remove all the points
+ **/
+void hkl_kdtree_reset(HklKdTree *self)
+{
+	darray_resize(self->points, 0);
+	darray_resize(self->nodes, 0);
+}
+
+/**
+ * hkl_kdtree_size: (skip)
+ * @self: the this ptr
+ *
+ * Returns: the number of points in the tree
+ **/
+size_t hkl_kdtree_size(const HklKdTree *self)
+{
+	return darray_size(self->nodes);
+}
+
+/**
+ * hkl_kdtree_add: (skip)
+ * @self: the this ptr
+ * @point: (array): the coordinates of the point (dim values)
+ * @data: (array): the payload of the point (data_size values)
+ *
+ * add a point to the tree. When the tree is full the oldest half of
+ * the points is dropped and the tree rebuilt with the others.
+ **/
+void hkl_kdtree_add(HklKdTree *self, const double point[], const double data[])
+{
+	size_t stride = self->dim + self->data_size;
+	size_t n = darray_size(self->nodes);
+	size_t i;
+
+	if(n == self->capacity){
+		size_t keep = n / 2;
+
+		memmove(&darray_item(self->points, 0),
+			&darray_item(self->points, (n - keep) * stride),
+			keep * stride * sizeof(double));
+		darray_resize(self->points, keep * stride);
+		darray_resize(self->nodes, 0);
+		for(i=0; i<keep; ++i)
+			kdtree_link(self, i);
+		n = keep;
+	}
+
+	darray_append_items(self->points, point, self->dim);
+	darray_append_items(self->points, data, self->data_size);
+	kdtree_link(self, n);
+}
+
+static void kdtree_nearest(const HklKdTree *self, size_t i, size_t depth,
+			   const double point[], size_t *best, double *best_d2)
+{
+	const double *p;
+	double d2 = 0.;
+	double diff;
+	size_t k;
+	size_t axis = depth % self->dim;
+	const struct hkl_kdtree_node_t *node;
+
+	if(i == HKL_KDTREE_NONE)
+		return;
+
+	p = kdtree_point(self, i);
+	for(k=0; k<self->dim; ++k)
+		d2 += (point[k] - p[k]) * (point[k] - p[k]);
+	if(d2 < *best_d2){
+		*best_d2 = d2;
+		*best = i;
+	}
+
+	node = &darray_item(self->nodes, i);
+	diff = point[axis] - p[axis];
+	kdtree_nearest(self, diff < 0 ? node->left : node->right, depth + 1,
+		       point, best, best_d2);
+	if(diff * diff < *best_d2)
+		kdtree_nearest(self, diff < 0 ? node->right : node->left, depth + 1,
+			       point, best, best_d2);
+}
+
+/**
+ * hkl_kdtree_nearest: (skip)
+ * @self: the this ptr
+ * @point: (array): the coordinates of the requested point
+ * @distance: (out) (allow-none): the euclidean distance to the nearest point
+ *
+ * find the nearest point of the tree.
+ *
+ * Returns: the payload of the nearest point or NULL if the tree is
+ * empty, it is valid until the next hkl_kdtree_add.
+ **/
+const double *hkl_kdtree_nearest(const HklKdTree *self, const double point[],
+				 double *distance)
+{
+	size_t best = HKL_KDTREE_NONE;
+	double best_d2 = INFINITY;
+
+	if(darray_size(self->nodes) == 0)
+		return NULL;
+
+	kdtree_nearest(self, 0, 0, point, &best, &best_d2);
+	if(distance)
+		*distance = sqrt(best_d2);
+
+	return kdtree_point(self, best) + self->dim;
+}
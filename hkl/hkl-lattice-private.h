@@ -24,10 +24,24 @@
 
 #include <stdio.h>
 
+#include "hkl-matrix-private.h"         // for _HklMatrix
 #include "hkl.h"
 
 G_BEGIN_DECLS
 
+/*
+ * the B matrix, its inverse and the reciprocal lattice parameters
+ * computed for a given version of the lattice.
+ */
+struct hkl_lattice_cache_t
+{
+	unsigned int version;
+	int valid;
+	HklMatrix B;
+	HklMatrix B_1;
+	double reciprocal[6]; /* a*, b*, c*, alpha*, beta*, gamma* */
+};
+
 struct _HklLattice
 {
 	HklParameter *a;
@@ -36,6 +50,9 @@ struct _HklLattice
 	HklParameter *alpha;
 	HklParameter *beta;
 	HklParameter *gamma;
+	HklLatticeSystem system;
+	unsigned int version; /* bumped each time a parameter changed */
+	struct hkl_lattice_cache_t cache;
 };
 
 #define HKL_LATTICE_ERROR hkl_lattice_error_quark ()
@@ -47,10 +64,21 @@ static GQuark hkl_lattice_error_quark (void)
 
 typedef enum {
 	HKL_LATTICE_CHECK_LATTICE, /* the lattice parameters are not valid */
+	HKL_LATTICE_CHECK_SYSTEM, /* the lattice parameters do not respect the crystal system */
 } HklLatticeError;
 
 extern void hkl_lattice_lattice_set(HklLattice *self, const HklLattice *lattice);
 
+extern int hkl_lattice_parameter_tie(const HklLattice *self, unsigned int idx);
+
+extern void hkl_lattice_constrain(HklLattice *self);
+
+extern void hkl_lattice_values_set(HklLattice *self,
+				   double a, double b, double c,
+				   double alpha, double beta, double gamma);
+
+extern int hkl_lattice_get_B_derivatives(const HklLattice *self, HklMatrix *dB);
+
 extern void hkl_lattice_randomize(HklLattice *self);
 
 extern void hkl_lattice_fprintf(FILE *f, const HklLattice *self);
@@ -29,6 +29,7 @@
 #include "hkl-unit-private.h"           // for hkl_unit_length_nm, etc
 #include "hkl-vector-private.h"         // for hkl_vector_angle, etc
 #include "hkl.h"                        // for HklLattice, etc
+#include "hkl/ccan/array_size/array_size.h"  // for ARRAY_SIZE
 
 /* private */
 
@@ -61,8 +62,160 @@ static int check_lattice_param(double a, double b, double c,
 		return TRUE;
 }
 
+/*
+ * for each crystal system, the index of the parameter (a, b, c,
+ * alpha, beta, gamma) each parameter is tied to, or -1 if the
+ * parameter has a fixed value.
+ */
+static const int lattice_system_ties[][6] = {
+	[HKL_LATTICE_SYSTEM_TRICLINIC] = {0, 1, 2, 3, 4, 5},
+	[HKL_LATTICE_SYSTEM_MONOCLINIC] = {0, 1, 2, -1, 4, -1},
+	[HKL_LATTICE_SYSTEM_ORTHORHOMBIC] = {0, 1, 2, -1, -1, -1},
+	[HKL_LATTICE_SYSTEM_TETRAGONAL] = {0, 0, 2, -1, -1, -1},
+	[HKL_LATTICE_SYSTEM_RHOMBOHEDRAL] = {0, 0, 0, 3, 3, 3},
+	[HKL_LATTICE_SYSTEM_HEXAGONAL] = {0, 0, 2, -1, -1, -1},
+	[HKL_LATTICE_SYSTEM_CUBIC] = {0, 0, 0, -1, -1, -1},
+};
+
+static double lattice_system_fixed_value(HklLatticeSystem system, unsigned int idx)
+{
+	if (system == HKL_LATTICE_SYSTEM_HEXAGONAL && idx == 5)
+		return 120 * HKL_DEGTORAD;
+	else
+		return 90 * HKL_DEGTORAD;
+}
+
 /* public */
 
+/*
+ * set the value (default unit) of one lattice parameter, the
+ * version is bumped only if the value changed.
+ */
+static void lattice_parameter_value_set(HklLattice *self, HklParameter *parameter,
+					double value)
+{
+	if (parameter->_value != value){
+		hkl_parameter_value_set(parameter, value, HKL_UNIT_DEFAULT, NULL);
+		self->version++;
+	}
+}
+
+/*
+ * check that the lattice parameters (a, b, c, alpha, beta, gamma in
+ * default unit) respect the ties of the crystal system.
+ */
+static int lattice_check_ties(HklLatticeSystem system, const double values[6],
+			      GError **error)
+{
+	static const char *names[] = {"a", "b", "c", "alpha", "beta", "gamma"};
+	unsigned int i;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	for(i=0; i<6; ++i){
+		int tie = lattice_system_ties[system][i];
+		double expected;
+
+		if (tie == (int)i)
+			continue;
+
+		expected = tie < 0 ? lattice_system_fixed_value(system, i) : values[tie];
+		if (fabs(values[i] - expected) > HKL_EPSILON){
+			g_set_error(error,
+				    HKL_LATTICE_ERROR,
+				    HKL_LATTICE_CHECK_SYSTEM,
+				    "the \"%s\" parameter does not respect the crystal system of the lattice",
+				    names[i]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * set one lattice parameter from another one. The crystal system
+ * ties are checked before, a tied or fixed parameter can only be set
+ * to its constrained value, the parameters tied to this one follow.
+ */
+static int lattice_parameter_set(HklLattice *self, unsigned int idx,
+				 const HklParameter *parameter, GError **error)
+{
+	HklParameter *parameters[] = {
+		self->a, self->b, self->c,
+		self->alpha, self->beta, self->gamma,
+	};
+	double values[6];
+	unsigned int i;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	for(i=0; i<6; ++i)
+		values[i] = parameters[i]->_value;
+	values[idx] = parameter->_value;
+
+	if (lattice_system_ties[self->system][idx] != (int)idx
+	    && !lattice_check_ties(self->system, values, error)){
+		g_assert (error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if (!hkl_parameter_init_copy(parameters[idx], parameter, error))
+		return FALSE;
+	self->version++;
+	hkl_lattice_constrain(self);
+
+	return TRUE;
+}
+
+static int lattice_compute_B(const HklLattice *self, HklMatrix *B);
+
+static int lattice_compute_reciprocal(const HklLattice *self, double reciprocal[6]);
+
+/*
+ * recompute the cached B, B^-1 and reciprocal lattice if the lattice
+ * changed since the last computation. The cache is updated even on a
+ * const lattice, so a lattice must not be shared between threads.
+ */
+static const struct hkl_lattice_cache_t *lattice_cache_get(const HklLattice *self)
+{
+	struct hkl_lattice_cache_t *cache = (struct hkl_lattice_cache_t *)&self->cache;
+
+	if (cache->version != self->version){
+		cache->version = self->version;
+		cache->valid = lattice_compute_B(self, &cache->B)
+			&& lattice_compute_reciprocal(self, cache->reciprocal);
+		if (cache->valid){
+			/*
+			 * invert the triangular matrix B
+			 * | a b c |
+			 * | 0 d e |
+			 * | 0 0 f |
+			 */
+			double a = cache->B.data[0][0];
+			double b = cache->B.data[0][1];
+			double c = cache->B.data[0][2];
+			double d = cache->B.data[1][1];
+			double e = cache->B.data[1][2];
+			double f = cache->B.data[2][2];
+
+			cache->B_1.data[0][0] = 1 / a;
+			cache->B_1.data[0][1] = -b / a / d;
+			cache->B_1.data[0][2] = (b * e - d * c) / a / d / f;
+
+			cache->B_1.data[1][0] = 0;
+			cache->B_1.data[1][1] = 1 / d;
+			cache->B_1.data[1][2] = -e / d / f;
+
+			cache->B_1.data[2][0] = 0;
+			cache->B_1.data[2][1] = 0;
+			cache->B_1.data[2][2] = 1 / f;
+		}
+	}
+
+	return cache;
+}
+
 /**
  * hkl_lattice_new:
  * @a: the length of the a parameter
@@ -118,6 +271,10 @@ HklLattice *hkl_lattice_new(double a, double b, double c,
 					TRUE, TRUE,
 					&hkl_unit_angle_rad,
 					&hkl_unit_angle_deg);
+	self->system = HKL_LATTICE_SYSTEM_TRICLINIC;
+	self->version = 1;
+	self->cache.version = 0;
+
 	return self;
 }
 
@@ -141,6 +298,9 @@ HklLattice *hkl_lattice_new_copy(const HklLattice *self)
 	copy->alpha = hkl_parameter_new_copy(self->alpha);
 	copy->beta = hkl_parameter_new_copy(self->beta);
 	copy->gamma = hkl_parameter_new_copy(self->gamma);
+	copy->system = self->system;
+	copy->version = self->version;
+	copy->cache = self->cache;
 
 	return copy;
 }
@@ -196,9 +356,7 @@ const HklParameter *hkl_lattice_a_get(const HklLattice *self)
 int hkl_lattice_a_set(HklLattice *self, const HklParameter *parameter,
 		      GError **error)
 {
-	hkl_error (error == NULL || *error == NULL);
-
-	return hkl_parameter_init_copy(self->a, parameter, error);
+	return lattice_parameter_set(self, 0, parameter, error);
 }
 
 /**
@@ -221,9 +379,7 @@ const HklParameter *hkl_lattice_b_get(const HklLattice *self)
 int hkl_lattice_b_set(HklLattice *self, const HklParameter *parameter,
 		      GError **error)
 {
-	hkl_error (error == NULL || *error == NULL);
-
-	return hkl_parameter_init_copy(self->b, parameter, error);
+	return lattice_parameter_set(self, 1, parameter, error);
 }
 
 /**
@@ -246,9 +402,7 @@ const HklParameter *hkl_lattice_c_get(const HklLattice *self)
 int hkl_lattice_c_set(HklLattice *self, const HklParameter *parameter,
 		      GError **error)
 {
-	hkl_error (error == NULL || *error == NULL);
-
-	return hkl_parameter_init_copy(self->c, parameter, error);
+	return lattice_parameter_set(self, 2, parameter, error);
 }
 
 /**
@@ -271,9 +425,7 @@ const HklParameter *hkl_lattice_alpha_get(const HklLattice *self)
 int hkl_lattice_alpha_set(HklLattice *self, const HklParameter *parameter,
 			  GError **error)
 {
-	hkl_error (error == NULL || *error == NULL);
-
-	return hkl_parameter_init_copy(self->alpha, parameter, error);
+	return lattice_parameter_set(self, 3, parameter, error);
 }
 
 /**
@@ -296,9 +448,7 @@ const HklParameter *hkl_lattice_beta_get(const HklLattice *self)
 int hkl_lattice_beta_set(HklLattice *self, const HklParameter *parameter,
 			 GError **error)
 {
-	hkl_error (error == NULL || *error == NULL);
-
-	return hkl_parameter_init_copy(self->beta, parameter, error);
+	return lattice_parameter_set(self, 4, parameter, error);
 }
 
 /**
@@ -321,9 +471,7 @@ const HklParameter *hkl_lattice_gamma_get(const HklLattice *self)
 int hkl_lattice_gamma_set(HklLattice *self, const HklParameter *parameter,
 			   GError **error)
 {
-	hkl_error (error == NULL || *error == NULL);
-
-	return hkl_parameter_init_copy(self->gamma, parameter, error);
+	return lattice_parameter_set(self, 5, parameter, error);
 }
 
 /**
@@ -342,6 +490,140 @@ void hkl_lattice_lattice_set(HklLattice *self, const HklLattice *lattice)
 	hkl_parameter_init_copy(self->alpha, lattice->alpha, NULL);
 	hkl_parameter_init_copy(self->beta, lattice->beta, NULL);
 	hkl_parameter_init_copy(self->gamma, lattice->gamma, NULL);
+	self->system = lattice->system;
+	self->version++;
+}
+
+/**
+ * hkl_lattice_system_get:
+ * @self: the this ptr
+ *
+ * Returns: the crystal system constraining the lattice parameters.
+ **/
+HklLatticeSystem hkl_lattice_system_get(const HklLattice *self)
+{
+	return self->system;
+}
+
+/**
+ * hkl_lattice_system_set:
+ * @self: the this ptr
+ * @system: the crystal system
+ * @error: return location for a GError, or NULL
+ *
+ * constrain the lattice parameters with the crystal system. The tied
+ * parameters (for example b and c for a cubic lattice) take the
+ * value of their reference parameter (a), and the fixed angles are
+ * set to 90 (or 120 for the hexagonal gamma). During the sample
+ * affinement only the independent parameters are fitted.
+ *
+ * Returns: TRUE on success, FALSE if the crystal system is unknown or
+ * if the constrained lattice is not valid.
+ **/
+int hkl_lattice_system_set(HklLattice *self, HklLatticeSystem system,
+			   GError **error)
+{
+	HklLattice *tmp;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if ((unsigned int)system >= ARRAY_SIZE(lattice_system_ties)){
+		g_set_error(error,
+			    HKL_LATTICE_ERROR,
+			    HKL_LATTICE_CHECK_SYSTEM,
+			    "unknown crystal system (%d)", system);
+		return FALSE;
+	}
+
+	tmp = hkl_lattice_new_copy(self);
+	tmp->system = system;
+	hkl_lattice_constrain(tmp);
+
+	if(!check_lattice_param(hkl_parameter_value_get(tmp->a, HKL_UNIT_DEFAULT),
+				hkl_parameter_value_get(tmp->b, HKL_UNIT_DEFAULT),
+				hkl_parameter_value_get(tmp->c, HKL_UNIT_DEFAULT),
+				hkl_parameter_value_get(tmp->alpha, HKL_UNIT_DEFAULT),
+				hkl_parameter_value_get(tmp->beta, HKL_UNIT_DEFAULT),
+				hkl_parameter_value_get(tmp->gamma, HKL_UNIT_DEFAULT),
+				error)){
+		g_assert (error == NULL || *error != NULL);
+		hkl_lattice_free(tmp);
+		return FALSE;
+	}
+	g_assert (error == NULL || *error == NULL);
+
+	hkl_lattice_lattice_set(self, tmp);
+	hkl_lattice_free(tmp);
+
+	return TRUE;
+}
+
+/**
+ * hkl_lattice_parameter_tie: (skip)
+ * @self: the this ptr
+ * @idx: the index of the parameter (a, b, c, alpha, beta, gamma)
+ *
+ * Returns: the index of the parameter @idx is tied to (@idx itself
+ * for an independent parameter) or -1 if its value is fixed by the
+ * crystal system.
+ **/
+int hkl_lattice_parameter_tie(const HklLattice *self, unsigned int idx)
+{
+	return lattice_system_ties[self->system][idx];
+}
+
+/**
+ * hkl_lattice_constrain: (skip)
+ * @self: the this ptr
+ *
+ * apply the crystal system constraints on the lattice parameters.
+ **/
+void hkl_lattice_constrain(HklLattice *self)
+{
+	unsigned int i;
+	HklParameter *parameters[] = {
+		self->a, self->b, self->c,
+		self->alpha, self->beta, self->gamma,
+	};
+
+	for(i=0; i<6; ++i){
+		int tie = lattice_system_ties[self->system][i];
+
+		if (tie == (int)i)
+			continue;
+
+		lattice_parameter_value_set(self, parameters[i],
+					    tie < 0
+					    ? lattice_system_fixed_value(self->system, i)
+					    : parameters[tie]->_value);
+	}
+}
+
+/**
+ * hkl_lattice_values_set: (skip)
+ * @self: the this ptr
+ * @a: the length of the a parameter (default unit)
+ * @b: the length of the b parameter (default unit)
+ * @c: the length of the c parameter (default unit)
+ * @alpha: the angle between b and c (radian)
+ * @beta: the angle between a and c (radian)
+ * @gamma: the angle between a and b (radian)
+ *
+ * set the lattice parameters without any check, then apply the
+ * crystal system constraints. The cached B matrix is kept if none
+ * of the parameters changed.
+ **/
+void hkl_lattice_values_set(HklLattice *self,
+			    double a, double b, double c,
+			    double alpha, double beta, double gamma)
+{
+	lattice_parameter_value_set(self, self->a, a);
+	lattice_parameter_value_set(self, self->b, b);
+	lattice_parameter_value_set(self, self->c, c);
+	lattice_parameter_value_set(self, self->alpha, alpha);
+	lattice_parameter_value_set(self, self->beta, beta);
+	lattice_parameter_value_set(self, self->gamma, gamma);
+	hkl_lattice_constrain(self);
 }
 
 /**
@@ -354,7 +636,8 @@ void hkl_lattice_lattice_set(HklLattice *self, const HklLattice *lattice)
  * @beta:
  * @gamma:
  *
- * set the lattice parameters
+ * set the lattice parameters, they must respect the crystal system
+ * of the lattice (see hkl_lattice_system_set).
  *
  * Returns:
  **/
@@ -381,12 +664,23 @@ int hkl_lattice_set(HklLattice *self,
 	}
 	g_assert (error == NULL || *error == NULL);
 
+	{
+		const double values[] = {_a, _b, _c, _alpha, _beta, _gamma};
+
+		if(!lattice_check_ties(self->system, values, error)){
+			g_assert (error == NULL || *error != NULL);
+			return FALSE;
+		}
+	}
+
 	hkl_parameter_value_set(self->a, _a, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->b, _b, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->c, _c, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->alpha, _alpha, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->beta, _beta, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->gamma, _gamma, HKL_UNIT_DEFAULT, NULL);
+	self->version++;
+	hkl_lattice_constrain(self);
 
 	return TRUE;
 }
@@ -427,6 +721,18 @@ void hkl_lattice_get(const HklLattice *self,
  * Returns:
  **/
 int hkl_lattice_get_B(const HklLattice *self, HklMatrix *B)
+{
+	const struct hkl_lattice_cache_t *cache = lattice_cache_get(self);
+
+	if (!cache->valid)
+		return FALSE;
+
+	*B = cache->B;
+
+	return TRUE;
+}
+
+static int lattice_compute_B(const HklLattice *self, HklMatrix *B)
 {
 	double D;
 	double c_alpha, s_alpha;
@@ -468,6 +774,86 @@ int hkl_lattice_get_B(const HklLattice *self, HklMatrix *B)
 	return TRUE;
 }
 
+/* derivative of n/m */
+static inline double quotient_derivative(double n, double dn, double m, double dm)
+{
+	return (dn * m - n * dm) / (m * m);
+}
+
+/**
+ * hkl_lattice_get_B_derivatives: (skip)
+ * @self: the @HklLattice
+ * @dB: (out): where to store the 6 derivatives of the B matrix (array of 6 #HklMatrix)
+ *
+ * Compute the partial derivatives of the B matrix with respect to a,
+ * b, c, alpha, beta and gamma (in this order). Needed by the
+ * least-squares affinement of the samples.
+ *
+ * Returns: TRUE or FALSE depending of the success of the
+ * computation.
+ **/
+int hkl_lattice_get_B_derivatives(const HklLattice *self, HklMatrix *dB)
+{
+	HklMatrix B;
+	double a, b, c;
+	double ca, sa;
+	double cb, sb;
+	double cg, sg;
+	double D, dD;
+	int i, j, k;
+
+	if (!hkl_lattice_get_B(self, &B))
+		return FALSE;
+
+	a = hkl_parameter_value_get(self->a, HKL_UNIT_DEFAULT);
+	b = hkl_parameter_value_get(self->b, HKL_UNIT_DEFAULT);
+	c = hkl_parameter_value_get(self->c, HKL_UNIT_DEFAULT);
+	ca = cos(hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT));
+	sa = sin(hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT));
+	cb = cos(hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT));
+	sb = sin(hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT));
+	cg = cos(hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT));
+	sg = sin(hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT));
+	D = sqrt(1 - ca*ca - cb*cb - cg*cg + 2*ca*cb*cg);
+
+	for(k=0; k<6; ++k)
+		for(i=0; i<3; ++i)
+			for(j=0; j<3; ++j)
+				dB[k].data[i][j] = 0.;
+
+	/* a, b and c only scale some elements of B */
+	dB[0].data[0][0] = -B.data[0][0] / a;
+	dB[1].data[0][1] = -B.data[0][1] / b;
+	dB[1].data[1][1] = -B.data[1][1] / b;
+	dB[2].data[0][2] = -B.data[0][2] / c;
+	dB[2].data[1][2] = -B.data[1][2] / c;
+	dB[2].data[2][2] = -B.data[2][2] / c;
+
+	/* alpha */
+	dD = sa * (ca - cb*cg) / D;
+	dB[3].data[0][0] = HKL_TAU / a * quotient_derivative(sa, ca, D, dD);
+	dB[3].data[0][1] = HKL_TAU / b * quotient_derivative(ca*cb - cg, -sa*cb, sa*D, ca*D + sa*dD);
+	dB[3].data[0][2] = HKL_TAU / c * quotient_derivative(cg*ca - cb, -sa*cg, sa*D, ca*D + sa*dD);
+	dB[3].data[1][1] = -HKL_TAU * ca / (b * sa * sa);
+	dB[3].data[1][2] = HKL_TAU / c * quotient_derivative(cb*cg - ca, sa, sa*sb*sg, ca*sb*sg);
+
+	/* beta */
+	dD = sb * (cb - ca*cg) / D;
+	dB[4].data[0][0] = -HKL_TAU * sa * dD / (a * D * D);
+	dB[4].data[0][1] = HKL_TAU / (b * sa) * quotient_derivative(ca*cb - cg, -ca*sb, D, dD);
+	dB[4].data[0][2] = HKL_TAU / (c * sa) * quotient_derivative(cg*ca - cb, sb, D, dD);
+	dB[4].data[1][2] = HKL_TAU / (c * sa) * quotient_derivative(cb*cg - ca, -sb*cg, sb*sg, cb*sg);
+
+	/* gamma */
+	dD = sg * (cg - ca*cb) / D;
+	dB[5].data[0][0] = -HKL_TAU * sa * dD / (a * D * D);
+	dB[5].data[0][1] = HKL_TAU / (b * sa) * quotient_derivative(ca*cb - cg, sg, D, dD);
+	dB[5].data[0][2] = HKL_TAU / (c * sa) * quotient_derivative(cg*ca - cb, -sg*ca, D, dD);
+	dB[5].data[1][2] = HKL_TAU / (c * sa) * quotient_derivative(cb*cg - ca, -cb*sg, sb*sg, sb*cg);
+
+	return TRUE;
+}
+
 /**
  * hkl_lattice_get_1_B: (skip)
  * @self: the @HklLattice
@@ -481,46 +867,16 @@ int hkl_lattice_get_B(const HklLattice *self, HklMatrix *B)
  **/
 int hkl_lattice_get_1_B(const HklLattice *self, HklMatrix *B)
 {
-	HklMatrix tmp;
-	double a;
-	double b;
-	double c;
-	double d;
-	double e;
-	double f;
+	const struct hkl_lattice_cache_t *cache;
 
 	if(!self || !B)
 		return FALSE;
 
-	/*
-	 * first compute the B matrix
-	 * | a b c |
-	 * | 0 d e |
-	 * | 0 0 f |
-	 */
-	hkl_lattice_get_B(self, &tmp);
-
-	/*
-	 * now invert this triangular matrix
-	 */
-	a = tmp.data[0][0];
-	b = tmp.data[0][1];
-	c = tmp.data[0][2];
-	d = tmp.data[1][1];
-	e = tmp.data[1][2];
-	f = tmp.data[2][2];
-
-	B->data[0][0] = 1 / a;
-	B->data[0][1] = -b / a / d;
-	B->data[0][2] = (b * e - d * c) / a / d / f;
+	cache = lattice_cache_get(self);
+	if (!cache->valid)
+		return FALSE;
 
-	B->data[1][0] = 0;
-	B->data[1][1] = 1 / d;
-	B->data[1][2] = -e / d / f;
-
-	B->data[2][0] = 0;
-	B->data[2][1] = 0;
-	B->data[2][2] = 1 / f;
+	*B = cache->B_1;
 
 	return TRUE;
 }
@@ -531,11 +887,28 @@ int hkl_lattice_get_1_B(const HklLattice *self, HklMatrix *B)
  * @reciprocal: the lattice where the result will be computed
  *
  * compute the reciprocal #HklLattice and put the result id the
- * provided @reciprocal parameter
+ * provided @reciprocal parameter. The crystal system of @reciprocal
+ * is reset to triclinic, the reciprocal of a constrained lattice does
+ * not always respect its ties (gamma* = 60 for an hexagonal one).
  *
  * Returns: 0 or 1 if it succeed.
  **/
 int hkl_lattice_reciprocal(const HklLattice *self, HklLattice *reciprocal)
+{
+	const struct hkl_lattice_cache_t *cache = lattice_cache_get(self);
+
+	if (!cache->valid)
+		return FALSE;
+
+	reciprocal->system = HKL_LATTICE_SYSTEM_TRICLINIC;
+	hkl_lattice_values_set(reciprocal,
+			       cache->reciprocal[0], cache->reciprocal[1], cache->reciprocal[2],
+			       cache->reciprocal[3], cache->reciprocal[4], cache->reciprocal[5]);
+
+	return TRUE;
+}
+
+static int lattice_compute_reciprocal(const HklLattice *self, double reciprocal[6])
 {
 	double c_alpha, c_beta, c_gamma;
 	double s_alpha, s_beta, s_gamma;
@@ -570,14 +943,12 @@ int hkl_lattice_reciprocal(const HklLattice *self, HklLattice *reciprocal)
 	s_beta2 = D / s_gamma_s_alpha;
 	s_beta3 = D / s_alpha_s_beta;
 
-	hkl_lattice_set(reciprocal,
-			HKL_TAU * s_alpha / (hkl_parameter_value_get(self->a, HKL_UNIT_DEFAULT) * D),
-			HKL_TAU * s_beta  / (hkl_parameter_value_get(self->b, HKL_UNIT_DEFAULT) * D),
-			HKL_TAU * s_gamma / (hkl_parameter_value_get(self->c, HKL_UNIT_DEFAULT) * D),
-			atan2(s_beta1, c_beta1),
-			atan2(s_beta2, c_beta2),
-			atan2(s_beta3, c_beta3),
-			HKL_UNIT_DEFAULT, NULL);
+	reciprocal[0] = HKL_TAU * s_alpha / (hkl_parameter_value_get(self->a, HKL_UNIT_DEFAULT) * D);
+	reciprocal[1] = HKL_TAU * s_beta  / (hkl_parameter_value_get(self->b, HKL_UNIT_DEFAULT) * D);
+	reciprocal[2] = HKL_TAU * s_gamma / (hkl_parameter_value_get(self->c, HKL_UNIT_DEFAULT) * D);
+	reciprocal[3] = atan2(s_beta1, c_beta1);
+	reciprocal[4] = atan2(s_beta2, c_beta2);
+	reciprocal[5] = atan2(s_beta3, c_beta3);
 
 	return TRUE;
 }
@@ -738,6 +1109,7 @@ void hkl_lattice_randomize(HklLattice *self)
 					HKL_UNIT_DEFAULT, NULL);
 		break;
 	}
+	self->version++;
 }
 
 /**
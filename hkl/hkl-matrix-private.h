@@ -39,6 +39,9 @@ extern HklMatrix *hkl_matrix_dup(const HklMatrix* self);
 extern void hkl_matrix_init_from_euler(HklMatrix *self,
 				       double euler_x, double euler_y, double euler_z) HKL_ARG_NONNULL(1);
 
+extern void hkl_matrix_init_from_euler_derivatives(HklMatrix dM[3],
+						   double euler_x, double euler_y, double euler_z);
+
 extern void hkl_matrix_matrix_set(HklMatrix *self, const HklMatrix *m) HKL_ARG_NONNULL(1, 2);
 
 extern void hkl_matrix_init_from_two_vector(HklMatrix *self,
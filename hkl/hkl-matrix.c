@@ -248,6 +248,61 @@ void hkl_matrix_init_from_euler(HklMatrix *self,
 	M[2][2] = A *C;
 }
 
+/**
+ * hkl_matrix_init_from_euler_derivatives: (skip)
+ * @dM: (out): the three derivatives of the rotation matrix
+ * @euler_x: the eulerian value along X
+ * @euler_y: the eulerian value along Y
+ * @euler_z: the eulerian value along Z
+ *
+ * compute the partial derivatives of the rotation #HklMatrix
+ * computed by hkl_matrix_init_from_euler with respect to euler_x,
+ * euler_y and euler_z.
+ **/
+void hkl_matrix_init_from_euler_derivatives(HklMatrix dM[3],
+					    double euler_x, double euler_y, double euler_z)
+{
+	double A = cos(euler_x);
+	double B = sin(euler_x);
+	double C = cos(euler_y);
+	double D = sin(euler_y);
+	double E = cos(euler_z);
+	double F = sin(euler_z);
+
+	/* d/deuler_x */
+	dM[0].data[0][0] = 0.;
+	dM[0].data[0][1] = 0.;
+	dM[0].data[0][2] = 0.;
+	dM[0].data[1][0] = A*D*E - B*F;
+	dM[0].data[1][1] =-A*D*F - B*E;
+	dM[0].data[1][2] =-A*C;
+	dM[0].data[2][0] = B*D*E + A*F;
+	dM[0].data[2][1] =-B*D*F + A*E;
+	dM[0].data[2][2] =-B*C;
+
+	/* d/deuler_y */
+	dM[1].data[0][0] =-D*E;
+	dM[1].data[0][1] = D*F;
+	dM[1].data[0][2] = C;
+	dM[1].data[1][0] = B*C*E;
+	dM[1].data[1][1] =-B*C*F;
+	dM[1].data[1][2] = B*D;
+	dM[1].data[2][0] =-A*C*E;
+	dM[1].data[2][1] = A*C*F;
+	dM[1].data[2][2] =-A*D;
+
+	/* d/deuler_z */
+	dM[2].data[0][0] =-C*F;
+	dM[2].data[0][1] =-C*E;
+	dM[2].data[0][2] = 0.;
+	dM[2].data[1][0] =-B*D*F + A*E;
+	dM[2].data[1][1] =-B*D*E - A*F;
+	dM[2].data[1][2] = 0.;
+	dM[2].data[2][0] = A*D*F + B*E;
+	dM[2].data[2][1] = A*D*E - B*F;
+	dM[2].data[2][2] = 0.;
+}
+
 /**
  * hkl_matrix_to_euler:
  * @self: the rotation #HklMatrix use to compute the eulerians angles
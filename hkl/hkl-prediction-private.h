@@ -0,0 +1,72 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_PREDICTION_PRIVATE_H__
+#define __HKL_PREDICTION_PRIVATE_H__
+
+#include <stddef.h>                     // for size_t
+#include "hkl.h"                        // for HklPrediction, etc
+#include "hkl-matrix-private.h"         // for _HklMatrix
+#include "hkl/ccan/darray/darray.h"     // for darray
+
+G_BEGIN_DECLS
+
+/* one predicted reflection, value is the distance to the Ewald
+ * sphere for a geometry or the crossing position for a sweep */
+struct hkl_prediction_reflection_t
+{
+	double hkl[3];
+	double value;
+};
+
+typedef darray(struct hkl_prediction_reflection_t) darray_prediction_reflection;
+
+/* the reciprocal lattice points within qmax are binned in a uniform
+ * grid of n^3 cubic cells covering [-qmax, qmax]^3, the points of the
+ * cell i are stored in [offsets[i], offsets[i+1]) */
+struct _HklPrediction
+{
+	HklMatrix B;
+	double qmax;
+	double cell;
+	size_t n;
+	size_t *offsets;
+	darray(double) hkl[3];
+	darray(double) q[3]; /* B.hkl */
+	darray_prediction_reflection reflections; /* of the last query */
+};
+
+#define HKL_PREDICTION_ERROR hkl_prediction_error_quark ()
+
+static GQuark hkl_prediction_error_quark (void)
+{
+	return g_quark_from_static_string ("hkl-prediction-error-quark");
+}
+
+typedef enum {
+	HKL_PREDICTION_ERROR_NEW, /* can not build the index */
+	HKL_PREDICTION_ERROR_LATTICE, /* the lattice of the sample changed */
+	HKL_PREDICTION_ERROR_SWEEP, /* can not sweep this axis */
+} HklPredictionError;
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,609 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <math.h>                       // for sqrt, floor, fmod, etc
+#include <stdlib.h>                     // for free, calloc
+#include <string.h>                     // for memcmp, memset
+#include "hkl-axis-private.h"           // for HklAxis
+#include "hkl-geometry-private.h"       // for _HklGeometry, _HklHolder
+#include "hkl-lattice-private.h"        // for HklLattice
+#include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_error, etc
+#include "hkl-prediction-private.h"     // for _HklPrediction
+#include "hkl-quaternion-private.h"     // for hkl_quaternion_to_matrix, etc
+#include "hkl-sample-private.h"         // for _HklSample
+#include "hkl-source-private.h"         // for hkl_source_compute_ki
+#include "hkl-unit-private.h"           // for hkl_unit_factor
+#include "hkl-vector-private.h"         // for HklVector
+#include "hkl/ccan/darray/darray.h"     // for darray_item, darray_size, etc
+
+#define HKL_PREDICTION_POINTS_PER_CELL 8
+#define HKL_PREDICTION_CELLS_MAX 64 /* along each direction */
+#define HKL_PREDICTION_POINTS_MAX 100000000
+
+static inline size_t prediction_bin(const HklPrediction *self, double x)
+{
+	double i = floor((x + self->qmax) / self->cell);
+
+	return i < 0 ? 0 : i >= self->n ? self->n - 1 : (size_t)i;
+}
+
+static inline void prediction_cell_box(const HklPrediction *self, size_t cell,
+				       double lo[3], double hi[3])
+{
+	size_t idx[3] = {cell / (self->n * self->n), (cell / self->n) % self->n, cell % self->n};
+	size_t i;
+
+	for(i=0; i<3; ++i){
+		lo[i] = -self->qmax + idx[i] * self->cell;
+		hi[i] = lo[i] + self->cell;
+	}
+}
+
+/**
+ * hkl_prediction_new:
+ * @sample: the sample which lattice is indexed
+ * @qmax: the maximum norm of the scattering vector (default unit)
+ * @error: return location for a GError, or NULL
+ *
+ * enumerate once all the reciprocal lattice nodes of the sample
+ * lattice with |Q| <= qmax and bin them in a uniform grid of cells,
+ * the index is then used to predict the reflections crossing the
+ * Ewald sphere. It must be rebuilt if the lattice changes.
+ *
+ * Returns: the new index or NULL if it can not be built.
+ **/
+HklPrediction *hkl_prediction_new(const HklSample *sample, double qmax, GError **error)
+{
+	HklPrediction *self;
+	HklMatrix B_1;
+	darray(double) points = darray_new(); /* h, k, l, x, y, z */
+	darray(size_t) cells = darray_new();
+	size_t *fill;
+	size_t n_points;
+	double n_nodes = 1;
+	int hmax[3];
+	int hkl[3];
+	size_t i;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!(qmax > 0)){
+		g_set_error(error,
+			    HKL_PREDICTION_ERROR,
+			    HKL_PREDICTION_ERROR_NEW,
+			    "qmax must be strictly positive");
+		return NULL;
+	}
+
+	self = HKL_MALLOC(HklPrediction);
+
+	if(!hkl_lattice_get_B(sample->lattice, &self->B)
+	   || !hkl_lattice_get_1_B(sample->lattice, &B_1)){
+		g_set_error(error,
+			    HKL_PREDICTION_ERROR,
+			    HKL_PREDICTION_ERROR_NEW,
+			    "the lattice of the sample is not valid");
+		free(self);
+		return NULL;
+	}
+
+	/* hkl = B^-1.q so |h_i| <= |row_i(B^-1)| * qmax */
+	for(i=0; i<3; ++i){
+		hmax[i] = ceil(qmax * sqrt(B_1.data[i][0] * B_1.data[i][0]
+					   + B_1.data[i][1] * B_1.data[i][1]
+					   + B_1.data[i][2] * B_1.data[i][2]));
+		n_nodes *= 2 * hmax[i] + 1;
+	}
+	if(n_nodes > HKL_PREDICTION_POINTS_MAX){
+		g_set_error(error,
+			    HKL_PREDICTION_ERROR,
+			    HKL_PREDICTION_ERROR_NEW,
+			    "too many reciprocal lattice nodes within qmax (%g)", n_nodes);
+		free(self);
+		return NULL;
+	}
+
+	for(hkl[0]=-hmax[0]; hkl[0]<=hmax[0]; ++hkl[0])
+		for(hkl[1]=-hmax[1]; hkl[1]<=hmax[1]; ++hkl[1])
+			for(hkl[2]=-hmax[2]; hkl[2]<=hmax[2]; ++hkl[2]){
+				double point[6];
+				size_t j;
+
+				if(hkl[0] == 0 && hkl[1] == 0 && hkl[2] == 0)
+					continue;
+
+				for(j=0; j<3; ++j){
+					point[j] = hkl[j];
+					point[3 + j] = self->B.data[j][0] * hkl[0]
+						+ self->B.data[j][1] * hkl[1]
+						+ self->B.data[j][2] * hkl[2];
+				}
+				if(point[3] * point[3] + point[4] * point[4] + point[5] * point[5] > qmax * qmax)
+					continue;
+				darray_append_items(points, point, 6);
+			}
+	n_points = darray_size(points) / 6;
+
+	self->qmax = qmax;
+	self->n = cbrt((double)n_points / HKL_PREDICTION_POINTS_PER_CELL);
+	self->n = MIN(MAX(self->n, 1), HKL_PREDICTION_CELLS_MAX);
+	self->cell = 2 * qmax / self->n;
+
+	/* counting sort of the points by cell */
+	self->offsets = calloc(self->n * self->n * self->n + 1, sizeof(*self->offsets));
+	darray_resize(cells, n_points);
+	for(i=0; i<n_points; ++i){
+		const double *point = &darray_item(points, 6 * i);
+
+		darray_item(cells, i) = (prediction_bin(self, point[3]) * self->n
+					 + prediction_bin(self, point[4])) * self->n
+			+ prediction_bin(self, point[5]);
+		self->offsets[darray_item(cells, i) + 1] += 1;
+	}
+	for(i=0; i<self->n * self->n * self->n; ++i)
+		self->offsets[i + 1] += self->offsets[i];
+
+	for(i=0; i<3; ++i){
+		darray_init(self->hkl[i]);
+		darray_resize(self->hkl[i], n_points);
+		darray_init(self->q[i]);
+		darray_resize(self->q[i], n_points);
+	}
+	fill = calloc(self->n * self->n * self->n, sizeof(*fill));
+	for(i=0; i<n_points; ++i){
+		const double *point = &darray_item(points, 6 * i);
+		size_t cell = darray_item(cells, i);
+		size_t idx = self->offsets[cell] + fill[cell]++;
+		size_t j;
+
+		for(j=0; j<3; ++j){
+			darray_item(self->hkl[j], idx) = point[j];
+			darray_item(self->q[j], idx) = point[3 + j];
+		}
+	}
+	free(fill);
+	darray_free(cells);
+	darray_free(points);
+
+	darray_init(self->reflections);
+
+	return self;
+}
+
+/**
+ * hkl_prediction_free:
+ * @self: the this ptr
+ *
+ * release the memory of the index
+ **/
+void hkl_prediction_free(HklPrediction *self)
+{
+	size_t i;
+
+	for(i=0; i<3; ++i){
+		darray_free(self->hkl[i]);
+		darray_free(self->q[i]);
+	}
+	darray_free(self->reflections);
+	free(self->offsets);
+	free(self);
+}
+
+/**
+ * hkl_prediction_len:
+ * @self: the this ptr
+ *
+ * Returns: the number of reciprocal lattice nodes of the index
+ **/
+size_t hkl_prediction_len(const HklPrediction *self)
+{
+	return darray_size(self->hkl[0]);
+}
+
+/**
+ * hkl_prediction_reflections_len:
+ * @self: the this ptr
+ *
+ * Returns: the number of reflections predicted by the last query
+ **/
+size_t hkl_prediction_reflections_len(const HklPrediction *self)
+{
+	return darray_size(self->reflections);
+}
+
+/**
+ * hkl_prediction_reflection_get:
+ * @self: the this ptr
+ * @idx: the index of the reflection, lower than hkl_prediction_reflections_len()
+ * @h: (out caller-allocates): the h of the reflection
+ * @k: (out caller-allocates): the k of the reflection
+ * @l: (out caller-allocates): the l of the reflection
+ * @value: (out caller-allocates): the signed distance to the Ewald
+ *         sphere for hkl_prediction_geometry() or the crossing
+ *         position of the axis for hkl_prediction_sweep().
+ *
+ * get one of the reflections predicted by the last query
+ **/
+void hkl_prediction_reflection_get(const HklPrediction *self, size_t idx,
+				   double *h, double *k, double *l, double *value)
+{
+	const struct hkl_prediction_reflection_t *reflection = &darray_item(self->reflections, idx);
+
+	*h = reflection->hkl[0];
+	*k = reflection->hkl[1];
+	*l = reflection->hkl[2];
+	*value = reflection->value;
+}
+
+/* queries, the cells are split in chunks run in parallel, each chunk
+ * collects its own reflections which are concatenated in the cells
+ * order so the result does not depend on the scheduling */
+struct prediction_query_t
+{
+	/* geometry */
+	double center[3]; /* of the Ewald sphere in the B frame */
+	double radius;
+	double tolerance;
+	/* sweep */
+	HklMatrix W; /* from the B frame to the swept axis frame */
+	HklVector u; /* the swept axis */
+	HklVector ki; /* in the swept axis frame */
+	double from;
+	double to;
+	double factor;
+};
+
+typedef void (* prediction_cell_func) (const HklPrediction *self,
+				       const struct prediction_query_t *query,
+				       size_t cell,
+				       darray_prediction_reflection *reflections);
+
+struct prediction_chunk_t
+{
+	const HklPrediction *prediction;
+	const struct prediction_query_t *query;
+	prediction_cell_func func;
+	size_t begin;
+	size_t end;
+	darray_prediction_reflection reflections;
+};
+
+static void prediction_chunk_run(gpointer data, gpointer user_data)
+{
+	struct prediction_chunk_t *chunk = data;
+	size_t cell;
+
+	for(cell=chunk->begin; cell<chunk->end; ++cell)
+		if(chunk->prediction->offsets[cell] != chunk->prediction->offsets[cell + 1])
+			chunk->func(chunk->prediction, chunk->query, cell, &chunk->reflections);
+}
+
+static void prediction_run(HklPrediction *self,
+			   const struct prediction_query_t *query,
+			   prediction_cell_func func)
+{
+	struct prediction_chunk_t *chunks;
+	GThreadPool *pool;
+	size_t n_cells = self->n * self->n * self->n;
+	size_t n_chunks;
+	size_t k;
+
+	darray_resize(self->reflections, 0);
+
+	n_chunks = MIN(n_cells, 4 * g_get_num_processors());
+	chunks = calloc(n_chunks, sizeof(*chunks));
+	pool = g_thread_pool_new(prediction_chunk_run, NULL,
+				 g_get_num_processors(), TRUE, NULL);
+	for(k=0; k<n_chunks; ++k){
+		chunks[k].prediction = self;
+		chunks[k].query = query;
+		chunks[k].func = func;
+		chunks[k].begin = n_cells * k / n_chunks;
+		chunks[k].end = n_cells * (k + 1) / n_chunks;
+		darray_init(chunks[k].reflections);
+		if(!pool || !g_thread_pool_push(pool, &chunks[k], NULL))
+			prediction_chunk_run(&chunks[k], NULL);
+	}
+	if(pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	for(k=0; k<n_chunks; ++k){
+		darray_append_items(self->reflections,
+				    chunks[k].reflections.item,
+				    darray_size(chunks[k].reflections));
+		darray_free(chunks[k].reflections);
+	}
+	free(chunks);
+}
+
+static int prediction_lattice_check(const HklPrediction *self,
+				    const HklSample *sample, GError **error)
+{
+	HklMatrix B;
+
+	if(!hkl_lattice_get_B(sample->lattice, &B)
+	   || memcmp(&B, &self->B, sizeof(B))){
+		g_set_error(error,
+			    HKL_PREDICTION_ERROR,
+			    HKL_PREDICTION_ERROR_LATTICE,
+			    "the lattice of the sample is not the indexed one");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void prediction_geometry_cell(const HklPrediction *self,
+				     const struct prediction_query_t *query,
+				     size_t cell,
+				     darray_prediction_reflection *reflections)
+{
+	const double *x = &darray_item(self->q[0], 0);
+	const double *y = &darray_item(self->q[1], 0);
+	const double *z = &darray_item(self->q[2], 0);
+	double rmin = MAX(query->radius - query->tolerance, 0);
+	double rmax = query->radius + query->tolerance;
+	double lo[3], hi[3];
+	double dmin2 = 0;
+	double dmax2 = 0;
+	size_t i;
+
+	/* skip the cells which do not intersect the shell */
+	prediction_cell_box(self, cell, lo, hi);
+	for(i=0; i<3; ++i){
+		double a = lo[i] - query->center[i];
+		double b = hi[i] - query->center[i];
+
+		if(a > 0)
+			dmin2 += a * a;
+		else if(b < 0)
+			dmin2 += b * b;
+		dmax2 += MAX(a * a, b * b);
+	}
+	if(dmin2 > rmax * rmax || dmax2 < rmin * rmin)
+		return;
+
+	for(i=self->offsets[cell]; i<self->offsets[cell + 1]; ++i){
+		double dx = x[i] - query->center[0];
+		double dy = y[i] - query->center[1];
+		double dz = z[i] - query->center[2];
+		double distance = sqrt(dx * dx + dy * dy + dz * dz) - query->radius;
+
+		if(fabs(distance) <= query->tolerance){
+			struct hkl_prediction_reflection_t reflection = {
+				{darray_item(self->hkl[0], i),
+				 darray_item(self->hkl[1], i),
+				 darray_item(self->hkl[2], i)},
+				distance,
+			};
+			darray_append(*reflections, reflection);
+		}
+	}
+}
+
+/**
+ * hkl_prediction_geometry:
+ * @self: the this ptr
+ * @geometry: the geometry
+ * @sample: the sample, with the indexed lattice
+ * @tolerance: the maximum distance to the Ewald sphere (default unit)
+ * @error: return location for a GError, or NULL
+ *
+ * predict the reflections of the index in diffraction condition for
+ * a geometry, the ones at less than tolerance of the Ewald sphere.
+ * Use hkl_prediction_reflection_get() to read them.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_prediction_geometry(HklPrediction *self,
+			    const HklGeometry *geometry,
+			    const HklSample *sample,
+			    double tolerance,
+			    GError **error)
+{
+	struct prediction_query_t query;
+	HklMatrix R;
+	HklVector ki;
+	size_t i;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	memset(&query, 0, sizeof(query));
+	if(!prediction_lattice_check(self, sample, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	/* Q = R.U.B.hkl is in diffraction condition if |ki + Q| = |ki|,
+	 * so B.hkl must lie on the sphere of center -(R.U)^T.ki */
+	hkl_quaternion_to_matrix(&darray_item(geometry->holders, 0)->q, &R);
+	hkl_matrix_times_matrix(&R, &sample->U);
+	hkl_source_compute_ki(&geometry->source, &ki);
+	for(i=0; i<3; ++i)
+		query.center[i] = -(R.data[0][i] * ki.data[0]
+				    + R.data[1][i] * ki.data[1]
+				    + R.data[2][i] * ki.data[2]);
+	query.radius = hkl_vector_norm2(&ki);
+	query.tolerance = fabs(tolerance);
+
+	prediction_run(self, &query, prediction_geometry_cell);
+
+	return TRUE;
+}
+
+static void prediction_sweep_cell(const HklPrediction *self,
+				  const struct prediction_query_t *query,
+				  size_t cell,
+				  darray_prediction_reflection *reflections)
+{
+	const double *x = &darray_item(self->q[0], 0);
+	const double *y = &darray_item(self->q[1], 0);
+	const double *z = &darray_item(self->q[2], 0);
+	const double (*W)[3] = query->W.data;
+	const double *u = query->u.data;
+	const double *k = query->ki.data;
+	double lo[3], hi[3];
+	double dmin2 = 0;
+	size_t i;
+
+	/* only the nodes with |Q| <= 2|ki| can diffract */
+	prediction_cell_box(self, cell, lo, hi);
+	for(i=0; i<3; ++i){
+		if(lo[i] > 0)
+			dmin2 += lo[i] * lo[i];
+		else if(hi[i] < 0)
+			dmin2 += hi[i] * hi[i];
+	}
+	if(dmin2 > 4 * query->radius * query->radius)
+		return;
+
+	for(i=self->offsets[cell]; i<self->offsets[cell + 1]; ++i){
+		double v[3], w[3];
+		double vu, a, b, c, r, delta, alpha;
+		size_t j;
+
+		for(j=0; j<3; ++j)
+			v[j] = W[j][0] * x[i] + W[j][1] * y[i] + W[j][2] * z[i];
+		vu = v[0] * u[0] + v[1] * u[1] + v[2] * u[2];
+		w[0] = u[1] * v[2] - u[2] * v[1];
+		w[1] = u[2] * v[0] - u[0] * v[2];
+		w[2] = u[0] * v[1] - u[1] * v[0];
+
+		/* with Rot(phi).v = vu.u + cos(phi).(v - vu.u) + sin(phi).(u x v)
+		 * the condition 2 ki.Q + |Q|^2 = 0 is a.cos(phi) + b.sin(phi) + c = 0 */
+		c = vu * (k[0] * u[0] + k[1] * u[1] + k[2] * u[2]);
+		a = k[0] * v[0] + k[1] * v[1] + k[2] * v[2] - c;
+		b = k[0] * w[0] + k[1] * w[1] + k[2] * w[2];
+		c += (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) / 2;
+		r = sqrt(a * a + b * b);
+		if(r < HKL_EPSILON || fabs(c) > r)
+			continue;
+
+		delta = atan2(b, a);
+		alpha = acos(-c / r);
+		for(j=0; j<(alpha > 0 ? 2 : 1); ++j){
+			double phi = fmod((j ? delta - alpha : delta + alpha) - query->from, 2 * M_PI);
+
+			if(phi < 0)
+				phi += 2 * M_PI;
+			for(phi+=query->from; phi<=query->to; phi+=2 * M_PI){
+				struct hkl_prediction_reflection_t reflection = {
+					{darray_item(self->hkl[0], i),
+					 darray_item(self->hkl[1], i),
+					 darray_item(self->hkl[2], i)},
+					phi * query->factor,
+				};
+				darray_append(*reflections, reflection);
+			}
+		}
+	}
+}
+
+/**
+ * hkl_prediction_sweep:
+ * @self: the this ptr
+ * @geometry: the geometry, the other axes stay at their current position
+ * @sample: the sample, with the indexed lattice
+ * @axis_name: the swept axis, an axis of the sample holder
+ * @from: the start of the sweep
+ * @to: the end of the sweep
+ * @unit_type: the unit of from, to and the crossing positions
+ * @error: return location for a GError, or NULL
+ *
+ * predict the reflections of the index crossing the Ewald sphere
+ * while the axis moves from @from to @to (an omega or phi
+ * sweep). Use hkl_prediction_reflection_get() to read them with their
+ * crossing position, a reflection is listed once per crossing.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_prediction_sweep(HklPrediction *self,
+			 const HklGeometry *geometry,
+			 const HklSample *sample,
+			 const char *axis_name,
+			 double from, double to,
+			 HklUnitEnum unit_type,
+			 GError **error)
+{
+	static HklQuaternion q0 = {{1, 0, 0, 0}};
+	struct prediction_query_t query;
+	const HklHolder *holder = darray_item(geometry->holders, 0);
+	const HklAxis *axis;
+	HklQuaternion before = q0;
+	HklQuaternion after = q0;
+	HklMatrix A;
+	size_t i, p;
+	int idx;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	memset(&query, 0, sizeof(query));
+	if(!prediction_lattice_check(self, sample, error)){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	idx = hkl_geometry_get_axis_idx_by_name(geometry, axis_name);
+	for(p=0; p<holder->config->len; ++p)
+		if(idx >= 0 && holder->config->idx[p] == (size_t)idx)
+			break;
+	if(p == holder->config->len){
+		g_set_error(error,
+			    HKL_PREDICTION_ERROR,
+			    HKL_PREDICTION_ERROR_SWEEP,
+			    "\"%s\" is not an axis of the sample holder", axis_name);
+		return FALSE;
+	}
+	axis = container_of(darray_item(geometry->axes, idx), HklAxis, parameter);
+
+	/* R = before.Rot(phi).after so Q = before.Rot(phi).W.B.hkl */
+	for(i=0; i<holder->config->len; ++i){
+		const HklAxis *a = container_of(darray_item(geometry->axes,
+							    holder->config->idx[i]),
+						HklAxis, parameter);
+		if(i < p)
+			hkl_quaternion_times_quaternion(&before, &a->q);
+		else if(i > p)
+			hkl_quaternion_times_quaternion(&after, &a->q);
+	}
+	hkl_quaternion_to_matrix(&after, &query.W);
+	hkl_matrix_times_matrix(&query.W, &sample->U);
+
+	/* ki in the frame of the swept axis */
+	hkl_source_compute_ki(&geometry->source, &query.ki);
+	hkl_quaternion_to_matrix(&before, &A);
+	hkl_matrix_transpose(&A);
+	hkl_matrix_times_vector(&A, &query.ki);
+	query.radius = hkl_vector_norm2(&query.ki);
+
+	query.u = axis->axis_v;
+	hkl_vector_normalize(&query.u);
+
+	query.factor = unit_type == HKL_UNIT_USER
+		? hkl_unit_factor(axis->parameter.unit, axis->parameter.punit)
+		: 1.;
+	query.from = from / query.factor;
+	query.to = to / query.factor;
+
+	prediction_run(self, &query, prediction_sweep_cell);
+
+	return TRUE;
+}
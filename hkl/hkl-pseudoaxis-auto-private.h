@@ -58,7 +58,8 @@ struct _HklModeAutoInfo {
 
 #define HKL_MODE_OPERATIONS_AUTO_DEFAULTS	\
 	HKL_MODE_OPERATIONS_DEFAULTS,		\
-		.set = hkl_mode_auto_set_real
+		.set = hkl_mode_auto_set_real,	\
+		.jacobian = hkl_mode_auto_jacobian_real
 
 #define CHECK_NAN(x, len) do{				\
 		for(uint i=0; i<len; ++i)		\
@@ -86,6 +87,13 @@ extern int hkl_mode_auto_set_real(HklMode *self,
 				  HklSample *sample,
 				  GError **error);
 
+extern int hkl_mode_auto_jacobian_real(HklMode *self,
+				       HklEngine *engine,
+				       double f[], double jx[], double jh[],
+				       GError **error);
+
+extern int hkl_mode_auto_linear_solve(double a[], double b[], size_t n);
+
 /***********************/
 /* HklModeAutoWithInit */
 /***********************/
@@ -112,7 +120,8 @@ typedef enum {
 	HKL_MODE_OPERATIONS_AUTO_DEFAULTS,				\
 		.capabilities = HKL_ENGINE_CAPABILITIES_READABLE | HKL_ENGINE_CAPABILITIES_WRITABLE | HKL_ENGINE_CAPABILITIES_INITIALIZABLE, \
 		.free = hkl_mode_auto_with_init_free_real,		\
-		.initialized_set = hkl_mode_auto_with_init_initialized_set_real
+		.initialized_set = hkl_mode_auto_with_init_initialized_set_real, \
+		.initialized_copy = hkl_mode_auto_with_init_initialized_copy_real
 
 static void hkl_mode_auto_with_init_free_real(HklMode *mode)
 {
@@ -164,6 +173,31 @@ static int hkl_mode_auto_with_init_initialized_set_real(HklMode *mode,
 	return TRUE;
 }
 
+static void hkl_mode_auto_with_init_initialized_copy_real(HklMode *mode,
+							  const HklMode *src)
+{
+	HklModeAutoWithInit *self = container_of(mode, HklModeAutoWithInit, mode);
+	const HklModeAutoWithInit *other = container_of(src, HklModeAutoWithInit, mode);
+
+	if(other->geometry){
+		if(self->geometry)
+			hkl_geometry_free(self->geometry);
+		self->geometry = hkl_geometry_new_copy(other->geometry);
+	}
+	if(other->detector){
+		if(self->detector)
+			hkl_detector_free(self->detector);
+		self->detector = hkl_detector_new_copy(other->detector);
+	}
+	if(other->sample){
+		if(self->sample)
+			hkl_sample_free(self->sample);
+		self->sample = hkl_sample_new_copy(other->sample);
+	}
+
+	mode->initialized = src->initialized;
+}
+
 extern HklMode *hkl_mode_auto_with_init_new(const HklModeAutoInfo *info,
 					    const HklModeOperations *ops,
 					    int initialized);
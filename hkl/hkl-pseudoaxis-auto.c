@@ -21,9 +21,13 @@
  */
 #include <alloca.h>                     // for alloca
 #include <gsl/gsl_errno.h>              // for ::GSL_CONTINUE
+#include <gsl/gsl_linalg.h>             // for gsl_linalg_LU_decomp, etc
 #include <gsl/gsl_machine.h>            // for GSL_SQRT_DBL_EPSILON
 #include <gsl/gsl_matrix_double.h>      // for gsl_matrix_alloc, etc
 #include <gsl/gsl_multiroots.h>         // for gsl_multiroot_function, etc
+#include <gsl/gsl_permutation.h>        // for gsl_permutation
+#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
+#include <gsl/gsl_sys.h>                // for gsl_isnan
 #include <gsl/gsl_vector_double.h>      // for gsl_vector, etc
 #include <math.h>                       // for fabs, M_PI
 #include <stddef.h>                     // for size_t
@@ -31,6 +35,7 @@
 #include <string.h>                     // for NULL, memset, memcpy
 #include <sys/types.h>                  // for uint
 #include "hkl-geometry-private.h"       // for hkl_geometry_update
+#include "hkl-interval-private.h"       // for hkl_interval_length, etc
 #include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_assert, etc
 #include "hkl-parameter-private.h"      // for _HklParameter
 #include "hkl-pseudoaxis-auto-private.h"  // for HklModeAutoInfo, etc
@@ -50,6 +55,7 @@ static GQuark hkl_mode_auto_error_quark (void)
 
 typedef enum {
 	HKL_MODE_AUTO_ERROR_SET, /* can not set the engine */
+	HKL_MODE_AUTO_ERROR_JACOBIAN, /* can not compute the jacobian */
 } HklModeAutoError;
 
 /*********************************************/
@@ -103,6 +109,252 @@ static void find_degenerated_axes(HklEngine *self,
 	gsl_matrix_free(J);
 }
 
+/**
+ * @brief bounded variables used by the range constrained solver.
+ *
+ * For each axis with a range shorter than 2*pi, the solver does not
+ * work directly with the axis value x but with an unbounded variable
+ * u such as x = center + half * sin(u). Whatever the value of u, the
+ * axis stays in its range during the whole search. Axes with an empty
+ * range (min == max) are pinned to this value and axes with a range of
+ * 2*pi or more are left untouched (half == 0).
+ */
+struct bounded_function_t {
+	gsl_multiroot_function *function;
+	double *center;
+	double *half;
+	int *pinned;
+	gsl_vector *x;
+};
+
+static void bounded_init(struct bounded_function_t *self,
+			 HklEngine *engine,
+			 gsl_multiroot_function *function)
+{
+	size_t i = 0;
+	size_t len = function->n;
+	HklParameter **axis;
+
+	self->function = function;
+	self->center = malloc(len * sizeof(*self->center));
+	self->half = malloc(len * sizeof(*self->half));
+	self->pinned = malloc(len * sizeof(*self->pinned));
+	self->x = gsl_vector_alloc(len);
+
+	darray_foreach(axis, engine->axes){
+		HklInterval *range = &(*axis)->range;
+
+		self->pinned[i] = range->min == range->max;
+		if(hkl_interval_length(range) < 2*M_PI){
+			self->center[i] = (range->min + range->max) / 2.;
+			self->half[i] = (range->max - range->min) / 2.;
+		}else{
+			self->center[i] = 0.;
+			self->half[i] = 0.;
+		}
+		++i;
+	}
+}
+
+static void bounded_release(struct bounded_function_t *self)
+{
+	gsl_vector_free(self->x);
+	free(self->pinned);
+	free(self->half);
+	free(self->center);
+}
+
+/* compute the axes values from the bounded variables */
+static void bounded_to_axes(const struct bounded_function_t *self,
+			    const double u[], double x[])
+{
+	size_t i;
+
+	for(i=0; i<self->function->n; ++i)
+		if(self->pinned[i])
+			x[i] = self->center[i];
+		else if(self->half[i] > 0.)
+			x[i] = self->center[i] + self->half[i] * sin(u[i]);
+		else
+			x[i] = u[i];
+}
+
+/* compute the bounded variables from the axes values, the values are
+ * projected strictly inside the axes range before the conversion */
+static void bounded_from_axes(const struct bounded_function_t *self,
+			      const double x[], double u[])
+{
+	size_t i;
+
+	for(i=0; i<self->function->n; ++i)
+		if(self->pinned[i])
+			u[i] = 0.;
+		else if(self->half[i] > 0.){
+			double t = gsl_sf_angle_restrict_symm(x[i] - self->center[i]) / self->half[i];
+
+			if(t > 1. - HKL_EPSILON)
+				t = 1. - HKL_EPSILON;
+			else if(t < -1. + HKL_EPSILON)
+				t = -1. + HKL_EPSILON;
+			u[i] = asin(t);
+		}else
+			u[i] = x[i];
+}
+
+/* a random starting point spanning the whole range of the bounded axes */
+static void bounded_randomize(const struct bounded_function_t *self,
+			      double u[])
+{
+	size_t i;
+
+	for(i=0; i<self->function->n; ++i)
+		if(self->pinned[i])
+			u[i] = 0.;
+		else if(self->half[i] > 0.)
+			u[i] = ((double)rand() / RAND_MAX - .5) * M_PI;
+		else
+			u[i] = (double)rand() / RAND_MAX / 180. * M_PI;
+}
+
+static int bounded_function(const gsl_vector *u, void *params, gsl_vector *f)
+{
+	struct bounded_function_t *self = params;
+
+	bounded_to_axes(self, u->data, self->x->data);
+
+	return self->function->f(self->x, self->function->params, f);
+}
+
+/**
+ * @brief check that an axis value or one of its equivalent is in the
+ * axis range.
+ *
+ * @param axis the axis to test.
+ * @param value the value to test.
+ *
+ * this is the same test than hkl_parameter_is_valid but without the
+ * need to set the axis value.
+ */
+static int axis_value_is_valid(const HklParameter *axis, double value)
+{
+	HklInterval range = axis->range;
+
+	if(hkl_interval_length(&range) > 2*M_PI)
+		return TRUE;
+
+	hkl_interval_angle_restrict_symm(&range);
+	value = gsl_sf_angle_restrict_symm(value);
+
+	if(range.min <= range.max)
+		return range.min - HKL_EPSILON <= value && value <= range.max + HKL_EPSILON;
+	else
+		return value <= range.max + HKL_EPSILON || value >= range.min - HKL_EPSILON;
+}
+
+/* number of solved points remembered by an engine for the warm start */
+#define HKL_ENGINE_SEEDS_CAPACITY 1024
+
+static double residual_norm2(gsl_multiroot_function *f, double x[], gsl_vector *_f)
+{
+	gsl_vector_view xv = gsl_vector_view_array(x, f->n);
+	double norm2 = 0.;
+	size_t i;
+
+	if(f->f(&xv.vector, f->params, _f))
+		return INFINITY;
+	for(i=0; i<_f->size; ++i)
+		norm2 += _f->data[i] * _f->data[i];
+
+	return gsl_isnan(norm2) ? INFINITY : norm2;
+}
+
+/* use the geometry axes values as starting point if it is better than x */
+static void seed_try(HklEngine *self, gsl_multiroot_function *f,
+		     const double values[], double x[], double *best,
+		     gsl_vector *_f)
+{
+	size_t len = f->n;
+	double *seed = alloca(len * sizeof(*seed));
+	HklParameter **axis;
+	double norm2;
+	size_t i = 0;
+
+	darray_foreach(axis, self->axes)
+		seed[i++] = values[hkl_geometry_get_axis_idx_by_name(self->geometry,
+								      (*axis)->name)];
+
+	norm2 = residual_norm2(f, seed, _f);
+	if(norm2 < *best){
+		*best = norm2;
+		memcpy(x, seed, len * sizeof(*x));
+	}
+}
+
+/**
+ * @brief start from a precomputed or previously solved point when it
+ * is a better guess
+ *
+ * @param self the current HklEngine
+ * @param f The function to use for the computation.
+ * @param x the starting point (axes values) replaced by the seed.
+ *
+ * The candidates are the solution interpolated from the engine grid
+ * (hkl_engine_grid_compute) and the solution of the nearest target
+ * in the k-d tree of the solved points. The candidate with the
+ * smallest residual is used if it is better than the current axes
+ * values.
+ */
+static void seed_starting_point(HklEngine *self, gsl_multiroot_function *f,
+				double x[])
+{
+	double *target = alloca(darray_size(self->pseudo_axes) * sizeof(*target));
+	double *values = alloca(darray_size(self->geometry->axes) * sizeof(*values));
+	const double *data = NULL;
+	gsl_vector *_f;
+	HklParameter **parameter;
+	double best;
+	size_t i;
+
+	i = 0;
+	darray_foreach(parameter, self->pseudo_axes)
+		target[i++] = (*parameter)->_value;
+
+	if(self->seeds)
+		data = hkl_kdtree_nearest(self->seeds, target, NULL);
+
+	if(!data && !self->grid)
+		return;
+
+	_f = gsl_vector_alloc(f->n);
+	best = residual_norm2(f, x, _f);
+	if(self->grid && hkl_engine_grid_seed(self, target, values))
+		seed_try(self, f, values, x, &best, _f);
+	if(data)
+		seed_try(self, f, data, x, &best, _f);
+	gsl_vector_free(_f);
+}
+
+/* remember the solution of the current target */
+static void seed_add(HklEngine *self)
+{
+	size_t n_axes = darray_size(self->geometry->axes);
+	double *target = alloca(darray_size(self->pseudo_axes) * sizeof(*target));
+	double *values = alloca(n_axes * sizeof(*values));
+	HklParameter **parameter;
+	size_t i;
+
+	if(!self->seeds)
+		self->seeds = hkl_kdtree_new(darray_size(self->pseudo_axes), n_axes,
+					     HKL_ENGINE_SEEDS_CAPACITY);
+
+	i = 0;
+	darray_foreach(parameter, self->pseudo_axes)
+		target[i++] = (*parameter)->_value;
+	hkl_geometry_axes_values_get(self->geometry, values, n_axes, HKL_UNIT_DEFAULT);
+
+	hkl_kdtree_add(self->seeds, target, values);
+}
+
 /**
  * @brief this private method try to find the first solution
  *
@@ -111,6 +363,9 @@ static void find_degenerated_axes(HklEngine *self,
  *
  * If a solution was found it also check for degenerated axes.
  * A degenerated axes is an Axes with no effect on the function.
+ * When the engine list is range constrained, the search is done with
+ * the bounded variables so all the visited points are in the axes
+ * ranges.
  * @see find_degenerated
  * @return TRUE or FALSE.
  */
@@ -121,14 +376,20 @@ static int find_first_geometry(HklEngine *self,
 	gsl_multiroot_fsolver_type const *T;
 	gsl_multiroot_fsolver *s;
 	gsl_vector *x;
+	gsl_vector const *x_solution;
 	size_t len = darray_size(self->mode->info->axes_w);
 	double *x_data;
 	double *x_data0 = alloca(len * sizeof(*x_data0));
+	double *s_data0 = alloca(len * sizeof(*s_data0));
 	size_t iter = 0;
 	int status;
 	int res = FALSE;
 	size_t i;
 	HklParameter **axis;
+	int constrained = self->engines->range_constrained;
+	struct bounded_function_t bounded;
+	gsl_multiroot_function bf;
+	gsl_multiroot_function *fs = f;
 
 	/* get the starting point from the geometry */
 	/* must be put in the auto_set method */
@@ -142,10 +403,26 @@ static int find_first_geometry(HklEngine *self,
 	/* keep a copy of the first axes positions to deal with degenerated axes */
 	memcpy(x_data0, x_data, len * sizeof(double));
 
+	seed_starting_point(self, f, x_data);
+
+	if (constrained) {
+		bounded_init(&bounded, self, f);
+		bf.f = bounded_function;
+		bf.n = f->n;
+		bf.params = &bounded;
+		fs = &bf;
+		bounded_from_axes(&bounded, x_data, x_data);
+
+		/* the degenerated axes keep their first position, it
+		 * must be in the range too */
+		bounded_from_axes(&bounded, x_data0, s_data0);
+		bounded_to_axes(&bounded, s_data0, x_data0);
+	}
+
 	/* Initialize method  */
 	T = gsl_multiroot_fsolver_hybrid;
 	s = gsl_multiroot_fsolver_alloc (T, len);
-	gsl_multiroot_fsolver_set (s, f, x);
+	gsl_multiroot_fsolver_set (s, fs, x);
 
 #ifdef DEBUG
 			fprintf(stdout, "Initial starting point: \n");
@@ -166,9 +443,12 @@ static int find_first_geometry(HklEngine *self,
 #endif
 		if (status || (iter % 300) == 0) {
 			/* Restart from another point. */
-			for(i=0; i<len; ++i)
-				x_data[i] = (double)rand() / RAND_MAX / 180. * M_PI;
-			gsl_multiroot_fsolver_set(s, f, x);
+			if (constrained)
+				bounded_randomize(&bounded, x_data);
+			else
+				for(i=0; i<len; ++i)
+					x_data[i] = (double)rand() / RAND_MAX / 180. * M_PI;
+			gsl_multiroot_fsolver_set(s, fs, x);
 			gsl_multiroot_fsolver_iterate(s);
 #ifdef DEBUG
 			fprintf(stdout, "randomize the starting point: \n");
@@ -198,7 +478,14 @@ static int find_first_geometry(HklEngine *self,
 #endif
 
 	if (status != GSL_CONTINUE) {
-		find_degenerated_axes(self, f, s->x, s->f, degenerated);
+		/* go back to the axes values */
+		x_solution = s->x;
+		if (constrained) {
+			bounded_to_axes(&bounded, s->x->data, x_data);
+			x_solution = x;
+		}
+
+		find_degenerated_axes(self, f, x_solution, s->f, degenerated);
 
 #ifdef DEBUG
 		/* print the test header */
@@ -212,7 +499,7 @@ static int find_first_geometry(HklEngine *self,
 		/* set the geometry from the gsl_vector */
 		/* in a futur version the geometry must contain a gsl_vector */
 		/* to avoid this. */
-		x_data = (double *)s->x->data;
+		x_data = (double *)x_solution->data;
 		i = 0;
 		darray_foreach(axis, self->axes){
 			hkl_parameter_value_set(*axis,
@@ -223,10 +510,13 @@ static int find_first_geometry(HklEngine *self,
 		}
 
 		hkl_geometry_update(self->geometry);
+		seed_add(self);
 		res = TRUE;
 	}
 
 	/* release memory */
+	if (constrained)
+		bounded_release(&bounded);
 	gsl_vector_free(x);
 	gsl_multiroot_fsolver_free(s);
 
@@ -246,27 +536,27 @@ static int find_first_geometry(HklEngine *self,
  * 2 -> pi + angle
  * 3 -> -angle
  */
+static inline double change_sector_value(double x0, int sector)
+{
+	switch (sector) {
+	case 1:
+		return M_PI - x0;
+	case 2:
+		return M_PI + x0;
+	case 3:
+		return -x0;
+	default:
+		return x0;
+	}
+}
+
 static void change_sector(double x[], double const x0[],
 			  int const sector[], size_t n)
 {
 	size_t i;
 
-	for(i=0; i<n; ++i) {
-		switch (sector[i]) {
-		case 0:
-			x[i] = x0[i];
-			break;
-		case 1:
-			x[i] = M_PI - x0[i];
-			break;
-		case 2:
-			x[i] = M_PI + x0[i];
-			break;
-		case 3:
-			x[i] = -x0[i];
-			break;
-		}
-	}
+	for(i=0; i<n; ++i)
+		x[i] = change_sector_value(x0[i], sector[i]);
 }
 
 /**
@@ -316,6 +606,7 @@ static int test_sector(gsl_vector const *x,
  *
  * @param axes_len number of axes
  * @param op_len number of operation per axes. (4 for now)
+ * @param admissible for each axes and operation, is the sector admissible (axes_len * 4).
  * @param p The vector containing the current permutation.
  * @param axes_idx The index of the axes we are permution.
  * @param op the current operation to set.
@@ -324,7 +615,8 @@ static int test_sector(gsl_vector const *x,
  * @param _x a gsl_vector use to compute the sectors (optimization)
  * @param _f a gsl_vector use during the sector test (optimization)
  */
-static void perm_r(size_t axes_len, size_t op_len[], int p[], size_t axes_idx,
+static void perm_r(size_t axes_len, size_t op_len[], const int admissible[],
+		   int p[], size_t axes_idx,
 		   int op, gsl_multiroot_function *f, double x0[],
 		   gsl_vector *_x, gsl_vector *_f)
 {
@@ -338,7 +630,8 @@ static void perm_r(size_t axes_len, size_t op_len[], int p[], size_t axes_idx,
 			hkl_engine_add_geometry(f->params, x_data);
 	} else
 		for (i=0; i<op_len[axes_idx]; ++i)
-			perm_r(axes_len, op_len, p, axes_idx, i, f, x0, _x, _f);
+			if (admissible[axes_idx * 4 + i])
+				perm_r(axes_len, op_len, admissible, p, axes_idx, i, f, x0, _x, _f);
 }
 
 /**
@@ -353,6 +646,8 @@ static void perm_r(size_t axes_len, size_t op_len[], int p[], size_t axes_idx,
  * GSL library (the multi root solver hybrid). Then it multiplicates the
  * solutions from this starting point using cosinus/sinus properties.
  * It addes all valid solutions to the self->geometries.
+ * When the engine list is range constrained, the sectors which put an
+ * axis out of its range are pruned before the permutations.
  */
 static int solve_function(HklEngine *self,
 			  const HklFunction *function)
@@ -363,6 +658,7 @@ static int solve_function(HklEngine *self,
 	double x0[function->size];
 	int degenerated[function->size];
 	size_t op_len[function->size];
+	int admissible[function->size * 4];
 	int res;
 	gsl_vector *_x; /* use to compute sectors in perm_r (avoid copy) */
 	gsl_vector *_f; /* use to test sectors in perm_r (avoid copy) */
@@ -382,12 +678,19 @@ static int solve_function(HklEngine *self,
 		/* use first solution as starting point for permutations */
 		i = 0;
 		darray_foreach(axis, self->axes){
+			size_t op;
+
 			x0[i] = (*axis)->_value;
 			op_len[i] = degenerated[i] ? 1 : 4;
+			for (op=0; op<4; ++op)
+				admissible[i * 4 + op] = !self->engines->range_constrained
+					|| axis_value_is_valid(*axis,
+							       change_sector_value(x0[i], op));
 			++i;
 		}
 		for (i=0; i<op_len[0]; ++i)
-			perm_r(function->size, op_len, p, 0, i, &f, x0, _x, _f);
+			if (admissible[i])
+				perm_r(function->size, op_len, admissible, p, 0, i, &f, x0, _x, _f);
 	}
 
 	gsl_vector_free(_f);
@@ -463,6 +766,118 @@ int hkl_mode_auto_set_real(HklMode *self,
 	return TRUE;
 }
 
+/**
+ * hkl_mode_auto_jacobian_real: (skip)
+ * @self: the mode
+ * @engine: the engine, its geometry is the evaluation point
+ * @f: (out caller-allocates): the mode function F(x, h), n_axes values
+ * @jx: (out caller-allocates): dF/dx, n_axes x n_axes row major
+ * @jh: (out caller-allocates): dF/dh, n_axes x n_pseudo_axes row major
+ * @error: return location for a GError, or NULL
+ *
+ * evaluate the first function of the mode and its jacobians (forward
+ * differences) for the axes x of the engine geometry and the target
+ * pseudo axes values h of the engine. Along the solutions of the mode
+ * F(x, h) = 0 so dx = -jx^-1.jh.dh. The engine geometry is restored
+ * and nothing is allocated.
+ *
+ * Returns: TRUE on success, FALSE if the function can not be evaluated
+ **/
+int hkl_mode_auto_jacobian_real(HklMode *self,
+				HklEngine *engine,
+				double f[], double jx[], double jh[],
+				GError **error)
+{
+	HklModeAutoInfo *auto_info = container_of(self->info, HklModeAutoInfo, info);
+	const HklFunction *function = darray_item(auto_info->functions, 0);
+	const size_t n = function->size;
+	const size_t n_h = darray_size(engine->pseudo_axes);
+	double x[n];
+	double df[n];
+	gsl_vector_view _x = gsl_vector_view_array(x, n);
+	gsl_vector_view _f = gsl_vector_view_array(f, n);
+	gsl_vector_view _df = gsl_vector_view_array(df, n);
+	HklParameter **axis;
+	size_t i, j;
+	int status;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	i = 0;
+	darray_foreach(axis, engine->axes){
+		x[i++] = (*axis)->_value;
+	}
+
+	status = function->function(&_x.vector, engine, &_f.vector);
+
+	/* dF/dx */
+	for(j=0; j<n && status == GSL_SUCCESS; ++j){
+		const double xj = x[j];
+		const double dx = GSL_SQRT_DBL_EPSILON * (fabs(xj) > 1. ? fabs(xj) : 1.);
+
+		x[j] = xj + dx;
+		status = function->function(&_x.vector, engine, &_df.vector);
+		x[j] = xj;
+		for(i=0; i<n; ++i)
+			jx[i * n + j] = (df[i] - f[i]) / dx;
+	}
+
+	/* dF/dh */
+	for(j=0; j<n_h && status == GSL_SUCCESS; ++j){
+		HklParameter *pseudo_axis = darray_item(engine->pseudo_axes, j);
+		const double hj = pseudo_axis->_value;
+		const double dh = GSL_SQRT_DBL_EPSILON * (fabs(hj) > 1. ? fabs(hj) : 1.);
+
+		pseudo_axis->_value = hj + dh;
+		status = function->function(&_x.vector, engine, &_df.vector);
+		pseudo_axis->_value = hj;
+		for(i=0; i<n; ++i)
+			jh[i * n_h + j] = (df[i] - f[i]) / dh;
+	}
+
+	set_geometry_axes(engine, x);
+
+	if(status != GSL_SUCCESS){
+		g_set_error(error,
+			    HKL_MODE_AUTO_ERROR,
+			    HKL_MODE_AUTO_ERROR_JACOBIAN,
+			    "can not evaluate the \"%s\" mode function",
+			    self->info->name);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * hkl_mode_auto_linear_solve: (skip)
+ * @a: the n x n matrix (row major), destroyed by the decomposition
+ * @b: the right hand side, replaced by the solution
+ * @n: the size of the system
+ *
+ * solve a.x = b in place without allocation (LU decomposition)
+ *
+ * Returns: FALSE if the matrix is singular
+ **/
+int hkl_mode_auto_linear_solve(double a[], double b[], size_t n)
+{
+	size_t data[n];
+	gsl_permutation p = {n, data};
+	gsl_matrix_view m = gsl_matrix_view_array(a, n, n);
+	gsl_vector_view x = gsl_vector_view_array(b, n);
+	int signum;
+	size_t i;
+
+	if(gsl_linalg_LU_decomp(&m.matrix, &p, &signum) != GSL_SUCCESS)
+		return FALSE;
+
+	for(i=0; i<n; ++i)
+		if(fabs(a[i * n + i]) < HKL_EPSILON * HKL_EPSILON)
+			return FALSE;
+
+	return gsl_linalg_LU_svx(&m.matrix, &p, &x.vector) == GSL_SUCCESS;
+}
+
 HklMode *hkl_mode_auto_with_init_new(const HklModeAutoInfo *auto_info,
 				     const HklModeOperations *ops,
 				     int initialized)
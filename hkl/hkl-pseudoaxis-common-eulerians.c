@@ -20,7 +20,6 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  *          Jens Krüger <Jens.Krueger@frm2.tum.de>
  */
-#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
 #include <math.h>                       // for sin, asin, M_PI_2, tan, etc
 #include <stdlib.h>                     // for free
 #include <sys/types.h>                  // for uint
@@ -29,6 +28,7 @@
 #include "hkl-parameter-private.h"      // for _HklParameter, etc
 #include "hkl-pseudoaxis-common-eulerians-private.h"
 #include "hkl-pseudoaxis-private.h"     // for _HklPseudoAxis, etc
+#include "hkl-unit-private.h"           // for hkl_unit_angle_deg, etc
 #include "hkl.h"                        // for HklParameter, HklPseudoAxis, etc
 #include "hkl/ccan/array_size/array_size.h"  // for ARRAY_SIZE
 #include "hkl/ccan/container_of/container_of.h"  // for container_of
@@ -43,55 +43,114 @@ static GQuark hkl_mode_eulerians_error_quark (void)
 
 typedef enum {
 	HKL_MODE_EULERIANS_ERROR_SET, /* can not set the engine */
+	HKL_MODE_EULERIANS_ERROR_TO_KAPPA, /* can not convert to kappa angles */
 } HklModeEuleriansError;
 
-static int kappa_to_eulerian(const double angles[],
-			     double *omega, double *chi, double *phi,
-			     double alpha, int solution)
+/**
+ * hkl_eulerians_from_kappa:
+ * @komega: (array length=n): the komega angles
+ * @kappa: (array length=n): the kappa angles
+ * @kphi: (array length=n): the kphi angles
+ * @omega: (out caller-allocates) (array length=n): the omega angles
+ * @chi: (out caller-allocates) (array length=n): the chi angles
+ * @phi: (out caller-allocates) (array length=n): the phi angles
+ * @n: the number of angles triplets
+ * @alpha: the angle of the kappa axis (default unit)
+ * @solution: the solution (0 or 1), like the "solutions" parameter
+ *            of the eulerians engine
+ * @unit_type: the unit type (default or user) of the angles
+ *
+ * convert a whole set of kappa angles into their eulerian
+ * equivalent. This is the computation of the eulerians engine
+ * without a geometry and without branch in the loop, but its cost
+ * is in the scalar libm calls (tan, atan, asin).
+ **/
+void hkl_eulerians_from_kappa(const double komega[], const double kappa[], const double kphi[],
+			      double omega[], double chi[], double phi[], size_t n,
+			      double alpha, int solution, HklUnitEnum unit_type)
 {
-	const double komega = angles[0];
-	const double kappa = gsl_sf_angle_restrict_symm(angles[1]);
-	const double kphi = angles[2];
-	const double p = atan(tan(kappa/2.) * cos(alpha));
-
-	if (solution){
-		*omega = komega + p - M_PI_2;
-		*chi = 2 * asin(sin(kappa/2.) * sin(alpha));
-		*phi = kphi + p + M_PI_2;
-	}else{
-		*omega = komega + p + M_PI_2;
-		*chi = -2 * asin(sin(kappa/2.) * sin(alpha));
-		*phi = kphi + p - M_PI_2;
-	}
+	const double factor = unit_type == HKL_UNIT_USER
+		? hkl_unit_factor(&hkl_unit_angle_rad, &hkl_unit_angle_deg) : 1.;
+	const double cos_alpha = cos(alpha);
+	const double sin_alpha = sin(alpha);
+	const double sign = solution ? 1. : -1.;
+	size_t i;
 
-	return TRUE;
+	for(i=0; i<n; ++i){
+		/* kappa / 2 restricted to ]-pi/2, pi/2] */
+		double k2 = kappa[i] / factor / 2.;
+		double p;
+
+		k2 -= M_PI * round(k2 / M_PI);
+		p = atan(tan(k2) * cos_alpha);
+
+		omega[i] = komega[i] + (p - sign * M_PI_2) * factor;
+		chi[i] = sign * 2 * asin(sin(k2) * sin_alpha) * factor;
+		phi[i] = kphi[i] + (p + sign * M_PI_2) * factor;
+	}
 }
 
-static int eulerian_to_kappa(const double omega, const double chi, const double phi,
-			     double angles[],
-			     double alpha, double solution)
+/**
+ * hkl_eulerians_to_kappa:
+ * @omega: (array length=n): the omega angles
+ * @chi: (array length=n): the chi angles
+ * @phi: (array length=n): the phi angles
+ * @komega: (out caller-allocates) (array length=n): the komega angles
+ * @kappa: (out caller-allocates) (array length=n): the kappa angles
+ * @kphi: (out caller-allocates) (array length=n): the kphi angles
+ * @n: the number of angles triplets
+ * @alpha: the angle of the kappa axis (default unit)
+ * @solution: the solution (0 or 1), like the "solutions" parameter
+ *            of the eulerians engine
+ * @unit_type: the unit type (default or user) of the angles
+ * @error: return location for a GError, or NULL
+ *
+ * convert a whole set of eulerian angles into their kappa
+ * equivalent. The triplets with |chi| > 2 * alpha are unreachable,
+ * their kappa angles are set to NAN.
+ *
+ * Returns: TRUE if all the triplets are reachable, FALSE otherwise.
+ **/
+int hkl_eulerians_to_kappa(const double omega[], const double chi[], const double phi[],
+			   double komega[], double kappa[], double kphi[], size_t n,
+			   double alpha, int solution, HklUnitEnum unit_type,
+			   GError **error)
 {
-	int status = TRUE;
-	double *komega = &angles[0];
-	double *kappa = &angles[1];
-	double *kphi = &angles[2];
-
-	if (fabs(chi) <= alpha * 2){
-		const double p = asin(tan(chi/2.)/tan(alpha));
-
-		if (solution){
-			*komega = omega - p + M_PI_2;
-			*kappa = 2 * asin(sin(chi/2.)/sin(alpha));
-			*kphi = phi - p - M_PI_2;
-		}else{
-			*komega = omega + p - M_PI_2;
-			*kappa = -2 * asin(sin(chi/2.)/sin(alpha));
-			*kphi = phi + p + M_PI_2;
-		}
-	}else
-		status = FALSE;
+	const double factor = unit_type == HKL_UNIT_USER
+		? hkl_unit_factor(&hkl_unit_angle_rad, &hkl_unit_angle_deg) : 1.;
+	const double tan_alpha = tan(alpha);
+	const double sin_alpha = sin(alpha);
+	const double sign = solution ? 1. : -1.;
+	size_t i;
+	size_t unreachables = 0;
+
+	hkl_error (error == NULL || *error == NULL);
 
-	return status;
+	for(i=0; i<n; ++i){
+		const double c2 = chi[i] / factor / 2.;
+		const double p = asin(tan(c2) / tan_alpha);
+		const int reachable = fabs(c2) <= alpha;
+
+		komega[i] = omega[i] - sign * (p - M_PI_2) * factor;
+		kappa[i] = reachable ? sign * 2 * asin(sin(c2) / sin_alpha) * factor : NAN;
+		kphi[i] = phi[i] - sign * (p + M_PI_2) * factor;
+		unreachables += !reachable;
+	}
+
+	if(unreachables){
+		for(i=0; i<n; ++i)
+			if(isnan(kappa[i]))
+				komega[i] = kphi[i] = NAN;
+
+		g_set_error(error,
+			    HKL_MODE_EULERIANS_ERROR,
+			    HKL_MODE_EULERIANS_ERROR_TO_KAPPA,
+			    "%zu unreachable eulerian angles : |chi| > %f",
+			    unreachables, 2 * alpha * factor);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 /***********/
@@ -126,11 +185,11 @@ static int hkl_mode_get_eulerians_real(HklMode *self,
 	solution = darray_item(self->parameters, 0)->_value;
 
 	eulerians = container_of(engine, HklEngineEulerians, engine);
-	kappa_to_eulerian(angles,
-			  &eulerians->omega->_value,
-			  &eulerians->chi->_value,
-			  &eulerians->phi->_value,
-			  50 * HKL_DEGTORAD, solution);
+	hkl_eulerians_from_kappa(&angles[0], &angles[1], &angles[2],
+				 &eulerians->omega->_value,
+				 &eulerians->chi->_value,
+				 &eulerians->phi->_value,
+				 1, 50 * HKL_DEGTORAD, solution, HKL_UNIT_DEFAULT);
 
 	return TRUE;
 }
@@ -148,10 +207,11 @@ static int hkl_mode_set_eulerians_real(HklMode *self,
 
 	solution = darray_item(self->parameters, 0)->_value;
 	engine_eulerians = container_of(engine, HklEngineEulerians, engine);
-	if(!eulerian_to_kappa(engine_eulerians->omega->_value,
-			      engine_eulerians->chi->_value,
-			      engine_eulerians->phi->_value,
-			      angles, 50 * HKL_DEGTORAD, solution)){
+	if(!hkl_eulerians_to_kappa(&engine_eulerians->omega->_value,
+				   &engine_eulerians->chi->_value,
+				   &engine_eulerians->phi->_value,
+				   &angles[0], &angles[1], &angles[2],
+				   1, 50 * HKL_DEGTORAD, solution, HKL_UNIT_DEFAULT, NULL)){
 		g_set_error(error,
 			    HKL_MODE_EULERIANS_ERROR,
 			    HKL_MODE_EULERIANS_ERROR_SET,
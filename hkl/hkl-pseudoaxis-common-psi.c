@@ -20,11 +20,15 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 #include <gsl/gsl_errno.h>              // for ::GSL_SUCCESS
+#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
 #include <gsl/gsl_vector_double.h>      // for gsl_vector
 #include <gsl/gsl_sys.h>                // for gsl_isnan
+#include <math.h>                       // for ceil, fabs, floor
 #include <stdio.h>                      // for fprintf, stderr
 #include <stdlib.h>                     // for NULL, exit, free
+#include <string.h>                     // for memcpy
 #include <sys/types.h>                  // for uint
+#include "hkl-axis-private.h"           // for HklAxis
 #include "hkl-detector-private.h"       // for hkl_detector_compute_kf
 #include "hkl-geometry-private.h"       // for HklHolder, _HklGeometry, etc
 #include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_assert, etc
@@ -52,6 +56,7 @@ static GQuark hkl_mode_psi_error_quark (void)
 typedef enum {
 	HKL_MODE_PSI_ERROR_INIT, /* can not init the engine */
 	HKL_MODE_PSI_ERROR_GET, /* can not get the engine */
+	HKL_MODE_PSI_ERROR_SCAN, /* can not scan the azimuth */
 } HklModePsiError;
 
 /***********************/
@@ -247,12 +252,24 @@ static int hkl_mode_get_psi_real(HklMode *base,
 	return TRUE;
 }
 
+static void hkl_mode_initialized_copy_psi_real(HklMode *self,
+					       const HklMode *src)
+{
+	HklModePsi *psi_mode = container_of(self, HklModePsi, parent);
+	const HklModePsi *psi_src = container_of(src, HklModePsi, parent);
+
+	psi_mode->Q0 = psi_src->Q0;
+	psi_mode->hkl0 = psi_src->hkl0;
+	self->initialized = src->initialized;
+}
+
 HklMode *hkl_mode_psi_new(const HklModeAutoInfo *auto_info)
 {
 	static const HklModeOperations operations = {
 		HKL_MODE_OPERATIONS_AUTO_DEFAULTS,
 		.capabilities = HKL_ENGINE_CAPABILITIES_READABLE | HKL_ENGINE_CAPABILITIES_WRITABLE | HKL_ENGINE_CAPABILITIES_INITIALIZABLE,
 		.initialized_set = hkl_mode_initialized_set_psi_real,
+		.initialized_copy = hkl_mode_initialized_copy_psi_real,
 		.get = hkl_mode_get_psi_real,
 	};
 	HklModePsi *self;
@@ -307,3 +324,209 @@ HklEngine *hkl_engine_psi_new(void)
 
 	return &self->engine;
 }
+
+/************/
+/* psi scan */
+/************/
+
+/* largest rotation integrated at once when rotating the sample about Q */
+#define PSI_SCAN_ROTATION_STEP (5 * HKL_DEGTORAD)
+
+/* rotate the sample of the geometry by dpsi about the Q vector of the
+ * laboratory. The sample axes speeds of a rotation about Q are given
+ * by sum(dtheta_i * w_i) = dpsi * Q, w_i being the sample axes in the
+ * laboratory frame, this linear system is integrated by small steps.
+ * Returns FALSE if the sample holder has not exactly three
+ * independent axes. */
+static int psi_scan_rotate_sample(HklGeometry *geometry, const HklVector *Q, double dpsi)
+{
+	HklHolder *sample_holder = darray_item(geometry->holders, 0);
+	HklVector q = *Q;
+	size_t n = ceil(fabs(dpsi) / PSI_SCAN_ROTATION_STEP);
+	size_t i, j;
+
+	if(sample_holder->config->len != 3)
+		return FALSE;
+
+	if(n == 0)
+		return TRUE;
+
+	hkl_vector_normalize(&q);
+	hkl_vector_times_double(&q, dpsi / n);
+
+	for(i=0; i<n; ++i){
+		HklQuaternion qr = {{1, 0, 0, 0}};
+		HklMatrix M;
+		HklVector dtheta;
+
+		hkl_geometry_update(geometry);
+		for(j=0; j<3; ++j){
+			HklAxis *axis = container_of(darray_item(geometry->axes,
+								 sample_holder->config->idx[j]),
+						     HklAxis, parameter);
+			HklVector w = axis->axis_v;
+
+			hkl_vector_normalize(&w);
+			hkl_vector_rotated_quaternion(&w, &qr);
+			M.data[0][j] = w.data[0];
+			M.data[1][j] = w.data[1];
+			M.data[2][j] = w.data[2];
+			hkl_quaternion_times_quaternion(&qr, &axis->q);
+		}
+
+		if(hkl_matrix_solve(&M, &dtheta, &q))
+			return FALSE;
+
+		for(j=0; j<3; ++j){
+			HklParameter *axis = darray_item(geometry->axes,
+							 sample_holder->config->idx[j]);
+
+			hkl_parameter_value_set(axis, axis->_value + dtheta.data[j],
+						HKL_UNIT_DEFAULT, NULL);
+		}
+	}
+	hkl_geometry_update(geometry);
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_psi_scan:
+ * @self: the psi engine
+ * @hkl0: (array fixed-size=3): the reflection kept in diffraction
+ * @hkl1: (array fixed-size=3): the reference reflection of the azimuth
+ * @from: the first azimuth of the scan
+ * @to: the last azimuth of the scan
+ * @step: the azimuth step, its sign must match to - from
+ * @unit_type: the unit type (default or user) of the azimuths
+ * @error: return location for a GError, or NULL
+ *
+ * compute the whole trajectory of an azimuthal scan around @hkl0.
+ * The psi engine is initialized on @hkl0 (reached with the "hkl"
+ * engine from the current geometry) with @hkl1 as reference. Each
+ * point is seeded with the previous one, its sample rotated about Q
+ * by the azimuth step when the sample holder has three axes, and the
+ * solution the closest to this seed is kept so the trajectory stays
+ * on the same branch. The geometry of the engine list is left
+ * unchanged, the psi engine stays initialized on @hkl0.
+ *
+ * Return value: #HklGeometryList with one geometry per azimuth or
+ *               NULL if an azimuth has no solution, use
+ *               hkl_geometry_list_free to release the memory once
+ *               done.
+ **/
+HklGeometryList *hkl_engine_psi_scan(HklEngine *self,
+				     const double hkl0[], const double hkl1[],
+				     double from, double to, double step,
+				     HklUnitEnum unit_type, GError **error)
+{
+	HklEnginePsi *psi_engine = container_of(self, HklEnginePsi, engine);
+	HklGeometry *geometry = self->engines->geometry;
+	HklGeometry *start;
+	HklGeometryList *scan = NULL;
+	HklGeometryList *solutions;
+	HklEngine *hkl;
+	HklVector ki, Q;
+	double values[3];
+	double factor;
+	double psi;
+	size_t n, i;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!self->mode || self->mode->ops->get != hkl_mode_get_psi_real
+	   || darray_size(self->mode->parameters) != 3){
+		g_set_error(error,
+			    HKL_MODE_PSI_ERROR,
+			    HKL_MODE_PSI_ERROR_SCAN,
+			    "the \"%s\" engine is not a psi engine",
+			    self->info->name);
+		return NULL;
+	}
+
+	factor = unit_type == HKL_UNIT_USER
+		? hkl_unit_factor(psi_engine->psi->unit, psi_engine->psi->punit) : 1.;
+	if(step == 0. || (to - from) / step < 0.){
+		g_set_error(error,
+			    HKL_MODE_PSI_ERROR,
+			    HKL_MODE_PSI_ERROR_SCAN,
+			    "can not scan psi from %f to %f by %f",
+			    from, to, step);
+		return NULL;
+	}
+	n = floor((to - from) / step + HKL_EPSILON) + 1;
+	from /= factor;
+	step /= factor;
+
+	hkl = hkl_engine_list_engine_get_by_name(self->engines, "hkl", error);
+	if(!hkl){
+		g_assert(error == NULL || *error != NULL);
+		return NULL;
+	}
+
+	start = hkl_geometry_new_copy(geometry);
+
+	/* go to hkl0 and initialize the psi engine with hkl1 as reference */
+	memcpy(values, hkl0, sizeof(values));
+	solutions = hkl_engine_pseudo_axes_values_set(hkl, values, 3, HKL_UNIT_DEFAULT, error);
+	if(!solutions){
+		g_assert(error == NULL || *error != NULL);
+		goto out;
+	}
+	hkl_geometry_set(geometry,
+			 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions)));
+	hkl_geometry_list_free(solutions);
+
+	memcpy(values, hkl1, sizeof(values));
+	if(!hkl_engine_parameters_values_set(self, values, 3, HKL_UNIT_DEFAULT, error)
+	   || !hkl_engine_initialized_set(self, TRUE, error)){
+		g_assert(error == NULL || *error != NULL);
+		goto out;
+	}
+
+	/* Q is the same for all the azimuths */
+	hkl_source_compute_ki(&geometry->source, &ki);
+	hkl_detector_compute_kf(self->engines->detector, geometry, &Q);
+	hkl_vector_minus_vector(&Q, &ki);
+
+	/* the azimuth of the hkl0 geometry, when it is defined */
+	if(hkl_engine_get(self, NULL))
+		psi = psi_engine->psi->_value;
+	else
+		psi = from;
+
+	scan = hkl_geometry_list_new();
+	for(i=0; i<n; ++i){
+		const HklGeometry *solution;
+		double target = gsl_sf_angle_restrict_symm(from + i * step);
+
+		psi_scan_rotate_sample(geometry, &Q,
+				       gsl_sf_angle_restrict_symm(target - psi));
+
+		/* the solutions are sorted from the seed geometry */
+		solutions = hkl_engine_pseudo_axes_values_set(self, &target, 1,
+							      HKL_UNIT_DEFAULT, error);
+		if(!solutions){
+			g_assert(error == NULL || *error != NULL);
+			g_prefix_error(error, "psi %f: ", target * factor);
+			hkl_geometry_list_free(scan);
+			scan = NULL;
+			break;
+		}
+
+		solution = hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions));
+		list_add_tail(&scan->items, &hkl_geometry_list_item_new(solution)->list);
+		scan->n_items += 1;
+		hkl_geometry_set(geometry, solution);
+		psi = target;
+
+		hkl_geometry_list_free(solutions);
+	}
+
+out:
+	hkl_geometry_set(geometry, start);
+	hkl_engine_list_get(self->engines);
+	hkl_geometry_free(start);
+
+	return scan;
+}
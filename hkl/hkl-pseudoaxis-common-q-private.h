@@ -22,6 +22,7 @@
 #ifndef __HKL_PSEUDOAXIS_COMMON_Q_PRIVATE_H__
 #define __HKL_PSEUDOAXIS_COMMON_Q_PRIVATE_H__
 
+#include "hkl-pseudoaxis-private.h"     // for HklMode
 #include "hkl.h"
 
 G_BEGIN_DECLS
@@ -32,6 +33,13 @@ typedef struct _HklEngineQperQpar HklEngineQperQpar;
 
 extern double qmax(double wavelength);
 
+extern int hkl_mode_get_q_real(HklMode *self,
+			       HklEngine *engine,
+			       HklGeometry *geometry,
+			       HklDetector *detector,
+			       HklSample *sample,
+			       GError **error);
+
 extern HklEngine *hkl_engine_q_new(void);
 extern HklEngine *hkl_engine_q2_new(void);
 extern HklEngine *hkl_engine_qper_qpar_new(void);
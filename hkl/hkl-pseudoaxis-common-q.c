@@ -81,12 +81,12 @@ static const HklFunction q_func = {
 	.size = 1,
 };
 
-static int get_q_real(HklMode *self,
-		      HklEngine *base,
-		      HklGeometry *geometry,
-		      HklDetector *detector,
-		      HklSample *sample,
-		      GError **error)
+int hkl_mode_get_q_real(HklMode *self,
+			HklEngine *base,
+			HklGeometry *geometry,
+			HklDetector *detector,
+			HklSample *sample,
+			GError **error)
 {
 	double wavelength;
 	double theta;
@@ -124,7 +124,7 @@ static HklMode *mode_q(void)
 	};
 	static const HklModeOperations operations = {
 		HKL_MODE_OPERATIONS_AUTO_DEFAULTS,
-		.get = get_q_real,
+		.get = hkl_mode_get_q_real,
 	};
 
 	return hkl_mode_auto_new(&info, &operations, TRUE);
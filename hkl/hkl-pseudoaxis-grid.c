@@ -0,0 +1,470 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <alloca.h>                     // for alloca
+#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
+#include <gsl/gsl_sys.h>                // for gsl_isnan
+#include <math.h>                       // for floor, fabs, NAN
+#include <stdint.h>                     // for uint32_t
+#include <stdlib.h>                     // for free, malloc
+#include <string.h>                     // for memcpy, strcmp, strlen
+#include "hkl-geometry-private.h"       // for _HklGeometry, etc
+#include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_error
+#include "hkl-parameter-private.h"      // for _HklParameter
+#include "hkl-pseudoaxis-private.h"     // for _HklEngine, _HklEngineList, etc
+#include "hkl-unit-private.h"           // for HklUnit, hkl_unit_factor
+#include "hkl.h"                        // for HklEngine, etc
+#include "hkl/ccan/darray/darray.h"     // for darray_foreach, darray_size, etc
+
+/* precomputed solutions of an engine mode on a regular grid of the
+ * pseudo axes space. The grid is a single blob, the header followed
+ * by n_axes geometry axes values per node (NAN for an unreachable
+ * node), the first dimension varying the fastest. The same blob is
+ * written to the file and memory mapped back. */
+
+#define HKL_ENGINE_GRID_MAGIC "HKLGRID1"
+#define HKL_ENGINE_GRID_DIM_MAX 4
+
+struct hkl_engine_grid_header_t
+{
+	char magic[8];
+	char engine[32];
+	char mode[64];
+	uint32_t dim;
+	uint32_t n_axes;
+	uint32_t n[HKL_ENGINE_GRID_DIM_MAX];
+	double min[HKL_ENGINE_GRID_DIM_MAX];
+	double max[HKL_ENGINE_GRID_DIM_MAX];
+};
+
+struct hkl_engine_grid_t
+{
+	const struct hkl_engine_grid_header_t *header;
+	const double *values;
+	size_t n_nodes;
+	size_t size;
+	void *data; /* owned blob or NULL */
+	GMappedFile *file; /* mapped blob or NULL */
+};
+
+static size_t grid_n_nodes(const struct hkl_engine_grid_header_t *header)
+{
+	size_t k;
+	size_t n = 1;
+
+	for(k=0; k<header->dim; ++k)
+		n *= header->n[k];
+
+	return n;
+}
+
+static double grid_step(const struct hkl_engine_grid_header_t *header, size_t k)
+{
+	return header->n[k] > 1
+		? (header->max[k] - header->min[k]) / (header->n[k] - 1)
+		: 0.;
+}
+
+/* the pseudo axes values of a node */
+static void grid_node_target(const struct hkl_engine_grid_header_t *header,
+			     size_t node, double target[])
+{
+	size_t k;
+
+	for(k=0; k<header->dim; ++k){
+		target[k] = header->min[k] + (node % header->n[k]) * grid_step(header, k);
+		node /= header->n[k];
+	}
+}
+
+static struct hkl_engine_grid_t *grid_new(const struct hkl_engine_grid_header_t *header,
+					  void *data, GMappedFile *file, size_t size)
+{
+	struct hkl_engine_grid_t *self = HKL_MALLOC(struct hkl_engine_grid_t);
+
+	self->header = header;
+	self->values = (const double *)(header + 1);
+	self->n_nodes = grid_n_nodes(header);
+	self->size = size;
+	self->data = data;
+	self->file = file;
+
+	return self;
+}
+
+/**
+ * hkl_engine_grid_free: (skip)
+ * @self: the grid to release
+ *
+ * destructor
+ **/
+void hkl_engine_grid_free(struct hkl_engine_grid_t *self)
+{
+	if(self->file)
+		g_mapped_file_unref(self->file);
+	free(self->data);
+	free(self);
+}
+
+static void engine_grid_set(HklEngine *self, struct hkl_engine_grid_t *grid)
+{
+	if(self->grid)
+		hkl_engine_grid_free(self->grid);
+	self->grid = grid;
+}
+
+/* grid computation, each chunk of nodes is solved with its own copy of the engine */
+struct grid_chunk_t
+{
+	const HklEngine *engine;
+	const struct hkl_engine_grid_header_t *header;
+	double *values;
+	size_t begin;
+	size_t end;
+};
+
+static void grid_chunk_run(gpointer data, gpointer user_data)
+{
+	struct grid_chunk_t *chunk = data;
+	const struct hkl_engine_grid_header_t *header = chunk->header;
+	struct hkl_engine_clone_t clone;
+	double *target = alloca(header->dim * sizeof(*target));
+	int cloned;
+	size_t node;
+	size_t i;
+
+	cloned = hkl_engine_clone_init(&clone, chunk->engine);
+
+	for(node=chunk->begin; node<chunk->end; ++node){
+		double *values = &chunk->values[node * header->n_axes];
+		HklGeometryList *solutions = NULL;
+
+		if(cloned){
+			grid_node_target(header, node, target);
+			solutions = hkl_engine_pseudo_axes_values_set(clone.engine, target, header->dim,
+								      HKL_UNIT_DEFAULT, NULL);
+		}
+		if(solutions){
+			const HklGeometryListItem *first = hkl_geometry_list_items_first_get(solutions);
+
+			hkl_geometry_axes_values_get(hkl_geometry_list_item_geometry_get(first),
+						     values, header->n_axes, HKL_UNIT_DEFAULT);
+			hkl_geometry_list_free(solutions);
+		}else
+			for(i=0; i<header->n_axes; ++i)
+				values[i] = NAN;
+	}
+
+	hkl_engine_clone_release(&clone);
+}
+
+/**
+ * hkl_engine_grid_compute:
+ * @self: the this ptr
+ * @min: (array length=n_dim): the first value of each pseudo axis
+ * @max: (array length=n_dim): the last value of each pseudo axis
+ * @n: (array length=n_dim): the number of nodes along each pseudo axis
+ * @n_dim: the number of pseudo axes of the engine
+ * @unit_type: the unit type (default or user) of @min and @max
+ * @error: return location for a GError, or NULL
+ *
+ * solve the current mode of the engine on all the nodes of a regular
+ * grid of the pseudo axes space, in parallel. For each node the
+ * solution the closest to the current geometry is kept. The grid is
+ * then used to interpolate the starting point of the numerical
+ * solver, so the following hkl_engine_pseudo_axes_values_set only
+ * have to correct a very close guess. The grid can be saved with
+ * hkl_engine_grid_save and reloaded with hkl_engine_grid_load.
+ *
+ * The grid is only a seed: a grid computed for another sample or
+ * wavelength slows the solver down but does not change the solutions.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_engine_grid_compute(HklEngine *self,
+			    const double min[], const double max[],
+			    const size_t n[], size_t n_dim,
+			    HklUnitEnum unit_type, GError **error)
+{
+	struct hkl_engine_grid_header_t *header;
+	struct grid_chunk_t *chunks;
+	GThreadPool *pool;
+	size_t n_nodes = 1;
+	size_t n_axes;
+	size_t n_chunks;
+	size_t size;
+	size_t k;
+	void *data;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!self->engines || !self->engines->geometry
+	   || !self->engines->geometry->factory || !self->mode){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_GRID_COMPUTE,
+			    "Internal error");
+		return FALSE;
+	}
+
+	if(n_dim != darray_size(self->pseudo_axes) || n_dim > HKL_ENGINE_GRID_DIM_MAX
+	   || strlen(self->info->name) >= sizeof(header->engine)
+	   || strlen(self->mode->info->name) >= sizeof(header->mode)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_GRID_COMPUTE,
+			    "cannot compute a grid of %d dimensions for the mode \"%s\" of the engine \"%s\"",
+			    n_dim, self->mode->info->name, self->info->name);
+		return FALSE;
+	}
+
+	for(k=0; k<n_dim; ++k){
+		if(n[k] == 0 || min[k] > max[k]){
+			g_set_error(error,
+				    HKL_ENGINE_ERROR,
+				    HKL_ENGINE_ERROR_GRID_COMPUTE,
+				    "wrong grid dimension %d: [%f, %f] with %d nodes",
+				    k, min[k], max[k], n[k]);
+			return FALSE;
+		}
+		n_nodes *= n[k];
+	}
+
+	n_axes = darray_size(self->engines->geometry->axes);
+	size = sizeof(*header) + n_nodes * n_axes * sizeof(double);
+	data = calloc(1, size);
+	header = data;
+
+	memcpy(header->magic, HKL_ENGINE_GRID_MAGIC, sizeof(header->magic));
+	strcpy(header->engine, self->info->name);
+	strcpy(header->mode, self->mode->info->name);
+	header->dim = n_dim;
+	header->n_axes = n_axes;
+	for(k=0; k<n_dim; ++k){
+		const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, k);
+		double factor = unit_type == HKL_UNIT_USER
+			? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit)
+			: 1.;
+
+		header->n[k] = n[k];
+		header->min[k] = min[k] / factor;
+		header->max[k] = max[k] / factor;
+	}
+
+	n_chunks = MIN(n_nodes, g_get_num_processors());
+	chunks = calloc(n_chunks, sizeof(*chunks));
+	pool = g_thread_pool_new(grid_chunk_run, NULL, n_chunks, TRUE, NULL);
+	for(k=0; k<n_chunks; ++k){
+		chunks[k].engine = self;
+		chunks[k].header = header;
+		chunks[k].values = (double *)(header + 1);
+		chunks[k].begin = n_nodes * k / n_chunks;
+		chunks[k].end = n_nodes * (k + 1) / n_chunks;
+		if(!pool || !g_thread_pool_push(pool, &chunks[k], NULL))
+			grid_chunk_run(&chunks[k], NULL);
+	}
+	if(pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+	free(chunks);
+
+	engine_grid_set(self, grid_new(header, data, NULL, size));
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_grid_save:
+ * @self: the this ptr
+ * @filename: the file to write
+ * @error: return location for a GError, or NULL
+ *
+ * write the grid of the engine to a file, in the native byte order.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_engine_grid_save(const HklEngine *self, const char *filename,
+			 GError **error)
+{
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!self->grid){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_GRID_SAVE,
+			    "the engine \"%s\" has no grid to save",
+			    self->info->name);
+		return FALSE;
+	}
+
+	return g_file_set_contents(filename, (const gchar *)self->grid->header,
+				   self->grid->size, error);
+}
+
+/**
+ * hkl_engine_grid_load:
+ * @self: the this ptr
+ * @filename: the file to read
+ * @error: return location for a GError, or NULL
+ *
+ * memory map a grid written by hkl_engine_grid_save. The grid must
+ * have been computed for this engine and geometry, it is only used
+ * when its mode is the current mode of the engine.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_engine_grid_load(HklEngine *self, const char *filename,
+			 GError **error)
+{
+	GMappedFile *file;
+	const struct hkl_engine_grid_header_t *header;
+	size_t size;
+	size_t k;
+	int ok;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	file = g_mapped_file_new(filename, FALSE, error);
+	if(!file){
+		g_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	header = (const struct hkl_engine_grid_header_t *)g_mapped_file_get_contents(file);
+	size = g_mapped_file_get_length(file);
+
+	ok = size >= sizeof(*header)
+		&& !memcmp(header->magic, HKL_ENGINE_GRID_MAGIC, sizeof(header->magic))
+		&& header->dim == darray_size(self->pseudo_axes)
+		&& header->dim <= HKL_ENGINE_GRID_DIM_MAX
+		&& self->geometry
+		&& header->n_axes == darray_size(self->geometry->axes)
+		&& !strncmp(header->engine, self->info->name, sizeof(header->engine));
+	for(k=0; ok && k<header->dim; ++k)
+		ok = header->n[k] > 0;
+	ok = ok && size == sizeof(*header) + grid_n_nodes(header) * header->n_axes * sizeof(double);
+
+	if(!ok){
+		g_mapped_file_unref(file);
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_GRID_LOAD,
+			    "the file \"%s\" is not a grid of the engine \"%s\"",
+			    filename, self->info->name);
+		return FALSE;
+	}
+
+	engine_grid_set(self, grid_new(header, NULL, file, size));
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_grid_seed: (skip)
+ * @self: the this ptr
+ * @target: the pseudo axes values (default unit)
+ * @values: (out caller-allocates): the interpolated geometry axes values
+ *
+ * interpolate the solution of a target from the nodes of the grid
+ * cell containing it. The angles are interpolated relatively to the
+ * nearest node to avoid the 2pi jumps.
+ *
+ * Returns: FALSE if there is no grid for the current mode, if the
+ * target is outside the grid or next to an unreachable node.
+ **/
+int hkl_engine_grid_seed(const HklEngine *self, const double target[],
+			 double values[])
+{
+	const struct hkl_engine_grid_t *grid = self->grid;
+	const struct hkl_engine_grid_header_t *header;
+	size_t cell[HKL_ENGINE_GRID_DIM_MAX];
+	size_t stride[HKL_ENGINE_GRID_DIM_MAX];
+	double frac[HKL_ENGINE_GRID_DIM_MAX];
+	const double *ref;
+	size_t nearest = 0;
+	size_t corner;
+	size_t a, k;
+
+	if(!grid || !self->mode
+	   || strncmp(grid->header->mode, self->mode->info->name, sizeof(grid->header->mode)))
+		return FALSE;
+	header = grid->header;
+
+	for(k=0; k<header->dim; ++k){
+		double step = grid_step(header, k);
+		double u;
+
+		stride[k] = k ? stride[k - 1] * header->n[k - 1] : 1;
+		if(header->n[k] == 1 || step == 0.){
+			if(fabs(target[k] - header->min[k]) > HKL_EPSILON)
+				return FALSE;
+			cell[k] = 0;
+			frac[k] = 0.;
+			continue;
+		}
+
+		u = (target[k] - header->min[k]) / step;
+		if(u < -HKL_EPSILON || u > header->n[k] - 1 + HKL_EPSILON)
+			return FALSE;
+		cell[k] = u < 0 ? 0 : (size_t)floor(u);
+		if(cell[k] > header->n[k] - 2)
+			cell[k] = header->n[k] - 2;
+		frac[k] = u - cell[k];
+		frac[k] = frac[k] < 0. ? 0. : frac[k] > 1. ? 1. : frac[k];
+		nearest += (cell[k] + (frac[k] > .5)) * stride[k];
+	}
+
+	ref = &grid->values[nearest * header->n_axes];
+	if(gsl_isnan(ref[0]))
+		return FALSE;
+
+	for(a=0; a<header->n_axes; ++a)
+		values[a] = ref[a];
+
+	for(corner=0; corner<(1u << header->dim); ++corner){
+		const double *v;
+		double weight = 1.;
+		size_t node = 0;
+
+		for(k=0; k<header->dim; ++k){
+			int up = (corner >> k) & 1;
+
+			weight *= up ? frac[k] : 1. - frac[k];
+			node += (cell[k] + up) * stride[k];
+		}
+		if(weight == 0.)
+			continue;
+
+		v = &grid->values[node * header->n_axes];
+		if(gsl_isnan(v[0]))
+			return FALSE;
+
+		for(a=0; a<header->n_axes; ++a){
+			const HklParameter *axis = darray_item(self->geometry->axes, a);
+			double d = v[a] - ref[a];
+
+			if(axis->unit && axis->unit->type == HKL_UNIT_ANGLE_RAD)
+				d = gsl_sf_angle_restrict_symm(d);
+			values[a] += weight * d;
+		}
+	}
+
+	return TRUE;
+}
@@ -29,6 +29,7 @@
 #include <sys/types.h>                  // for uint
 #include "hkl-detector-private.h"
 #include "hkl-geometry-private.h"       // for hkl_geometry_update, etc
+#include "hkl-kdtree-private.h"         // for HklKdTree
 #include "hkl-macros-private.h"         // for HKL_MALLOC
 #include "hkl-parameter-private.h"      // for hkl_parameter_list_free, etc
 #include "hkl.h"                        // for HklEngine, HklMode, etc
@@ -45,6 +46,8 @@ typedef struct _HklEngineOperations HklEngineOperations;
 
 typedef darray(HklMode *) darray_mode;
 
+struct hkl_engine_grid_t;
+
 /*****************/
 /* HklPseudoAxis */
 /*****************/
@@ -134,6 +137,7 @@ struct _HklModeOperations
 				HklSample *sample,
 				int initialized,
 				GError **error);
+	void (* initialized_copy)(HklMode *self, const HklMode *src);
 	int (* get)(HklMode *self,
 		    HklEngine *engine,
 		    HklGeometry *geometry,
@@ -146,6 +150,10 @@ struct _HklModeOperations
 		    HklDetector *detector,
 		    HklSample *sample,
 		    GError **error);
+	int (* jacobian)(HklMode *self,
+			 HklEngine *engine,
+			 double f[], double jx[], double jh[],
+			 GError **error);
 };
 
 
@@ -153,6 +161,7 @@ struct _HklModeOperations
 		.free=hkl_mode_free_real,				\
 		.initialized_get=hkl_mode_initialized_get_real,		\
 		.initialized_set=hkl_mode_initialized_set_real,		\
+		.initialized_copy=hkl_mode_initialized_copy_real,	\
 		.get=hkl_mode_get_real,					\
 		.set=hkl_mode_set_real
 
@@ -221,6 +230,22 @@ static inline int hkl_mode_initialized_set(HklMode *self,
 }
 
 
+static inline void hkl_mode_initialized_copy_real(HklMode *self,
+						  const HklMode *src)
+{
+	/* by default the reference state lives in the parameters */
+	self->initialized = src->initialized;
+}
+
+
+/* copy the reference state of an initialized @src mode of the same
+ * type without recomputing it from the current geometry. */
+static inline void hkl_mode_initialized_copy(HklMode *self, const HklMode *src)
+{
+	self->ops->initialized_copy(self, src);
+}
+
+
 static inline int hkl_mode_get_real(HklMode *self,
 				    HklEngine *engine,
 				    HklGeometry *geometry,
@@ -324,8 +349,52 @@ struct _HklEngine
 	darray_string pseudo_axes_names;
 	darray_mode modes;
 	darray_string mode_names;
+	HklKdTree *seeds; /* solved pseudo axes values -> geometry axes values */
+	struct hkl_engine_grid_t *grid; /* precomputed solutions of a mode */
 };
 
+/* an independent copy of an engine with its own engine list,
+ * geometry, detector and sample, to solve in a worker thread */
+struct hkl_engine_clone_t
+{
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineList *engines;
+	HklEngine *engine;
+};
+
+extern int hkl_engine_clone_init(struct hkl_engine_clone_t *self, const HklEngine *src);
+
+extern void hkl_engine_clone_release(struct hkl_engine_clone_t *self);
+
+extern void hkl_engine_grid_free(struct hkl_engine_grid_t *self);
+
+extern int hkl_engine_grid_seed(const HklEngine *self, const double target[],
+				double values[]);
+
+
+/* LRU cache of the engines solutions, the key contains everything
+ * the solutions depend on */
+struct hkl_engine_list_cache_entry_t
+{
+	struct list_node list; /* in the lru list */
+	guint hash;
+	const HklFactory *factory;
+	const HklEngine *engine;
+	const HklMode *mode;
+	darray(double) key;
+	HklGeometryList *solutions; /* NULL for an unreachable target */
+	GError *error; /* the error of an unreachable target */
+};
+
+struct hkl_engine_list_cache_t
+{
+	size_t capacity; /* 0 if disabled */
+	double quantum;
+	GHashTable *entries;
+	struct list_head lru; /* the most recently used first */
+};
 
 struct _HklEngineList
 {
@@ -334,6 +403,8 @@ struct _HklEngineList
 	HklGeometry *geometry;
 	HklDetector *detector;
 	HklSample *sample;
+	int range_constrained;
+	struct hkl_engine_list_cache_t cache;
 };
 
 
@@ -349,6 +420,17 @@ static GQuark hkl_engine_error_quark (void)
 typedef enum {
 	HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_GET, /* can not get the engine pseudo axes values */
 	HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_SET, /* can not set the engine pseudo axes values */
+	HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_PLAN, /* can not plan the engine pseudo axes values */
+	HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_ORDER, /* can not order the engine pseudo axes values */
+	HKL_ENGINE_ERROR_GRID_COMPUTE, /* can not compute the engine grid */
+	HKL_ENGINE_ERROR_GRID_SAVE, /* can not save the engine grid */
+	HKL_ENGINE_ERROR_GRID_LOAD, /* can not load the engine grid */
+	HKL_ENGINE_ERROR_WAVELENGTH_SCAN, /* can not scan the wavelength */
+	HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_EQUIVALENTS, /* can not solve the equivalents */
+	HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_BATCH_GET, /* can not get the pseudo axes values of a batch */
+	HKL_ENGINE_ERROR_PVT_PROFILE, /* can not compute the motion profile */
+	HKL_ENGINE_ERROR_JACOBIAN_GET, /* can not compute the jacobian */
+	HKL_ENGINE_ERROR_JACOBIAN_SOLVE, /* can not solve the jacobian */
 	HKL_ENGINE_ERROR_PSEUDO_AXIS_SET, /* can not set the pseudo axis */
 	HKL_ENGINE_ERROR_INITIALIZE, /* can not initialize the engine */
 	HKL_ENGINE_ERROR_SET, /* can not set the engine */
@@ -385,6 +467,12 @@ static inline void hkl_engine_release(HklEngine *self)
 	if(self->sample)
 		hkl_sample_free(self->sample);
 
+	if(self->seeds)
+		hkl_kdtree_free(self->seeds);
+
+	if(self->grid)
+		hkl_engine_grid_free(self->grid);
+
 	/* release the mode added */
 	darray_foreach(mode, self->modes){
 		hkl_mode_free(*mode);
@@ -438,6 +526,8 @@ static inline void hkl_engine_init(HklEngine *self,
 	self->geometry = NULL;
 	self->detector = NULL;
 	self->sample = NULL;
+	self->seeds = NULL;
+	self->grid = NULL;
 }
 
 
@@ -681,6 +771,12 @@ static inline HklEngineList *hkl_engine_list_new(void)
 	self->geometry = NULL;
 	self->detector = NULL;
 	self->sample = NULL;
+	self->range_constrained = FALSE;
+
+	self->cache.capacity = 0;
+	self->cache.quantum = 0.;
+	self->cache.entries = NULL;
+	list_head_init(&self->cache.lru);
 
 	return self;
 }
@@ -0,0 +1,345 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <math.h>                       // for floor, fabs
+#include <stdlib.h>                     // for free, malloc
+#include "hkl-geometry-private.h"       // for _HklGeometry, etc
+#include "hkl-macros-private.h"         // for hkl_error
+#include "hkl-parameter-private.h"      // for _HklParameter
+#include "hkl-pseudoaxis-auto-private.h"  // for hkl_mode_auto_linear_solve
+#include "hkl-pseudoaxis-private.h"     // for _HklEngine, _HklEngineList, etc
+#include "hkl-unit-private.h"           // for hkl_unit_factor
+#include "hkl.h"                        // for HklEngine, etc
+#include "hkl/ccan/darray/darray.h"     // for darray_foreach, darray_size, etc
+
+/* the path of the pseudo axes is a cubic hermite spline through the
+ * knots, the tangents are the centered differences of the knots (one
+ * sided at both ends), so the velocities are continuous. */
+
+#define HKL_PROFILE_NEWTON_MAX 20
+
+struct profile_path_t
+{
+	const double *times;
+	size_t n_times;
+	size_t n; /* number of pseudo axes */
+	double *values; /* n_times x n, default unit */
+	double *tangents; /* n_times x n */
+	size_t segment;
+};
+
+static void profile_path_init(struct profile_path_t *self,
+			      const double times[], size_t n_times,
+			      const double values[], size_t n,
+			      const double factors[])
+{
+	size_t i, j;
+
+	self->times = times;
+	self->n_times = n_times;
+	self->n = n;
+	self->values = malloc(n_times * n * sizeof(*self->values));
+	self->tangents = malloc(n_times * n * sizeof(*self->tangents));
+	self->segment = 0;
+
+	for(i=0; i<n_times * n; ++i)
+		self->values[i] = values[i] / factors[i % n];
+
+	for(i=0; i<n_times; ++i){
+		size_t prev = i > 0 ? i - 1 : 0;
+		size_t next = i < n_times - 1 ? i + 1 : n_times - 1;
+
+		for(j=0; j<n; ++j)
+			self->tangents[i * n + j] = (self->values[next * n + j] - self->values[prev * n + j])
+				/ (times[next] - times[prev]);
+	}
+}
+
+static void profile_path_release(struct profile_path_t *self)
+{
+	free(self->tangents);
+	free(self->values);
+}
+
+/* the times must be visited in increasing order */
+static void profile_path_get(struct profile_path_t *self, double t,
+			     double h[], double dh[])
+{
+	const double *p0, *p1, *m0, *m1;
+	double dt, s, s2, s3;
+	size_t j;
+
+	while(self->segment < self->n_times - 2 && t > self->times[self->segment + 1])
+		self->segment++;
+
+	p0 = &self->values[self->segment * self->n];
+	p1 = p0 + self->n;
+	m0 = &self->tangents[self->segment * self->n];
+	m1 = m0 + self->n;
+	dt = self->times[self->segment + 1] - self->times[self->segment];
+	s = (t - self->times[self->segment]) / dt;
+	s2 = s * s;
+	s3 = s2 * s;
+
+	for(j=0; j<self->n; ++j){
+		h[j] = (2 * s3 - 3 * s2 + 1) * p0[j]
+			+ (s3 - 2 * s2 + s) * dt * m0[j]
+			+ (-2 * s3 + 3 * s2) * p1[j]
+			+ (s3 - s2) * dt * m1[j];
+		dh[j] = ((6 * s2 - 6 * s) * p0[j]
+			 + (3 * s2 - 4 * s + 1) * dt * m0[j]
+			 + (-6 * s2 + 6 * s) * p1[j]
+			 + (3 * s2 - 2 * s) * dt * m1[j]) / dt;
+	}
+}
+
+/**
+ * hkl_engine_pvt_profile:
+ * @self: the this ptr
+ * @times: (array length=n_times): the increasing times (s) of the
+ *         knots of the path
+ * @n_times: the number of knots, at least 2
+ * @values: (array length=n_values): the pseudo axes values of each
+ *          knot, row major
+ * @n_values: the size of the values array, n_times * the number of
+ *            pseudo axes of the engine
+ * @rate: the rate of the controller (Hz)
+ * @profile: (out caller-allocates) (array length=n_profile): the
+ *           position velocity time table, row major
+ * @n_profile: the size of the profile array
+ * @n_rows: (out caller-allocates): the number of rows of the table
+ * @unit_type: the unit type (default or user) of the values, the
+ *             positions and the velocities
+ * @error: return location for a GError, or NULL
+ *
+ * compute the motion profile of a continuous scan along a path of
+ * the pseudo axes parametrized in time. The path is a cubic hermite
+ * spline through the knots. The table contains one row every 1 /
+ * @rate seconds from the first knot to the last one. Each row is the
+ * time followed by the positions then the velocities of all the
+ * geometry axes (1 + 2 * n_axes columns).
+ *
+ * The first point is solved with the current mode, the next ones
+ * follow this solution: the positions are predicted from the previous
+ * row and corrected with a few Newton steps on the mode function, the
+ * velocities are dx/dt = -(dF/dx)^-1.dF/dh.dh/dt with F the mode
+ * function. The velocities and accelerations are checked against the
+ * axes motion model of the geometry (see
+ * hkl_geometry_axis_motion_set). The geometry of the engine list is
+ * left unchanged.
+ *
+ * If @n_profile is too small, @n_rows contains the number of rows
+ * needed and FALSE is returned.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_engine_pvt_profile(HklEngine *self,
+			   const double times[], size_t n_times,
+			   const double values[], size_t n_values,
+			   double rate,
+			   double profile[], size_t n_profile, size_t *n_rows,
+			   HklUnitEnum unit_type, GError **error)
+{
+	HklGeometry *geometry = self->engines->geometry;
+	const darray_motion *motions = &geometry->motions;
+	const size_t n_axes = darray_size(geometry->axes);
+	const size_t n_h = darray_size(self->info->pseudo_axes);
+	const size_t n_cols = 1 + 2 * n_axes;
+	struct profile_path_t path;
+	HklGeometry *start;
+	HklGeometryList *solutions;
+	double factors[n_axes + n_h];
+	double h[n_h];
+	double dh[n_h];
+	size_t i, j, k, n;
+	int res = FALSE;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	*n_rows = 0;
+
+	if(!self->mode || !self->mode->ops->jacobian
+	   || n_times < 2 || n_values != n_times * n_h || rate <= 0.){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PVT_PROFILE,
+			    "cannot compute the profile, wrong mode, number of times (%zu), values (%zu) or rate (%f)\n",
+			    n_times, n_values, rate);
+		return FALSE;
+	}
+	for(i=1; i<n_times; ++i)
+		if(times[i] <= times[i - 1]){
+			g_set_error(error,
+				    HKL_ENGINE_ERROR,
+				    HKL_ENGINE_ERROR_PVT_PROFILE,
+				    "cannot compute the profile, the times must be increasing\n");
+			return FALSE;
+		}
+
+	*n_rows = floor((times[n_times - 1] - times[0]) * rate + HKL_EPSILON) + 1;
+	if(n_profile < *n_rows * n_cols){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PVT_PROFILE,
+			    "cannot compute the profile, %zu values needed\n",
+			    *n_rows * n_cols);
+		return FALSE;
+	}
+
+	for(i=0; i<n_axes; ++i){
+		const HklParameter *axis = darray_item(geometry->axes, i);
+
+		factors[i] = unit_type == HKL_UNIT_USER
+			? hkl_unit_factor(axis->unit, axis->punit) : 1.;
+	}
+	for(i=0; i<n_h; ++i){
+		const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, i);
+
+		factors[n_axes + i] = unit_type == HKL_UNIT_USER
+			? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit) : 1.;
+	}
+
+	profile_path_init(&path, times, n_times, values, n_h, &factors[n_axes]);
+	start = hkl_geometry_new_copy(geometry);
+
+	/* the first point is solved, the engine internals then follow
+	 * the first solution */
+	profile_path_get(&path, times[0], h, dh);
+	solutions = hkl_engine_pseudo_axes_values_set(self, h, n_h, HKL_UNIT_DEFAULT, error);
+	if(!solutions){
+		g_assert(error == NULL || *error != NULL);
+		goto out;
+	}
+	hkl_geometry_set(geometry,
+			 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions)));
+	hkl_geometry_list_free(solutions);
+	hkl_engine_prepare_internal(self);
+
+	n = darray_size(self->axes);
+	{
+		size_t idx[n]; /* index of the engine axes in the geometry */
+		double x[n];
+		double v[n];
+		double f[n];
+		double jx[n * n];
+		double jh[n * n_h];
+
+		for(k=0; k<n; ++k){
+			for(j=0; j<n_axes; ++j)
+				if(darray_item(self->geometry->axes, j) == darray_item(self->axes, k))
+					idx[k] = j;
+			x[k] = darray_item(self->axes, k)->_value;
+			v[k] = 0.;
+		}
+
+		for(i=0; i<*n_rows; ++i){
+			const double t = times[0] + i / rate;
+			double *row = &profile[i * n_cols];
+			int converged = FALSE;
+			size_t iter;
+
+			profile_path_get(&path, t, h, dh);
+			for(j=0; j<n_h; ++j)
+				darray_item(self->pseudo_axes, j)->_value = h[j];
+
+			/* predict from the previous row then correct */
+			for(k=0; k<n; ++k)
+				x[k] += v[k] / rate;
+			set_geometry_axes(self, x);
+			for(iter=0; iter<HKL_PROFILE_NEWTON_MAX && !converged; ++iter){
+				if(!self->mode->ops->jacobian(self->mode, self, f, jx, jh, error)){
+					g_assert(error == NULL || *error != NULL);
+					goto out;
+				}
+
+				converged = TRUE;
+				for(k=0; k<n; ++k)
+					converged &= fabs(f[k]) < HKL_EPSILON;
+				if(!converged){
+					for(k=0; k<n; ++k)
+						f[k] = -f[k];
+					if(!hkl_mode_auto_linear_solve(jx, f, n))
+						break;
+					for(k=0; k<n; ++k)
+						x[k] += f[k];
+					set_geometry_axes(self, x);
+				}
+			}
+			if(!converged){
+				g_set_error(error,
+					    HKL_ENGINE_ERROR,
+					    HKL_ENGINE_ERROR_PVT_PROFILE,
+					    "cannot follow the path at %f s\n", t);
+				goto out;
+			}
+
+			/* dx/dt = -(dF/dx)^-1.dF/dh.dh/dt, the jacobians
+			 * are the ones of the converged point */
+			for(k=0; k<n; ++k){
+				f[k] = 0.;
+				for(j=0; j<n_h; ++j)
+					f[k] -= jh[k * n_h + j] * dh[j];
+			}
+			if(!hkl_mode_auto_linear_solve(jx, f, n)){
+				g_set_error(error,
+					    HKL_ENGINE_ERROR,
+					    HKL_ENGINE_ERROR_PVT_PROFILE,
+					    "singular mode jacobian at %f s\n", t);
+				goto out;
+			}
+
+			/* the motion model limits */
+			for(k=0; k<n && darray_size(*motions) == n_axes; ++k){
+				const HklAxisMotion *motion = &darray_item(*motions, idx[k]);
+
+				if(fabs(f[k]) > motion->velocity * (1 + HKL_EPSILON)
+				   || (i > 0 && motion->acceleration > 0.
+				       && fabs(f[k] - v[k]) * rate > motion->acceleration * (1 + HKL_EPSILON))){
+					g_set_error(error,
+						    HKL_ENGINE_ERROR,
+						    HKL_ENGINE_ERROR_PVT_PROFILE,
+						    "the \"%s\" axis exceeds its velocity or acceleration limit at %f s\n",
+						    darray_item(self->axes, k)->name, t);
+					goto out;
+				}
+			}
+			for(k=0; k<n; ++k)
+				v[k] = f[k];
+
+			row[0] = t;
+			for(j=0; j<n_axes; ++j){
+				row[1 + j] = darray_item(self->geometry->axes, j)->_value * factors[j];
+				row[1 + n_axes + j] = 0.;
+			}
+			for(k=0; k<n; ++k)
+				row[1 + n_axes + idx[k]] = v[k] * factors[idx[k]];
+		}
+	}
+	res = TRUE;
+
+out:
+	hkl_geometry_set(geometry, start);
+	hkl_engine_list_get(self->engines);
+	hkl_geometry_free(start);
+	profile_path_release(&path);
+
+	return res;
+}
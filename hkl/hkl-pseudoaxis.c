@@ -20,15 +20,27 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <gsl/gsl_machine.h>            // for GSL_SQRT_DBL_EPSILON
+#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
+#include <math.h>                       // for floor, fabs
 #include <stdio.h>                      // for fprintf, FILE
 #include <stdlib.h>                     // for free
 #include <string.h>                     // for NULL, strcmp
 #include <sys/types.h>                  // for uint
+#include "hkl-axis-private.h"           // for HklAxis
 #include "hkl-detector-private.h"       // for hkl_detector_new_copy
 #include "hkl-geometry-private.h"       // for _HklGeometryList, etc
 #include "hkl-macros-private.h"         // for hkl_assert, HKL_MALLOC, etc
 #include "hkl-parameter-private.h"      // for hkl_parameter_list_fprintf, etc
+#include "hkl-pseudoaxis-auto-private.h"  // for hkl_mode_auto_linear_solve
+#include "hkl-matrix-private.h"         // for hkl_matrix_solve
+#include "hkl-pseudoaxis-common-hkl-private.h"  // for hkl_mode_get_hkl_real
+#include "hkl-pseudoaxis-common-q-private.h"  // for hkl_mode_get_q_real
 #include "hkl-pseudoaxis-private.h"     // for _HklEngine, _HklEngineList, etc
+#include "hkl-quaternion-private.h"     // for hkl_quaternion_conjugate
+#include "hkl-sample-private.h"         // for _HklSample
+#include "hkl-source-private.h"         // for hkl_source_compute_ki
+#include "hkl-unit-private.h"           // for HklUnit
 #include "hkl.h"                        // for HklEngine, HklEngineList, etc
 #include "hkl/ccan/container_of/container_of.h"  // for container_of
 #include "hkl/ccan/darray/darray.h"     // for darray_foreach, darray_init, etc
@@ -153,6 +165,205 @@ int hkl_engine_pseudo_axes_values_get(HklEngine *self,
 	return TRUE;
 }
 
+/* solutions cache */
+
+static void engine_cache_key_push(struct hkl_engine_list_cache_entry_t *self,
+				  double value)
+{
+	/* -0. and 0. must give the same key */
+	darray_append(self->key, value + 0.);
+}
+
+/* compute the key of the current state of an engine */
+static void engine_cache_key_init(struct hkl_engine_list_cache_entry_t *self,
+				  const HklEngine *engine)
+{
+	const HklEngineList *engines = engine->engines;
+	const struct hkl_engine_list_cache_t *cache = &engines->cache;
+	const HklGeometry *geometry = engines->geometry;
+	HklParameter **parameter;
+	const darray_string *axes_w = &engine->mode->info->axes_w;
+	size_t i, j;
+	double *value;
+
+	self->factory = geometry->factory;
+	self->engine = engine;
+	self->mode = engine->mode;
+	self->solutions = NULL;
+	self->error = NULL;
+	darray_init(self->key);
+
+	/* quantized pseudo axes values */
+	darray_foreach(parameter, engine->pseudo_axes)
+		engine_cache_key_push(self,
+				      cache->quantum > 0.
+				      ? floor((*parameter)->_value / cache->quantum + .5)
+				      : (*parameter)->_value);
+
+	darray_foreach(parameter, engine->mode->parameters)
+		engine_cache_key_push(self, (*parameter)->_value);
+	engine_cache_key_push(self, engine->mode->initialized);
+	engine_cache_key_push(self, engines->range_constrained);
+
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+			engine_cache_key_push(self, engines->sample->UB.data[i][j]);
+
+	engine_cache_key_push(self, geometry->source.wave_length);
+
+	/* the detector kf */
+	engine_cache_key_push(self, engines->detector->type);
+	engine_cache_key_push(self, engines->detector->idx);
+	if(engines->detector->type == HKL_DETECTOR_TYPE_2D)
+		for(i=0; i<3; ++i)
+			for(j=0; j<3; ++j)
+				engine_cache_key_push(self, engines->detector->d2.orientation.data[i][j]);
+
+	/* the axes range and the reference values of the axes not
+	 * computed by the mode */
+	darray_foreach(parameter, geometry->axes){
+		const char **name;
+		int written = FALSE;
+
+		engine_cache_key_push(self, (*parameter)->range.min);
+		engine_cache_key_push(self, (*parameter)->range.max);
+		darray_foreach(name, *axes_w)
+			written |= !strcmp(*name, (*parameter)->name);
+		if(!written)
+			engine_cache_key_push(self, (*parameter)->_value);
+	}
+
+	/* FNV-1a */
+	self->hash = 2166136261u;
+	self->hash = (self->hash ^ GPOINTER_TO_UINT(self->engine)) * 16777619u;
+	self->hash = (self->hash ^ GPOINTER_TO_UINT(self->mode)) * 16777619u;
+	darray_foreach(value, self->key){
+		const unsigned char *bytes = (const unsigned char *)value;
+
+		for(i=0; i<sizeof(*value); ++i)
+			self->hash = (self->hash ^ bytes[i]) * 16777619u;
+	}
+}
+
+static guint engine_cache_entry_hash(gconstpointer key)
+{
+	const struct hkl_engine_list_cache_entry_t *self = key;
+
+	return self->hash;
+}
+
+static gboolean engine_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+	const struct hkl_engine_list_cache_entry_t *e1 = a;
+	const struct hkl_engine_list_cache_entry_t *e2 = b;
+	size_t i;
+
+	if(e1->hash != e2->hash
+	   || e1->factory != e2->factory
+	   || e1->engine != e2->engine
+	   || e1->mode != e2->mode
+	   || darray_size(e1->key) != darray_size(e2->key))
+		return FALSE;
+
+	for(i=0; i<darray_size(e1->key); ++i)
+		if(darray_item(e1->key, i) != darray_item(e2->key, i))
+			return FALSE;
+
+	return TRUE;
+}
+
+static void engine_cache_entry_free(gpointer data)
+{
+	struct hkl_engine_list_cache_entry_t *self = data;
+
+	darray_free(self->key);
+	if(self->solutions)
+		hkl_geometry_list_free(self->solutions);
+	if(self->error)
+		g_error_free(self->error);
+	free(self);
+}
+
+static void engine_list_cache_clear(HklEngineList *self)
+{
+	if(self->cache.entries){
+		g_hash_table_destroy(self->cache.entries);
+		self->cache.entries = NULL;
+	}
+	list_head_init(&self->cache.lru);
+}
+
+/* same as hkl_engine_set but look first in the solutions cache */
+static int engine_set_cached(HklEngine *self, GError **error)
+{
+	struct hkl_engine_list_cache_t *cache = &self->engines->cache;
+	struct hkl_engine_list_cache_entry_t *entry;
+	struct hkl_engine_list_cache_entry_t probe;
+	GError *tmp = NULL;
+
+	if(cache->capacity == 0 || !self->mode)
+		return hkl_engine_set(self, error);
+
+	if(!cache->entries)
+		cache->entries = g_hash_table_new_full(engine_cache_entry_hash,
+						       engine_cache_entry_equal,
+						       NULL,
+						       engine_cache_entry_free);
+
+	engine_cache_key_init(&probe, self);
+	entry = g_hash_table_lookup(cache->entries, &probe);
+	if(entry){
+		HklGeometryListItem *item;
+
+		darray_free(probe.key);
+
+		/* most recently used */
+		list_del_from(&cache->lru, &entry->list);
+		list_add(&cache->lru, &entry->list);
+
+		/* leave the engine internals as a real solve does */
+		hkl_engine_prepare_internal(self);
+
+		if(entry->error){
+			g_propagate_error(error, g_error_copy(entry->error));
+			return FALSE;
+		}
+
+		hkl_geometry_list_reset(self->engines->geometries);
+		list_for_each(&entry->solutions->items, item, list){
+			list_add_tail(&self->engines->geometries->items,
+				      &hkl_geometry_list_item_new_copy(item)->list);
+			self->engines->geometries->n_items += 1;
+		}
+		hkl_geometry_list_sort(self->engines->geometries,
+				       self->engines->geometry);
+
+		return TRUE;
+	}
+
+	/* miss, solve and keep the result even if unreachable */
+	entry = HKL_MALLOC(struct hkl_engine_list_cache_entry_t);
+	*entry = probe;
+	if(hkl_engine_set(self, &tmp))
+		entry->solutions = hkl_geometry_list_new_copy(self->engines->geometries);
+	else{
+		entry->error = tmp;
+		g_propagate_error(error, g_error_copy(tmp));
+	}
+
+	if(g_hash_table_size(cache->entries) >= cache->capacity){
+		struct hkl_engine_list_cache_entry_t *last;
+
+		last = list_tail(&cache->lru, struct hkl_engine_list_cache_entry_t, list);
+		list_del_from(&cache->lru, &last->list);
+		g_hash_table_remove(cache->entries, last);
+	}
+	g_hash_table_insert(cache->entries, entry, entry);
+	list_add(&cache->lru, &entry->list);
+
+	return entry->error == NULL;
+}
+
 /**
  * hkl_engine_pseudo_axes_values_set:
  * @self: the this ptr
@@ -191,7 +402,7 @@ HklGeometryList *hkl_engine_pseudo_axes_values_set(HklEngine *self,
 	}
 	g_assert (error == NULL || *error == NULL);
 
-	if(!hkl_engine_set(self, error)){
+	if(!engine_set_cached(self, error)){
 		g_assert(error == NULL || *error != NULL);
 		return NULL;
 	}
@@ -200,6 +411,1192 @@ HklGeometryList *hkl_engine_pseudo_axes_values_set(HklEngine *self,
 	return hkl_geometry_list_new_copy(self->engines->geometries);
 }
 
+static void pseudo_axes_values_lists_free(HklGeometryList **lists, size_t n)
+{
+	size_t i;
+
+	for(i=0; i<n; ++i)
+		hkl_geometry_list_free(lists[i]);
+	free(lists);
+}
+
+/* solve all the points, NULL if one of them has no solution */
+static HklGeometryList **pseudo_axes_values_solve(HklEngine *self,
+						  double values[], size_t n_points,
+						  HklUnitEnum unit_type, GError **error)
+{
+	size_t i;
+	size_t len = darray_size(self->info->pseudo_axes);
+	HklGeometryList **lists = calloc(n_points, sizeof(*lists));
+
+	for(i=0; i<n_points; ++i){
+		lists[i] = hkl_engine_pseudo_axes_values_set(self, &values[i * len], len,
+							     unit_type, error);
+		if(!lists[i]){
+			g_assert(error == NULL || *error != NULL);
+			g_prefix_error(error, "point %d: ", (int)i);
+			pseudo_axes_values_lists_free(lists, i);
+			return NULL;
+		}
+	}
+
+	return lists;
+}
+
+/**
+ * hkl_engine_pseudo_axes_values_plan:
+ * @self: the this ptr
+ * @values: (array length=n_values): the pseudo axes values of all the points
+ * @n_values: the size of the values array, a multiple of the number
+ *            of pseudo axes.
+ * @weights: (array length=n_weights) (allow-none): the cost weight of each axis
+ * @n_weights: the size of the weights array, 0 or the number of axes of the geometry
+ * @unit_type: the unit type (default or user) of the values
+ * @error: return location for a GError, or NULL
+ *
+ * solve each point of a scan (the pseudo axes values of the points
+ * are stored one after the other) and choose for each point the
+ * solution which minimize the cumulative distance of the whole
+ * scan, starting from the current geometry. Unlike the point per
+ * point sorting, this avoid the branch jumps in the middle of a
+ * scan. The axes contributions to the distance can be weighted,
+ * for example to penalize a slow motor.
+ *
+ * Return value: #HklGeometryList with one geometry per point or NULL
+ *               if a point has no solution, use hkl_geometry_list_free
+ *               to release the memory once done.
+ **/
+HklGeometryList *hkl_engine_pseudo_axes_values_plan(HklEngine *self,
+						    double values[], size_t n_values,
+						    const double weights[], size_t n_weights,
+						    HklUnitEnum unit_type, GError **error)
+{
+	size_t len = darray_size(self->info->pseudo_axes);
+	size_t n_points;
+	HklGeometryList **lists;
+	HklGeometryList *plan = NULL;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(n_values == 0 || n_values % len != 0
+	   || (n_weights != 0 && n_weights != darray_size(self->engines->geometry->axes))){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_PLAN,
+			    "cannot plan the engine pseudo axes, wrong number of values (%d) or weights (%d) given\n",
+			    n_values, n_weights);
+		return NULL;
+	}
+
+	n_points = n_values / len;
+	lists = pseudo_axes_values_solve(self, values, n_points, unit_type, error);
+	if(lists){
+		plan = hkl_geometry_list_plan(self->engines->geometry, lists, n_points,
+					      n_weights ? weights : NULL);
+		pseudo_axes_values_lists_free(lists, n_points);
+	}
+
+	return plan;
+}
+
+/**
+ * hkl_engine_pseudo_axes_values_order:
+ * @self: the this ptr
+ * @values: (array length=n_values): the pseudo axes values of all the points
+ * @n_values: the size of the values array, a multiple of the number
+ *            of pseudo axes.
+ * @order: (out caller-allocates): the visiting order of the points,
+ *         n_values / number of pseudo axes indexes.
+ * @unit_type: the unit type (default or user) of the values
+ * @error: return location for a GError, or NULL
+ *
+ * solve each point of an unordered list (for example a list of
+ * reflections to measure) and choose both the visiting order and
+ * the solution of each point which minimize the total motion time
+ * starting from the current geometry. The motion time is estimated
+ * with the axes motion model of the engine list geometry (see
+ * hkl_geometry_axis_motion_set).
+ *
+ * Return value: #HklGeometryList with one geometry per point in the
+ *               visiting order or NULL if a point has no solution,
+ *               use hkl_geometry_list_free to release the memory
+ *               once done.
+ **/
+HklGeometryList *hkl_engine_pseudo_axes_values_order(HklEngine *self,
+						     double values[], size_t n_values,
+						     size_t order[],
+						     HklUnitEnum unit_type, GError **error)
+{
+	size_t len = darray_size(self->info->pseudo_axes);
+	size_t n_points;
+	HklGeometryList **lists;
+	HklGeometryList *res = NULL;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(n_values == 0 || n_values % len != 0){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_ORDER,
+			    "cannot order the engine pseudo axes, wrong number of values (%d) given\n",
+			    n_values);
+		return NULL;
+	}
+
+	n_points = n_values / len;
+	lists = pseudo_axes_values_solve(self, values, n_points, unit_type, error);
+	if(lists){
+		res = hkl_geometry_list_order(self->engines->geometry, lists, n_points, order);
+		pseudo_axes_values_lists_free(lists, n_points);
+	}
+
+	return res;
+}
+
+/**
+ * hkl_engine_wavelength_scan:
+ * @self: the this ptr
+ * @values: (array length=n_values): the pseudo axes values kept during the scan
+ * @n_values: the number of pseudo axes of the engine
+ * @wavelengths: (array length=n_wavelengths): the wavelengths of the scan
+ * @n_wavelengths: the number of points of the scan
+ * @unit_type: the unit type (default or user) of the values and the wavelengths
+ * @error: return location for a GError, or NULL
+ *
+ * compute the trajectory of an energy scan, the pseudo axes being
+ * kept constant while the wavelength changes. The axes of each point
+ * are predicted from the previous points (secant extrapolation along
+ * the wavelength) and the solver only corrects this prediction. The
+ * solution the closest to the prediction is kept so the trajectory
+ * stays on the same branch. The geometry of the engine list is left
+ * unchanged.
+ *
+ * Return value: #HklGeometryList with one geometry (including its
+ *               wavelength) per point or NULL if a point has no
+ *               solution, use hkl_geometry_list_free to release the
+ *               memory once done.
+ **/
+HklGeometryList *hkl_engine_wavelength_scan(HklEngine *self,
+					    double values[], size_t n_values,
+					    const double wavelengths[], size_t n_wavelengths,
+					    HklUnitEnum unit_type, GError **error)
+{
+	HklGeometry *geometry = self->engines->geometry;
+	HklGeometry *start;
+	HklGeometryList *scan;
+	size_t n_axes = darray_size(geometry->axes);
+	double *prev = malloc(n_axes * sizeof(*prev));
+	double *prev2 = malloc(n_axes * sizeof(*prev2));
+	double *x = malloc(n_axes * sizeof(*x));
+	size_t i, j;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(n_values != darray_size(self->info->pseudo_axes) || n_wavelengths == 0){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_WAVELENGTH_SCAN,
+			    "cannot scan the wavelength, wrong number of values (%d) or wavelengths (%d) given\n",
+			    n_values, n_wavelengths);
+		free(x);
+		free(prev2);
+		free(prev);
+		return NULL;
+	}
+
+	start = hkl_geometry_new_copy(geometry);
+	scan = hkl_geometry_list_new();
+
+	for(i=0; i<n_wavelengths; ++i){
+		HklGeometryList *solutions;
+		const HklGeometry *solution;
+
+		if(!hkl_geometry_wavelength_set(geometry, wavelengths[i], unit_type, error)){
+			g_assert(error == NULL || *error != NULL);
+			break;
+		}
+
+		/* predict the axes from the two previous points */
+		if(i > 1 && wavelengths[i - 1] != wavelengths[i - 2]){
+			double t = (wavelengths[i] - wavelengths[i - 1])
+				/ (wavelengths[i - 1] - wavelengths[i - 2]);
+
+			for(j=0; j<n_axes; ++j){
+				const HklParameter *axis = darray_item(geometry->axes, j);
+				double d = prev[j] - prev2[j];
+
+				if(axis->unit && axis->unit->type == HKL_UNIT_ANGLE_RAD)
+					d = gsl_sf_angle_restrict_symm(d);
+				x[j] = prev[j] + t * d;
+			}
+			if(!hkl_geometry_axes_values_set(geometry, x, n_axes,
+							 HKL_UNIT_DEFAULT, error)){
+				g_assert(error == NULL || *error != NULL);
+				break;
+			}
+		}
+
+		solutions = hkl_engine_pseudo_axes_values_set(self, values, n_values,
+							      unit_type, error);
+		if(!solutions){
+			g_assert(error == NULL || *error != NULL);
+			g_prefix_error(error, "wavelength %d: ", (int)i);
+			break;
+		}
+
+		/* the solutions are sorted from the predicted geometry */
+		solution = hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions));
+		list_add_tail(&scan->items, &hkl_geometry_list_item_new(solution)->list);
+		scan->n_items += 1;
+
+		memcpy(prev2, prev, n_axes * sizeof(*prev));
+		hkl_geometry_axes_values_get(solution, prev, n_axes, HKL_UNIT_DEFAULT);
+		hkl_geometry_set(geometry, solution);
+
+		hkl_geometry_list_free(solutions);
+	}
+
+	hkl_geometry_set(geometry, start);
+	hkl_engine_list_get(self->engines);
+	hkl_geometry_free(start);
+	free(x);
+	free(prev2);
+	free(prev);
+
+	if(i != n_wavelengths){
+		hkl_geometry_list_free(scan);
+		return NULL;
+	}
+
+	return scan;
+}
+
+/* the equivalents of a reflection are solved in chunks, each chunk
+ * with its own copy of the engine */
+struct equivalent_t
+{
+	double hkl[3];
+	HklGeometry *geometry; /* the fastest solution or NULL if unreachable */
+	double cost;
+};
+
+struct equivalents_chunk_t
+{
+	const HklEngine *engine;
+	struct equivalent_t *equivalents;
+	size_t begin;
+	size_t end;
+};
+
+static void equivalents_chunk_run(gpointer data, gpointer user_data)
+{
+	struct equivalents_chunk_t *chunk = data;
+	struct hkl_engine_clone_t clone;
+	size_t i;
+
+	if(hkl_engine_clone_init(&clone, chunk->engine))
+		for(i=chunk->begin; i<chunk->end; ++i){
+			struct equivalent_t *equivalent = &chunk->equivalents[i];
+			HklGeometryList *solutions;
+			HklGeometryListItem *item;
+
+			solutions = hkl_engine_pseudo_axes_values_set(clone.engine,
+								      equivalent->hkl, 3,
+								      HKL_UNIT_DEFAULT, NULL);
+			if(!solutions)
+				continue;
+
+			list_for_each(&solutions->items, item, list){
+				double cost = hkl_geometry_motion_time(clone.geometry,
+								       item->geometry);
+
+				if(!equivalent->geometry || cost < equivalent->cost){
+					if(equivalent->geometry)
+						hkl_geometry_free(equivalent->geometry);
+					equivalent->geometry = hkl_geometry_new_copy(item->geometry);
+					equivalent->cost = cost;
+				}
+			}
+			hkl_geometry_list_free(solutions);
+		}
+
+	hkl_engine_clone_release(&clone);
+}
+
+static int equivalent_cmp(const void *p1, const void *p2)
+{
+	const struct equivalent_t *e1 = p1;
+	const struct equivalent_t *e2 = p2;
+
+	/* the reachable first, then by motion cost */
+	if(!e1->geometry || !e2->geometry)
+		return !e1->geometry - !e2->geometry;
+
+	return e1->cost < e2->cost ? -1 : e1->cost > e2->cost;
+}
+
+/**
+ * hkl_engine_pseudo_axes_values_equivalents:
+ * @self: the this ptr
+ * @values: (array length=n_values): the h, k, l of the reflection
+ * @n_values: the number of pseudo axes of the engine, must be 3
+ * @operators: (array length=n_operators): the 3x3 matrices (row major)
+ *             of the symmetry operators of the point group acting on hkl
+ * @n_operators: the size of the operators array, a multiple of 9
+ * @equivalents: (out caller-allocates) (array): the reachable
+ *               equivalent reflections, ranked, @n_values values per
+ *               reflection. It must hold (@n_operators / 9) * @n_values
+ *               values, one reflection per operator.
+ * @n_equivalents: (out caller-allocates): the number of equivalent
+ *                 reflections stored in @equivalents.
+ * @unit_type: the unit type (default or user) of the values
+ * @error: return location for a GError, or NULL
+ *
+ * generate the distinct symmetry equivalents of a reflection, solve
+ * them in parallel and rank the reachable ones by the estimated
+ * motion time from the current geometry (see
+ * hkl_geometry_motion_time). For each equivalent the fastest solution
+ * is kept.
+ *
+ * Return value: #HklGeometryList with the geometry of each reachable
+ *               equivalent in the ranked order, or NULL if none is
+ *               reachable, use hkl_geometry_list_free to release the
+ *               memory once done.
+ **/
+HklGeometryList *hkl_engine_pseudo_axes_values_equivalents(HklEngine *self,
+							   double values[], size_t n_values,
+							   const double operators[], size_t n_operators,
+							   double equivalents[], size_t *n_equivalents,
+							   HklUnitEnum unit_type, GError **error)
+{
+	struct equivalent_t *eqs;
+	struct equivalents_chunk_t *chunks;
+	HklGeometryList *res = NULL;
+	GThreadPool *pool;
+	size_t n_eqs = 0;
+	size_t n_chunks;
+	size_t i, j, k;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	*n_equivalents = 0;
+
+	if(n_values != 3 || n_values != darray_size(self->info->pseudo_axes)
+	   || n_operators == 0 || n_operators % 9 != 0){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_EQUIVALENTS,
+			    "cannot solve the equivalents, wrong number of values (%d) or operators (%d) given\n",
+			    n_values, n_operators);
+		return NULL;
+	}
+
+	/* the distinct equivalents */
+	eqs = calloc(n_operators / 9, sizeof(*eqs));
+	for(i=0; i<n_operators / 9; ++i){
+		const double *op = &operators[9 * i];
+		double hkl[3];
+		int known = FALSE;
+
+		for(j=0; j<3; ++j){
+			const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, j);
+			double factor = unit_type == HKL_UNIT_USER
+				? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit)
+				: 1.;
+
+			hkl[j] = (op[3 * j] * values[0]
+				  + op[3 * j + 1] * values[1]
+				  + op[3 * j + 2] * values[2]) / factor;
+		}
+
+		for(k=0; k<n_eqs && !known; ++k)
+			known = fabs(eqs[k].hkl[0] - hkl[0]) < HKL_EPSILON
+				&& fabs(eqs[k].hkl[1] - hkl[1]) < HKL_EPSILON
+				&& fabs(eqs[k].hkl[2] - hkl[2]) < HKL_EPSILON;
+		if(!known)
+			memcpy(eqs[n_eqs++].hkl, hkl, sizeof(hkl));
+	}
+
+	n_chunks = MIN(n_eqs, g_get_num_processors());
+	chunks = calloc(n_chunks, sizeof(*chunks));
+	pool = g_thread_pool_new(equivalents_chunk_run, NULL, n_chunks, TRUE, NULL);
+	for(k=0; k<n_chunks; ++k){
+		chunks[k].engine = self;
+		chunks[k].equivalents = eqs;
+		chunks[k].begin = n_eqs * k / n_chunks;
+		chunks[k].end = n_eqs * (k + 1) / n_chunks;
+		if(!pool || !g_thread_pool_push(pool, &chunks[k], NULL))
+			equivalents_chunk_run(&chunks[k], NULL);
+	}
+	if(pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+	free(chunks);
+
+	qsort(eqs, n_eqs, sizeof(*eqs), equivalent_cmp);
+
+	for(i=0; i<n_eqs && eqs[i].geometry; ++i){
+		const HklParameter *pseudo_axis;
+
+		if(!res)
+			res = hkl_geometry_list_new();
+		list_add_tail(&res->items, &hkl_geometry_list_item_new(eqs[i].geometry)->list);
+		res->n_items += 1;
+
+		for(j=0; j<3; ++j){
+			pseudo_axis = darray_item(self->pseudo_axes, j);
+			equivalents[3 * i + j] = eqs[i].hkl[j]
+				* (unit_type == HKL_UNIT_USER
+				   ? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit)
+				   : 1.);
+		}
+		*n_equivalents += 1;
+	}
+
+	for(i=0; i<n_eqs; ++i)
+		if(eqs[i].geometry)
+			hkl_geometry_free(eqs[i].geometry);
+	free(eqs);
+
+	if(!res)
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_EQUIVALENTS,
+			    "none of the %d equivalents of (%f, %f, %f) is reachable\n",
+			    n_eqs, values[0], values[1], values[2]);
+
+	return res;
+}
+
+/* the batch of positions is computed in chunks of rows. The hkl
+ * engines use a kernel working directly on the axes values, blocks
+ * of rows are stored as structures of arrays so the quaternion
+ * products are vectorized (omp simd loops, -fopenmp-simd). The cos and
+ * sin of the axes stay scalar libm calls. The other engines use their
+ * own copy of the engine in each chunk. */
+#define BATCH_BLOCK 64
+
+struct batch_chunk_t
+{
+	const HklEngine *engine;
+	const double *positions;
+	size_t n_axes;
+	double *values;
+	size_t n_values;
+	const double *factors; /* the axes then the pseudo axes unit factors */
+	HklUnitEnum unit_type;
+	size_t begin;
+	size_t end;
+	int res;
+
+	/* the hkl kernel */
+	const HklHolder *sample;
+	const HklHolder *detector;
+	HklVector kf; /* kf of the detector at the zero position */
+	HklVector ki;
+	HklMatrix UB_1;
+};
+
+/* q = q_axis1 * q_axis2 * ... for the n rows of a block */
+static void batch_holder_quaternions(const HklHolder *self,
+				     const double *positions, size_t n_axes,
+				     const double *factors, size_t n,
+				     double q[4][BATCH_BLOCK])
+{
+	size_t i, r;
+
+	for(r=0; r<n; ++r){
+		q[0][r] = 1.;
+		q[1][r] = q[2][r] = q[3][r] = 0.;
+	}
+
+	for(i=0; i<self->config->len; ++i){
+		const size_t idx = self->config->idx[i];
+		const HklVector *axis_v = &container_of(darray_item(self->geometry->axes, idx),
+							HklAxis, parameter)->axis_v;
+		const double norm = hkl_vector_norm2(axis_v);
+		const double x = axis_v->data[0] / norm;
+		const double y = axis_v->data[1] / norm;
+		const double z = axis_v->data[2] / norm;
+		const double factor = factors[idx];
+		double cs[2][BATCH_BLOCK];
+
+		for(r=0; r<n; ++r){
+			const double angle = positions[r * n_axes + idx] / factor / 2.;
+
+			cs[0][r] = cos(angle);
+			cs[1][r] = sin(angle);
+		}
+
+#pragma omp simd
+		for(r=0; r<n; ++r){
+			const double c = cs[0][r];
+			const double s = cs[1][r];
+			const double a = q[0][r];
+			const double b = q[1][r];
+			const double cc = q[2][r];
+			const double d = q[3][r];
+
+			q[0][r] = a * c - (b * x + cc * y + d * z) * s;
+			q[1][r] = b * c + (a * x + cc * z - d * y) * s;
+			q[2][r] = cc * c + (a * y - b * z + d * x) * s;
+			q[3][r] = d * c + (a * z + b * y - cc * x) * s;
+		}
+	}
+}
+
+static void batch_chunk_hkl_run(struct batch_chunk_t *chunk)
+{
+	double qs[4][BATCH_BLOCK];
+	double qd[4][BATCH_BLOCK];
+	double Q[3][BATCH_BLOCK];
+	double H[3][BATCH_BLOCK];
+	double M[3][3]; /* UB^-1 with the unit factors of the pseudo axes */
+	size_t row, r, i, j;
+
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+			M[i][j] = chunk->UB_1.data[i][j] * chunk->factors[chunk->n_axes + i];
+
+	for(row=chunk->begin; row<chunk->end; row+=BATCH_BLOCK){
+		const size_t n = MIN(BATCH_BLOCK, chunk->end - row);
+		const double *positions = &chunk->positions[row * chunk->n_axes];
+		double *values = &chunk->values[row * chunk->n_values];
+
+		batch_holder_quaternions(chunk->sample, positions, chunk->n_axes,
+					 chunk->factors, n, qs);
+		batch_holder_quaternions(chunk->detector, positions, chunk->n_axes,
+					 chunk->factors, n, qd);
+
+		/* Q = qd.kf.qd* - ki */
+#pragma omp simd
+		for(r=0; r<n; ++r){
+			const double *v = chunk->kf.data;
+			const double a = qd[0][r];
+			const double b = qd[1][r];
+			const double c = qd[2][r];
+			const double d = qd[3][r];
+
+			Q[0][r] = 2 * ((-c*c - d*d) * v[0] + (b*c - a*d) * v[1] + (a*c + b*d) * v[2])
+				+ v[0] - chunk->ki.data[0];
+			Q[1][r] = 2 * ((a*d + b*c) * v[0] + (-b*b - d*d) * v[1] + (c*d - a*b) * v[2])
+				+ v[1] - chunk->ki.data[1];
+			Q[2][r] = 2 * ((b*d - a*c) * v[0] + (a*b + c*d) * v[1] + (-b*b - c*c) * v[2])
+				+ v[2] - chunk->ki.data[2];
+		}
+
+		/* hkl = UB^-1.qs*.Q.qs */
+#pragma omp simd
+		for(r=0; r<n; ++r){
+			const double a = qs[0][r];
+			const double b = -qs[1][r];
+			const double c = -qs[2][r];
+			const double d = -qs[3][r];
+			const double vx = 2 * ((-c*c - d*d) * Q[0][r] + (b*c - a*d) * Q[1][r] + (a*c + b*d) * Q[2][r])
+				+ Q[0][r];
+			const double vy = 2 * ((a*d + b*c) * Q[0][r] + (-b*b - d*d) * Q[1][r] + (c*d - a*b) * Q[2][r])
+				+ Q[1][r];
+			const double vz = 2 * ((b*d - a*c) * Q[0][r] + (a*b + c*d) * Q[1][r] + (-b*b - c*c) * Q[2][r])
+				+ Q[2][r];
+
+			H[0][r] = M[0][0] * vx + M[0][1] * vy + M[0][2] * vz;
+			H[1][r] = M[1][0] * vx + M[1][1] * vy + M[1][2] * vz;
+			H[2][r] = M[2][0] * vx + M[2][1] * vy + M[2][2] * vz;
+		}
+
+		for(r=0; r<n; ++r)
+			for(i=0; i<3; ++i)
+				values[r * chunk->n_values + i] = H[i][r];
+	}
+}
+
+static void batch_chunk_engine_run(struct batch_chunk_t *chunk)
+{
+	struct hkl_engine_clone_t clone;
+	double *positions = malloc(chunk->n_axes * sizeof(*positions));
+	size_t row;
+
+	chunk->res = hkl_engine_clone_init(&clone, chunk->engine);
+	for(row=chunk->begin; row<chunk->end && chunk->res; ++row){
+		memcpy(positions, &chunk->positions[row * chunk->n_axes],
+		       chunk->n_axes * sizeof(*positions));
+		chunk->res = hkl_geometry_axes_values_set(clone.geometry,
+							  positions, chunk->n_axes,
+							  chunk->unit_type, NULL)
+			&& hkl_engine_pseudo_axes_values_get(clone.engine,
+							     &chunk->values[row * chunk->n_values],
+							     chunk->n_values,
+							     chunk->unit_type, NULL);
+	}
+
+	hkl_engine_clone_release(&clone);
+	free(positions);
+}
+
+static void batch_chunk_run(gpointer data, gpointer user_data)
+{
+	struct batch_chunk_t *chunk = data;
+
+	if(chunk->engine->mode->ops->get == hkl_mode_get_hkl_real)
+		batch_chunk_hkl_run(chunk);
+	else
+		batch_chunk_engine_run(chunk);
+}
+
+/**
+ * hkl_engine_pseudo_axes_values_batch_get:
+ * @self: the this ptr
+ * @positions: (array length=n_positions): the axes values of each
+ *             point, row major, one row per point in the order of
+ *             hkl_geometry_axes_names_get
+ * @n_positions: the size of the positions array, a multiple of the
+ *               number of axes of the geometry
+ * @values: (out caller-allocates) (array length=n_values): the
+ *          pseudo axes values of each point, row major.
+ * @n_values: the size of the values array, must be the number of
+ *            points times the number of pseudo axes of the engine
+ * @unit_type: the unit type (default or user) of the positions and values
+ * @error: return location for a GError, or NULL
+ *
+ * compute the pseudo axes values of a whole stream of axes values
+ * (an encoder readback for example) in parallel. The geometry, the
+ * detector and the sample attached to the engine are used but not
+ * modified.
+ *
+ * return value: TRUE if succeded or FALSE otherwise.
+ **/
+int hkl_engine_pseudo_axes_values_batch_get(HklEngine *self,
+					    const double positions[], size_t n_positions,
+					    double values[], size_t n_values,
+					    HklUnitEnum unit_type, GError **error)
+{
+	const HklGeometry *geometry = self->engines->geometry;
+	const HklDetector *detector = self->engines->detector;
+	const size_t n_axes = darray_size(geometry->axes);
+	const size_t n_pseudo_axes = darray_size(self->info->pseudo_axes);
+	const size_t n_rows = n_positions / n_axes;
+	struct batch_chunk_t *chunks;
+	GThreadPool *pool;
+	double *factors;
+	size_t n_chunks;
+	size_t i, k;
+	int res = TRUE;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(!self->mode || !self->mode->ops->get || !self->engines->sample
+	   || n_positions % n_axes != 0 || n_values != n_rows * n_pseudo_axes){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_BATCH_GET,
+			    "cannot get the pseudo axes values, wrong number of positions (%d) or values (%d) given\n",
+			    n_positions, n_values);
+		return FALSE;
+	}
+
+	if(n_rows == 0)
+		return TRUE;
+
+	factors = malloc((n_axes + n_pseudo_axes) * sizeof(*factors));
+	for(i=0; i<n_axes; ++i){
+		const HklParameter *axis = darray_item(geometry->axes, i);
+
+		factors[i] = unit_type == HKL_UNIT_USER
+			? hkl_unit_factor(axis->unit, axis->punit) : 1.;
+	}
+	for(i=0; i<n_pseudo_axes; ++i){
+		const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, i);
+
+		factors[n_axes + i] = unit_type == HKL_UNIT_USER
+			? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit) : 1.;
+	}
+
+	n_chunks = MIN(n_rows, g_get_num_processors());
+	chunks = calloc(n_chunks, sizeof(*chunks));
+	for(k=0; k<n_chunks; ++k){
+		chunks[k].engine = self;
+		chunks[k].positions = positions;
+		chunks[k].n_axes = n_axes;
+		chunks[k].values = values;
+		chunks[k].n_values = n_pseudo_axes;
+		chunks[k].factors = factors;
+		chunks[k].unit_type = unit_type;
+		chunks[k].begin = n_rows * k / n_chunks;
+		chunks[k].end = n_rows * (k + 1) / n_chunks;
+		chunks[k].res = TRUE;
+	}
+
+	if(self->mode->ops->get == hkl_mode_get_hkl_real){
+		struct batch_chunk_t kernel = chunks[0];
+		HklVector e;
+
+		/* for now the 0 holder is the sample holder. */
+		kernel.sample = darray_item(geometry->holders, 0);
+		kernel.detector = darray_item(geometry->holders, detector->idx);
+
+		hkl_vector_init(&kernel.kf, HKL_TAU / geometry->source.wave_length, 0, 0);
+		if (detector->type == HKL_DETECTOR_TYPE_2D)
+			hkl_matrix_times_vector(&detector->d2.orientation, &kernel.kf);
+		hkl_source_compute_ki(&geometry->source, &kernel.ki);
+
+		/* UB^-1, column by column */
+		for(i=0; i<3 && res; ++i){
+			HklVector x;
+
+			hkl_vector_init(&e, i == 0, i == 1, i == 2);
+			res = hkl_matrix_solve(&self->engines->sample->UB, &x, &e) == 0;
+			for(k=0; k<3; ++k)
+				kernel.UB_1.data[k][i] = x.data[k];
+		}
+
+		for(k=0; k<n_chunks; ++k){
+			chunks[k].sample = kernel.sample;
+			chunks[k].detector = kernel.detector;
+			chunks[k].kf = kernel.kf;
+			chunks[k].ki = kernel.ki;
+			chunks[k].UB_1 = kernel.UB_1;
+		}
+	}
+
+	if(res){
+		pool = g_thread_pool_new(batch_chunk_run, NULL, n_chunks, TRUE, NULL);
+		for(k=0; k<n_chunks; ++k)
+			if(!pool || !g_thread_pool_push(pool, &chunks[k], NULL))
+				batch_chunk_run(&chunks[k], NULL);
+		if(pool)
+			g_thread_pool_free(pool, FALSE, TRUE);
+
+		for(k=0; k<n_chunks; ++k)
+			res &= chunks[k].res;
+	}
+
+	free(chunks);
+	free(factors);
+
+	if(!res)
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXES_VALUES_BATCH_GET,
+			    "cannot compute the \"%s\" pseudo axes values of the positions\n",
+			    self->info->name);
+
+	return res;
+}
+
+/* synchronize the engine internals with the engine list without
+ * allocation */
+static int hkl_engine_jacobian_prepare(HklEngine *self, int code, GError **error)
+{
+	hkl_error (error == NULL || *error == NULL);
+
+	if(!self->engines || !self->engines->geometry || !self->engines->sample
+	   || !self->engines->detector || !self->geometry || !self->sample
+	   || !self->mode || !self->mode->ops->get){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    code,
+			    "the \"%s\" mode of the \"%s\" engine has no jacobian",
+			    self->mode ? self->mode->info->name : "",
+			    self->info->name);
+		return FALSE;
+	}
+
+	hkl_geometry_set(self->geometry, self->engines->geometry);
+	self->sample->UB = self->engines->sample->UB;
+
+	return TRUE;
+}
+
+/* the lab frame direction of an axis of a holder for the current
+ * geometry, the axis vector rotated by the axes before it in the
+ * holder chain. FALSE if the axis does not move the holder. */
+static int holder_axis_direction(const HklHolder *holder, size_t idx,
+				 HklVector *direction)
+{
+	HklQuaternion q = {{1, 0, 0, 0}};
+	size_t i;
+
+	for(i=0; i<holder->config->len; ++i){
+		const HklAxis *axis = container_of(darray_item(holder->geometry->axes,
+							       holder->config->idx[i]),
+						   HklAxis, parameter);
+
+		if(holder->config->idx[i] == idx){
+			*direction = axis->axis_v;
+			hkl_vector_normalize(direction);
+			hkl_vector_rotated_quaternion(direction, &q);
+			return TRUE;
+		}
+		hkl_quaternion_times_quaternion(&q, &axis->q);
+	}
+
+	return FALSE;
+}
+
+/*
+ * analytic jacobian dh/dθ (default units) of the hkl and q engines,
+ * for a single evaluation of the geometry. With Q = kf - ki and
+ * hkl = (Rs.UB)^-1.Q, the derivative along θk of a holder rotation
+ * R = R1...Rn applied to a vector v is ak x (R.v), ak being the lab
+ * frame direction of the axis k, so
+ *
+ *   dQ/dθk = ak x kf for a detector axis
+ *   dhkl/dθk = (Rs.UB)^-1.(dQ/dθk - ak x Q) for a sample axis
+ *   dq/dθk = ±Q.dQ/dθk / |Q|
+ *
+ * Returns FALSE when the engine has no closed form.
+ */
+static int engine_jacobian_analytic(HklEngine *self, double jacobian[])
+{
+	const size_t n = darray_size(self->axes);
+	HklGeometry *geometry = self->geometry;
+	const HklDetector *detector = self->engines->detector;
+	const int is_hkl = self->mode->ops->get == hkl_mode_get_hkl_real;
+	const HklHolder *sample_holder;
+	const HklHolder *detector_holder;
+	HklQuaternion qs;
+	HklVector ki, kf, Q;
+	double sign = 1.;
+	double norm;
+	size_t i, j;
+
+	if((!is_hkl && self->mode->ops->get != hkl_mode_get_q_real)
+	   || detector->idx >= darray_size(geometry->holders))
+		return FALSE;
+
+	/* this also updates the holders of the geometry */
+	hkl_source_compute_ki(&geometry->source, &ki);
+	hkl_detector_compute_kf(detector, geometry, &kf);
+	Q = kf;
+	hkl_vector_minus_vector(&Q, &ki);
+	norm = hkl_vector_norm2(&Q);
+
+	if(!is_hkl){
+		/* |Q| has no derivative for Q = 0 */
+		if(norm < HKL_EPSILON)
+			return FALSE;
+		if(kf.data[1] < 0 || kf.data[2] < 0)
+			sign = -1.;
+	}
+
+	/* for now the 0 holder is the sample holder */
+	sample_holder = darray_item(geometry->holders, 0);
+	detector_holder = darray_item(geometry->holders, detector->idx);
+	qs = sample_holder->q;
+	hkl_quaternion_conjugate(&qs);
+
+	for(j=0; j<n; ++j){
+		const size_t idx = hkl_geometry_get_axis_idx_by_name(geometry,
+								     darray_item(self->axes, j)->name);
+		HklVector dQ = {{0, 0, 0}};
+		HklVector dhkl;
+		HklVector a;
+
+		if(holder_axis_direction(detector_holder, idx, &a)){
+			dQ = a;
+			hkl_vector_vectorial_product(&dQ, &kf);
+		}
+
+		if(!is_hkl){
+			jacobian[j] = sign * hkl_vector_scalar_product(&Q, &dQ) / norm;
+			continue;
+		}
+
+		if(holder_axis_direction(sample_holder, idx, &a)){
+			hkl_vector_vectorial_product(&a, &Q);
+			hkl_vector_minus_vector(&dQ, &a);
+		}
+		hkl_vector_rotated_quaternion(&dQ, &qs);
+		if(hkl_matrix_solve(&self->sample->UB, &dhkl, &dQ))
+			return FALSE;
+		for(i=0; i<3; ++i)
+			jacobian[i * n + j] = dhkl.data[i];
+	}
+
+	return TRUE;
+}
+
+/* jacobian dh/dθ (default units) by forward differences of the mode
+ * get method, one evaluation of the geometry per axis */
+static int engine_jacobian_finite_differences(HklEngine *self, double jacobian[],
+					      GError **error)
+{
+	const size_t n = darray_size(self->axes);
+	const size_t n_h = darray_size(self->pseudo_axes);
+	double x[n];
+	double h[n_h];
+	size_t i, j;
+	int res = TRUE;
+
+	if(!hkl_engine_get(self, error)){
+		g_assert (error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	for(i=0; i<n; ++i)
+		x[i] = darray_item(self->axes, i)->_value;
+	for(i=0; i<n_h; ++i)
+		h[i] = darray_item(self->pseudo_axes, i)->_value;
+
+	for(j=0; j<n && res; ++j){
+		const double xj = x[j];
+		const double dx = GSL_SQRT_DBL_EPSILON * (fabs(xj) > 1. ? fabs(xj) : 1.);
+
+		x[j] = xj + dx;
+		set_geometry_axes(self, x);
+		res = self->mode->ops->get(self->mode, self, self->geometry,
+					   self->engines->detector, self->sample,
+					   error);
+		x[j] = xj;
+
+		for(i=0; i<n_h && res; ++i)
+			jacobian[i * n + j] = (darray_item(self->pseudo_axes, i)->_value - h[i]) / dx;
+	}
+
+	/* restore the current state */
+	set_geometry_axes(self, x);
+	for(i=0; i<n_h; ++i)
+		darray_item(self->pseudo_axes, i)->_value = h[i];
+
+	return res;
+}
+
+/**
+ * hkl_engine_jacobian_get:
+ * @self: the this ptr
+ * @jacobian: (out caller-allocates) (array length=n_jacobian): the
+ *            jacobian, row major
+ * @n_jacobian: the size of the jacobian array, the number of pseudo
+ *              axes times the number of axes of the current mode
+ * @unit_type: the unit type (default or user) of the jacobian
+ * @error: return location for a GError, or NULL
+ *
+ * compute the jacobian J = dh/dθ of the pseudo axes h with respect
+ * to the axes θ of the current mode (see
+ * hkl_engine_axis_names_get(HKL_ENGINE_AXIS_NAMES_GET_WRITE)) for the
+ * current geometry. The hkl and q engines use the analytic jacobian,
+ * for the price of one evaluation of the geometry. The other engines
+ * fall back to forward differences of the mode get method, one
+ * evaluation per axis. Nothing is allocated.
+ *
+ * Returns: TRUE on success, FALSE otherwise.
+ **/
+int hkl_engine_jacobian_get(HklEngine *self,
+			    double jacobian[], size_t n_jacobian,
+			    HklUnitEnum unit_type, GError **error)
+{
+	const size_t n = darray_size(self->axes);
+	const size_t n_h = darray_size(self->pseudo_axes);
+	size_t i, j;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if(n_jacobian != n * n_h){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_JACOBIAN_GET,
+			    "the jacobian must contain %zu values, not %zu",
+			    n * n_h, n_jacobian);
+		return FALSE;
+	}
+
+	if(!hkl_engine_jacobian_prepare(self, HKL_ENGINE_ERROR_JACOBIAN_GET, error)){
+		g_assert (error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if(!engine_jacobian_analytic(self, jacobian)
+	   && !engine_jacobian_finite_differences(self, jacobian, error)){
+		g_assert (error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if(unit_type == HKL_UNIT_USER)
+		for(i=0; i<n_h; ++i){
+			const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, i);
+
+			for(j=0; j<n; ++j){
+				const HklParameter *axis = darray_item(self->axes, j);
+
+				jacobian[i * n + j] *= hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit)
+					/ hkl_unit_factor(axis->unit, axis->punit);
+			}
+		}
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_jacobian_solve:
+ * @self: the this ptr
+ * @dh: (array length=n_dh): the pseudo axes variations
+ * @n_dh: the size of the dh array, the number of pseudo axes
+ * @dtheta: (out caller-allocates) (array length=n_dtheta): the axes
+ *          variations
+ * @n_dtheta: the size of the dtheta array, the number of axes of the
+ *            current mode
+ * @unit_type: the unit type (default or user) of dh and dtheta
+ * @error: return location for a GError, or NULL
+ *
+ * solve J.dθ = dh for the current geometry, J being the jacobian of
+ * hkl_engine_jacobian_get. This works as well with velocities, so it
+ * is the velocity map needed by feedback loops.
+ *
+ * When the mode has as many axes as pseudo axes, the analytic
+ * jacobian of the hkl and q engines is inverted directly. Otherwise
+ * the constraints of the mode (for example omega = tth / 2 in
+ * bissector) select the solution: with F(θ, h) = 0 the equations of
+ * the mode, dθ = -(dF/dθ)^-1.dF/dh.dh, dF being computed by forward
+ * differences of the mode equations. Nothing is allocated.
+ *
+ * Returns: TRUE on success, FALSE if the mode has no jacobian or if
+ * the geometry is singular.
+ **/
+int hkl_engine_jacobian_solve(HklEngine *self,
+			      const double dh[], size_t n_dh,
+			      double dtheta[], size_t n_dtheta,
+			      HklUnitEnum unit_type, GError **error)
+{
+	const size_t n = darray_size(self->axes);
+	const size_t n_h = darray_size(self->pseudo_axes);
+	double f[n];
+	double jx[n * n];
+	double jh[n * n_h];
+	size_t i, j;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if(n_dh != n_h || n_dtheta != n){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_JACOBIAN_SOLVE,
+			    "wrong number of values dh: %zu (expected %zu), dtheta: %zu (expected %zu)",
+			    n_dh, n_h, n_dtheta, n);
+		return FALSE;
+	}
+
+	if(!hkl_engine_jacobian_prepare(self, HKL_ENGINE_ERROR_JACOBIAN_SOLVE, error)){
+		g_assert (error == NULL || *error != NULL);
+		return FALSE;
+	}
+
+	if(n == n_h && engine_jacobian_analytic(self, jx)){
+		for(i=0; i<n; ++i){
+			const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, i);
+			const double factor = unit_type == HKL_UNIT_USER
+				? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit) : 1.;
+
+			dtheta[i] = dh[i] / factor;
+		}
+	}else{
+		if(!self->mode->ops->jacobian){
+			g_set_error(error,
+				    HKL_ENGINE_ERROR,
+				    HKL_ENGINE_ERROR_JACOBIAN_SOLVE,
+				    "the \"%s\" mode of the \"%s\" engine has no jacobian",
+				    self->mode->info->name, self->info->name);
+			return FALSE;
+		}
+
+		if(!hkl_engine_get(self, error)
+		   || !self->mode->ops->jacobian(self->mode, self, f, jx, jh, error)){
+			g_assert (error == NULL || *error != NULL);
+			return FALSE;
+		}
+
+		for(i=0; i<n; ++i){
+			dtheta[i] = 0.;
+			for(j=0; j<n_h; ++j){
+				const HklParameter *pseudo_axis = darray_item(self->pseudo_axes, j);
+				const double factor = unit_type == HKL_UNIT_USER
+					? hkl_unit_factor(pseudo_axis->unit, pseudo_axis->punit) : 1.;
+
+				dtheta[i] -= jh[i * n_h + j] * dh[j] / factor;
+			}
+		}
+	}
+
+	if(!hkl_mode_auto_linear_solve(jx, dtheta, n)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_JACOBIAN_SOLVE,
+			    "the jacobian of the \"%s\" mode is singular for this geometry",
+			    self->mode->info->name);
+		return FALSE;
+	}
+
+	if(unit_type == HKL_UNIT_USER)
+		for(i=0; i<n; ++i){
+			const HklParameter *axis = darray_item(self->axes, i);
+
+			dtheta[i] *= hkl_unit_factor(axis->unit, axis->punit);
+		}
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_clone_init: (skip)
+ * @self: the clone to initialize
+ * @src: the engine to copy
+ *
+ * create a new engine list from the factory of the @src geometry,
+ * with copies of its geometry, detector and sample, and select the
+ * same engine, mode, mode parameters and initialization reference state. The clone
+ * is independent of @src so it can be used from another thread.
+ *
+ * Returns: FALSE if the engine could not be reproduced, the clone
+ * must be released in all cases with hkl_engine_clone_release.
+ **/
+int hkl_engine_clone_init(struct hkl_engine_clone_t *self, const HklEngine *src)
+{
+	const HklEngineList *engines = src->engines;
+	size_t n_parameters;
+	double *parameters;
+	int res = FALSE;
+
+	self->geometry = hkl_geometry_new_copy(engines->geometry);
+	self->detector = hkl_detector_new_copy(engines->detector);
+	self->sample = hkl_sample_new_copy(engines->sample);
+	self->engines = hkl_factory_create_new_engine_list(self->geometry->factory);
+	hkl_engine_list_init(self->engines, self->geometry, self->detector, self->sample);
+	self->engines->range_constrained = engines->range_constrained;
+
+	self->engine = hkl_engine_list_engine_get_by_name(self->engines, src->info->name, NULL);
+	if(!self->engine || !src->mode
+	   || !hkl_engine_current_mode_set(self->engine, src->mode->info->name, NULL))
+		return FALSE;
+
+	n_parameters = darray_size(src->mode->parameters);
+	parameters = malloc(n_parameters * sizeof(*parameters));
+	hkl_engine_parameters_values_get(src, parameters, n_parameters, HKL_UNIT_DEFAULT);
+	if(n_parameters == 0
+	   || hkl_engine_parameters_values_set(self->engine, parameters, n_parameters,
+					       HKL_UNIT_DEFAULT, NULL))
+		res = TRUE;
+	free(parameters);
+
+	/* copy the reference state, re-initializing would recompute it
+	 * at the current geometry */
+	if(res)
+		hkl_mode_initialized_copy(self->engine->mode, src->mode);
+
+	return res;
+}
+
+/**
+ * hkl_engine_clone_release: (skip)
+ * @self: the clone to release
+ *
+ * release the memory of an engine clone
+ **/
+void hkl_engine_clone_release(struct hkl_engine_clone_t *self)
+{
+	hkl_engine_list_free(self->engines);
+	hkl_sample_free(self->sample);
+	hkl_detector_free(self->detector);
+	hkl_geometry_free(self->geometry);
+}
+
 /**
  * hkl_engine_pseudo_axis_get: (skip)
  * @self: the this ptr
@@ -544,6 +1941,10 @@ int hkl_engine_initialized_set(HklEngine *self, int initialized, GError **error)
 		return FALSE;
 	}
 
+	/* the cached solutions depend on the reference state of the
+	 * initialization which is not part of the keys */
+	engine_list_cache_clear(self->engines);
+
 	return hkl_mode_initialized_set(self->mode,
 					self,
 					self->engines->geometry,
@@ -603,6 +2004,7 @@ void hkl_engine_fprintf(FILE *f, const HklEngine *self)
  **/
 void hkl_engine_list_free(HklEngineList *self)
 {
+	engine_list_cache_clear(self);
 	hkl_engine_list_clear(self);
 	hkl_geometry_list_free(self->geometries);
 	free(self);
@@ -634,6 +2036,7 @@ int hkl_engine_list_geometry_set(HklEngineList *self, const HklGeometry *geometr
 {
 	if(!hkl_geometry_set(self->geometry, geometry))
 		return FALSE;
+	hkl_geometry_motion_set_from(self->geometry, geometry);
 
 	hkl_engine_list_get(self);
 
@@ -655,6 +2058,61 @@ int hkl_engine_list_select_solution(HklEngineList *self,
 	return hkl_geometry_init_geometry(self->geometry, item->geometry);
 }
 
+/**
+ * hkl_engine_list_range_constrained_get:
+ * @self: the this ptr
+ *
+ * Return: TRUE if the numerical solvers respect the axes range during
+ * the search.
+ **/
+int hkl_engine_list_range_constrained_get(const HklEngineList *self)
+{
+	return self->range_constrained;
+}
+
+/**
+ * hkl_engine_list_range_constrained_set:
+ * @self: the this ptr
+ * @range_constrained: TRUE to constrain the search in the axes range.
+ *
+ * By default the numerical solvers compute the solutions without
+ * taking care of the axes range and the out of range solutions are
+ * removed afterward. When range constrained, the search itself is
+ * done in the axes range (bounded variables) and the sectors out of
+ * range are not explored. This is usefull with tight axes limits.
+ **/
+void hkl_engine_list_range_constrained_set(HklEngineList *self,
+					   int range_constrained)
+{
+	self->range_constrained = range_constrained;
+}
+
+/**
+ * hkl_engine_list_solutions_cache_set:
+ * @self: the this ptr
+ * @capacity: the maximum number of cached targets, 0 to disable the cache.
+ * @quantum: the pseudo axes values are rounded to this step (default
+ *           unit) before the lookup, 0 for an exact match.
+ *
+ * keep the result of the last @capacity
+ * hkl_engine_pseudo_axes_values_set calls, the least recently used
+ * being dropped first. A target requested again with the same
+ * engine state (mode and its parameters, sample UB, wavelength,
+ * detector, axes range and values of the axes not computed by the
+ * mode) returns the cached solutions sorted for the current geometry
+ * without solving again. The unreachable targets are cached too and
+ * fail immediately. The cache is emptied by this method and by
+ * hkl_engine_initialized_set, the reference state of the
+ * initialization being kept by the modes.
+ **/
+void hkl_engine_list_solutions_cache_set(HklEngineList *self,
+					 size_t capacity, double quantum)
+{
+	engine_list_cache_clear(self);
+	self->cache.capacity = capacity;
+	self->cache.quantum = quantum;
+}
+
 /**
  * hkl_engine_list_engine_get_by_name:
  * @self: the this ptr
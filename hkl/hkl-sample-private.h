@@ -23,6 +23,7 @@
 #define __HKL_SAMPLE_PRIVATE_H__
 
 #include <stdio.h>                      // for FILE
+#include "ccan/darray/darray.h"         // for darray
 #include "ccan/list/list.h"             // for list_head, list_node
 #include "hkl-matrix-private.h"         // for _HklMatrix
 #include "hkl-vector-private.h"         // for HklVector
@@ -34,6 +35,47 @@ G_BEGIN_DECLS
 /* HklSample */
 /*************/
 
+/*
+ * structure of arrays copy of the flagged reflections (hkl and
+ * _hkl), rebuilt when the reflections were added, removed or
+ * modified. The fitness functions loop over these contiguous arrays
+ * instead of walking the reflections list.
+ */
+struct hkl_sample_packed_t {
+	int valid;
+	size_t n;
+	darray(double) hkl[3];
+	darray(double) _hkl[3];
+};
+
+/*
+ * the reciprocal lattice vectors used by the auto-indexing, sorted by
+ * norm and grouped into shells of the same norm. They are computed
+ * for a given version of the lattice and range of hkl. The angles
+ * between the vectors of two shells are computed on demand and kept
+ * with them, for a bounded number of pairs of shells.
+ */
+struct hkl_sample_autoindex_g_t {
+	HklVector hkl;
+	HklVector G; /* B.hkl */
+	double norm;
+};
+
+struct hkl_sample_autoindex_shell_t {
+	size_t begin;
+	size_t end;
+	double norm;
+};
+
+struct hkl_sample_autoindex_t {
+	int valid;
+	unsigned int version; /* of the lattice */
+	int hmax[3];
+	darray(struct hkl_sample_autoindex_g_t) gs;
+	darray(struct hkl_sample_autoindex_shell_t) shells;
+	GHashTable *angles; /* pair of shells -> sorted angles */
+};
+
 struct _HklSample {
 	char *name;
 	HklLattice *lattice;
@@ -44,6 +86,8 @@ struct _HklSample {
 	HklParameter *uz;
 	struct list_head reflections;
 	size_t n_reflections;
+	struct hkl_sample_packed_t packed;
+	struct hkl_sample_autoindex_t autoindex;
 };
 
 #define HKL_SAMPLE_ERROR hkl_sample_error_quark ()
@@ -56,6 +100,9 @@ static GQuark hkl_sample_error_quark (void)
 typedef enum {
 	HKL_SAMPLE_ERROR_MINIMIZED, /* can not minimize the sample */
 	HKL_SAMPLE_ERROR_COMPUTE_UB_BUSING_LEVY, /* can not compute UB */
+	HKL_SAMPLE_ERROR_COMPUTE_U_LEAST_SQUARES, /* can not compute U */
+	HKL_SAMPLE_ERROR_COMPUTE_UB_RANSAC, /* can not compute UB */
+	HKL_SAMPLE_ERROR_AUTOINDEX, /* can not index the reflections */
 } HklSampleError;
 
 
@@ -72,6 +119,7 @@ struct _HklSampleReflection {
 	HklVector hkl;
 	HklVector _hkl;
 	int flag;
+	HklSample *sample; /* the owner, NULL if not yet added */
 	struct list_node list;
 };
 
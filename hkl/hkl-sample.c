@@ -23,6 +23,9 @@
 /* for strdup */
 #define _XOPEN_SOURCE 500
 #include <gsl/gsl_errno.h>              // for gsl_set_error_handler, etc
+#include <gsl/gsl_linalg.h>             // for gsl_linalg_SV_decomp_jacobi
+#include <gsl/gsl_matrix_double.h>      // for gsl_matrix_set
+#include <gsl/gsl_multifit_nlinear.h>   // for gsl_multifit_nlinear_fdf, etc
 #include <gsl/gsl_multimin.h>           // for gsl_multimin_function, etc
 #include <gsl/gsl_nan.h>                // for GSL_NAN
 #include <gsl/gsl_vector_double.h>      // for gsl_vector_get, etc
@@ -48,6 +51,10 @@
 
 /* #define DEBUG */
 #define ITER_MAX 10000
+#define LM_XTOL 1e-10
+#define LM_GTOL 1e-10
+#define AUTOINDEX_N_SEEDS 8
+#define AUTOINDEX_ANGLES_MAX 4096
 
 /* private */
 static void hkl_sample_clear_all_reflections(HklSample *self)
@@ -59,6 +66,7 @@ static void hkl_sample_clear_all_reflections(HklSample *self)
 		list_del(&reflection->list);
 		hkl_sample_reflection_free(reflection);
 	}
+	self->packed.valid = FALSE;
 }
 
 
@@ -68,10 +76,99 @@ static void hkl_sample_copy_all_reflections(HklSample *self, const  HklSample *s
 
 	list_head_init(&self->reflections);
 	list_for_each(&src->reflections, reflection, list){
-		list_add_tail(&self->reflections,
-			      &hkl_sample_reflection_new_copy(reflection)->list);
+		HklSampleReflection *dup = hkl_sample_reflection_new_copy(reflection);
+
+		dup->sample = self;
+		list_add_tail(&self->reflections, &dup->list);
 	}
 	self->n_reflections = src->n_reflections;
+	self->packed.valid = FALSE;
+}
+
+static void hkl_sample_packed_init(struct hkl_sample_packed_t *self)
+{
+	size_t i;
+
+	self->valid = FALSE;
+	self->n = 0;
+	for(i=0; i<3; ++i){
+		darray_init(self->hkl[i]);
+		darray_init(self->_hkl[i]);
+	}
+}
+
+static void hkl_sample_packed_release(struct hkl_sample_packed_t *self)
+{
+	size_t i;
+
+	for(i=0; i<3; ++i){
+		darray_free(self->hkl[i]);
+		darray_free(self->_hkl[i]);
+	}
+}
+
+/*
+ * return the packed flagged reflections, rebuilt only if the
+ * reflections changed since the last call.
+ */
+static const struct hkl_sample_packed_t *hkl_sample_packed_get(HklSample *self)
+{
+	struct hkl_sample_packed_t *packed = &self->packed;
+	HklSampleReflection *reflection;
+	size_t i;
+	size_t n = 0;
+
+	if (packed->valid)
+		return packed;
+
+	for(i=0; i<3; ++i){
+		darray_resize(packed->hkl[i], self->n_reflections);
+		darray_resize(packed->_hkl[i], self->n_reflections);
+	}
+
+	list_for_each(&self->reflections, reflection, list){
+		if(reflection->flag){
+			for(i=0; i<3; ++i){
+				packed->hkl[i].item[n] = reflection->hkl.data[i];
+				packed->_hkl[i].item[n] = reflection->_hkl.data[i];
+			}
+			++n;
+		}
+	}
+	packed->n = n;
+	packed->valid = TRUE;
+
+	return packed;
+}
+
+/*
+ * sum of the squared residuals UB.h - Q over the packed reflections,
+ * the loop has no branch. The simd reduction lets the compiler
+ * reorder the sum to vectorize it (-fopenmp-simd).
+ */
+static double hkl_sample_packed_chi2(const struct hkl_sample_packed_t *self,
+				     const HklMatrix *UB)
+{
+	size_t i;
+	double chi2 = 0.;
+	const double *h = self->hkl[0].item;
+	const double *k = self->hkl[1].item;
+	const double *l = self->hkl[2].item;
+	const double *qx = self->_hkl[0].item;
+	const double *qy = self->_hkl[1].item;
+	const double *qz = self->_hkl[2].item;
+	const double (*M)[3] = UB->data;
+
+#pragma omp simd reduction(+:chi2)
+	for(i=0; i<self->n; ++i){
+		double rx = M[0][0] * h[i] + M[0][1] * k[i] + M[0][2] * l[i] - qx[i];
+		double ry = M[1][0] * h[i] + M[1][1] * k[i] + M[1][2] * l[i] - qy[i];
+		double rz = M[2][0] * h[i] + M[2][1] * k[i] + M[2][2] * l[i] - qz[i];
+
+		chi2 += rx * rx + ry * ry + rz * rz;
+	}
+
+	return chi2;
 }
 
 
@@ -116,6 +213,13 @@ static void hkl_sample_reflection_update(HklSampleReflection *self)
 	hkl_vector_rotated_quaternion(&self->_hkl, &q);
 }
 
+/* the packed reflections of the owner must be rebuilt */
+static void hkl_sample_reflection_changed(HklSampleReflection *self)
+{
+	if(self->sample)
+		self->sample->packed.valid = FALSE;
+}
+
 static void hkl_sample_compute_UxUyUz(HklSample *self)
 {
 	double ux;
@@ -162,12 +266,10 @@ static int hkl_sample_init_from_gsl_vector(HklSample *self, const gsl_vector *x)
 	hkl_parameter_value_set(self->ux, euler_x, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->uy, euler_y, HKL_UNIT_DEFAULT, NULL);
 	hkl_parameter_value_set(self->uz, euler_z, HKL_UNIT_DEFAULT, NULL);
-	hkl_parameter_value_set(self->lattice->a, gsl_vector_get(x, 3), HKL_UNIT_DEFAULT, NULL);
-	hkl_parameter_value_set(self->lattice->b, gsl_vector_get(x, 4), HKL_UNIT_DEFAULT, NULL);
-	hkl_parameter_value_set(self->lattice->c, gsl_vector_get(x, 5), HKL_UNIT_DEFAULT, NULL);
-	hkl_parameter_value_set(self->lattice->alpha, gsl_vector_get(x, 6), HKL_UNIT_DEFAULT, NULL);
-	hkl_parameter_value_set(self->lattice->beta, gsl_vector_get(x, 7), HKL_UNIT_DEFAULT, NULL);
-	hkl_parameter_value_set(self->lattice->gamma, gsl_vector_get(x, 8), HKL_UNIT_DEFAULT, NULL);
+	/* the cached B matrix is kept when the lattice is not fitted */
+	hkl_lattice_values_set(self->lattice,
+			       gsl_vector_get(x, 3), gsl_vector_get(x, 4), gsl_vector_get(x, 5),
+			       gsl_vector_get(x, 6), gsl_vector_get(x, 7), gsl_vector_get(x, 8));
 
 	hkl_matrix_init_from_euler(&self->U, euler_x, euler_y, euler_z);
 	if (!hkl_sample_compute_UB(self))
@@ -190,6 +292,25 @@ static void hkl_sample_to_gsl_vector(HklSample *self, gsl_vector *x)
 
 }
 
+/*
+ * is the idx parameter of the gsl vector (ux, uy, uz, a, b, c, alpha,
+ * beta, gamma) fitted. The lattice parameters tied or fixed by the
+ * crystal system are never fitted.
+ */
+static int hkl_sample_parameter_fit(const HklSample *self, size_t idx)
+{
+	const HklParameter *parameters[] = {
+		self->ux, self->uy, self->uz,
+		self->lattice->a, self->lattice->b, self->lattice->c,
+		self->lattice->alpha, self->lattice->beta, self->lattice->gamma,
+	};
+
+	if (idx >= 3 && hkl_lattice_parameter_tie(self->lattice, idx - 3) != (int)(idx - 3))
+		return FALSE;
+
+	return parameters[idx]->fit;
+}
+
 static double set_UB_fitness(const gsl_vector *x, void *params)
 {
 	size_t i, j;
@@ -213,29 +334,12 @@ static double set_UB_fitness(const gsl_vector *x, void *params)
 
 static double mono_crystal_fitness(const gsl_vector *x, void *params)
 {
-	size_t i, j;
-	double fitness;
 	HklSample *sample = params;
-	HklSampleReflection *reflection;
 
 	if (!hkl_sample_init_from_gsl_vector(sample, x))
 		return GSL_NAN;
 
-	fitness = 0.;
-	list_for_each(&sample->reflections, reflection, list){
-		if(reflection->flag){
-			HklVector UBh;
-
-			UBh = reflection->hkl;
-			hkl_matrix_times_vector(&sample->UB, &UBh);
-
-			for(j=0; j<3; ++j) {
-				double tmp = UBh.data[j] - reflection->_hkl.data[j];
-				fitness += tmp * tmp;
-			}
-		}
-	}
-	return fitness;
+	return hkl_sample_packed_chi2(hkl_sample_packed_get(sample), &sample->UB);
 }
 
 static int minimize(HklSample *sample,
@@ -247,6 +351,7 @@ static int minimize(HklSample *sample,
 	gsl_multimin_fminimizer *s = NULL;
 	gsl_vector *ss, *x;
 	gsl_multimin_function minex_func;
+	size_t i;
 	size_t iter = 0;
 	int status;
 	double size = 0;
@@ -263,15 +368,8 @@ static int minimize(HklSample *sample,
 
 	/* Set initial step sizes to 1 */
 	ss = gsl_vector_alloc (9);
-	gsl_vector_set (ss, 0, sample->ux->fit);
-	gsl_vector_set (ss, 1, sample->uy->fit);
-	gsl_vector_set (ss, 2, sample->uz->fit);
-	gsl_vector_set (ss, 3, sample->lattice->a->fit);
-	gsl_vector_set (ss, 4, sample->lattice->b->fit);
-	gsl_vector_set (ss, 5, sample->lattice->c->fit);
-	gsl_vector_set (ss, 6, sample->lattice->alpha->fit);
-	gsl_vector_set (ss, 7, sample->lattice->beta->fit);
-	gsl_vector_set (ss, 8, sample->lattice->gamma->fit);
+	for(i=0; i<9; ++i)
+		gsl_vector_set (ss, i, hkl_sample_parameter_fit(sample, i));
 
 	/* Initialize method and iterate */
 	minex_func.n = 9;
@@ -318,6 +416,663 @@ static int minimize(HklSample *sample,
 	return res;
 }
 
+/*
+ * this structure is used by the Levenberg-Marquardt least-squares
+ * affinement. Only the fitted parameters are part of the problem,
+ * idx contains their position in the full parameters vector x
+ * (ux, uy, uz, a, b, c, alpha, beta, gamma).
+ */
+struct affine_t
+{
+	HklSample *sample;
+	size_t n_fit;
+	size_t idx[9];
+	double x[9];
+};
+
+static int affine_set_x(struct affine_t *self, const gsl_vector *x)
+{
+	size_t i;
+	gsl_vector_view v = gsl_vector_view_array(self->x, 9);
+
+	for(i=0; i<self->n_fit; ++i)
+		self->x[self->idx[i]] = gsl_vector_get(x, i);
+
+	return hkl_sample_init_from_gsl_vector(self->sample, &v.vector);
+}
+
+/* residuals UB.h - Q for all the flagged reflections */
+static int affine_f(const gsl_vector *x, void *params, gsl_vector *f)
+{
+	size_t i;
+	struct affine_t *self = params;
+	const struct hkl_sample_packed_t *packed;
+	const double (*M)[3];
+
+	if (!affine_set_x(self, x))
+		return GSL_EDOM;
+
+	packed = hkl_sample_packed_get(self->sample);
+	M = self->sample->UB.data;
+	for(i=0; i<packed->n; ++i){
+		size_t j;
+
+		for(j=0; j<3; ++j)
+			gsl_vector_set(f, 3 * i + j,
+				       M[j][0] * packed->hkl[0].item[i]
+				       + M[j][1] * packed->hkl[1].item[i]
+				       + M[j][2] * packed->hkl[2].item[i]
+				       - packed->_hkl[j].item[i]);
+	}
+
+	return GSL_SUCCESS;
+}
+
+/*
+ * analytic jacobian of the residuals, d(UB)/dp = dU/dp.B or U.dB/dp.
+ * The derivative of UB is computed once per parameter then applied
+ * to all the packed reflections.
+ */
+static int affine_df(const gsl_vector *x, void *params, gsl_matrix *J)
+{
+	struct affine_t *self = params;
+	HklSample *sample = self->sample;
+	const struct hkl_sample_packed_t *packed;
+	HklMatrix B;
+	HklMatrix dB[6];
+	HklMatrix dM[9]; /* dU/dux, dU/duy, dU/duz, dB/da, ..., dB/dgamma */
+	size_t i, k, l, m;
+
+	if (!affine_set_x(self, x)
+	    || !hkl_lattice_get_B(sample->lattice, &B)
+	    || !hkl_lattice_get_B_derivatives(sample->lattice, dB))
+		return GSL_EDOM;
+
+	hkl_matrix_init_from_euler_derivatives(dM, self->x[0], self->x[1], self->x[2]);
+
+	/* a free lattice parameter moves all the parameters tied to it */
+	for(k=0; k<6; ++k){
+		memset(&dM[3 + k], 0, sizeof(dM[3 + k]));
+		for(l=0; l<6; ++l)
+			if (hkl_lattice_parameter_tie(sample->lattice, l) == (int)k)
+				for(m=0; m<3; ++m){
+					dM[3 + k].data[m][0] += dB[l].data[m][0];
+					dM[3 + k].data[m][1] += dB[l].data[m][1];
+					dM[3 + k].data[m][2] += dB[l].data[m][2];
+				}
+	}
+
+	packed = hkl_sample_packed_get(sample);
+	for(k=0; k<self->n_fit; ++k){
+		size_t idx = self->idx[k];
+		HklMatrix dUB;
+
+		if (idx < 3){
+			dUB = dM[idx];
+			hkl_matrix_times_matrix(&dUB, &B);
+		}else{
+			dUB = sample->U;
+			hkl_matrix_times_matrix(&dUB, &dM[idx]);
+		}
+
+		for(i=0; i<packed->n; ++i){
+			size_t j;
+
+			for(j=0; j<3; ++j)
+				gsl_matrix_set(J, 3 * i + j, k,
+					       dUB.data[j][0] * packed->hkl[0].item[i]
+					       + dUB.data[j][1] * packed->hkl[1].item[i]
+					       + dUB.data[j][2] * packed->hkl[2].item[i]);
+		}
+	}
+
+	return GSL_SUCCESS;
+}
+
+/*
+ * affine the sample with the Levenberg-Marquardt algorithm, the
+ * sample is unchanged if the affinement failed. chi2 (allow-none)
+ * contains the final sum of the squared residuals.
+ *
+ * the gsl error handler must be managed by the caller.
+ */
+static int levenberg_marquardt(HklSample *sample, double *chi2)
+{
+	struct affine_t params;
+	gsl_vector_view saved;
+	double x_saved[9];
+	gsl_multifit_nlinear_fdf fdf;
+	gsl_multifit_nlinear_parameters fdf_params = gsl_multifit_nlinear_default_parameters();
+	gsl_multifit_nlinear_workspace *w;
+	gsl_vector *x;
+	size_t i;
+	size_t n;
+	int info;
+	int status;
+
+	/* Starting point */
+	params.sample = sample;
+	params.n_fit = 0;
+	saved = gsl_vector_view_array(x_saved, 9);
+	hkl_sample_to_gsl_vector(sample, &saved.vector);
+	for(i=0; i<9; ++i){
+		params.x[i] = x_saved[i];
+		if (hkl_sample_parameter_fit(sample, i))
+			params.idx[params.n_fit++] = i;
+	}
+
+	n = 3 * hkl_sample_packed_get(sample)->n;
+
+	/* not enought residuals for a least-squares problem */
+	if (params.n_fit == 0 || n < params.n_fit)
+		return FALSE;
+
+	x = gsl_vector_alloc(params.n_fit);
+	for(i=0; i<params.n_fit; ++i)
+		gsl_vector_set(x, i, x_saved[params.idx[i]]);
+
+	fdf.f = affine_f;
+	fdf.df = affine_df;
+	fdf.fvv = NULL;
+	fdf.n = n;
+	fdf.p = params.n_fit;
+	fdf.params = &params;
+
+	w = gsl_multifit_nlinear_alloc(gsl_multifit_nlinear_trust, &fdf_params,
+				       n, params.n_fit);
+	status = gsl_multifit_nlinear_init(x, &fdf, w);
+	if (status == GSL_SUCCESS)
+		status = gsl_multifit_nlinear_driver(ITER_MAX, LM_XTOL, LM_GTOL, 0.,
+						     NULL, NULL, &info, w);
+
+	/* the last evaluation was maybe not at the solution */
+	if (status == GSL_SUCCESS
+	    && !affine_set_x(&params, gsl_multifit_nlinear_position(w)))
+		status = GSL_EDOM;
+
+	if (status == GSL_SUCCESS){
+		/* keep the eulerian angles in ]-pi, pi] */
+		hkl_sample_compute_UxUyUz(sample);
+		if (chi2){
+			const gsl_vector *f = gsl_multifit_nlinear_residual(w);
+
+			*chi2 = 0.;
+			for(i=0; i<n; ++i)
+				*chi2 += gsl_vector_get(f, i) * gsl_vector_get(f, i);
+		}
+	}else
+		hkl_sample_init_from_gsl_vector(sample, &saved.vector); /* restore the sample */
+
+#ifdef DEBUG
+	fprintf(stderr, "levenberg-marquardt status: %d (%s) info: %d\n",
+		status, gsl_strerror(status), info);
+#endif
+
+	gsl_multifit_nlinear_free(w);
+	gsl_vector_free(x);
+
+	return status == GSL_SUCCESS;
+}
+
+/*
+ * one starting point of the multistart affinement.
+ */
+struct affine_start_t
+{
+	HklSample *sample;
+	double chi2;
+	int res;
+};
+
+static void affine_start_run(gpointer data, gpointer user_data)
+{
+	struct affine_start_t *start = data;
+
+	start->res = levenberg_marquardt(start->sample, &start->chi2);
+}
+
+/*
+ * compute the U matrix using the Busing and Levy method from two
+ * non colinear reflections (h1, q1) and (h2, q2).
+ */
+static int busing_levy(HklMatrix *U, const HklMatrix *B,
+		       const HklVector *h1, const HklVector *q1,
+		       const HklVector *h2, const HklVector *q2)
+{
+	HklVector h1c;
+	HklVector h2c;
+	HklMatrix Tc;
+
+	if (hkl_vector_is_colinear(h1, h2))
+		return FALSE;
+
+	/* Compute matrix Tc from r1 and r2. */
+	h1c = *h1;
+	h2c = *h2;
+	hkl_matrix_times_vector(B, &h1c);
+	hkl_matrix_times_vector(B, &h2c);
+	hkl_matrix_init_from_two_vector(&Tc, &h1c, &h2c);
+	hkl_matrix_transpose(&Tc);
+
+	/* compute U */
+	hkl_matrix_init_from_two_vector(U, q1, q2);
+	hkl_matrix_times_matrix(U, &Tc);
+
+	return TRUE;
+}
+
+/*
+ * is the mesured q explained by UB.hkl within the angular tolerance
+ * (radian) for its direction and the relative tolerance for its norm.
+ * residual is incremented by the angle between them.
+ */
+static int is_indexed(const HklMatrix *UB,
+		      const HklVector *hkl, const HklVector *q,
+		      double angle_tolerance, double norm_tolerance,
+		      double *residual)
+{
+	HklVector UBh = *hkl;
+	double angle;
+	double norm = hkl_vector_norm2(q);
+
+	hkl_matrix_times_vector(UB, &UBh);
+	angle = hkl_vector_angle(&UBh, q);
+	if (angle > angle_tolerance
+	    || fabs(hkl_vector_norm2(&UBh) - norm) > norm_tolerance * norm)
+		return FALSE;
+
+	*residual += angle;
+
+	return TRUE;
+}
+
+/*
+ * RANSAC estimation of the UB matrix. Each hypothesis is computed
+ * with the Busing and Levy method from a pair of reflections and
+ * scored with the number of reflections it explains. The hypothesis
+ * are splitted into chunks evaluated in parallel, each chunk works
+ * with its own copy of the lattice.
+ */
+struct ransac_t
+{
+	HklSampleReflection **reflections;
+	size_t n_reflections;
+	const unsigned int *pairs;
+	double angle_tolerance;
+	double norm_tolerance;
+};
+
+struct ransac_chunk_t
+{
+	const struct ransac_t *ransac;
+	HklLattice *lattice;
+	size_t begin;
+	size_t end;
+	size_t n_inliers;
+	double residual;
+	HklMatrix U;
+};
+
+static int ransac_is_inlier(const struct ransac_t *ransac,
+			    const HklMatrix *UB,
+			    const HklSampleReflection *reflection,
+			    double *residual)
+{
+	return is_indexed(UB, &reflection->hkl, &reflection->_hkl,
+			  ransac->angle_tolerance, ransac->norm_tolerance,
+			  residual);
+}
+
+static void ransac_run(gpointer data, gpointer user_data)
+{
+	struct ransac_chunk_t *chunk = data;
+	const struct ransac_t *ransac = chunk->ransac;
+	HklMatrix B;
+	size_t i;
+
+	chunk->n_inliers = 0;
+	chunk->residual = 0.;
+
+	hkl_lattice_get_B(chunk->lattice, &B);
+
+	for(i=chunk->begin; i<chunk->end; ++i){
+		const HklSampleReflection *r1 = ransac->reflections[ransac->pairs[2 * i]];
+		const HklSampleReflection *r2 = ransac->reflections[ransac->pairs[2 * i + 1]];
+		HklVector h1 = r1->hkl;
+		HklVector h2 = r2->hkl;
+		HklMatrix U;
+		HklMatrix UB;
+		size_t j;
+		size_t n_inliers = 0;
+		double residual = 0.;
+
+		/* reject the pairs which are not self consistent, U
+		 * does not change the theoretical angle */
+		hkl_matrix_times_vector(&B, &h1);
+		hkl_matrix_times_vector(&B, &h2);
+		if (hkl_vector_is_colinear(&r1->_hkl, &r2->_hkl)
+		    || fabs(hkl_vector_angle(&h1, &h2)
+			    - hkl_vector_angle(&r1->_hkl, &r2->_hkl)) > ransac->angle_tolerance)
+			continue;
+
+		if (!busing_levy(&U, &B,
+				 &r1->hkl, &r1->_hkl, &r2->hkl, &r2->_hkl))
+			continue;
+
+		UB = U;
+		hkl_matrix_times_matrix(&UB, &B);
+
+		for(j=0; j<ransac->n_reflections; ++j)
+			n_inliers += ransac_is_inlier(ransac, &UB, ransac->reflections[j],
+						      &residual);
+
+		if (n_inliers > chunk->n_inliers
+		    || (n_inliers == chunk->n_inliers && residual < chunk->residual)){
+			chunk->n_inliers = n_inliers;
+			chunk->residual = residual;
+			chunk->U = U;
+		}
+	}
+}
+
+/*
+ * auto-indexing, the angles between the Q vectors of the first
+ * reflections (the seeds) are matched against the angles between the
+ * reciprocal lattice vectors of the shells with compatible norms.
+ * Each match gives a candidate orientation (Busing and Levy) and the
+ * candidates are voted in parallel by the number of reflections they
+ * index.
+ */
+struct autoindex_angle_t
+{
+	double angle;
+	unsigned int g1;
+	unsigned int g2;
+};
+
+struct autoindex_candidate_t
+{
+	size_t r1;
+	size_t r2;
+	HklVector h1;
+	HklVector h2;
+};
+
+struct autoindex_t
+{
+	HklMatrix B;
+	HklMatrix B_1;
+	const HklVector *q;
+	size_t n_q;
+	const struct autoindex_candidate_t *candidates;
+	int hmax[3];
+	double angle_tolerance;
+	double norm_tolerance;
+};
+
+struct autoindex_chunk_t
+{
+	const struct autoindex_t *autoindex;
+	size_t begin;
+	size_t end;
+	size_t n_indexed;
+	double residual;
+	HklMatrix U;
+};
+
+static void hkl_sample_autoindex_init(struct hkl_sample_autoindex_t *self)
+{
+	self->valid = FALSE;
+	self->version = 0;
+	darray_init(self->gs);
+	darray_init(self->shells);
+	self->angles = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+					     g_free, (GDestroyNotify)g_array_unref);
+}
+
+static void hkl_sample_autoindex_release(struct hkl_sample_autoindex_t *self)
+{
+	darray_free(self->gs);
+	darray_free(self->shells);
+	g_hash_table_destroy(self->angles);
+}
+
+static int autoindex_g_cmp(const void *p1, const void *p2)
+{
+	const struct hkl_sample_autoindex_g_t *g1 = p1;
+	const struct hkl_sample_autoindex_g_t *g2 = p2;
+
+	return (g1->norm > g2->norm) - (g1->norm < g2->norm);
+}
+
+static gint autoindex_angle_cmp(gconstpointer p1, gconstpointer p2)
+{
+	const struct autoindex_angle_t *a1 = p1;
+	const struct autoindex_angle_t *a2 = p2;
+
+	return (a1->angle > a2->angle) - (a1->angle < a2->angle);
+}
+
+/*
+ * return the reciprocal lattice vectors with |h_i| <= hmax[i],
+ * rebuilt only if the lattice or the range of hkl changed.
+ */
+static struct hkl_sample_autoindex_t *hkl_sample_autoindex_get(HklSample *self,
+							       const HklMatrix *B,
+							       const int hmax[3])
+{
+	struct hkl_sample_autoindex_t *cache = &self->autoindex;
+	struct hkl_sample_autoindex_g_t *g;
+	int h, k, l;
+
+	if (cache->valid && cache->version == self->lattice->version
+	    && cache->hmax[0] == hmax[0]
+	    && cache->hmax[1] == hmax[1]
+	    && cache->hmax[2] == hmax[2])
+		return cache;
+
+	darray_resize(cache->gs, 0);
+	darray_resize(cache->shells, 0);
+	g_hash_table_remove_all(cache->angles);
+
+	for(h=-hmax[0]; h<=hmax[0]; ++h)
+		for(k=-hmax[1]; k<=hmax[1]; ++k)
+			for(l=-hmax[2]; l<=hmax[2]; ++l){
+				struct hkl_sample_autoindex_g_t g;
+
+				if (h == 0 && k == 0 && l == 0)
+					continue;
+
+				hkl_vector_init(&g.hkl, h, k, l);
+				g.G = g.hkl;
+				hkl_matrix_times_vector(B, &g.G);
+				g.norm = hkl_vector_norm2(&g.G);
+				darray_append(cache->gs, g);
+			}
+	qsort(cache->gs.item, darray_size(cache->gs), sizeof(*cache->gs.item),
+	      autoindex_g_cmp);
+
+	darray_foreach(g, cache->gs){
+		size_t idx = g - cache->gs.item;
+		struct hkl_sample_autoindex_shell_t *last = darray_size(cache->shells)
+			? &darray_item(cache->shells, darray_size(cache->shells) - 1)
+			: NULL;
+
+		if (last && g->norm - last->norm <= HKL_EPSILON * g->norm)
+			last->end = idx + 1;
+		else{
+			struct hkl_sample_autoindex_shell_t shell = {idx, idx + 1, g->norm};
+
+			darray_append(cache->shells, shell);
+		}
+	}
+
+	cache->valid = TRUE;
+	cache->version = self->lattice->version;
+	memcpy(cache->hmax, hmax, sizeof(cache->hmax));
+
+	return cache;
+}
+
+/* the first shell with a norm greater or equal to norm */
+static size_t autoindex_shell_lower_bound(const struct hkl_sample_autoindex_t *self,
+					  double norm)
+{
+	size_t begin = 0;
+	size_t end = darray_size(self->shells);
+
+	while(begin < end){
+		size_t middle = begin + (end - begin) / 2;
+
+		if (darray_item(self->shells, middle).norm < norm)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+
+	return begin;
+}
+
+/*
+ * the angles between the non colinear vectors of two shells, sorted
+ * by angle. They are computed once per lattice, at most
+ * AUTOINDEX_ANGLES_MAX pairs of shells are kept.
+ */
+static const GArray *autoindex_shells_angles(struct hkl_sample_autoindex_t *self,
+					     size_t s1, size_t s2)
+{
+	gint64 key = ((gint64)s1 << 32) | (gint64)s2;
+	GArray *angles = g_hash_table_lookup(self->angles, &key);
+
+	if (!angles){
+		const struct hkl_sample_autoindex_shell_t *shell1 = &darray_item(self->shells, s1);
+		const struct hkl_sample_autoindex_shell_t *shell2 = &darray_item(self->shells, s2);
+		gint64 *k = g_new(gint64, 1);
+		size_t i, j;
+
+		angles = g_array_new(FALSE, FALSE, sizeof(struct autoindex_angle_t));
+		for(i=shell1->begin; i<shell1->end; ++i)
+			for(j=shell2->begin; j<shell2->end; ++j){
+				const HklVector *G1 = &darray_item(self->gs, i).G;
+				const HklVector *G2 = &darray_item(self->gs, j).G;
+				struct autoindex_angle_t angle;
+
+				if (hkl_vector_is_colinear(G1, G2))
+					continue;
+
+				angle.angle = hkl_vector_angle(G1, G2);
+				angle.g1 = i;
+				angle.g2 = j;
+				g_array_append_val(angles, angle);
+			}
+		g_array_sort(angles, autoindex_angle_cmp);
+
+		if (g_hash_table_size(self->angles) >= AUTOINDEX_ANGLES_MAX)
+			g_hash_table_remove_all(self->angles);
+		*k = key;
+		g_hash_table_insert(self->angles, k, angles);
+	}
+
+	return angles;
+}
+
+/* the first angle greater or equal to angle */
+static guint autoindex_angle_lower_bound(const GArray *angles, double angle)
+{
+	guint begin = 0;
+	guint end = angles->len;
+
+	while(begin < end){
+		guint middle = begin + (end - begin) / 2;
+
+		if (g_array_index(angles, struct autoindex_angle_t, middle).angle < angle)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+
+	return begin;
+}
+
+/*
+ * the hkl indexing the mesured q with the UB matrix (UB_1 is its
+ * inverse), FALSE if the nearest integer hkl is out of the hmax range
+ * or does not explain q.
+ */
+static int autoindex_hkl(const HklMatrix *UB, const HklMatrix *UB_1,
+			 const HklVector *q, const int hmax[3],
+			 double angle_tolerance, double norm_tolerance,
+			 HklVector *hkl, double *residual)
+{
+	size_t i;
+
+	*hkl = *q;
+	hkl_matrix_times_vector(UB_1, hkl);
+	for(i=0; i<3; ++i){
+		hkl->data[i] = round(hkl->data[i]);
+		if (fabs(hkl->data[i]) > hmax[i])
+			return FALSE;
+	}
+
+	return !hkl_vector_is_null(hkl)
+		&& is_indexed(UB, hkl, q, angle_tolerance, norm_tolerance, residual);
+}
+
+/* UB and its inverse UB^-1 = B^-1.U^T */
+static void autoindex_UB(const struct autoindex_t *self, const HklMatrix *U,
+			 HklMatrix *UB, HklMatrix *UB_1)
+{
+	HklMatrix Ut = *U;
+
+	*UB = *U;
+	hkl_matrix_times_matrix(UB, &self->B);
+	hkl_matrix_transpose(&Ut);
+	*UB_1 = self->B_1;
+	hkl_matrix_times_matrix(UB_1, &Ut);
+}
+
+static void autoindex_run(gpointer data, gpointer user_data)
+{
+	struct autoindex_chunk_t *chunk = data;
+	const struct autoindex_t *autoindex = chunk->autoindex;
+	size_t i;
+
+	chunk->n_indexed = 0;
+	chunk->residual = 0.;
+
+	for(i=chunk->begin; i<chunk->end; ++i){
+		const struct autoindex_candidate_t *candidate = &autoindex->candidates[i];
+		HklMatrix U;
+		HklMatrix UB;
+		HklMatrix UB_1;
+		HklVector hkl;
+		size_t j;
+		size_t n_indexed = 0;
+		double residual = 0.;
+
+		if (!busing_levy(&U, &autoindex->B,
+				 &candidate->h1, &autoindex->q[candidate->r1],
+				 &candidate->h2, &autoindex->q[candidate->r2]))
+			continue;
+
+		autoindex_UB(autoindex, &U, &UB, &UB_1);
+
+		for(j=0; j<autoindex->n_q; ++j)
+			n_indexed += autoindex_hkl(&UB, &UB_1, &autoindex->q[j],
+						   autoindex->hmax,
+						   autoindex->angle_tolerance,
+						   autoindex->norm_tolerance,
+						   &hkl, &residual);
+
+		if (n_indexed > chunk->n_indexed
+		    || (n_indexed == chunk->n_indexed && residual < chunk->residual)){
+			chunk->n_indexed = n_indexed;
+			chunk->residual = residual;
+			chunk->U = U;
+		}
+	}
+}
+
 /*************/
 /* HklSample */
 /*************/
@@ -361,6 +1116,8 @@ HklSample* hkl_sample_new(const char *name)
 	hkl_sample_compute_UB(self);
 	list_head_init(&self->reflections);
 	self->n_reflections = 0;
+	hkl_sample_packed_init(&self->packed);
+	hkl_sample_autoindex_init(&self->autoindex);
 
 	return self;
 }
@@ -391,6 +1148,8 @@ HklSample *hkl_sample_new_copy(const HklSample *self)
 	dup->uy = hkl_parameter_new_copy(self->uy);
 	dup->uz = hkl_parameter_new_copy(self->uz);
 
+	hkl_sample_packed_init(&dup->packed);
+	hkl_sample_autoindex_init(&dup->autoindex);
 	hkl_sample_copy_all_reflections(dup, self);
 
 	return dup;
@@ -413,6 +1172,8 @@ void hkl_sample_free(HklSample *self)
 	hkl_parameter_free(self->uy);
 	hkl_parameter_free(self->uz);
 	hkl_sample_clear_all_reflections(self);
+	hkl_sample_packed_release(&self->packed);
+	hkl_sample_autoindex_release(&self->autoindex);
 	free(self);
 }
 
@@ -700,6 +1461,8 @@ void hkl_sample_add_reflection(HklSample *self,
 
 	list_add_tail(&self->reflections, &reflection->list);
 	self->n_reflections++;
+	reflection->sample = self;
+	self->packed.valid = FALSE;
 }
 
 /**
@@ -715,6 +1478,7 @@ void hkl_sample_del_reflection(HklSample *self,
 	list_del(&reflection->list);
 	hkl_sample_reflection_free(reflection);
 	self->n_reflections--;
+	self->packed.valid = FALSE;
 }
 
 /**
@@ -734,30 +1498,13 @@ int hkl_sample_compute_UB_busing_levy(HklSample *self,
 				      GError **error)
 
 {
+	HklMatrix B;
+
 	hkl_error (error == NULL || *error == NULL);
 
-	if (!hkl_vector_is_colinear(&r1->hkl, &r2->hkl)) {
-		HklVector h1c;
-		HklVector h2c;
-		HklMatrix B;
-		HklMatrix Tc;
-
-		/* Compute matrix Tc from r1 and r2. */
-		h1c = r1->hkl;
-		h2c = r2->hkl;
-		hkl_lattice_get_B(self->lattice, &B);
-		hkl_matrix_times_vector(&B, &h1c);
-		hkl_matrix_times_vector(&B, &h2c);
-		hkl_matrix_init_from_two_vector(&Tc, &h1c, &h2c);
-		hkl_matrix_transpose(&Tc);
-
-		/* compute U */
-		hkl_matrix_init_from_two_vector(&self->U,
-						&r1->_hkl, &r2->_hkl);
-		hkl_matrix_times_matrix(&self->U, &Tc);
-		hkl_sample_compute_UxUyUz(self);
-		hkl_sample_compute_UB(self);
-	}else{
+	hkl_lattice_get_B(self->lattice, &B);
+	if (!busing_levy(&self->U, &B,
+			 &r1->hkl, &r1->_hkl, &r2->hkl, &r2->_hkl)) {
 		g_set_error(error,
 			    HKL_SAMPLE_ERROR,
 			    HKL_SAMPLE_ERROR_COMPUTE_UB_BUSING_LEVY,
@@ -765,24 +1512,536 @@ int hkl_sample_compute_UB_busing_levy(HklSample *self,
 
 		return FALSE;
 	}
+	hkl_sample_compute_UxUyUz(self);
+	hkl_sample_compute_UB(self);
+
 	g_assert (error == NULL || *error == NULL);
 
 	return TRUE;
 }
 
+/**
+ * hkl_sample_compute_U_least_squares:
+ * @self: the this ptr
+ * @error: return location for a GError, or NULL
+ *
+ * compute the U matrix which fits the best all the flagged
+ * reflections, the lattice (B matrix) is kept constant. This is the
+ * orthogonal Procrustes problem solved with the Kabsch algorithm: the
+ * singular values decomposition of the 3x3 covariance matrix
+ * sum(B.h x Q). The cost is linear with the number of reflections.
+ *
+ * Returns: TRUE on success, FALSE if there is less than two non
+ * colinear flagged reflections.
+ **/
+int hkl_sample_compute_U_least_squares(HklSample *self, GError **error)
+{
+	double h[9] = {0};
+	double v[9];
+	double s[3];
+	gsl_matrix_view H = gsl_matrix_view_array(h, 3, 3);
+	gsl_matrix_view V = gsl_matrix_view_array(v, 3, 3);
+	gsl_vector_view S = gsl_vector_view_array(s, 3);
+	HklSampleReflection *reflection;
+	HklMatrix B;
+	HklMatrix M;
+	double d;
+	size_t i, j;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if (!hkl_lattice_get_B(self->lattice, &B)){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_COMPUTE_U_LEAST_SQUARES,
+			    "It is not possible to compute the U matrix with an invalid lattice");
+		return FALSE;
+	}
+
+	/* covariance matrix H = sum (B.h) x Q */
+	list_for_each(&self->reflections, reflection, list){
+		if(reflection->flag){
+			HklVector Bh = reflection->hkl;
+
+			hkl_matrix_times_vector(&B, &Bh);
+			for(i=0; i<3; ++i)
+				for(j=0; j<3; ++j)
+					h[3 * i + j] += Bh.data[i] * reflection->_hkl.data[j];
+		}
+	}
+
+	/* H = W.S.V^T, W replaces H */
+	gsl_set_error_handler_off();
+	if (gsl_linalg_SV_decomp_jacobi(&H.matrix, &V.matrix, &S.vector)
+	    || s[0] < HKL_EPSILON || s[1] < HKL_EPSILON * s[0]){
+		gsl_set_error_handler (NULL);
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_COMPUTE_U_LEAST_SQUARES,
+			    "It is not possible to compute the U matrix with less than two non colinear reflections");
+		return FALSE;
+	}
+	gsl_set_error_handler (NULL);
+
+	/* U = V.diag(1, 1, d).W^T with d = det(V.W^T) to get a rotation */
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+			M.data[i][j] = v[3 * i] * h[3 * j]
+				+ v[3 * i + 1] * h[3 * j + 1]
+				+ v[3 * i + 2] * h[3 * j + 2];
+	d = hkl_matrix_det(&M) < 0. ? -1. : 1.;
+
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+			self->U.data[i][j] = v[3 * i] * h[3 * j]
+				+ v[3 * i + 1] * h[3 * j + 1]
+				+ d * v[3 * i + 2] * h[3 * j + 2];
+
+	hkl_sample_compute_UxUyUz(self);
+	hkl_sample_compute_UB(self);
+
+	return TRUE;
+}
+
+/**
+ * hkl_sample_compute_UB_ransac:
+ * @self: the this ptr
+ * @n_iterations: the maximum number of reflection pairs to try
+ * @angle_tolerance: the angular tolerance (radian) of an inlier
+ *                   reflection
+ * @norm_tolerance: the relative tolerance on the norm of Q of an
+ *                  inlier reflection
+ * @error: return location for a GError, or NULL
+ *
+ * robust computation of the UB matrix in presence of mis-indexed
+ * reflections. The Busing and Levy method is applied to reflection
+ * pairs (all of them if there is less than @n_iterations pairs,
+ * otherwise @n_iterations random pairs). The pairs whose theoretical
+ * and mesured angles differ by more than @angle_tolerance are
+ * rejected without computation. Each UB is scored by the number of
+ * reflections it explains (the angle between Q and UB.hkl is less
+ * than @angle_tolerance and their norms differ by less than
+ * @norm_tolerance * |Q|) and the pairs are evaluated in parallel.
+ *
+ * The flag of the reflections is set to TRUE for the inliers of the
+ * best UB, FALSE otherwise, and U is refined with a least squares
+ * fit over the inliers.
+ *
+ * Returns: TRUE on success, FALSE if no consistent pair of
+ * reflections was found.
+ **/
+int hkl_sample_compute_UB_ransac(HklSample *self,
+				 unsigned int n_iterations,
+				 double angle_tolerance, double norm_tolerance,
+				 GError **error)
+{
+	struct ransac_t ransac;
+	HklMatrix B;
+	struct ransac_chunk_t *chunks;
+	struct ransac_chunk_t *best = NULL;
+	HklSampleReflection *reflection;
+	unsigned int *pairs;
+	size_t i, j;
+	size_t n_pairs;
+	size_t n_chunks;
+	size_t chunk_len;
+	GThreadPool *pool;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	ransac.angle_tolerance = angle_tolerance;
+	ransac.norm_tolerance = norm_tolerance;
+	ransac.n_reflections = self->n_reflections;
+	n_pairs = ransac.n_reflections * (ransac.n_reflections - 1) / 2;
+	if (ransac.n_reflections < 2 || n_iterations == 0
+	    || !hkl_lattice_get_B(self->lattice, &B)){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_COMPUTE_UB_RANSAC,
+			    "It is not possible to compute the UB matrix with less than two reflections or an invalid lattice");
+		return FALSE;
+	}
+
+	ransac.reflections = malloc(ransac.n_reflections * sizeof(*ransac.reflections));
+	i = 0;
+	list_for_each(&self->reflections, reflection, list)
+		ransac.reflections[i++] = reflection;
+
+	/* the random generator is not thread safe, prepare all the
+	 * pairs before */
+	if (n_pairs > n_iterations)
+		n_pairs = n_iterations;
+	pairs = malloc(2 * n_pairs * sizeof(*pairs));
+	if (n_pairs == ransac.n_reflections * (ransac.n_reflections - 1) / 2){
+		size_t k = 0;
+
+		for(i=0; i<ransac.n_reflections; ++i)
+			for(j=i+1; j<ransac.n_reflections; ++j){
+				pairs[k++] = i;
+				pairs[k++] = j;
+			}
+	}else
+		for(i=0; i<n_pairs; ++i){
+			pairs[2 * i] = rand() % ransac.n_reflections;
+			pairs[2 * i + 1] = rand() % (ransac.n_reflections - 1);
+			if (pairs[2 * i + 1] >= pairs[2 * i])
+				pairs[2 * i + 1]++;
+		}
+	ransac.pairs = pairs;
+
+	n_chunks = g_get_num_processors();
+	if (n_chunks > n_pairs)
+		n_chunks = n_pairs;
+	chunk_len = (n_pairs + n_chunks - 1) / n_chunks;
+	chunks = calloc(n_chunks, sizeof(*chunks));
+	for(i=0; i<n_chunks; ++i){
+		chunks[i].ransac = &ransac;
+		chunks[i].lattice = hkl_lattice_new_copy(self->lattice);
+		chunks[i].begin = i * chunk_len;
+		chunks[i].end = i * chunk_len + chunk_len < n_pairs ? i * chunk_len + chunk_len : n_pairs;
+	}
+
+	pool = g_thread_pool_new(ransac_run, NULL, n_chunks, TRUE, NULL);
+	for(i=0; i<n_chunks; ++i)
+		if (!pool || !g_thread_pool_push(pool, &chunks[i], NULL))
+			ransac_run(&chunks[i], NULL);
+	if (pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	for(i=0; i<n_chunks; ++i)
+		if (chunks[i].n_inliers >= 2
+		    && (!best
+			|| chunks[i].n_inliers > best->n_inliers
+			|| (chunks[i].n_inliers == best->n_inliers && chunks[i].residual < best->residual)))
+			best = &chunks[i];
+
+	if (best){
+		HklMatrix UB = best->U;
+		double residual = 0.;
+
+		hkl_matrix_times_matrix(&UB, &B);
+		for(i=0; i<ransac.n_reflections; ++i)
+			ransac.reflections[i]->flag = ransac_is_inlier(&ransac, &UB,
+								       ransac.reflections[i],
+								       &residual);
+		self->packed.valid = FALSE;
+
+		self->U = best->U;
+		if (!hkl_sample_compute_U_least_squares(self, NULL)){
+			hkl_sample_compute_UxUyUz(self);
+			hkl_sample_compute_UB(self);
+		}
+	}else
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_COMPUTE_UB_RANSAC,
+			    "No consistent pair of reflections was found among the %u tried.",
+			    (unsigned int)n_pairs);
+
+	for(i=0; i<n_chunks; ++i)
+		hkl_lattice_free(chunks[i].lattice);
+	free(chunks);
+	free(pairs);
+	free(ransac.reflections);
+
+	return best != NULL;
+}
+
+/**
+ * hkl_sample_autoindex:
+ * @self: the this ptr
+ * @hkl_max: the largest |h|, |k| and |l| of the indexation
+ * @angle_tolerance: the angular tolerance (radian)
+ * @norm_tolerance: the relative tolerance on the norm of Q
+ * @error: return location for a GError, or NULL
+ *
+ * index the reflections without any prior knowledge of their hkl or
+ * of the sample orientation, only the lattice is used. The angles
+ * between the mesured Q of the first reflections are matched
+ * against the angles between the reciprocal lattice vectors with
+ * compatible norms, each match gives a candidate orientation and the
+ * candidates are voted in parallel by the number of reflections they
+ * index.
+ *
+ * The reciprocal lattice vectors and the angles between them are
+ * computed once and kept until the lattice changes, so indexing
+ * another set of reflections of the same sample is fast. Their
+ * indices are limited to @hkl_max, a reflection needing a larger
+ * index is not indexed.
+ *
+ * On success the hkl of the indexed reflections are replaced and
+ * their flag set to TRUE, the other reflections are unflagged. U is
+ * refined with a least squares fit over the indexed reflections.
+ * For a high symmetry lattice the orientation is one of the
+ * equivalent ones.
+ *
+ * Returns: TRUE on success, FALSE if no orientation was found.
+ **/
+int hkl_sample_autoindex(HklSample *self, unsigned int hkl_max,
+			 double angle_tolerance, double norm_tolerance,
+			 GError **error)
+{
+	struct autoindex_t autoindex;
+	struct autoindex_chunk_t *chunks;
+	struct autoindex_chunk_t *best = NULL;
+	struct hkl_sample_autoindex_t *cache;
+	darray(struct autoindex_candidate_t) candidates = darray_new();
+	HklSampleReflection *reflection;
+	HklVector *q;
+	GThreadPool *pool;
+	double qmax = 0.;
+	size_t i, j;
+	size_t n_seeds;
+	size_t n_chunks;
+	size_t chunk_len;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if (self->n_reflections < 2 || hkl_max == 0
+	    || angle_tolerance <= 0. || norm_tolerance <= 0.
+	    || !hkl_lattice_get_B(self->lattice, &autoindex.B)
+	    || !hkl_lattice_get_1_B(self->lattice, &autoindex.B_1)){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_AUTOINDEX,
+			    "It is not possible to index less than two reflections or with an invalid lattice");
+		return FALSE;
+	}
+
+	/* the mesured Q of the reflections */
+	q = malloc(self->n_reflections * sizeof(*q));
+	i = 0;
+	list_for_each(&self->reflections, reflection, list){
+		q[i] = reflection->_hkl;
+		if (hkl_vector_norm2(&q[i]) > qmax)
+			qmax = hkl_vector_norm2(&q[i]);
+		++i;
+	}
+	qmax *= 1. + norm_tolerance;
+	n_seeds = MIN(self->n_reflections, AUTOINDEX_N_SEEDS);
+
+	autoindex.q = q;
+	autoindex.n_q = self->n_reflections;
+	autoindex.angle_tolerance = angle_tolerance;
+	autoindex.norm_tolerance = norm_tolerance;
+
+	/* the reciprocal lattice vectors up to the largest Q,
+	 * |h_i| <= |row_i(B^-1)|.qmax */
+	for(i=0; i<3; ++i){
+		HklVector row;
+
+		hkl_vector_init(&row,
+				autoindex.B_1.data[i][0],
+				autoindex.B_1.data[i][1],
+				autoindex.B_1.data[i][2]);
+		autoindex.hmax[i] = MIN(ceil(hkl_vector_norm2(&row) * qmax), hkl_max);
+	}
+	cache = hkl_sample_autoindex_get(self, &autoindex.B, autoindex.hmax);
+
+	/* match the seed pairs with the pairs of shells */
+	for(i=0; i<n_seeds; ++i)
+		for(j=i+1; j<n_seeds; ++j){
+			double n1 = hkl_vector_norm2(&q[i]);
+			double n2 = hkl_vector_norm2(&q[j]);
+			double angle = hkl_vector_angle(&q[i], &q[j]);
+			size_t s1, s2;
+
+			if (hkl_vector_is_colinear(&q[i], &q[j]))
+				continue;
+
+			for(s1=autoindex_shell_lower_bound(cache, n1 * (1. - norm_tolerance));
+			    s1<darray_size(cache->shells)
+				    && darray_item(cache->shells, s1).norm <= n1 * (1. + norm_tolerance);
+			    ++s1)
+				for(s2=autoindex_shell_lower_bound(cache, n2 * (1. - norm_tolerance));
+				    s2<darray_size(cache->shells)
+					    && darray_item(cache->shells, s2).norm <= n2 * (1. + norm_tolerance);
+				    ++s2){
+					const GArray *angles = autoindex_shells_angles(cache, s1, s2);
+					guint p;
+
+					for(p=autoindex_angle_lower_bound(angles, angle - angle_tolerance);
+					    p<angles->len
+						    && g_array_index(angles, struct autoindex_angle_t, p).angle <= angle + angle_tolerance;
+					    ++p){
+						const struct autoindex_angle_t *a = &g_array_index(angles, struct autoindex_angle_t, p);
+						struct autoindex_candidate_t candidate = {
+							i, j,
+							darray_item(cache->gs, a->g1).hkl,
+							darray_item(cache->gs, a->g2).hkl,
+						};
+
+						darray_append(candidates, candidate);
+					}
+				}
+		}
+	autoindex.candidates = candidates.item;
+
+	/* vote */
+	n_chunks = MIN(g_get_num_processors(), darray_size(candidates));
+	chunks = NULL;
+	if (n_chunks > 0){
+		chunk_len = (darray_size(candidates) + n_chunks - 1) / n_chunks;
+		chunks = calloc(n_chunks, sizeof(*chunks));
+		for(i=0; i<n_chunks; ++i){
+			chunks[i].autoindex = &autoindex;
+			chunks[i].begin = MIN(i * chunk_len, darray_size(candidates));
+			chunks[i].end = MIN(i * chunk_len + chunk_len, darray_size(candidates));
+		}
+
+		pool = g_thread_pool_new(autoindex_run, NULL, n_chunks, TRUE, NULL);
+		for(i=0; i<n_chunks; ++i)
+			if (!pool || !g_thread_pool_push(pool, &chunks[i], NULL))
+				autoindex_run(&chunks[i], NULL);
+		if (pool)
+			g_thread_pool_free(pool, FALSE, TRUE);
+
+		for(i=0; i<n_chunks; ++i)
+			if (chunks[i].n_indexed >= 2
+			    && (!best
+				|| chunks[i].n_indexed > best->n_indexed
+				|| (chunks[i].n_indexed == best->n_indexed && chunks[i].residual < best->residual)))
+				best = &chunks[i];
+	}
+
+	if (best){
+		HklMatrix UB;
+		HklMatrix UB_1;
+		double residual = 0.;
+
+		autoindex_UB(&autoindex, &best->U, &UB, &UB_1);
+		i = 0;
+		list_for_each(&self->reflections, reflection, list){
+			HklVector hkl;
+
+			reflection->flag = autoindex_hkl(&UB, &UB_1, &q[i++],
+							 autoindex.hmax,
+							 angle_tolerance, norm_tolerance,
+							 &hkl, &residual);
+			if (reflection->flag)
+				reflection->hkl = hkl;
+		}
+		self->packed.valid = FALSE;
+
+		self->U = best->U;
+		if (!hkl_sample_compute_U_least_squares(self, NULL)){
+			hkl_sample_compute_UxUyUz(self);
+			hkl_sample_compute_UB(self);
+		}
+	}else
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_AUTOINDEX,
+			    "No orientation indexing the reflections was found (%u candidates).",
+			    (unsigned int)darray_size(candidates));
+
+	free(chunks);
+	darray_free(candidates);
+	free(q);
+
+	return best != NULL;
+}
+
 /**
  * hkl_sample_affine:
  * @self: the this ptr
  *
- * affine the sample
+ * affine the sample. A least-squares Levenberg-Marquardt algorithm
+ * with an analytic jacobian is used when there is enought flagged
+ * reflections, otherwise (or if it fails) the affinement fall back on
+ * the simplex algorithm.
  *
  * Returns: the fitness of the affined #HklSample
  **/
 int hkl_sample_affine(HklSample *self, GError **error)
 {
+	int res;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	gsl_set_error_handler_off();
+	res = levenberg_marquardt(self, NULL);
+	gsl_set_error_handler (NULL);
+
+	if (res)
+		return TRUE;
+
 	return minimize(self, mono_crystal_fitness, self, error);
 }
 
+/**
+ * hkl_sample_affine_multistart:
+ * @self: the this ptr
+ * @n_starts: the number of random orientations to try
+ * @error: return location for a GError, or NULL
+ *
+ * affine the sample with the Levenberg-Marquardt algorithm from the
+ * current orientation and from @n_starts random orientations (only
+ * the fitted ux, uy, uz are randomized). The affinements are done in
+ * parallel and the solution with the smallest residual is kept. Use
+ * this method when the current orientation of the sample is far from
+ * the real one.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_sample_affine_multistart(HklSample *self, unsigned int n_starts,
+				 GError **error)
+{
+	size_t i;
+	size_t n = n_starts + 1;
+	struct affine_start_t *starts;
+	struct affine_start_t *best = NULL;
+	GThreadPool *pool;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	/* the random generator is not thread safe, prepare all the
+	 * starting points before */
+	starts = calloc(n, sizeof(*starts));
+	for(i=0; i<n; ++i){
+		starts[i].sample = hkl_sample_new_copy(self);
+		if (i > 0){
+			hkl_parameter_randomize(starts[i].sample->ux);
+			hkl_parameter_randomize(starts[i].sample->uy);
+			hkl_parameter_randomize(starts[i].sample->uz);
+		}
+	}
+
+	gsl_set_error_handler_off();
+	pool = g_thread_pool_new(affine_start_run, NULL,
+				 g_get_num_processors(), TRUE, NULL);
+	for(i=0; i<n; ++i)
+		if (!pool || !g_thread_pool_push(pool, &starts[i], NULL))
+			affine_start_run(&starts[i], NULL);
+	if (pool)
+		g_thread_pool_free(pool, FALSE, TRUE);
+	gsl_set_error_handler (NULL);
+
+	for(i=0; i<n; ++i)
+		if (starts[i].res && (!best || starts[i].chi2 < best->chi2))
+			best = &starts[i];
+
+	if (best){
+		hkl_lattice_lattice_set(self->lattice, best->sample->lattice);
+		hkl_parameter_init_copy(self->ux, best->sample->ux, NULL);
+		hkl_parameter_init_copy(self->uy, best->sample->uy, NULL);
+		hkl_parameter_init_copy(self->uz, best->sample->uz, NULL);
+		self->U = best->sample->U;
+		self->UB = best->sample->UB;
+	}else
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "Minimization failed for the %u starting points.",
+			    n_starts + 1);
+
+	for(i=0; i<n; ++i)
+		hkl_sample_free(starts[i].sample);
+	free(starts);
+
+	return best != NULL;
+}
+
 /**
  * hkl_sample_get_reflection_mesured_angle:
  * @self: the this ptr
@@ -921,6 +2180,7 @@ HklSampleReflection *hkl_sample_reflection_new(const HklGeometry *geometry,
 	self->hkl.data[1] = k;
 	self->hkl.data[2] = l;
 	self->flag = TRUE;
+	self->sample = NULL;
 
 	hkl_sample_reflection_update(self);
 
@@ -946,6 +2206,7 @@ HklSampleReflection *hkl_sample_reflection_new_copy(const HklSampleReflection *s
 	dup->hkl = self->hkl;
 	dup->_hkl = self->_hkl;
 	dup->flag = self->flag;
+	dup->sample = NULL;
 
 	return dup;
 }
@@ -1009,6 +2270,7 @@ int hkl_sample_reflection_hkl_set(HklSampleReflection *self,
 	self->hkl.data[0] = h;
 	self->hkl.data[1] = k;
 	self->hkl.data[2] = l;
+	hkl_sample_reflection_changed(self);
 
 	return TRUE;
 }
@@ -1034,6 +2296,7 @@ int hkl_sample_reflection_flag_get(const HklSampleReflection *self)
 void hkl_sample_reflection_flag_set(HklSampleReflection *self, int flag)
 {
 	self->flag = flag;
+	hkl_sample_reflection_changed(self);
 }
 
 /**
@@ -1066,4 +2329,5 @@ void hkl_sample_reflection_geometry_set(HklSampleReflection *self,
 		self->geometry = hkl_geometry_new_copy(geometry);
 
 	hkl_sample_reflection_update(self);
+	hkl_sample_reflection_changed(self);
 }
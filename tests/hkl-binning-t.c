@@ -0,0 +1,157 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include "hkl.h"
+#include <tap/basic.h>
+#include <tap/float.h>
+#include <tap/hkl-tap.h>
+
+#define WIDTH 11
+#define HEIGHT 7
+#define N_FRAMES 5
+
+static void frames_add(void)
+{
+	int res = TRUE;
+	const HklFactory *factory;
+	HklGeometry *geometries[N_FRAMES];
+	HklSample *sample;
+	HklDetector *detector;
+	HklBinning *binning;
+	double frames[N_FRAMES][WIDTH * HEIGHT];
+	const double *frames_p[N_FRAMES];
+	double h[WIDTH * HEIGHT], k[WIDTH * HEIGHT], l[WIDTH * HEIGHT];
+	const double min[3] = {.9, -.1, -.1};
+	const double max[3] = {1.1, .1, .1};
+	const size_t n[3] = {20, 20, 20};
+	double intensities[20 * 20 * 20];
+	double counts[20 * 20 * 20];
+	double total = 0;
+	double expected = 0;
+	size_t idx[20 * 20 * 20];
+	size_t n_voxels;
+	HklFrames *source;
+	char *filename;
+	FILE *file;
+	size_t f, p, i;
+
+	filename = g_build_filename(g_get_tmp_dir(), "hkl-binning-t-frames.bin", NULL);
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_2D);
+	res &= DIAG(hkl_detector_2d_pixels_set(detector, WIDTH, HEIGHT, 1e-3, 1e-3, NULL));
+	res &= DIAG(hkl_detector_2d_poni_set(detector, 1., 5., 3., NULL));
+
+	res &= DIAG(NULL == hkl_binning_new(HKL_BINNING_SPACE_HKL, max, min, n, NULL));
+	binning = hkl_binning_new(HKL_BINNING_SPACE_HKL, min, max, n, NULL);
+	res &= DIAG(NULL != binning);
+	res &= DIAG(20 * 20 * 20 == hkl_binning_len(binning));
+
+	/* a small omega scan around (1, 0, 0), one masked pixel per frame */
+	for(f=0; f<N_FRAMES; ++f){
+		geometries[f] = hkl_factory_create_new_geometry(factory);
+		res &= DIAG(hkl_geometry_set_values_v(geometries[f], HKL_UNIT_USER, NULL,
+						      29. + .5 * f, 0., 90., 60.));
+		for(p=0; p<WIDTH * HEIGHT; ++p)
+			frames[f][p] = p == f ? NAN : 2.;
+		frames_p[f] = frames[f];
+
+		res &= DIAG(hkl_detector_2d_hkl_get(detector, geometries[f], sample, h, k, l, NULL));
+		for(p=0; p<WIDTH * HEIGHT; ++p)
+			if(p != f
+			   && h[p] >= min[0] && h[p] < max[0]
+			   && k[p] >= min[1] && k[p] < max[1]
+			   && l[p] >= min[2] && l[p] < max[2])
+				expected += 1;
+	}
+	res &= DIAG(expected > 0);
+
+	/* the frames can be streamed */
+	res &= DIAG(hkl_binning_frames_add(binning, detector, geometries, sample,
+					   frames_p, 2, NULL));
+	res &= DIAG(hkl_binning_frames_add(binning, detector, &geometries[2], sample,
+					   &frames_p[2], N_FRAMES - 2, NULL));
+
+	/* every pixel inside the grid is counted once */
+	hkl_binning_get(binning, intensities, counts);
+	for(i=0; i<hkl_binning_len(binning); ++i){
+		total += counts[i];
+		res &= DIAG(intensities[i] == 2. * counts[i]);
+	}
+	res &= DIAG(total == expected);
+
+	/* the sparse view gives the same voxels */
+	n_voxels = hkl_binning_voxels_len(binning);
+	res &= DIAG(n_voxels > 0);
+	{
+		double sparse_intensities[20 * 20 * 20];
+		double sparse_counts[20 * 20 * 20];
+
+		hkl_binning_voxels_get(binning, idx, sparse_intensities, sparse_counts);
+		for(i=0; i<n_voxels; ++i){
+			res &= DIAG(sparse_counts[i] == counts[idx[i]]);
+			res &= DIAG(sparse_intensities[i] == intensities[idx[i]]);
+		}
+	}
+
+	/* the same grid from the frames mapped from a file */
+	hkl_binning_reset(binning);
+	res &= DIAG(0 == hkl_binning_voxels_len(binning));
+	file = fopen(filename, "wb");
+	if(file){
+		fwrite(frames, sizeof(frames[0][0]), N_FRAMES * WIDTH * HEIGHT, file);
+		fclose(file);
+	}
+	source = hkl_frames_new_raw(filename, HKL_FRAMES_TYPE_FLOAT64, WIDTH, HEIGHT, 0, 0, NULL);
+	res &= DIAG(NULL != source);
+	res &= DIAG(hkl_binning_frames_source_add(binning, detector, geometries, sample,
+						  source, NULL));
+	{
+		double source_intensities[20 * 20 * 20];
+		double source_counts[20 * 20 * 20];
+
+		hkl_binning_get(binning, source_intensities, source_counts);
+		for(i=0; i<hkl_binning_len(binning); ++i){
+			res &= DIAG(source_intensities[i] == intensities[i]);
+			res &= DIAG(source_counts[i] == counts[i]);
+		}
+	}
+	hkl_frames_free(source);
+	remove(filename);
+
+	ok(res == TRUE, __func__);
+
+	hkl_binning_free(binning);
+	for(f=0; f<N_FRAMES; ++f)
+		hkl_geometry_free(geometries[f]);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	g_free(filename);
+}
+
+int main(int argc, char** argv)
+{
+	plan(1);
+
+	frames_add();
+
+	return 0;
+}
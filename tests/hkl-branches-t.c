@@ -0,0 +1,197 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include "hkl.h"
+#include <tap/basic.h>
+#include <tap/hkl-tap.h>
+
+static void trajectory(void)
+{
+	int res = TRUE;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklBranches *branches;
+	size_t alive = 0;
+	size_t births, deaths;
+	size_t i, id;
+	static const size_t n = 20;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "constant_phi", NULL));
+
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+
+	/* (0, 0, 1) -> (0, 1, 1) */
+	branches = hkl_branches_new(0.);
+	for(i=0; i<=n; ++i){
+		double hkl[] = {0, (double)i / n, 1};
+		HklGeometryList *solutions;
+		size_t n_solutions = 0;
+
+		solutions = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+							      HKL_UNIT_DEFAULT, NULL);
+		hkl_branches_add(branches, solutions, &births, &deaths);
+		if(solutions){
+			n_solutions = hkl_geometry_list_n_items_get(solutions);
+			hkl_engine_list_select_solution(engines,
+							hkl_geometry_list_items_first_get(solutions));
+			hkl_geometry_list_free(solutions);
+		}
+
+		/* each solution belongs to one branch */
+		res &= DIAG(alive + births - deaths == n_solutions);
+		alive = n_solutions;
+	}
+	res &= DIAG(hkl_branches_n_points_get(branches) == n + 1);
+	res &= DIAG(hkl_branches_len(branches) > 0);
+
+	/* the branches are continuous */
+	for(id=0; id<hkl_branches_len(branches); ++id){
+		size_t birth, death;
+		double prev[4];
+
+		hkl_branches_branch_get(branches, id, &birth, &death);
+		res &= DIAG(birth < death && death <= n + 1);
+		res &= DIAG(NULL == hkl_branches_geometry_get(branches, id, death));
+
+		for(i=birth; i<death; ++i){
+			const HklGeometry *g = hkl_branches_geometry_get(branches, id, i);
+			double values[4];
+			size_t j;
+
+			res &= DIAG(NULL != g);
+			if(!g)
+				break;
+
+			hkl_geometry_axes_values_get(g, values, 4, HKL_UNIT_DEFAULT);
+			if(i > birth)
+				for(j=0; j<4; ++j)
+					res &= DIAG(cos(values[j] - prev[j]) > cos(30 * HKL_DEGTORAD));
+			memcpy(prev, values, sizeof(values));
+		}
+	}
+	res &= DIAG(NULL == hkl_branches_geometry_get(branches, hkl_branches_len(branches), 0));
+
+	/* a point without solution kills all the branches */
+	hkl_branches_add(branches, NULL, &births, &deaths);
+	res &= DIAG(births == 0 && deaths == alive);
+	for(id=0; id<hkl_branches_len(branches); ++id){
+		size_t birth, death;
+
+		hkl_branches_branch_get(branches, id, &birth, &death);
+		res &= DIAG(death <= n + 1);
+	}
+
+	hkl_branches_free(branches);
+
+	ok(res == TRUE, __func__);
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void max_distance(void)
+{
+	int res = TRUE;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklBranches *branches;
+	HklGeometryList *solutions1;
+	HklGeometryList *solutions2;
+	size_t births, deaths;
+	double hkl1[] = {0, 0, 1};
+	double hkl2[] = {0, 1, 1};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+	solutions1 = hkl_engine_pseudo_axes_values_set(engine, hkl1, ARRAY_SIZE(hkl1),
+						       HKL_UNIT_DEFAULT, NULL);
+	solutions2 = hkl_engine_pseudo_axes_values_set(engine, hkl2, ARRAY_SIZE(hkl2),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != solutions1 && NULL != solutions2);
+	if(solutions1 && solutions2){
+		size_t n1 = hkl_geometry_list_n_items_get(solutions1);
+		size_t n2 = hkl_geometry_list_n_items_get(solutions2);
+
+		branches = hkl_branches_new(HKL_EPSILON);
+
+		hkl_branches_add(branches, solutions1, &births, &deaths);
+		res &= DIAG(births == n1 && deaths == 0);
+
+		/* the same point continues all the branches */
+		hkl_branches_add(branches, solutions1, &births, &deaths);
+		res &= DIAG(births == 0 && deaths == 0);
+
+		/* too far from the previous point */
+		hkl_branches_add(branches, solutions2, &births, &deaths);
+		res &= DIAG(births == n2 && deaths == n1);
+		res &= DIAG(hkl_branches_len(branches) == n1 + n2);
+
+		hkl_branches_free(branches);
+	}
+
+	if(solutions2)
+		hkl_geometry_list_free(solutions2);
+	if(solutions1)
+		hkl_geometry_list_free(solutions1);
+
+	ok(res == TRUE, __func__);
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+int main(int argc, char** argv)
+{
+	plan(2);
+
+	trajectory();
+	max_distance();
+
+	return 0;
+}
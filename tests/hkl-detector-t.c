@@ -21,9 +21,11 @@
  */
 #include "hkl.h"
 #include <tap/basic.h>
+#include <tap/hkl-tap.h>
 
 #include "hkl-axis-private.h" /* temporary */
 #include "hkl-detector-private.h"
+#include "hkl-source-private.h"
 
 static void new(void)
 {
@@ -93,13 +95,87 @@ static void compute_kf(void)
 	hkl_detector_free(detector);
 }
 
+static void frame_2d(void)
+{
+	int res = TRUE;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklDetector *detector;
+	HklVector ki;
+	HklVector kf;
+	double qx[15], qy[15], qz[15];
+	double h[15], k[15], l[15];
+	size_t width, height;
+	size_t i;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	/* only for 2D detectors */
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	res &= DIAG(!hkl_detector_2d_pixels_set(detector, 5, 3, 1e-4, 1e-4, NULL));
+	res &= DIAG(!hkl_detector_2d_q_get(detector, geometry, qx, qy, qz, NULL));
+	hkl_detector_free(detector);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_2D);
+	res &= DIAG(HKL_DETECTOR_TYPE_2D == hkl_detector_type_get(detector));
+	res &= DIAG(!hkl_detector_2d_pixels_set(detector, 0, 3, 1e-4, 1e-4, NULL));
+	res &= DIAG(!hkl_detector_2d_poni_set(detector, 0., 2., 1., NULL));
+	res &= DIAG(hkl_detector_2d_pixels_set(detector, 5, 3, 1e-4, 1e-4, NULL));
+	res &= DIAG(hkl_detector_2d_poni_set(detector, 1., 2., 1., NULL));
+	hkl_detector_2d_pixels_get(detector, &width, &height);
+	res &= DIAG(5 == width && 3 == height);
+
+	/* the normal incidence pixel sees the (1, 0, 0) reflection */
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL,
+					      30., 0., 90., 60.));
+	res &= DIAG(hkl_detector_2d_hkl_get(detector, geometry, sample, h, k, l, NULL));
+	res &= DIAG(fabs(h[7] - 1) < HKL_EPSILON);
+	res &= DIAG(fabs(k[7]) < HKL_EPSILON);
+	res &= DIAG(fabs(l[7]) < HKL_EPSILON);
+
+	/* the same kf than compute_kf for this pixel */
+	res &= DIAG(hkl_detector_2d_q_get(detector, geometry, qx, qy, qz, NULL));
+	hkl_source_compute_ki(&geometry->source, &ki);
+	hkl_detector_compute_kf(detector, geometry, &kf);
+	res &= DIAG(fabs(qx[7] - kf.data[0] + ki.data[0]) < HKL_EPSILON);
+	res &= DIAG(fabs(qy[7] - kf.data[1] + ki.data[1]) < HKL_EPSILON);
+	res &= DIAG(fabs(qz[7] - kf.data[2] + ki.data[2]) < HKL_EPSILON);
+
+	/* every pixel is on the Ewald sphere and sees a different Q */
+	for(i=0; i<15; ++i){
+		HklVector kf_i = {{qx[i] + ki.data[0], qy[i] + ki.data[1], qz[i] + ki.data[2]}};
+
+		res &= DIAG(fabs(hkl_vector_norm2(&kf_i) - hkl_vector_norm2(&ki)) < HKL_EPSILON);
+		if(i != 7)
+			res &= DIAG(fabs(qx[i] - qx[7]) + fabs(qy[i] - qy[7]) + fabs(qz[i] - qz[7]) > HKL_EPSILON);
+	}
+
+	/* a rotation of the plane around x moves the pixels, not the
+	 * normal incidence point */
+	res &= DIAG(hkl_detector_2d_orientation_set(detector, M_PI_2, 0, 0, NULL));
+	res &= DIAG(hkl_detector_2d_hkl_get(detector, geometry, sample, h, k, l, NULL));
+	res &= DIAG(fabs(h[7] - 1) < HKL_EPSILON);
+	res &= DIAG(fabs(k[7]) < HKL_EPSILON);
+	res &= DIAG(fabs(l[7]) < HKL_EPSILON);
+
+	ok(res == TRUE, __func__);
+
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 int main(int argc, char** argv)
 {
-	plan(7);
+	plan(8);
 
 	new();
 	attach_to_holder();
 	compute_kf();
+	frame_2d();
 
 	return 0;
 }
@@ -0,0 +1,169 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include "hkl.h"
+#include <string.h>
+#include <tap/basic.h>
+#include <tap/float.h>
+#include <tap/hkl-tap.h>
+
+#include "hkl-frames-private.h"
+
+static void raw(void)
+{
+	int res = TRUE;
+	HklFrames *frames;
+	char *filename;
+	FILE *f;
+	unsigned short data[3][4 * 2];
+	double values[4 * 2];
+	size_t width, height;
+	size_t i, j;
+
+	filename = g_build_filename(g_get_tmp_dir(), "hkl-frames-t-raw.bin", NULL);
+
+	/* a 16 bytes file header and 8 bytes before each frame */
+	f = fopen(filename, "wb");
+	if(f){
+		char header[16] = {0};
+
+		fwrite(header, 1, 16, f);
+		for(i=0; i<3; ++i){
+			for(j=0; j<4 * 2; ++j)
+				data[i][j] = 100 * i + j;
+			fwrite(header, 1, 8, f);
+			fwrite(data[i], sizeof(data[i][0]), 4 * 2, f);
+		}
+		fclose(f);
+	}
+
+	res &= DIAG(NULL == hkl_frames_new_raw(filename, HKL_FRAMES_TYPE_UINT16, 4, 2, 0, 0, NULL));
+	/* unknown pixel type and frame size overflow */
+	res &= DIAG(NULL == hkl_frames_new_raw(filename, (HklFramesType)42, 4, 2, 0, 0, NULL));
+	res &= DIAG(NULL == hkl_frames_new_raw(filename, HKL_FRAMES_TYPE_UINT16,
+					       G_MAXSIZE / 2, 2, 0, 0, NULL));
+	frames = hkl_frames_new_raw(filename, HKL_FRAMES_TYPE_UINT16, 4, 2, 16, 8, NULL);
+	res &= DIAG(NULL != frames);
+	res &= DIAG(3 == hkl_frames_len(frames));
+	hkl_frames_size_get(frames, &width, &height);
+	res &= DIAG(4 == width && 2 == height);
+	res &= DIAG(HKL_FRAMES_TYPE_UINT16 == hkl_frames_type_get(frames));
+
+	for(i=0; i<3; ++i){
+		const unsigned short *row = hkl_frames_row_get(frames, i, 1, NULL);
+
+		res &= DIAG(!memcmp(row, &data[i][4], 4 * sizeof(*row)));
+		hkl_frames_frame_get(frames, i, values);
+		for(j=0; j<4 * 2; ++j)
+			res &= DIAG(values[j] == 100 * i + j);
+	}
+
+	ok(res == TRUE, __func__);
+
+	hkl_frames_free(frames);
+	remove(filename);
+	g_free(filename);
+}
+
+static void edf(void)
+{
+	int res = TRUE;
+	HklFrames *frames;
+	char *filename;
+	FILE *f;
+	double values[3 * 2];
+	size_t width, height;
+	size_t i, j;
+
+	filename = g_build_filename(g_get_tmp_dir(), "hkl-frames-t.edf", NULL);
+
+	/* two big endian float frames with 512 bytes headers */
+	f = fopen(filename, "wb");
+	if(f){
+		for(i=0; i<2; ++i){
+			char header[512];
+			int n;
+
+			n = snprintf(header, sizeof(header),
+				     "{\nHeaderID = EH:%06zu:000000:000000 ;\nByteOrder = HighByteFirst ;\n"
+				     "DataType = FloatValue ;\nDim_1 = 3 ;\nDim_2 = 2 ;\nSize = 24 ;\n",
+				     i + 1);
+			memset(&header[n], ' ', sizeof(header) - n);
+			header[sizeof(header) - 2] = '}';
+			header[sizeof(header) - 1] = '\n';
+			fwrite(header, 1, sizeof(header), f);
+			for(j=0; j<3 * 2; ++j){
+				float v = 10 * i + j + .5;
+				unsigned char bytes[4];
+				guint32 u;
+
+				memcpy(&u, &v, sizeof(u));
+				bytes[0] = u >> 24;
+				bytes[1] = u >> 16;
+				bytes[2] = u >> 8;
+				bytes[3] = u;
+				fwrite(bytes, 1, 4, f);
+			}
+		}
+		fclose(f);
+	}
+
+	frames = hkl_frames_new_edf(filename, NULL);
+	res &= DIAG(NULL != frames);
+	res &= DIAG(2 == hkl_frames_len(frames));
+	hkl_frames_size_get(frames, &width, &height);
+	res &= DIAG(3 == width && 2 == height);
+	res &= DIAG(HKL_FRAMES_TYPE_FLOAT32 == hkl_frames_type_get(frames));
+	for(i=0; i<2; ++i){
+		hkl_frames_frame_get(frames, i, values);
+		for(j=0; j<3 * 2; ++j)
+			res &= DIAG(values[j] == 10 * i + j + .5);
+
+		/* one row converted in place */
+		hkl_frames_row_values_get(frames, i, 1, values);
+		for(j=0; j<3; ++j)
+			res &= DIAG(values[j] == 10 * i + 3 + j + .5);
+	}
+	hkl_frames_free(frames);
+
+	/* not an EDF file */
+	f = fopen(filename, "w");
+	if(f){
+		fprintf(f, "not an edf file");
+		fclose(f);
+	}
+	res &= DIAG(NULL == hkl_frames_new_edf(filename, NULL));
+
+	ok(res == TRUE, __func__);
+
+	remove(filename);
+	g_free(filename);
+}
+
+int main(int argc, char** argv)
+{
+	plan(2);
+
+	raw();
+	edf();
+
+	return 0;
+}
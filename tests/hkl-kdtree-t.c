@@ -0,0 +1,119 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include "hkl.h"
+#include <tap/basic.h>
+#include <tap/float.h>
+#include <tap/hkl-tap.h>
+
+#include "hkl-kdtree-private.h"
+
+static void nearest(void)
+{
+	int res = TRUE;
+	HklKdTree *tree;
+	double points[200][3];
+	size_t i, j;
+
+	tree = hkl_kdtree_new(3, 1, 1000);
+	res &= DIAG(NULL == hkl_kdtree_nearest(tree, points[0], NULL));
+
+	for(i=0; i<200; ++i){
+		double data = i;
+
+		for(j=0; j<3; ++j)
+			points[i][j] = (double)rand() / RAND_MAX;
+		hkl_kdtree_add(tree, points[i], &data);
+	}
+	res &= DIAG(hkl_kdtree_size(tree) == 200);
+
+	/* same result than the brute force search */
+	for(i=0; i<100; ++i){
+		double point[3];
+		double distance;
+		double best = INFINITY;
+		const double *data;
+
+		for(j=0; j<3; ++j)
+			point[j] = (double)rand() / RAND_MAX;
+
+		for(j=0; j<200; ++j){
+			double d = sqrt((point[0] - points[j][0]) * (point[0] - points[j][0])
+					+ (point[1] - points[j][1]) * (point[1] - points[j][1])
+					+ (point[2] - points[j][2]) * (point[2] - points[j][2]));
+			if(d < best)
+				best = d;
+		}
+
+		data = hkl_kdtree_nearest(tree, point, &distance);
+		res &= DIAG(NULL != data);
+		res &= DIAG(fabs(best - distance) < HKL_EPSILON);
+	}
+
+	/* an existing point is its own nearest point */
+	res &= DIAG(42. == *hkl_kdtree_nearest(tree, points[42], NULL));
+
+	hkl_kdtree_reset(tree);
+	res &= DIAG(hkl_kdtree_size(tree) == 0);
+
+	ok(res == TRUE, __func__);
+
+	hkl_kdtree_free(tree);
+}
+
+static void capacity(void)
+{
+	int res = TRUE;
+	HklKdTree *tree;
+	size_t i;
+
+	tree = hkl_kdtree_new(1, 1, 10);
+
+	/* the oldest half is dropped when full */
+	for(i=0; i<11; ++i){
+		double point = i;
+
+		hkl_kdtree_add(tree, &point, &point);
+	}
+	res &= DIAG(hkl_kdtree_size(tree) == 6);
+	for(i=0; i<11; ++i){
+		double point = i;
+		double distance;
+		const double *data = hkl_kdtree_nearest(tree, &point, &distance);
+
+		res &= DIAG(*data == (i < 5 ? 5. : point));
+		res &= DIAG(fabs(distance - (i < 5 ? 5. - i : 0.)) < HKL_EPSILON);
+	}
+
+	ok(res == TRUE, __func__);
+
+	hkl_kdtree_free(tree);
+}
+
+int main(int argc, char** argv)
+{
+	plan(2);
+
+	nearest();
+	capacity();
+
+	return 0;
+}
@@ -272,6 +272,21 @@ static void reciprocal(void)
 		      HKL_TAU * 0.0626708259,HKL_TAU * 0.0626912310,HKL_TAU * 0.0541800061,
 		      1.5713705262, 1.5716426508, 1.0473718249);
 
+	/* a destination constrained by an hexagonal system */
+	ok(TRUE == hkl_lattice_set(lattice, 1., 1., 2.,
+				   90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 120 * HKL_DEGTORAD,
+				   HKL_UNIT_DEFAULT, NULL),
+	   __func__);
+	ok(TRUE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_HEXAGONAL, NULL), __func__);
+	hkl_lattice_free(reciprocal);
+	reciprocal = hkl_lattice_new_copy(lattice);
+	ok(TRUE == hkl_lattice_reciprocal(lattice, reciprocal), __func__);
+	ok(HKL_LATTICE_SYSTEM_TRICLINIC == hkl_lattice_system_get(reciprocal), __func__);
+
+	CHECK_LATTICE(reciprocal,
+		      HKL_TAU * 2. / sqrt(3.), HKL_TAU * 2. / sqrt(3.), HKL_TAU / 2.,
+		      90. * HKL_DEGTORAD, 90. * HKL_DEGTORAD, 60. * HKL_DEGTORAD);
+
 	hkl_lattice_free(lattice);
 	hkl_lattice_free(reciprocal);
 }
@@ -292,6 +307,16 @@ static void get_B(void)
 	hkl_lattice_get_B(lattice, B);
 	is_matrix(B_ref, B, __func__);
 
+	/* the cached B follows the lattice parameters */
+	ok(TRUE == hkl_lattice_set(lattice, 3.08, 3.08, 3.08, 90, 90, 90,
+				   HKL_UNIT_USER, NULL), __func__);
+	hkl_lattice_get_B(lattice, B);
+	hkl_matrix_init(B_ref,
+			HKL_TAU / 3.08, 0, 0,
+			0, HKL_TAU / 3.08, 0,
+			0, 0, HKL_TAU / 3.08);
+	is_matrix(B_ref, B, __func__);
+
 	hkl_lattice_free(lattice);
 	hkl_matrix_free(B);
 	hkl_matrix_free(B_ref);
@@ -324,9 +349,79 @@ static void get_1_B(void)
 	hkl_matrix_free(I_ref);
 }
 
+static void lattice_system(void)
+{
+	HklLattice *lattice;
+	HklParameter *p;
+	GError *error;
+
+	lattice = hkl_lattice_new(1.54, 2., 3.,
+				  80*HKL_DEGTORAD, 85*HKL_DEGTORAD, 95*HKL_DEGTORAD,
+				  NULL);
+	ok(HKL_LATTICE_SYSTEM_TRICLINIC == hkl_lattice_system_get(lattice), __func__);
+
+	/* tetragonal a = b */
+	error = NULL;
+	ok(TRUE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_TETRAGONAL, &error), __func__);
+	ok(error == NULL, __func__);
+	ok(HKL_LATTICE_SYSTEM_TETRAGONAL == hkl_lattice_system_get(lattice), __func__);
+	CHECK_LATTICE(lattice, 1.54, 1.54, 3., 90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD);
+
+	/* hexagonal gamma = 120 */
+	ok(TRUE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_HEXAGONAL, NULL), __func__);
+	CHECK_LATTICE(lattice, 1.54, 1.54, 3., 90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 120*HKL_DEGTORAD);
+
+	/* cubic a = b = c */
+	ok(TRUE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_CUBIC, NULL), __func__);
+	CHECK_LATTICE(lattice, 1.54, 1.54, 1.54, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD);
+
+	/* the setters respect the crystal system */
+	error = NULL;
+	ok(FALSE == hkl_lattice_set(lattice, 1.54, 2., 1.54, 90., 90., 90., HKL_UNIT_USER, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+	p = hkl_parameter_new_copy(hkl_lattice_b_get(lattice));
+	ok(TRUE == hkl_parameter_value_set(p, 2., HKL_UNIT_DEFAULT, NULL), __func__);
+	ok(FALSE == hkl_lattice_b_set(lattice, p, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+	hkl_parameter_free(p);
+	p = hkl_parameter_new_copy(hkl_lattice_gamma_get(lattice));
+	ok(TRUE == hkl_parameter_value_set(p, 100., HKL_UNIT_USER, NULL), __func__);
+	ok(FALSE == hkl_lattice_gamma_set(lattice, p, NULL), __func__);
+	hkl_parameter_free(p);
+	CHECK_LATTICE(lattice, 1.54, 1.54, 1.54, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD);
+
+	/* b and c follow a */
+	p = hkl_parameter_new_copy(hkl_lattice_a_get(lattice));
+	ok(TRUE == hkl_parameter_value_set(p, 2., HKL_UNIT_DEFAULT, NULL), __func__);
+	ok(TRUE == hkl_lattice_a_set(lattice, p, NULL), __func__);
+	hkl_parameter_free(p);
+	CHECK_LATTICE(lattice, 2., 2., 2., 90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD);
+	ok(TRUE == hkl_lattice_set(lattice, 1.54, 1.54, 1.54, 90., 90., 90., HKL_UNIT_USER, NULL), __func__);
+
+	/* unknown crystal system */
+	ok(FALSE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_CUBIC + 1, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+	ok(HKL_LATTICE_SYSTEM_CUBIC == hkl_lattice_system_get(lattice), __func__);
+
+	/* a rhombohedral lattice with alpha = 150 is not valid */
+	ok(TRUE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_TRICLINIC, NULL), __func__);
+	ok(TRUE == hkl_lattice_set(lattice, 1.54, 1.54, 1.54, 150., 90., 90., HKL_UNIT_USER, NULL), __func__);
+	error = NULL;
+	ok(FALSE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_RHOMBOHEDRAL, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+	ok(HKL_LATTICE_SYSTEM_TRICLINIC == hkl_lattice_system_get(lattice), __func__);
+	CHECK_LATTICE(lattice, 1.54, 1.54, 1.54, 150*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD);
+
+	hkl_lattice_free(lattice);
+}
+
 int main(int argc, char** argv)
 {
-	plan(137);
+	plan(209);
 
 	new();
 	new_copy();
@@ -334,6 +429,7 @@ int main(int argc, char** argv)
 	reciprocal();
 	get_B();
 	get_1_B();
+	lattice_system();
 
 	return 0;
 }
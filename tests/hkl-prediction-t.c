@@ -0,0 +1,151 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2014 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include "hkl.h"
+#include <tap/basic.h>
+#include <tap/float.h>
+#include <tap/hkl-tap.h>
+
+static int reflection_predicted(const HklPrediction *prediction,
+				double h, double k, double l, double *value)
+{
+	size_t i;
+
+	for(i=0; i<hkl_prediction_reflections_len(prediction); ++i){
+		double hh, kk, ll;
+
+		hkl_prediction_reflection_get(prediction, i, &hh, &kk, &ll, value);
+		if(hh == h && kk == k && ll == l)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void geometry(void)
+{
+	int res = TRUE;
+	const HklFactory *factory;
+	HklGeometry *geom;
+	HklSample *sample;
+	HklLattice *lattice;
+	HklPrediction *prediction;
+	double qmax;
+	double value;
+	size_t i;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geom = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	/* everything reachable with this wavelength */
+	qmax = 2 * HKL_TAU / hkl_geometry_wavelength_get(geom, HKL_UNIT_DEFAULT);
+	res &= DIAG(NULL == hkl_prediction_new(sample, 0., NULL));
+	prediction = hkl_prediction_new(sample, qmax, NULL);
+	res &= DIAG(NULL != prediction);
+	res &= DIAG(hkl_prediction_len(prediction) > 0);
+
+	res &= DIAG(hkl_geometry_set_values_v(geom, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	res &= DIAG(hkl_prediction_geometry(prediction, geom, sample, 1e-3, NULL));
+	res &= DIAG(reflection_predicted(prediction, 1, 0, 0, &value));
+	res &= DIAG(fabs(value) < HKL_EPSILON);
+	res &= DIAG(!reflection_predicted(prediction, 0, 0, 1, &value));
+	for(i=0; i<hkl_prediction_reflections_len(prediction); ++i){
+		double h, k, l;
+
+		hkl_prediction_reflection_get(prediction, i, &h, &k, &l, &value);
+		res &= DIAG(fabs(value) <= 1e-3);
+	}
+
+	/* the index must be rebuilt once the lattice changed */
+	lattice = hkl_lattice_new(1.54, 1.54, 2.,
+				  90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD,
+				  NULL);
+	hkl_sample_lattice_set(sample, lattice);
+	res &= DIAG(!hkl_prediction_geometry(prediction, geom, sample, 1e-3, NULL));
+
+	ok(res == TRUE, __func__);
+
+	hkl_lattice_free(lattice);
+	hkl_prediction_free(prediction);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geom);
+}
+
+static void sweep(void)
+{
+	int res = TRUE;
+	const HklFactory *factory;
+	HklGeometry *geom;
+	HklSample *sample;
+	HklPrediction *prediction;
+	double qmax;
+	double value;
+	size_t i, n;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geom = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	qmax = 2 * HKL_TAU / hkl_geometry_wavelength_get(geom, HKL_UNIT_DEFAULT);
+	prediction = hkl_prediction_new(sample, qmax, NULL);
+
+	res &= DIAG(hkl_geometry_set_values_v(geom, HKL_UNIT_USER, NULL, 0., 0., 90., 60.));
+	res &= DIAG(!hkl_prediction_sweep(prediction, geom, sample, "tth",
+					  -180., 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_prediction_sweep(prediction, geom, sample, "omega",
+					 -180., 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(reflection_predicted(prediction, 1, 0, 0, &value));
+	n = hkl_prediction_reflections_len(prediction);
+	res &= DIAG(n > 0);
+
+	/* each reflection is on the Ewald sphere at its crossing angle */
+	for(i=0; i<n; ++i){
+		double h, k, l;
+		double omega;
+		double distance;
+
+		res &= DIAG(hkl_prediction_sweep(prediction, geom, sample, "omega",
+						 -180., 180., HKL_UNIT_USER, NULL));
+		hkl_prediction_reflection_get(prediction, i, &h, &k, &l, &omega);
+		res &= DIAG(omega >= -180. && omega <= 180.);
+
+		res &= DIAG(hkl_geometry_set_values_v(geom, HKL_UNIT_USER, NULL, omega, 0., 90., 60.));
+		res &= DIAG(hkl_prediction_geometry(prediction, geom, sample, 1e-6, NULL));
+		res &= DIAG(reflection_predicted(prediction, h, k, l, &distance));
+	}
+
+	ok(res == TRUE, __func__);
+
+	hkl_prediction_free(prediction);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geom);
+}
+
+int main(int argc, char** argv)
+{
+	plan(2);
+
+	geometry();
+	sweep();
+
+	return 0;
+}
@@ -23,6 +23,8 @@
 #include <tap/basic.h>
 #include <tap/hkl-tap.h>
 
+#include "hkl-pseudoaxis-private.h" /* for hkl_engine_clone_init */
+
 static void getter(void)
 {
 	int res = TRUE;
@@ -254,6 +256,87 @@ static void psi_setter(void)
 	hkl_geometry_free(geometry);
 }
 
+static void psi_scan(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklEngine *hkl;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometry *start;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	static const double hkl0[] = {0, 0, 1};
+	static const double hkl1[] = {1, 0, 0};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	hkl = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	engine = hkl_engine_list_engine_get_by_name(engines, "psi", NULL);
+
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+	start = hkl_geometry_new_copy(geometry);
+
+	/* only the psi engine can scan the azimuth */
+	res &= DIAG(NULL == hkl_engine_psi_scan(hkl, hkl0, hkl1, -60., 60., 5.,
+						HKL_UNIT_USER, NULL));
+
+	/* wrong step */
+	res &= DIAG(NULL == hkl_engine_psi_scan(engine, hkl0, hkl1, -60., 60., -5.,
+						HKL_UNIT_USER, NULL));
+
+	geometries = hkl_engine_psi_scan(engine, hkl0, hkl1, -60., 60., 5.,
+					 HKL_UNIT_USER, NULL);
+	res &= DIAG(NULL != geometries);
+
+	/* the geometry is not modified */
+	res &= DIAG(hkl_geometry_motion_time(start, geometry) == 0.);
+
+	if(geometries){
+		const HklGeometryListItem *item;
+		double prev[4];
+		size_t i = 0;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) == 25);
+
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			const HklGeometry *g = hkl_geometry_list_item_geometry_get(item);
+			double values[4];
+			size_t j;
+
+			hkl_geometry_set(geometry, g);
+			res &= DIAG(check_pseudoaxes(hkl, (double *)hkl0, 3));
+			res &= DIAG(check_pseudoaxes_v(engine, (-60. + 5. * i) * HKL_DEGTORAD));
+
+			/* no jump between two consecutive azimuths */
+			hkl_geometry_axes_values_get(g, values, 4, HKL_UNIT_DEFAULT);
+			if(i > 0)
+				for(j=0; j<4; ++j)
+					res &= DIAG(cos(values[j] - prev[j]) > cos(20. * HKL_DEGTORAD));
+			memcpy(prev, values, sizeof(values));
+			i++;
+		}
+
+		hkl_geometry_set(geometry, start);
+		hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, "psi scan");
+
+	hkl_geometry_free(start);
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 static void q(void)
 {
 	int res = TRUE;
@@ -364,16 +447,1223 @@ static void hkl_psi_constant_vertical(void)
 	hkl_geometry_free(geometry);
 }
 
+/* the clone of an initialized engine keeps the reference state of
+ * the source even when the geometry moved since the initialization */
+static int clone_check(HklEngine *engine, double values[], size_t n_values)
+{
+	int res = TRUE;
+	struct hkl_engine_clone_t clone;
+	HklGeometryList *expected;
+	HklGeometryList *solutions = NULL;
+	size_t n = darray_size(engine->mode->parameters);
+	double p1[n];
+	double p2[n];
+	size_t i;
+
+	res &= DIAG(hkl_engine_clone_init(&clone, engine));
+
+	/* the mode parameters are not recomputed */
+	hkl_engine_parameters_values_get(engine, p1, n, HKL_UNIT_DEFAULT);
+	hkl_engine_parameters_values_get(clone.engine, p2, n, HKL_UNIT_DEFAULT);
+	for(i=0; i<n; ++i)
+		res &= DIAG(fabs(p1[i] - p2[i]) < HKL_EPSILON);
+
+	/* and the clone solves like the source */
+	expected = hkl_engine_pseudo_axes_values_set(engine, values, n_values,
+						     HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != expected);
+	if(expected){
+		solutions = hkl_engine_pseudo_axes_values_set(clone.engine, values, n_values,
+							      HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL != solutions);
+	}
+	if(expected && solutions){
+		res &= DIAG(hkl_geometry_list_n_items_get(expected)
+			    == hkl_geometry_list_n_items_get(solutions));
+		res &= DIAG(hkl_geometry_motion_time(hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(expected)),
+						     hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions)))
+			    < HKL_EPSILON);
+	}
+	if(solutions)
+		hkl_geometry_list_free(solutions);
+	if(expected)
+		hkl_geometry_list_free(expected);
+
+	hkl_engine_clone_release(&clone);
+
+	return res;
+}
+
+static void clone_initialized(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	double psi = 10. * HKL_DEGTORAD;
+	static double hkl[] = {1, 0, 1};
+	static double hkl1[] = {1, 0, 0};
+	static double hkl2[] = {1, 1, 0};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	/* psi: hkl0 is computed at the initialization geometry */
+	engine = hkl_engine_list_engine_get_by_name(engines, "psi", NULL);
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl1, ARRAY_SIZE(hkl1),
+						     HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 20., 30., 10., 50.));
+	res &= DIAG(clone_check(engine, &psi, 1));
+
+	/* psi_constant: psi is stored in the parameters at the initialization */
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "psi_constant", NULL));
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl2, ARRAY_SIZE(hkl2),
+						     HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 20., 30., 10., 50.));
+	res &= DIAG(clone_check(engine, hkl, ARRAY_SIZE(hkl)));
+
+	ok(res == TRUE, "clone initialized");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void range_constrained(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	HklParameter *chi;
+	HklParameter *phi;
+	static double hkl[] = {1, 0, 0};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	/* tight limits on chi and phi */
+	chi = hkl_parameter_new_copy(hkl_geometry_axis_get(geometry, "chi", NULL));
+	res &= DIAG(hkl_parameter_min_max_set(chi, -10., 10., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_set(geometry, "chi", chi, NULL));
+
+	phi = hkl_parameter_new_copy(hkl_geometry_axis_get(geometry, "phi", NULL));
+	res &= DIAG(hkl_parameter_min_max_set(phi, 0., 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_set(geometry, "phi", phi, NULL));
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	res &= DIAG(FALSE == hkl_engine_list_range_constrained_get(engines));
+	hkl_engine_list_range_constrained_set(engines, TRUE);
+	res &= DIAG(TRUE == hkl_engine_list_range_constrained_get(engines));
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+							HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) > 0);
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			double values[4];
+
+			hkl_geometry_set(geometry,
+					 hkl_geometry_list_item_geometry_get(item));
+			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+
+			hkl_geometry_axes_values_get(geometry, values, 4, HKL_UNIT_USER);
+			res &= DIAG(values[1] >= -10. && values[1] <= 10.);
+			res &= DIAG(values[2] >= 0. && values[2] <= 180.);
+		}
+		hkl_geometry_list_free(geometries);
+	}
+
+	/* (0, 1, 0) is along the phi axis so phi is degenerated and
+	 * keeps its first position (0) which is out of its range. Only
+	 * the constrained solver moves it into the range. */
+	hkl[0] = 0; hkl[1] = 1; hkl[2] = 0;
+	res &= DIAG(hkl_parameter_min_max_set(chi, -180., 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_set(geometry, "chi", chi, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(phi, 100., 120., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_set(geometry, "phi", phi, NULL));
+
+	hkl_engine_list_range_constrained_set(engines, FALSE);
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL == geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+
+	hkl_engine_list_range_constrained_set(engines, TRUE);
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			double values[4];
+
+			hkl_geometry_set(geometry,
+					 hkl_geometry_list_item_geometry_get(item));
+			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+
+			hkl_geometry_axes_values_get(geometry, values, 4, HKL_UNIT_USER);
+			res &= DIAG(values[2] >= 100. && values[2] <= 120.);
+		}
+		hkl_geometry_list_free(geometries);
+	}
+
+	/* a fixed axis (min == max) is pinned to its value */
+	hkl[0] = 1; hkl[1] = 0; hkl[2] = 0;
+	res &= DIAG(hkl_parameter_min_max_set(chi, 0., 0., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_set(geometry, "chi", chi, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(phi, -180., 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_set(geometry, "phi", phi, NULL));
+
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 10., 0., 10., 20.);
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			double values[4];
+
+			hkl_geometry_set(geometry,
+					 hkl_geometry_list_item_geometry_get(item));
+			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+
+			hkl_geometry_axes_values_get(geometry, values, 4, HKL_UNIT_USER);
+			res &= DIAG(values[1] == 0.);
+		}
+		hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, "range constrained");
+
+	hkl_parameter_free(phi);
+	hkl_parameter_free(chi);
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void scan_plan(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	size_t i;
+	static double hkl[] = {
+		1, 0, 0,
+		1, 0, .1,
+		1, 0, .2,
+		1, 0, .3,
+		1, 0, .4,
+		1, 0, .5,
+	};
+	static double weights[] = {1, 1, 1, 1};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	/* wrong number of weights */
+	res &= DIAG(NULL == hkl_engine_pseudo_axes_values_plan(engine, hkl, ARRAY_SIZE(hkl),
+							       weights, 3,
+							       HKL_UNIT_DEFAULT, NULL));
+
+	geometries = hkl_engine_pseudo_axes_values_plan(engine, hkl, ARRAY_SIZE(hkl),
+							weights, ARRAY_SIZE(weights),
+							HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+		HklGeometry *start = hkl_geometry_new_copy(geometry);
+		HklGeometry *prev = hkl_geometry_new_copy(geometry);
+		double planned = 0.;
+		double greedy = 0.;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) == ARRAY_SIZE(hkl) / 3);
+
+		/* each geometry reach its point */
+		i = 0;
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			double values[4];
+			double values_prev[4];
+			size_t j;
+
+			hkl_geometry_axes_values_get(prev, values_prev, 4, HKL_UNIT_DEFAULT);
+			hkl_geometry_axes_values_get(hkl_geometry_list_item_geometry_get(item),
+						     values, 4, HKL_UNIT_DEFAULT);
+			for(j=0; j<4; ++j)
+				planned += fabs(values[j] - values_prev[j]);
+			hkl_geometry_set(prev, hkl_geometry_list_item_geometry_get(item));
+
+			hkl_geometry_set(geometry, hkl_geometry_list_item_geometry_get(item));
+			res &= DIAG(check_pseudoaxes(engine, &hkl[3 * i], 3));
+			hkl_geometry_set(geometry, start);
+			i++;
+		}
+
+		/* the plan is never longer than the point per point choice */
+		hkl_geometry_set(prev, start);
+		for(i=0; i<ARRAY_SIZE(hkl) / 3; ++i){
+			HklGeometryList *solutions;
+
+			solutions = hkl_engine_pseudo_axes_values_set(engine, &hkl[3 * i], 3,
+								      HKL_UNIT_DEFAULT, NULL);
+			if(solutions){
+				const HklGeometry *first = hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions));
+				double values[4];
+				double values_prev[4];
+				size_t j;
+
+				hkl_geometry_axes_values_get(prev, values_prev, 4, HKL_UNIT_DEFAULT);
+				hkl_geometry_axes_values_get(first, values, 4, HKL_UNIT_DEFAULT);
+				for(j=0; j<4; ++j)
+					greedy += fabs(values[j] - values_prev[j]);
+				hkl_geometry_set(prev, first);
+				hkl_geometry_list_free(solutions);
+			}
+		}
+		res &= DIAG(planned <= greedy + HKL_EPSILON);
+
+		hkl_geometry_free(prev);
+		hkl_geometry_free(start);
+		hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, "scan plan");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void scan_order(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	size_t i;
+	size_t order[5];
+	static double hkl[] = {
+		1, 0, .4,
+		0, 1, 0,
+		1, 0, 0,
+		0, 1, .4,
+		1, 0, .2,
+	};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	/* a slow tth motor and only one motor moving at a time */
+	res &= DIAG(hkl_geometry_axis_motion_set(geometry, "omega", 2., 4., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_geometry_axis_motion_set(geometry, "tth", .5, 1., HKL_UNIT_USER, NULL));
+	res &= DIAG(FALSE == hkl_geometry_axis_motion_set(geometry, "nu", 1., 1., HKL_UNIT_USER, NULL));
+	res &= DIAG(FALSE == hkl_geometry_axis_motion_set(geometry, "chi", 0., 1., HKL_UNIT_USER, NULL));
+	hkl_geometry_simultaneous_motions_set(geometry, 1);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	/* wrong number of values */
+	res &= DIAG(NULL == hkl_engine_pseudo_axes_values_order(engine, hkl, 4, order,
+								HKL_UNIT_DEFAULT, NULL));
+
+	geometries = hkl_engine_pseudo_axes_values_order(engine, hkl, ARRAY_SIZE(hkl),
+							 order, HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+		HklGeometry *start = hkl_geometry_new_copy(geometry);
+		HklGeometry *prev = hkl_geometry_new_copy(geometry);
+		int seen[ARRAY_SIZE(order)] = {0};
+		double ordered = 0.;
+		double unordered = 0.;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) == ARRAY_SIZE(order));
+
+		/* order is a permutation and each geometry reach its point */
+		i = 0;
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			const HklGeometry *g = hkl_geometry_list_item_geometry_get(item);
+
+			res &= DIAG(order[i] < ARRAY_SIZE(order) && !seen[order[i]]);
+			seen[order[i]] = TRUE;
+
+			ordered += hkl_geometry_motion_time(prev, g);
+			hkl_geometry_set(prev, g);
+
+			hkl_geometry_set(geometry, g);
+			res &= DIAG(check_pseudoaxes(engine, &hkl[3 * order[i]], 3));
+			hkl_geometry_set(geometry, start);
+			i++;
+		}
+
+		/* never slower than the given order with the first solutions */
+		hkl_geometry_set(prev, start);
+		for(i=0; i<ARRAY_SIZE(order); ++i){
+			HklGeometryList *solutions;
+
+			solutions = hkl_engine_pseudo_axes_values_set(engine, &hkl[3 * i], 3,
+								      HKL_UNIT_DEFAULT, NULL);
+			if(solutions){
+				const HklGeometry *first = hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(solutions));
+
+				unordered += hkl_geometry_motion_time(prev, first);
+				hkl_geometry_set(prev, first);
+				hkl_geometry_list_free(solutions);
+			}
+		}
+		res &= DIAG(ordered <= unordered + HKL_EPSILON);
+
+		hkl_geometry_free(prev);
+		hkl_geometry_free(start);
+		hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, "scan order");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void solutions_cache(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklGeometryList *cached;
+	HklDetector *detector;
+	HklSample *sample;
+	GError *error1 = NULL;
+	GError *error2 = NULL;
+	static double hkl[] = {1, 0, 0};
+	static double unreachable[] = {10, 10, 10};
+	static double hkl1[] = {0, 1, 0};
+	double psi = 10. * HKL_DEGTORAD;
+	size_t i;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	hkl_engine_list_solutions_cache_set(engines, 4, HKL_EPSILON);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	/* the same target twice give the same solutions */
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	cached = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						   HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	res &= DIAG(NULL != cached);
+	if(geometries && cached){
+		const HklGeometryListItem *item1;
+		const HklGeometryListItem *item2;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries)
+			    == hkl_geometry_list_n_items_get(cached));
+		for(item1=hkl_geometry_list_items_first_get(geometries),
+			    item2=hkl_geometry_list_items_first_get(cached);
+		    item1 && item2;
+		    item1=hkl_geometry_list_items_next_get(geometries, item1),
+			    item2=hkl_geometry_list_items_next_get(cached, item2)){
+			double v1[4];
+			double v2[4];
+			size_t i;
+
+			hkl_geometry_axes_values_get(hkl_geometry_list_item_geometry_get(item1),
+						     v1, 4, HKL_UNIT_DEFAULT);
+			hkl_geometry_axes_values_get(hkl_geometry_list_item_geometry_get(item2),
+						     v2, 4, HKL_UNIT_DEFAULT);
+			for(i=0; i<4; ++i)
+				res &= DIAG(fabs(v1[i] - v2[i]) < HKL_EPSILON);
+		}
+	}
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	if(cached)
+		hkl_geometry_list_free(cached);
+
+	/* an unreachable target fails each time with the same error */
+	res &= DIAG(NULL == hkl_engine_pseudo_axes_values_set(engine, unreachable, ARRAY_SIZE(unreachable),
+							      HKL_UNIT_DEFAULT, &error1));
+	res &= DIAG(NULL == hkl_engine_pseudo_axes_values_set(engine, unreachable, ARRAY_SIZE(unreachable),
+							      HKL_UNIT_DEFAULT, &error2));
+	res &= DIAG(error1 != NULL);
+	res &= DIAG(error2 != NULL);
+	if(error1 && error2)
+		res &= DIAG(error1->code == error2->code
+			    && !strcmp(error1->message, error2->message));
+	g_clear_error(&error1);
+	g_clear_error(&error2);
+
+	/* a new wavelength is a new target */
+	res &= DIAG(hkl_geometry_wavelength_set(geometry, 1., HKL_UNIT_DEFAULT, NULL));
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		hkl_geometry_set(geometry,
+				 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries)));
+		res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+		hkl_geometry_list_free(geometries);
+	}
+
+	/* a new initialization is a new target */
+	engine = hkl_engine_list_engine_get_by_name(engines, "psi", NULL);
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl1, ARRAY_SIZE(hkl1),
+						     HKL_UNIT_DEFAULT, NULL));
+	for(i=0; i<2; ++i){
+		geometries = hkl_engine_pseudo_axes_values_set(engine, &psi, 1,
+							       HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL != geometries);
+		if(geometries)
+			hkl_geometry_list_free(geometries);
+		res &= DIAG(1 == g_hash_table_size(engines->cache.entries));
+	}
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+	res &= DIAG(NULL == engines->cache.entries);
+	geometries = hkl_engine_pseudo_axes_values_set(engine, &psi, 1,
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		hkl_geometry_set(geometry,
+				 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries)));
+		res &= DIAG(check_pseudoaxes(engine, &psi, 1));
+		hkl_geometry_list_free(geometries);
+	}
+	res &= DIAG(1 == g_hash_table_size(engines->cache.entries));
+
+	ok(res == TRUE, "solutions cache");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+/* solve a bissector target from a given start with a fresh engine
+ * list, so no previous solution is used as a seed */
+static HklGeometryList *bissector_solve(HklGeometry *start, HklDetector *detector,
+					HklSample *sample, const char *grid,
+					double target[])
+{
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometryList *solutions = NULL;
+
+	engines = hkl_factory_create_new_engine_list(hkl_factory_get_by_name("E4CV", NULL));
+	hkl_engine_list_init(engines, start, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	if(hkl_engine_current_mode_set(engine, "bissector", NULL)
+	   && (!grid || hkl_engine_grid_load(engine, grid, NULL)))
+		solutions = hkl_engine_pseudo_axes_values_set(engine, target, 3,
+							      HKL_UNIT_DEFAULT, NULL);
+	hkl_engine_list_free(engines);
+
+	return solutions;
+}
+
+/* the two lists contain the same geometries, in any order */
+static int same_geometries(const HklGeometryList *l1, const HklGeometryList *l2)
+{
+	const HklGeometryListItem *i1;
+	const HklGeometryListItem *i2;
+
+	if(hkl_geometry_list_n_items_get(l1) != hkl_geometry_list_n_items_get(l2))
+		return FALSE;
+
+	HKL_GEOMETRY_LIST_FOREACH(i1, l1){
+		int found = FALSE;
+
+		HKL_GEOMETRY_LIST_FOREACH(i2, l2)
+			found |= hkl_geometry_motion_time(hkl_geometry_list_item_geometry_get(i1),
+							  hkl_geometry_list_item_geometry_get(i2))
+				< HKL_EPSILON;
+		if(!found)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void grid(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	gchar *filename;
+	FILE *f;
+	size_t i;
+	static double min[] = {0.5, 0, 0};
+	static double max[] = {1.5, 0, 1};
+	static size_t n[] = {5, 1, 5};
+	static double node[] = {1.25, 0, .5};
+	double seed[4];
+	HklGeometry *start;
+	HklGeometryList *seeded;
+	HklGeometryList *unseeded;
+	static double targets[][3] = {
+		{1, 0, 0},
+		{1.1, 0, .3},
+		{.6, 0, .9},
+	};
+
+	filename = g_build_filename(g_get_tmp_dir(), "hkl-pseudoaxis-e4cv-t-grid.bin", NULL);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	/* compute and save the grid */
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	res &= DIAG(FALSE == hkl_engine_grid_save(engine, filename, NULL));
+	res &= DIAG(FALSE == hkl_engine_grid_compute(engine, min, max, n, 2,
+						     HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_grid_compute(engine, min, max, n, ARRAY_SIZE(n),
+					    HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_grid_save(engine, filename, NULL));
+	hkl_engine_list_free(engines);
+
+	/* load it in a new engine list and solve with it */
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+	res &= DIAG(hkl_engine_grid_load(engine, filename, NULL));
+
+	/* the solver starts from the grid seed: from a start on the
+	 * other tth branch the solutions are the ones of a solve started
+	 * from the seed, not the ones of the same start without grid. */
+	res &= DIAG(hkl_engine_grid_seed(engine, node, seed));
+	start = hkl_geometry_new_copy(geometry);
+	res &= DIAG(hkl_geometry_axes_values_set(start, seed, ARRAY_SIZE(seed),
+						 HKL_UNIT_DEFAULT, NULL));
+	seeded = bissector_solve(start, detector, sample, NULL, node);
+	seed[0] = -seed[0];
+	seed[3] = -seed[3];
+	res &= DIAG(hkl_geometry_axes_values_set(start, seed, ARRAY_SIZE(seed),
+						 HKL_UNIT_DEFAULT, NULL));
+	unseeded = bissector_solve(start, detector, sample, NULL, node);
+	geometries = bissector_solve(start, detector, sample, filename, node);
+	res &= DIAG(NULL != seeded && NULL != unseeded && NULL != geometries);
+	if(seeded && unseeded && geometries){
+		res &= DIAG(same_geometries(seeded, geometries));
+		res &= DIAG(!same_geometries(unseeded, geometries));
+	}
+	if(seeded)
+		hkl_geometry_list_free(seeded);
+	if(unseeded)
+		hkl_geometry_list_free(unseeded);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	hkl_geometry_free(start);
+
+	for(i=0; i<ARRAY_SIZE(targets); ++i){
+		geometries = hkl_engine_pseudo_axes_values_set(engine, targets[i], 3,
+							       HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL != geometries);
+		if(geometries){
+			const HklGeometryListItem *item;
+
+			HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+				hkl_geometry_set(geometry,
+						 hkl_geometry_list_item_geometry_get(item));
+				res &= DIAG(check_pseudoaxes(engine, targets[i], 3));
+			}
+			hkl_geometry_list_free(geometries);
+		}
+	}
+
+	/* not a grid file */
+	f = fopen(filename, "w");
+	if(f){
+		fprintf(f, "not a grid");
+		fclose(f);
+	}
+	res &= DIAG(FALSE == hkl_engine_grid_load(engine, filename, NULL));
+	remove(filename);
+
+	ok(res == TRUE, "grid");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+	g_free(filename);
+}
+
+static void wavelength_scan(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	double wavelength;
+	static double hkl[] = {0, 0, 1};
+	static double wavelengths[] = {1.54, 1.50, 1.46, 1.42, 1.38, 1.34};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	wavelength = hkl_geometry_wavelength_get(geometry, HKL_UNIT_DEFAULT);
+
+	/* wrong number of values */
+	res &= DIAG(NULL == hkl_engine_wavelength_scan(engine, hkl, 2,
+						       wavelengths, ARRAY_SIZE(wavelengths),
+						       HKL_UNIT_DEFAULT, NULL));
+
+	geometries = hkl_engine_wavelength_scan(engine, hkl, ARRAY_SIZE(hkl),
+						wavelengths, ARRAY_SIZE(wavelengths),
+						HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+		HklGeometry *start = hkl_geometry_new_copy(geometry);
+		double prev[4];
+		size_t i = 0;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) == ARRAY_SIZE(wavelengths));
+
+		/* each point reach hkl at its wavelength on a continuous trajectory */
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			const HklGeometry *g = hkl_geometry_list_item_geometry_get(item);
+			double values[4];
+			size_t j;
+
+			res &= DIAG(fabs(wavelengths[i] - hkl_geometry_wavelength_get(g, HKL_UNIT_DEFAULT)) < HKL_EPSILON);
+
+			hkl_geometry_axes_values_get(g, values, 4, HKL_UNIT_USER);
+			if(i > 0)
+				for(j=0; j<4; ++j)
+					res &= DIAG(fabs(values[j] - prev[j]) < 5.);
+			memcpy(prev, values, sizeof(prev));
+
+			hkl_geometry_set(geometry, g);
+			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+			hkl_geometry_set(geometry, start);
+			i++;
+		}
+
+		hkl_geometry_free(start);
+		hkl_geometry_list_free(geometries);
+	}
+
+	/* the engine list geometry is left unchanged */
+	res &= DIAG(wavelength == hkl_geometry_wavelength_get(geometry, HKL_UNIT_DEFAULT));
+
+	ok(res == TRUE, "wavelength scan");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void equivalents(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	double operators[48 * 9];
+	double eqs[48 * 3];
+	size_t n_eqs;
+	size_t n_operators = 0;
+	size_t i, j;
+	static double hkl[] = {1, 0, 0};
+	static const int permutations[6][3] = {
+		{0, 1, 2}, {0, 2, 1}, {1, 0, 2},
+		{1, 2, 0}, {2, 0, 1}, {2, 1, 0},
+	};
+
+	/* m-3m, all the signed permutation matrices */
+	for(i=0; i<6; ++i)
+		for(j=0; j<8; ++j){
+			double *op = &operators[9 * n_operators++];
+			size_t r;
+
+			memset(op, 0, 9 * sizeof(*op));
+			for(r=0; r<3; ++r)
+				op[3 * r + permutations[i][r]] = (j >> r) & 1 ? -1 : 1;
+		}
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	/* wrong number of operators */
+	res &= DIAG(NULL == hkl_engine_pseudo_axes_values_equivalents(engine, hkl, ARRAY_SIZE(hkl),
+								      operators, 8,
+								      eqs, &n_eqs,
+								      HKL_UNIT_DEFAULT, NULL));
+
+	geometries = hkl_engine_pseudo_axes_values_equivalents(engine, hkl, ARRAY_SIZE(hkl),
+							       operators, ARRAY_SIZE(operators),
+							       eqs, &n_eqs,
+							       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		const HklGeometryListItem *item;
+		HklGeometry *start = hkl_geometry_new_copy(geometry);
+		double cost = 0.;
+
+		/* the 6 distinct equivalents of (1, 0, 0) at most */
+		res &= DIAG(n_eqs > 0 && n_eqs <= 6);
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) == n_eqs);
+
+		/* ranked by motion time, each geometry reach its equivalent */
+		i = 0;
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			const HklGeometry *g = hkl_geometry_list_item_geometry_get(item);
+			double t = hkl_geometry_motion_time(start, g);
+
+			res &= DIAG(fabs(fabs(eqs[3 * i]) + fabs(eqs[3 * i + 1]) + fabs(eqs[3 * i + 2]) - 1.) < HKL_EPSILON);
+			for(j=0; j<i; ++j)
+				res &= DIAG(eqs[3 * i] != eqs[3 * j]
+					    || eqs[3 * i + 1] != eqs[3 * j + 1]
+					    || eqs[3 * i + 2] != eqs[3 * j + 2]);
+
+			res &= DIAG(t >= cost - HKL_EPSILON);
+			cost = t;
+
+			hkl_geometry_set(geometry, g);
+			res &= DIAG(check_pseudoaxes(engine, &eqs[3 * i], 3));
+			hkl_geometry_set(geometry, start);
+			i++;
+		}
+
+		hkl_geometry_free(start);
+		hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, "equivalents");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void batch_get(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	size_t i, j;
+	static const char *names[] = {"hkl", "q"};
+	double positions[][4] = {
+		{30., 0., 0., 60.},
+		{30., 0., 90., 60.},
+		{30., 0., -90., 60.},
+		{30., 0., 180., 60.},
+		{45., 0., 135., 90.},
+		{10., 20., 30., 40.},
+		{-15., 50., -70., 25.},
+	};
+	double values[ARRAY_SIZE(positions) * 3];
+
+	for(i=0; i<ARRAY_SIZE(positions); ++i)
+		for(j=0; j<4; ++j)
+			positions[i][j] *= HKL_DEGTORAD;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	for(i=0; i<ARRAY_SIZE(names); ++i){
+		size_t n;
+		HklGeometry *start = hkl_geometry_new_copy(geometry);
+
+		engine = hkl_engine_list_engine_get_by_name(engines, names[i], NULL);
+		n = hkl_engine_len(engine);
+
+		/* wrong number of values */
+		res &= DIAG(FALSE == hkl_engine_pseudo_axes_values_batch_get(engine,
+									     &positions[0][0], 4 * ARRAY_SIZE(positions),
+									     values, n * ARRAY_SIZE(positions) - 1,
+									     HKL_UNIT_DEFAULT, NULL));
+
+		res &= DIAG(hkl_engine_pseudo_axes_values_batch_get(engine,
+								    &positions[0][0], 4 * ARRAY_SIZE(positions),
+								    values, n * ARRAY_SIZE(positions),
+								    HKL_UNIT_DEFAULT, NULL));
+
+		/* the geometry is not modified */
+		res &= DIAG(hkl_geometry_motion_time(start, geometry) == 0.);
+
+		/* same values than one geometry at a time */
+		for(j=0; j<ARRAY_SIZE(positions); ++j){
+			res &= DIAG(hkl_geometry_axes_values_set(geometry, positions[j], 4,
+								 HKL_UNIT_DEFAULT, NULL));
+			res &= DIAG(check_pseudoaxes(engine, &values[j * n], n));
+		}
+
+		hkl_geometry_set(geometry, start);
+		hkl_geometry_free(start);
+	}
+
+	ok(res == TRUE, "batch_get");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void pvt_profile(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometry *start;
+	HklDetector *detector;
+	HklSample *sample;
+	size_t i, j, n_rows;
+	static const double times[] = {0., 2.};
+	static const double values[] = {
+		0, 0, 1,
+		0, 1, 1,
+	};
+	const double rate = 10.;
+	double profile[21 * 9];
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+	start = hkl_geometry_new_copy(geometry);
+
+	/* wrong number of values */
+	res &= DIAG(FALSE == hkl_engine_pvt_profile(engine, times, 2, values, 5, rate,
+						    profile, ARRAY_SIZE(profile), &n_rows,
+						    HKL_UNIT_USER, NULL));
+
+	/* the profile buffer is too small */
+	res &= DIAG(FALSE == hkl_engine_pvt_profile(engine, times, 2, values, 6, rate,
+						    profile, ARRAY_SIZE(profile) - 1, &n_rows,
+						    HKL_UNIT_USER, NULL));
+	res &= DIAG(n_rows == 21);
+
+	res &= DIAG(hkl_engine_pvt_profile(engine, times, 2, values, 6, rate,
+					   profile, ARRAY_SIZE(profile), &n_rows,
+					   HKL_UNIT_USER, NULL));
+	res &= DIAG(n_rows == 21);
+
+	/* the geometry is not modified */
+	res &= DIAG(hkl_geometry_motion_time(start, geometry) == 0.);
+
+	for(i=0; i<n_rows; ++i){
+		double *row = &profile[i * 9];
+		double hkl[] = {0, row[0] / 2., 1};
+
+		res &= DIAG(fabs(row[0] - i / rate) < HKL_EPSILON);
+
+		/* the positions follow the path */
+		res &= DIAG(hkl_geometry_axes_values_set(geometry, &row[1], 4,
+							 HKL_UNIT_USER, NULL));
+		res &= DIAG(check_pseudoaxes(engine, hkl, 3));
+
+		/* the velocities are the derivatives of the positions */
+		if(i > 0 && i < n_rows - 1)
+			for(j=0; j<4; ++j)
+				res &= DIAG(fabs(row[5 + j] - (row[9 + 1 + j] - row[-9 + 1 + j]) * rate / 2.) < 1e-1);
+	}
+	hkl_geometry_set(geometry, start);
+
+	/* a too slow tth motor */
+	res &= DIAG(hkl_geometry_axis_motion_set(geometry, "tth", 1., 0., HKL_UNIT_USER, NULL));
+	res &= DIAG(FALSE == hkl_engine_pvt_profile(engine, times, 2, values, 6, rate,
+						    profile, ARRAY_SIZE(profile), &n_rows,
+						    HKL_UNIT_USER, NULL));
+
+	ok(res == TRUE, "pvt_profile");
+
+	hkl_geometry_free(start);
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void jacobian(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	size_t i, j;
+	double hkl[] = {1, 1, 1};
+	static const double dh[] = {.1, -.2, .3};
+	double J[3 * 4];
+	double dtheta[4];
+	double values[4];
+	HklEngine *engine_q;
+	double Jq[1];
+	double q1, q2;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+
+	geometries = hkl_engine_pseudo_axes_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries){
+		hkl_geometry_set(geometry,
+				 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries)));
+		hkl_geometry_list_free(geometries);
+		hkl_engine_list_get(engines);
+
+		/* wrong sizes */
+		res &= DIAG(FALSE == hkl_engine_jacobian_get(engine, J, ARRAY_SIZE(J) - 1,
+							     HKL_UNIT_USER, NULL));
+		res &= DIAG(FALSE == hkl_engine_jacobian_solve(engine, dh, ARRAY_SIZE(dh),
+							       dtheta, ARRAY_SIZE(dtheta) - 1,
+							       HKL_UNIT_USER, NULL));
+
+		res &= DIAG(hkl_engine_jacobian_get(engine, J, ARRAY_SIZE(J),
+						    HKL_UNIT_USER, NULL));
+		res &= DIAG(hkl_engine_jacobian_solve(engine, dh, ARRAY_SIZE(dh),
+						      dtheta, ARRAY_SIZE(dtheta),
+						      HKL_UNIT_USER, NULL));
+
+		/* the current pseudo axes values are kept */
+		res &= DIAG(check_pseudoaxes(engine, hkl, 3));
+
+		/* J.dθ = dh and the bissector constraint */
+		for(i=0; i<3; ++i){
+			double dh_i = 0.;
+
+			for(j=0; j<4; ++j)
+				dh_i += J[i * 4 + j] * dtheta[j];
+			res &= DIAG(fabs(dh_i - dh[i]) < 1e-5);
+		}
+		res &= DIAG(fabs(dtheta[0] - dtheta[3] / 2.) < 1e-5);
+
+		/* the analytic jacobian is the derivative of the getter */
+		hkl_geometry_axes_values_get(geometry, values, 4, HKL_UNIT_USER);
+		for(j=0; j<4; ++j){
+			double h1[3];
+			double h2[3];
+
+			values[j] += 1e-3;
+			res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+								 HKL_UNIT_USER, NULL));
+			res &= DIAG(hkl_engine_pseudo_axes_values_get(engine, h2, 3,
+								      HKL_UNIT_USER, NULL));
+			values[j] -= 2e-3;
+			res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+								 HKL_UNIT_USER, NULL));
+			res &= DIAG(hkl_engine_pseudo_axes_values_get(engine, h1, 3,
+								      HKL_UNIT_USER, NULL));
+			values[j] += 1e-3;
+			for(i=0; i<3; ++i)
+				res &= DIAG(fabs((h2[i] - h1[i]) / 2e-3 - J[i * 4 + j]) < 1e-6);
+		}
+		res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+							 HKL_UNIT_USER, NULL));
+
+		/* the q engine has as many axes as pseudo axes */
+		engine_q = hkl_engine_list_engine_get_by_name(engines, "q", NULL);
+		res &= DIAG(hkl_engine_jacobian_get(engine_q, Jq, 1, HKL_UNIT_USER, NULL));
+		res &= DIAG(hkl_engine_jacobian_solve(engine_q, dh, 1, dtheta, 1,
+						      HKL_UNIT_USER, NULL));
+		res &= DIAG(fabs(Jq[0] * dtheta[0] - dh[0]) < HKL_EPSILON);
+		values[3] += 1e-3;
+		res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+							 HKL_UNIT_USER, NULL));
+		res &= DIAG(hkl_engine_pseudo_axes_values_get(engine_q, &q2, 1, HKL_UNIT_USER, NULL));
+		values[3] -= 2e-3;
+		res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+							 HKL_UNIT_USER, NULL));
+		res &= DIAG(hkl_engine_pseudo_axes_values_get(engine_q, &q1, 1, HKL_UNIT_USER, NULL));
+		values[3] += 1e-3;
+		res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+							 HKL_UNIT_USER, NULL));
+		res &= DIAG(fabs((q2 - q1) / 2e-3 - Jq[0]) < 1e-6);
+
+		/* dθ of the hkl engine again, the q one used the array */
+		res &= DIAG(hkl_engine_jacobian_solve(engine, dh, ARRAY_SIZE(dh),
+						      dtheta, ARRAY_SIZE(dtheta),
+						      HKL_UNIT_USER, NULL));
+
+		/* a small move of the axes along dθ */
+		hkl_geometry_axes_values_get(geometry, values, 4, HKL_UNIT_USER);
+		for(j=0; j<4; ++j)
+			values[j] += 1e-4 * dtheta[j];
+		res &= DIAG(hkl_geometry_axes_values_set(geometry, values, 4,
+							 HKL_UNIT_USER, NULL));
+		for(i=0; i<3; ++i)
+			hkl[i] += 1e-4 * dh[i];
+		res &= DIAG(check_pseudoaxes(engine, hkl, 3));
+	}
+
+	ok(res == TRUE, "jacobian");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 int main(int argc, char** argv)
 {
-	plan(6);
+	plan(18);
 
 	getter();
 	degenerated();
 	psi_getter();
 	psi_setter();
+	psi_scan();
 	q();
 	hkl_psi_constant_vertical();
+	clone_initialized();
+	range_constrained();
+	scan_plan();
+	scan_order();
+	solutions_cache();
+	grid();
+	wavelength_scan();
+	equivalents();
+	batch_get();
+	pvt_profile();
+	jacobian();
 
 	return 0;
 }
@@ -163,6 +163,85 @@ static void eulerians(void)
 	hkl_geometry_free(geometry);
 }
 
+static void eulerians_batch(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	size_t i;
+	int solution;
+	static double komega[] = {0., 10., -30., 45., 170.};
+	static double kappa[] = {0., 20., -100., 135., 200.};
+	static double kphi[] = {0., 30., 60., -90., -170.};
+	static double chi[] = {0., 120.};
+	double omega[ARRAY_SIZE(komega)];
+	double chi_[ARRAY_SIZE(komega)];
+	double phi[ARRAY_SIZE(komega)];
+	double komega_[ARRAY_SIZE(komega)];
+	double kappa_[ARRAY_SIZE(komega)];
+	double kphi_[ARRAY_SIZE(komega)];
+
+	factory = hkl_factory_get_by_name("K4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	sample = hkl_sample_new("test");
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	engines = hkl_factory_create_new_engine_list(factory);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "eulerians", NULL);
+
+	for(solution=0; solution<2; ++solution){
+		double params[] = {solution};
+
+		res &= DIAG(hkl_engine_parameters_values_set(engine, params, ARRAY_SIZE(params),
+							     HKL_UNIT_DEFAULT, NULL));
+
+		hkl_eulerians_from_kappa(komega, kappa, kphi, omega, chi_, phi,
+					 ARRAY_SIZE(komega), 50 * HKL_DEGTORAD, solution,
+					 HKL_UNIT_USER);
+
+		/* same values than the eulerians engine */
+		for(i=0; i<ARRAY_SIZE(komega); ++i){
+			res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL,
+							      komega[i], kappa[i], kphi[i], 0.));
+			res &= DIAG(check_pseudoaxes_v(engine,
+						       omega[i] * HKL_DEGTORAD,
+						       chi_[i] * HKL_DEGTORAD,
+						       phi[i] * HKL_DEGTORAD));
+		}
+
+		/* and back */
+		res &= DIAG(hkl_eulerians_to_kappa(omega, chi_, phi, komega_, kappa_, kphi_,
+						   ARRAY_SIZE(komega), 50 * HKL_DEGTORAD, solution,
+						   HKL_UNIT_USER, NULL));
+		for(i=0; i<ARRAY_SIZE(komega); ++i){
+			double k = kappa[i] - 360. * round(kappa[i] / 360.);
+
+			res &= DIAG(fabs(cos((komega_[i] - komega[i]) * HKL_DEGTORAD) - 1.) < HKL_EPSILON);
+			res &= DIAG(fabs(kappa_[i] - k) < HKL_EPSILON);
+			res &= DIAG(fabs(cos((kphi_[i] - kphi[i]) * HKL_DEGTORAD) - 1.) < HKL_EPSILON);
+		}
+
+		/* |chi| > 2 * alpha is unreachable */
+		res &= DIAG(FALSE == hkl_eulerians_to_kappa(omega, chi, phi, komega_, kappa_, kphi_,
+							    ARRAY_SIZE(chi), 50 * HKL_DEGTORAD, solution,
+							    HKL_UNIT_USER, NULL));
+		res &= DIAG(!isnan(kappa_[0]));
+		res &= DIAG(isnan(kappa_[1]) && isnan(komega_[1]) && isnan(kphi_[1]));
+	}
+
+	ok(res == TRUE, "eulerians_batch");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 static void q(void)
 {
 	int res = TRUE;
@@ -223,10 +302,11 @@ static void q(void)
 
 int main(int argc, char** argv)
 {
-	plan(3);
+	plan(4);
 
 	degenerated();
 	eulerians();
+	eulerians_batch();
 	q();
 
 	return 0;
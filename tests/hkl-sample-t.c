@@ -24,6 +24,8 @@
 #include <tap/float.h>
 #include <tap/hkl-tap.h>
 
+#include "hkl-sample-private.h"
+
 #define SET(_sample, _param, _value) do{				\
 		HklParameter *parameter = hkl_parameter_new_copy(hkl_sample_ ## _param ## _get(_sample)); \
 		GError *error;						\
@@ -291,6 +293,309 @@ static void compute_UB_busing_levy(void)
 	hkl_matrix_free(m_I);
 }
 
+static void compute_U_least_squares(void)
+{
+	GError *error;
+	HklDetector *detector;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklSampleReflection *r0, *r1, *r2, *r3;
+	HklMatrix *m_I = hkl_matrix_new_full(1,0,0,
+					     0,1,0,
+					     0, 0, 1);
+	HklMatrix *m_ref = hkl_matrix_new_full(1., 0., 0.,
+					       0., 0., 1.,
+					       0.,-1., 0.);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+
+	/* r0 and r1 are compatible with U = I */
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.), __func__);
+	r0 = hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL);
+	hkl_sample_add_reflection(sample, r0);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., -90., 60.), __func__);
+	r1 = hkl_sample_reflection_new(geometry, detector, -1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, r1);
+
+	/* r2 and r3 are compatible with U = m_ref */
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.), __func__);
+	r2 = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, r2);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 180., 60.), __func__);
+	r3 = hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL);
+	hkl_sample_add_reflection(sample, r3);
+
+	/* only the flagged reflections are used */
+	hkl_sample_reflection_flag_set(r2, FALSE);
+	hkl_sample_reflection_flag_set(r3, FALSE);
+
+	error = NULL;
+	ok(TRUE == hkl_sample_compute_U_least_squares(sample, &error), __func__);
+	is_matrix(m_I, hkl_sample_U_get(sample), __func__);
+	CHECK_UX_UY_UZ(sample, 0., 0., 0.);
+
+	hkl_sample_reflection_flag_set(r0, FALSE);
+	hkl_sample_reflection_flag_set(r1, FALSE);
+	hkl_sample_reflection_flag_set(r2, TRUE);
+	hkl_sample_reflection_flag_set(r3, TRUE);
+
+	ok(TRUE == hkl_sample_compute_U_least_squares(sample, NULL), __func__);
+	is_matrix(m_ref, hkl_sample_U_get(sample), __func__);
+	CHECK_UX_UY_UZ(sample, -90. * HKL_DEGTORAD, 0., 0.);
+
+	/* failling test, only one reflection */
+	hkl_sample_reflection_flag_set(r3, FALSE);
+
+	error = NULL;
+	ok(FALSE == hkl_sample_compute_U_least_squares(sample, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+	is_matrix(m_ref, hkl_sample_U_get(sample), __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+	hkl_matrix_free(m_ref);
+	hkl_matrix_free(m_I);
+}
+
+static void compute_UB_ransac(void)
+{
+	GError *error;
+	HklDetector *detector;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklSampleReflection *r[6];
+	size_t i;
+	/* 4 reflections compatible with U = I and 2 mis-indexed */
+	const struct {
+		double h, k, l;
+		double phi;
+		int inlier;
+	} data[] = {
+		{ 0, 0, 1,   0., TRUE},
+		{-1, 0, 0, -90., TRUE},
+		{ 1, 0, 0,  90., TRUE},
+		{ 0, 0,-1, 180., TRUE},
+		{ 0, 1, 0, 180., FALSE},
+		{ 0, 0, 1,  90., FALSE},
+	};
+	HklMatrix *m_I = hkl_matrix_new_full(1,0,0,
+					     0,1,0,
+					     0, 0, 1);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+
+	/* not enought reflections */
+	error = NULL;
+	ok(FALSE == hkl_sample_compute_UB_ransac(sample, 100, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+
+	for(i=0; i<ARRAY_SIZE(data); ++i){
+		ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL,
+						     30., 0., data[i].phi, 60.), __func__);
+		r[i] = hkl_sample_reflection_new(geometry, detector,
+						 data[i].h, data[i].k, data[i].l, NULL);
+		hkl_sample_add_reflection(sample, r[i]);
+	}
+
+	ok(TRUE == hkl_sample_compute_UB_ransac(sample, 100, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(error == NULL, __func__);
+	is_matrix(m_I, hkl_sample_U_get(sample), __func__);
+	for(i=0; i<ARRAY_SIZE(data); ++i)
+		ok(data[i].inlier == hkl_sample_reflection_flag_get(r[i]), __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+	hkl_matrix_free(m_I);
+}
+
+static void autoindex(void)
+{
+	GError *error;
+	HklDetector *detector;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklSampleReflection *r[5];
+	size_t i;
+	/* unindexed peaks, 4 from the {100} family and 1 unindexable */
+	const struct {
+		double phi;
+		double tth;
+		int indexed;
+	} data[] = {
+		{  0., 60., TRUE},
+		{-90., 60., TRUE},
+		{ 90., 60., TRUE},
+		{180., 60., TRUE},
+		{ 45., 50., FALSE},
+	};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+
+	/* not enought reflections */
+	error = NULL;
+	ok(FALSE == hkl_sample_autoindex(sample, 12, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+
+	for(i=0; i<ARRAY_SIZE(data); ++i){
+		ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL,
+						     data[i].tth / 2., 0., data[i].phi, data[i].tth), __func__);
+		r[i] = hkl_sample_reflection_new(geometry, detector, 1, 1, 1, NULL);
+		hkl_sample_add_reflection(sample, r[i]);
+	}
+
+	/* the hkl range must not be empty */
+	ok(FALSE == hkl_sample_autoindex(sample, 0, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(error != NULL, __func__);
+	g_clear_error(&error);
+
+	ok(TRUE == hkl_sample_autoindex(sample, 12, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(error == NULL, __func__);
+	for(i=0; i<ARRAY_SIZE(data); ++i)
+		ok(data[i].indexed == hkl_sample_reflection_flag_get(r[i]), __func__);
+
+	/* the indexation is compatible with the mesured angles */
+	for(i=1; i<4; ++i)
+		is_double(hkl_sample_get_reflection_mesured_angle(sample, r[0], r[i]),
+			  hkl_sample_get_reflection_theoretical_angle(sample, r[0], r[i]),
+			  HKL_EPSILON, __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+}
+
+static void autoindex_known_UB(void)
+{
+	GError *error;
+	HklDetector *detector;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklLattice *lattice;
+	HklMatrix *U;
+	HklSample *reference;
+	HklSample *sample;
+	HklSampleReflection *r[8];
+	size_t i, j, k;
+	double hkls[][3] = {
+		{1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+		{1, 1, 0}, {1, 0, 1}, {0, 1, 1},
+		{1, 1, 1}, {0, 2, 0},
+	};
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	engines = hkl_factory_create_new_engine_list(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	lattice = hkl_lattice_new(1.54, 2., 3.,
+				  90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD,
+				  NULL);
+
+	/* generate the peaks of a known orientation */
+	reference = hkl_sample_new("reference");
+	hkl_sample_lattice_set(reference, lattice);
+	U = hkl_matrix_new_euler(10 * HKL_DEGTORAD, 20 * HKL_DEGTORAD, 30 * HKL_DEGTORAD);
+	hkl_sample_U_set(reference, U, NULL);
+
+	sample = hkl_sample_new("test");
+	hkl_sample_lattice_set(sample, lattice);
+
+	hkl_engine_list_init(engines, geometry, detector, reference);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	ok(TRUE == hkl_engine_current_mode_set(engine, "bissector", NULL), __func__);
+
+	for(i=0; i<ARRAY_SIZE(hkls); ++i){
+		HklGeometryList *geometries;
+
+		geometries = hkl_engine_pseudo_axes_values_set(engine, hkls[i], ARRAY_SIZE(hkls[i]),
+							       HKL_UNIT_DEFAULT, NULL);
+		ok(NULL != geometries, __func__);
+		if(geometries){
+			hkl_geometry_set(geometry,
+					 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries)));
+			hkl_geometry_list_free(geometries);
+		}
+		r[i] = hkl_sample_reflection_new(geometry, detector, 1, 1, 1, NULL);
+		hkl_sample_add_reflection(sample, r[i]);
+	}
+
+	error = NULL;
+	ok(TRUE == hkl_sample_autoindex(sample, 4, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(error == NULL, __func__);
+
+	/* the second call reuses the cached reciprocal lattice vectors */
+	ok(TRUE == hkl_sample_autoindex(sample, 4, HKL_DEGTORAD, 1e-2, &error), __func__);
+
+	/* U is one of the orthorhombic equivalents of the reference */
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j){
+			double m = 0;
+
+			for(k=0; k<3; ++k)
+				m += hkl_matrix_get(hkl_sample_U_get(sample), k, i) * hkl_matrix_get(U, k, j);
+			is_double(i == j ? 1. : 0., fabs(m), HKL_EPSILON, __func__);
+		}
+
+	/* all the peaks are indexed up to the signs */
+	for(i=0; i<ARRAY_SIZE(hkls); ++i){
+		double h, k, l;
+
+		ok(TRUE == hkl_sample_reflection_flag_get(r[i]), __func__);
+		hkl_sample_reflection_hkl_get(r[i], &h, &k, &l);
+		ok(fabs(fabs(h) - hkls[i][0]) < HKL_EPSILON
+		   && fabs(fabs(k) - hkls[i][1]) < HKL_EPSILON
+		   && fabs(fabs(l) - hkls[i][2]) < HKL_EPSILON, __func__);
+	}
+
+	/* a smaller hkl range after a larger one, (0 2 0) is not indexed
+	 * anymore and no index exceeds the range */
+	ok(TRUE == hkl_sample_autoindex(sample, 1, HKL_DEGTORAD, 1e-2, &error), __func__);
+	ok(FALSE == hkl_sample_reflection_flag_get(r[7]), __func__);
+	for(i=0; i<ARRAY_SIZE(hkls); ++i){
+		double h, k, l;
+
+		hkl_sample_reflection_hkl_get(r[i], &h, &k, &l);
+		ok(!hkl_sample_reflection_flag_get(r[i])
+		   || (fabs(h) <= 1 && fabs(k) <= 1 && fabs(l) <= 1), __func__);
+	}
+
+	hkl_matrix_free(U);
+	hkl_lattice_free(lattice);
+	hkl_sample_free(reference);
+	hkl_sample_free(sample);
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+}
+
 static void affine(void)
 {
 	GError *error;
@@ -364,6 +669,131 @@ static void affine(void)
 	hkl_matrix_free(m_ref);
 }
 
+static void affine_multistart(void)
+{
+	GError *error;
+	double a, b, c, alpha, beta, gamma;
+	const HklFactory *factory;
+	HklDetector *detector;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklSampleReflection *ref;
+	HklMatrix *m_ref = hkl_matrix_new_full(1., 0., 0.,
+					       0., 1., 0.,
+					       0., 0., 1.);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 60., 60., 60., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, .625, .75, -.216506350946, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 45., 45., 45., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, .665975615037, .683012701892, .299950211252, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	/* start far from the real orientation */
+	SET_UX_UY_UZ(sample, 120 * HKL_DEGTORAD, 40 * HKL_DEGTORAD, -70 * HKL_DEGTORAD);
+
+	error = NULL;
+	ok(TRUE == hkl_sample_affine_multistart(sample, 20, &error), __func__);
+	ok(error == NULL, __func__);
+
+	hkl_lattice_get(hkl_sample_lattice_get(sample),
+			&a, &b, &c, &alpha, &beta, &gamma, HKL_UNIT_DEFAULT);
+
+	is_matrix(m_ref, hkl_sample_U_get(sample), __func__);
+	is_double(1.54, a, HKL_EPSILON, __func__);
+	is_double(1.54, b, HKL_EPSILON, __func__);
+	is_double(1.54, c, HKL_EPSILON, __func__);
+	is_double(90 * HKL_DEGTORAD, alpha, HKL_EPSILON, __func__);
+	is_double(90 * HKL_DEGTORAD, beta, HKL_EPSILON, __func__);
+	is_double(90 * HKL_DEGTORAD, gamma, HKL_EPSILON, __func__);
+	CHECK_UX_UY_UZ(sample, 0., 0., 0.);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+	hkl_matrix_free(m_ref);
+}
+
+static void affine_cubic(void)
+{
+	GError *error;
+	double a, b, c, alpha, beta, gamma;
+	const HklFactory *factory;
+	HklDetector *detector;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklLattice *lattice;
+	HklSampleReflection *ref;
+	HklMatrix *m_ref = hkl_matrix_new_full(1., 0., 0.,
+					       0., 1., 0.,
+					       0., 0., 1.);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	/* only a and U are fitted for a cubic lattice */
+	sample = hkl_sample_new("test");
+	lattice = hkl_lattice_new(1.5, 1.5, 1.5,
+				  90 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  NULL);
+	ok(TRUE == hkl_lattice_system_set(lattice, HKL_LATTICE_SYSTEM_CUBIC, NULL), __func__);
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_lattice_free(lattice);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	ok(TRUE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.), __func__);
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	error = NULL;
+	ok(TRUE == hkl_sample_affine(sample, &error), __func__);
+	ok(error == NULL, __func__);
+
+	hkl_lattice_get(hkl_sample_lattice_get(sample),
+			&a, &b, &c, &alpha, &beta, &gamma, HKL_UNIT_DEFAULT);
+
+	ok(HKL_LATTICE_SYSTEM_CUBIC == hkl_lattice_system_get(hkl_sample_lattice_get(sample)), __func__);
+	is_matrix(m_ref, hkl_sample_U_get(sample), __func__);
+	is_double(1.54, a, HKL_EPSILON, __func__);
+	is_double(1.54, b, HKL_EPSILON, __func__);
+	is_double(1.54, c, HKL_EPSILON, __func__);
+	is_double(90 * HKL_DEGTORAD, alpha, HKL_EPSILON, __func__);
+	is_double(90 * HKL_DEGTORAD, beta, HKL_EPSILON, __func__);
+	is_double(90 * HKL_DEGTORAD, gamma, HKL_EPSILON, __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+	hkl_matrix_free(m_ref);
+}
+
 static void get_reflections_xxx_angle(void)
 {
 	HklDetector *detector;
@@ -495,9 +925,125 @@ static void reflection_set_geometry(void)
 	hkl_matrix_free(m_ref);
 }
 
+/* sum of |UB.hkl - Q|^2 over the flagged reflections, from the
+ * reflections themselves and not from the packed copy of the sample */
+static double flagged_fitness(HklSample *sample)
+{
+	HklSampleReflection *reflection;
+	const HklMatrix *UB = hkl_sample_UB_get(sample);
+	double fitness = 0.;
+
+	HKL_SAMPLE_REFLECTIONS_FOREACH(reflection, sample){
+		size_t i, j;
+
+		if(!reflection->flag)
+			continue;
+		for(i=0; i<3; ++i){
+			double r = -reflection->_hkl.data[i];
+
+			for(j=0; j<3; ++j)
+				r += UB->data[i][j] * reflection->hkl.data[j];
+			fitness += r * r;
+		}
+	}
+
+	return fitness;
+}
+
+/* refit from the same starting point, the fit must reach UB_ref only
+ * with consistent reflections */
+static int affine_from(HklSample *sample, const HklLattice *lattice,
+		       const HklMatrix *U, const HklMatrix *UB_ref,
+		       int consistent)
+{
+	int res;
+	double fitness;
+
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_sample_U_set(sample, U, NULL);
+	res = hkl_sample_affine(sample, NULL);
+	fitness = flagged_fitness(sample);
+
+	if(consistent)
+		return res && fitness < HKL_EPSILON
+			&& hkl_matrix_cmp(UB_ref, hkl_sample_UB_get(sample));
+	else
+		return fitness > HKL_EPSILON
+			&& !hkl_matrix_cmp(UB_ref, hkl_sample_UB_get(sample));
+}
+
+static void affine_packed(void)
+{
+	HklDetector *detector;
+	const HklFactory *factory;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklLattice *lattice;
+	HklSampleReflection *bad;
+	HklMatrix *U;
+	HklMatrix *UB_ref = hkl_matrix_new_full(HKL_TAU / 1.54, 0., 0.,
+						0., HKL_TAU / 1.54, 0.,
+						0., 0., HKL_TAU / 1.54);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	sample = hkl_sample_new("test");
+	lattice = hkl_lattice_new(1.54, 1.54, 1.54,
+				  90*HKL_DEGTORAD, 90*HKL_DEGTORAD, 90*HKL_DEGTORAD,
+				  NULL);
+	U = hkl_matrix_new_euler(1 * HKL_DEGTORAD, 2 * HKL_DEGTORAD, 3 * HKL_DEGTORAD);
+
+	/* reflections of the sample with U = I */
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.);
+	hkl_sample_add_reflection(sample, hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL));
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.);
+	hkl_sample_add_reflection(sample, hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL));
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.);
+	hkl_sample_add_reflection(sample, hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL));
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 45., 45., 45., 60.);
+	hkl_sample_add_reflection(sample, hkl_sample_reflection_new(geometry, detector,
+								    .665975615037, .683012701892, .299950211252,
+								    NULL));
+	ok(affine_from(sample, lattice, U, UB_ref, TRUE), __func__);
+
+	/* each change of the reflections must be seen by the next fit */
+
+	/* add a (0 1 0) reflection indexed as (1 0 0) */
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.);
+	bad = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, bad);
+	ok(affine_from(sample, lattice, U, UB_ref, FALSE), __func__);
+
+	/* unflag it */
+	hkl_sample_reflection_flag_set(bad, FALSE);
+	ok(affine_from(sample, lattice, U, UB_ref, TRUE), __func__);
+
+	/* flag it again with the right hkl */
+	hkl_sample_reflection_flag_set(bad, TRUE);
+	ok(TRUE == hkl_sample_reflection_hkl_set(bad, 0, 1, 0, NULL), __func__);
+	ok(affine_from(sample, lattice, U, UB_ref, TRUE), __func__);
+
+	/* move it to the (1 0 0) position */
+	hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.);
+	hkl_sample_reflection_geometry_set(bad, geometry);
+	ok(affine_from(sample, lattice, U, UB_ref, FALSE), __func__);
+
+	/* delete it */
+	hkl_sample_del_reflection(sample, bad);
+	ok(affine_from(sample, lattice, U, UB_ref, TRUE), __func__);
+
+	hkl_matrix_free(UB_ref);
+	hkl_matrix_free(U);
+	hkl_lattice_free(lattice);
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+}
+
 int main(int argc, char** argv)
 {
-	plan(114);
+	plan(269);
 
 	new();
 	add_reflection();
@@ -506,7 +1052,14 @@ int main(int argc, char** argv)
 	set_ux_uy_uz();
 	set_UB();
 	compute_UB_busing_levy();
+	compute_U_least_squares();
+	compute_UB_ransac();
+	autoindex();
+	autoindex_known_UB();
 	affine();
+	affine_multistart();
+	affine_cubic();
+	affine_packed();
 	get_reflections_xxx_angle();
 
 	reflection_set_geometry();